@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpkapi.h"
+#include "geo.h"
+#include "audit.h"
+
+// Audit constants
+#define AUD_PATH  1024  // Longest path handled, in bytes
+#define AUD_SHORT 16    // Fewest bytes a .geo file can have
+#define AUD_ROUND 7     // Mantissa bits dropped when matching vertices
+#define AUD_ZERO  1e-6f // Values this close to zero match zero
+
+// Audit being run over a directory
+typedef struct {
+    AUD  *aud;
+    char *dir; // Directory being audited
+} AUD_WALK;
+
+// Names of the stream kinds, as the reports label them
+static char *AUD_STREAMS[GEO_STREAMS] = {
+    "meta", "faces", "coords", "normals", "texcoords"
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Records why a file failed to load
+static void setError(AUD_FILE *file, char *error) {
+    file->error = malloc(strlen(error) + 1);
+    strcpy(file->error, error);
+    return;
+}
+
+// Puts the vertices of a face in ascending order
+static void sortFace(GEO_FACE *face, int *v) {
+    int tmp;
+
+    v[0] = face->v1; v[1] = face->v2; v[2] = face->v3;
+    if (v[0] > v[1]) { tmp = v[0]; v[0] = v[1]; v[1] = tmp; }
+    if (v[1] > v[2]) { tmp = v[1]; v[1] = v[2]; v[2] = tmp; }
+    if (v[0] > v[1]) { tmp = v[0]; v[0] = v[1]; v[1] = tmp; }
+    return;
+}
+
+// Makes an empty hash table of item numbers, at most half full for count
+static int* makeSlots(int count, int *mask) {
+    int *slots, slotnum, x;
+
+    for (slotnum = 16; slotnum < count * 2; slotnum <<= 1);
+    slots = malloc(slotnum * sizeof(int));
+    if (slots != NULL)
+        for (x = 0; x < slotnum; x++) slots[x] = -1;
+    *mask = slotnum - 1;
+    return slots;
+}
+
+// Counts a model's faces without any area
+static int countDegenerate(GEO_MODEL *mod) {
+    float e1[3], e2[3], c[3];
+    GEO_VERTEX *a, *b, *d;
+    int x, count = 0;
+
+    for (x = 0; x < mod->facenum; x++) {
+        a = &mod->vertices[mod->faces[x].v1];
+        b = &mod->vertices[mod->faces[x].v2];
+        d = &mod->vertices[mod->faces[x].v3];
+        e1[0] = b->x - a->x; e1[1] = b->y - a->y; e1[2] = b->z - a->z;
+        e2[0] = d->x - a->x; e2[1] = d->y - a->y; e2[2] = d->z - a->z;
+        c[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        c[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        c[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        if (c[0] == 0.0f && c[1] == 0.0f && c[2] == 0.0f) count++;
+    }
+    return count;
+}
+
+// Counts a model's faces using the same vertices as an earlier face, in
+// whatever order
+static int countDupFaces(GEO_MODEL *mod) {
+    int *slots, mask, x, y, a[3], b[3], count = 0;
+    unsigned int hash;
+
+    slots = makeSlots(mod->facenum, &mask);
+    if (slots == NULL) return 0;
+    for (x = 0; x < mod->facenum; x++) {
+        sortFace(&mod->faces[x], a);
+        hash = (unsigned int) a[0] * 73856093U ^
+            (unsigned int) a[1] * 19349663U ^ (unsigned int) a[2] * 83492791U;
+        for (y = hash & mask; slots[y] >= 0; y = (y + 1) & mask) {
+            sortFace(&mod->faces[slots[y]], b);
+            if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) break;
+        }
+        if (slots[y] >= 0) count++;
+        else slots[y] = x;
+    }
+    free(slots);
+    return count;
+}
+
+// Rounds a float off for matching, as its bits
+static unsigned int roundFloat(float f) {
+    unsigned int bits;
+
+    if (f > -AUD_ZERO && f < AUD_ZERO) return 0;
+    memcpy(&bits, &f, 4);
+    bits += 1 << (AUD_ROUND - 1);
+    return bits & ~((1U << AUD_ROUND) - 1);
+}
+
+// Counts a model's vertices matching an earlier one in every attribute.
+// The streams are delta coded, so copies of a vertex are often decoded a
+// little differently and are matched to about five digits
+static int countDupVerts(GEO_MODEL *mod) {
+    int *slots, mask, x, y, count = 0;
+    unsigned int *keys, hash;
+    float *f;
+
+    slots = makeSlots(mod->vertexnum, &mask);
+    keys = malloc(mod->vertexnum * 8 * sizeof(int));
+    if (slots == NULL || keys == NULL) {
+        free(slots);
+        free(keys);
+        return 0;
+    }
+
+    for (x = 0; x < mod->vertexnum; x++) {
+        f = &mod->vertices[x].x;
+        for (y = 0, hash = 2166136261U; y < 8; y++) {
+            keys[x * 8 + y] = roundFloat(f[y]);
+            hash = (hash ^ keys[x * 8 + y]) * 16777619U;
+        }
+        for (y = hash & mask; slots[y] >= 0; y = (y + 1) & mask)
+            if (!memcmp(&keys[slots[y] * 8], &keys[x * 8], 8 * sizeof(int)))
+                break;
+        if (slots[y] >= 0) count++;
+        else slots[y] = x;
+    }
+    free(keys);
+    free(slots);
+    return count;
+}
+
+// Loads a range of the files found, mapping each so the load times only
+// cover reading and decoding
+static void auditFiles(void *data, int first, int last) {
+    char path[AUD_PATH * 2 + 2];
+    unsigned long long start;
+    AUD_WALK *walk = data;
+    GEO_MODEL *mod;
+    AUD_FILE *file;
+    TPK_MAP *map;
+    GEO *geo;
+    int x, y;
+
+    for (x = first; x < last; x++) {
+        file = &walk->aud->files[x];
+        sprintf(path, "%s/%s", walk->dir, file->path);
+        map = tpkMapFile(path);
+        if (map == NULL) {
+            setError(file, "Could not open the file");
+            continue;
+        }
+        file->bytes = map->length;
+        if (map->length < AUD_SHORT || map->length > 0x7FFFFFFF) {
+            setError(file, (map->length < AUD_SHORT) ?
+                "File is too short to be a .geo" : "File is over 2 GB");
+            tpkDelete(map);
+            continue;
+        }
+
+        // Time the load alone, the checks come after
+        start = tpkClock();
+        geo = geoAudit(map->data, (int) map->length, &file->stats);
+        file->ms = (double) (tpkClock() - start) / 1000000.0;
+        if (geo == NULL) {
+            setError(file, *geoLastError() ? geoLastError() :
+                "Could not load the file");
+            tpkDelete(map);
+            continue;
+        }
+
+        // Look the geometry over
+        file->modelnum = geo->modelnum;
+        for (y = 0; y < geo->modelnum; y++) {
+            mod = &geo->models[y];
+            file->facenum += mod->facenum;
+            file->vertexnum += mod->vertexnum;
+            file->degenerate += countDegenerate(mod);
+            file->dupfaces += countDupFaces(mod);
+            file->dupverts += countDupVerts(mod);
+        }
+        geoFree(geo);
+        tpkDelete(map);
+    }
+
+    return;
+}
+
+// Compression ratio of a file's streams of one kind, 0 if it has none
+static double streamRatio(GEO_STATS *stats, int kind) {
+    if (stats->packed[kind] <= 0) return 0.0;
+    return (double) stats->unpacked[kind] / (double) stats->packed[kind];
+}
+
+// Writes a string as a CSV field
+static void writeCSVString(FILE *fPtr, char *s) {
+    fputc('"', fPtr);
+    for ( ; s != NULL && *s; s++) {
+        if (*s == '"') fputc('"', fPtr);
+        fputc(*s, fPtr);
+    }
+    fputc('"', fPtr);
+    return;
+}
+
+// Writes a string as a JSON value, null if there's none
+static void writeJSONString(FILE *fPtr, char *s) {
+    if (s == NULL) {
+        fprintf(fPtr, "null");
+        return;
+    }
+    fputc('"', fPtr);
+    for ( ; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', fPtr);
+        if ((unsigned char) *s >= 32) fputc(*s, fPtr);
+        else fprintf(fPtr, "\\u%04x", (unsigned char) *s);
+    }
+    fputc('"', fPtr);
+    return;
+}
+
+// Orders files by load time, slowest first
+static int compareTime(const void *a, const void *b) {
+    const AUD_FILE *x = *(AUD_FILE **) a, *y = *(AUD_FILE **) b;
+
+    if (x->ms != y->ms) return (x->ms > y->ms) ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+// Orders files by size, largest first
+static int compareSize(const void *a, const void *b) {
+    const AUD_FILE *x = *(AUD_FILE **) a, *y = *(AUD_FILE **) b;
+
+    if (x->bytes != y->bytes) return (x->bytes > y->bytes) ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+// Adds every file's findings up into one
+static void addTotals(AUD *aud, AUD_FILE *total) {
+    AUD_FILE *file;
+    int x, y;
+
+    memset(total, 0, sizeof(AUD_FILE));
+    for (x = 0; x < aud->filenum; x++) {
+        file = &aud->files[x];
+        total->bytes += file->bytes;
+        total->ms += file->ms;
+        total->modelnum += file->modelnum;
+        total->facenum += file->facenum;
+        total->vertexnum += file->vertexnum;
+        total->degenerate += file->degenerate;
+        total->dupfaces += file->dupfaces;
+        total->dupverts += file->dupverts;
+        total->stats.badenums += file->stats.badenums;
+        for (y = 0; y < GEO_STREAMS; y++) {
+            total->stats.packed[y] += file->stats.packed[y];
+            total->stats.unpacked[y] += file->stats.unpacked[y];
+        }
+    }
+    return;
+}
+
+// Writes the findings of one file, or the totals, as a JSON object
+static void writeJSONFile(FILE *fPtr, AUD_FILE *file, int total) {
+    int x;
+
+    fprintf(fPtr, "{");
+    if (!total) {
+        fprintf(fPtr, "\"path\":");
+        writeJSONString(fPtr, file->path);
+        fprintf(fPtr, ",\"loaded\":%s,\"version\":%d,",
+            (file->error == NULL) ? "true" : "false", file->stats.version);
+    }
+    fprintf(fPtr, "\"bytes\":%.0f,\"load_ms\":%.3f,\"models\":%d,"
+        "\"faces\":%d,\"vertices\":%d,\"ratios\":{", (double) file->bytes,
+        file->ms, file->modelnum, file->facenum, file->vertexnum);
+    for (x = 0; x < GEO_STREAMS; x++)
+        fprintf(fPtr, "%s\"%s\":%.3f", x ? "," : "", AUD_STREAMS[x],
+            streamRatio(&file->stats, x));
+    fprintf(fPtr, "},\"degenerate_faces\":%d,\"duplicate_faces\":%d,"
+        "\"duplicate_vertices\":%d,\"bad_texture_enums\":%d",
+        file->degenerate, file->dupfaces, file->dupverts,
+        file->stats.badenums);
+    if (!total) {
+        fprintf(fPtr, ",\"error\":");
+        writeJSONString(fPtr, file->error);
+    }
+    fprintf(fPtr, "}");
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Free an audit
+void audFree(AUD *aud) {
+    int x;
+
+    // Error checking
+    if (aud == NULL) return;
+
+    // Delete object and return
+    for (x = 0; x < aud->filenum; x++) {
+        free(aud->files[x].path);
+        if (aud->files[x].error != NULL) free(aud->files[x].error);
+    }
+    if (aud->files != NULL) free(aud->files);
+    free(aud);
+    return;
+}
+
+// Load every .geo file under a directory in full, in parallel on the job
+// system, recording how each is stored, how long it took and what's wrong
+// with it. Returns NULL on failure
+AUD* audRun(char *dir) {
+    AUD_WALK walk;
+    char **paths;
+    int x;
+
+    // Error checking
+    if (dir == NULL || strlen(dir) >= AUD_PATH) return NULL;
+
+    // Find and load every .geo file
+    memset(&walk, 0, sizeof(AUD_WALK));
+    walk.aud = calloc(1, sizeof(AUD));
+    walk.dir = dir;
+    paths = tpkFindFiles(dir, ".geo", &walk.aud->filenum);
+    if (walk.aud->filenum)
+        walk.aud->files = calloc(walk.aud->filenum, sizeof(AUD_FILE));
+    for (x = 0; x < walk.aud->filenum; x++)
+        walk.aud->files[x].path = paths[x];
+    if (paths != NULL) free(paths);
+    tpkParallelFor(auditFiles, &walk, walk.aud->filenum, 1);
+
+    for (x = 0; x < walk.aud->filenum; x++)
+        if (walk.aud->files[x].error != NULL) walk.aud->failed++;
+    return walk.aud;
+}
+
+// Print the totals of an audit, the show slowest and largest files, and
+// the files that failed to load
+void audSummary(AUD *aud, int show) {
+    AUD_FILE total, **order;
+    int x, y;
+
+    // Error checking
+    if (aud == NULL) return;
+
+    // Totals
+    addTotals(aud, &total);
+    printf("%d files, %d loaded, %d failed\n", aud->filenum,
+        aud->filenum - aud->failed, aud->failed);
+    printf("  %d models, %d faces, %d vertices\n", total.modelnum,
+        total.facenum, total.vertexnum);
+    printf("  %.1f MB loaded in %.0f ms of load time, %.1f MB/s per thread\n",
+        total.bytes / 1048576.0, total.ms, (total.ms > 0.0) ?
+        total.bytes / 1048576.0 / (total.ms / 1000.0) : 0.0);
+    printf("  Compression:");
+    for (x = 0; x < GEO_STREAMS; x++)
+        printf(" %s %.2fx", AUD_STREAMS[x], streamRatio(&total.stats, x));
+    printf("\n  %d degenerate faces, %d duplicate faces, ", total.degenerate,
+        total.dupfaces);
+    printf("%d duplicate vertices, %d bad texture enums\n", total.dupverts,
+        total.stats.badenums);
+    if (!aud->filenum || show < 1) return;
+
+    // The worst files
+    order = malloc(aud->filenum * sizeof(AUD_FILE *));
+    for (x = 0; x < aud->filenum; x++) order[x] = &aud->files[x];
+    if (show > aud->filenum) show = aud->filenum;
+    qsort(order, aud->filenum, sizeof(AUD_FILE *), compareTime);
+    printf("Slowest to load:\n");
+    for (x = 0; x < show; x++)
+        printf("  %10.2f ms  %s\n", order[x]->ms, order[x]->path);
+    qsort(order, aud->filenum, sizeof(AUD_FILE *), compareSize);
+    printf("Largest:\n");
+    for (x = 0; x < show; x++)
+        printf("  %10.2f MB  %s\n", order[x]->bytes / 1048576.0,
+            order[x]->path);
+    free(order);
+
+    // Files that failed, in the order they were found
+    if (aud->failed) printf("Failed:\n");
+    for (x = y = 0; x < aud->filenum && y < show; x++) {
+        if (aud->files[x].error == NULL) continue;
+        printf("  %s: %s\n", aud->files[x].path, aud->files[x].error);
+        y++;
+    }
+    if (aud->failed > show) printf("  ...and %d more\n", aud->failed - show);
+    return;
+}
+
+// Write an audit as CSV, a row per file. Returns nonzero on failure
+int audWriteCSV(AUD *aud, char *filename) {
+    AUD_FILE *file;
+    FILE *fPtr;
+    int x, y;
+
+    // Error checking
+    if (aud == NULL || filename == NULL) return 1;
+    fPtr = fopen(filename, "w");
+    if (fPtr == NULL) return 1;
+
+    fprintf(fPtr, "path,loaded,version,bytes,load_ms,models,faces,vertices");
+    for (x = 0; x < GEO_STREAMS; x++)
+        fprintf(fPtr, ",%s_ratio", AUD_STREAMS[x]);
+    fprintf(fPtr, ",degenerate_faces,duplicate_faces,duplicate_vertices,"
+        "bad_texture_enums,error\n");
+    for (x = 0; x < aud->filenum; x++) {
+        file = &aud->files[x];
+        writeCSVString(fPtr, file->path);
+        fprintf(fPtr, ",%d,%d,%.0f,%.3f,%d,%d,%d", file->error == NULL,
+            file->stats.version, (double) file->bytes, file->ms,
+            file->modelnum, file->facenum, file->vertexnum);
+        for (y = 0; y < GEO_STREAMS; y++)
+            fprintf(fPtr, ",%.3f", streamRatio(&file->stats, y));
+        fprintf(fPtr, ",%d,%d,%d,%d,", file->degenerate, file->dupfaces,
+            file->dupverts, file->stats.badenums);
+        writeCSVString(fPtr, file->error);
+        fprintf(fPtr, "\n");
+    }
+
+    // Report whether everything was written
+    x = ferror(fPtr);
+    if (fclose(fPtr) || x) return 1;
+    return 0;
+}
+
+// Write an audit as JSON, an object per file and one for the totals.
+// Returns nonzero on failure
+int audWriteJSON(AUD *aud, char *filename) {
+    AUD_FILE total;
+    FILE *fPtr;
+    int x;
+
+    // Error checking
+    if (aud == NULL || filename == NULL) return 1;
+    fPtr = fopen(filename, "w");
+    if (fPtr == NULL) return 1;
+
+    fprintf(fPtr, "{\"files\":[");
+    for (x = 0; x < aud->filenum; x++) {
+        fprintf(fPtr, "%s\n", x ? "," : "");
+        writeJSONFile(fPtr, &aud->files[x], 0);
+    }
+    addTotals(aud, &total);
+    fprintf(fPtr, "\n],\"failed\":%d,\"totals\":", aud->failed);
+    writeJSONFile(fPtr, &total, 1);
+    fprintf(fPtr, "}\n");
+
+    // Report whether everything was written
+    x = ferror(fPtr);
+    if (fclose(fPtr) || x) return 1;
+    return 0;
+}
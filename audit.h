@@ -0,0 +1,34 @@
+#ifndef __GEO_AUDIT__
+#define __GEO_AUDIT__
+
+#include "geo.h"
+
+// Findings about one .geo file
+typedef struct {
+    char     *path;       // Path relative to the audited directory
+    char     *error;      // Why it failed to load, NULL if it loaded
+    long long bytes;      // Size of the file
+    double    ms;         // Time taken to load it, in milliseconds
+    GEO_STATS stats;      // How it's stored, as far as it could be read
+    int       modelnum;   // Number of models
+    int       facenum;    // Faces over all models
+    int       vertexnum;  // Vertices over all models
+    int       degenerate; // Faces without any area
+    int       dupfaces;   // Faces using the same vertices as another
+    int       dupverts;   // Vertices matching another of their model
+} AUD_FILE;
+
+// Audit of every .geo file under a directory
+typedef struct {
+    int       filenum; // Number of files audited
+    int       failed;  // Number of them that failed to load
+    AUD_FILE *files;
+} AUD;
+
+void audFree(AUD *);
+AUD* audRun(char *);
+void audSummary(AUD *, int);
+int  audWriteCSV(AUD *, char *);
+int  audWriteJSON(AUD *, char *);
+
+#endif // __GEO_AUDIT__
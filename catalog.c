@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpkapi.h"
+#include "geo.h"
+#include "catalog.h"
+
+// Catalog layout, in native byte order
+//   Header:   char[4] "GCAT", int32 version, int32 filenum, int32 modelnum,
+//             int32 slotnum, int32 string bytes
+//   Files:    filenum int32 offsets of the paths in the strings
+//   Models:   modelnum CAT_RECORDs sorted by hash, so that models with the
+//             same name follow each other
+//   Slots:    slotnum int32 model numbers, -1 where empty. There are a
+//             power of two of them, and each name has one
+//   Strings:  NUL terminated empty string, paths and model names
+#define CAT_MAGIC   "GCAT"
+#define CAT_VERSION 1
+#define CAT_HEADER  24
+#define CAT_PATH    1024 // Longest path handled, in bytes
+
+// Model as stored in the catalog
+typedef struct {
+    unsigned int hash;      // Hash of the model name
+    int          name;      // Offset of the model name in the strings
+    int          file;      // File the model is in
+    int          model;     // Index of the model within the file
+    int          facenum;   // Number of faces in the model
+    int          vertexnum; // Number of vertices in the model
+} CAT_RECORD;
+
+// Extended data structure for obscuring control information from applications
+typedef struct {
+    CAT         cat;
+    TPK_MAP    *map;        // Mapping of the catalog file
+    int        *files;      // Offsets of the file paths
+    CAT_RECORD *records;    // Models, sorted by hash
+    int        *slots;      // Hash table of model numbers
+    int         mask;       // Hash table size minus one
+    char       *strings;    // Paths and model names
+    int         stringsize; // Length of the strings
+} CAT_EXT;
+
+// Model probed while building a catalog
+typedef struct {
+    char *name;      // Name of the model
+    int   facenum;   // Number of faces in the model
+    int   vertexnum; // Number of vertices in the model
+} CAT_PROBE;
+
+// File found while building a catalog
+typedef struct {
+    char      *path;     // Path relative to the catalog's directory
+    int        modelnum; // Models probed, 0 if the file couldn't be
+    CAT_PROBE *models;
+} CAT_FILE;
+
+// State of a catalog build
+typedef struct {
+    char     *dir;     // Directory the catalog covers
+    CAT_FILE *files;
+    int       filenum;
+} CAT_BUILD;
+
+// Model ready to be sorted into place
+typedef struct {
+    CAT_RECORD record;
+    char      *name;
+} CAT_SORT;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Folds a character so lookups ignore case
+static int foldChar(int c) {
+    if (c >= 'A' && c <= 'Z') return c + 'a' - 'A';
+    return c;
+}
+
+// Hash a model name the way lookups compare it
+static unsigned int hashName(char *name) {
+    unsigned int hash = 2166136261U;
+
+    for ( ; *name; name++)
+        hash = (hash ^ (unsigned int) foldChar((unsigned char) *name)) *
+            16777619U;
+    return hash;
+}
+
+// Compare two model names the way lookups do, returning 0 if they match
+static int compareName(char *a, char *b) {
+    for ( ; *a && foldChar((unsigned char) *a) ==
+        foldChar((unsigned char) *b); a++, b++);
+    return foldChar((unsigned char) *a) - foldChar((unsigned char) *b);
+}
+
+// Orders models by hash, then name, then where they are
+static int compareSort(const void *a, const void *b) {
+    const CAT_SORT *x = a, *y = b;
+    int ret;
+
+    if (x->record.hash != y->record.hash)
+        return x->record.hash < y->record.hash ? -1 : 1;
+    ret = compareName(x->name, y->name);
+    if (ret) return ret;
+    if (x->record.file != y->record.file)
+        return x->record.file - y->record.file;
+    return x->record.model - y->record.model;
+}
+
+// Probes a range of the files found, mapping each so that only the pages
+// holding the meta stream are read
+static void probeFiles(void *data, int first, int last) {
+    char path[CAT_PATH * 2 + 2];
+    CAT_BUILD *build = data;
+    CAT_FILE *file;
+    TPK_MAP *map;
+    GEO *geo;
+    int x, y;
+
+    for (x = first; x < last; x++) {
+        file = &build->files[x];
+        sprintf(path, "%s/%s", build->dir, file->path);
+        map = tpkMapFile(path);
+        if (map == NULL) continue;
+
+        // The meta stream leads, so a huge file only needs its start
+        geo = geoProbe(map->data, map->length > 0x7FFFFFFF ? 0x7FFFFFFF :
+            (int) map->length);
+        if (geo != NULL && geo->modelnum > 0) {
+            file->modelnum = geo->modelnum;
+            file->models = malloc(geo->modelnum * sizeof(CAT_PROBE));
+            for (y = 0; y < geo->modelnum; y++) {
+                file->models[y].name = malloc(strlen(geo->models[y].id) + 1);
+                strcpy(file->models[y].name, geo->models[y].id);
+                file->models[y].facenum = geo->models[y].facenum;
+                file->models[y].vertexnum = geo->models[y].vertexnum;
+            }
+        }
+        if (geo != NULL) geoFree(geo);
+        tpkDelete(map);
+    }
+
+    return;
+}
+
+// Deletes the state of a catalog build
+static void freeBuild(CAT_BUILD *build) {
+    int x, y;
+
+    for (x = 0; x < build->filenum; x++) {
+        for (y = 0; y < build->files[x].modelnum; y++)
+            free(build->files[x].models[y].name);
+        if (build->files[x].models != NULL) free(build->files[x].models);
+        free(build->files[x].path);
+    }
+    if (build->files != NULL) free(build->files);
+    free(build);
+    return;
+}
+
+// Writes a built catalog under a temporary name, then puts it in place so
+// that readers never map half of one
+static int writeCatalog(char *filename, int *head, int *files,
+    CAT_SORT *sorts, int *slots, char *strings) {
+    char tmpname[CAT_PATH + 8];
+    FILE *fPtr;
+    int x;
+
+    sprintf(tmpname, "%s.tmp", filename);
+    fPtr = fopen(tmpname, "wb");
+    if (fPtr == NULL) return 1;
+    fwrite(head, sizeof(int), 6, fPtr);
+    fwrite(files, sizeof(int), head[2], fPtr);
+    for (x = 0; x < head[3]; x++)
+        fwrite(&sorts[x].record, sizeof(CAT_RECORD), 1, fPtr);
+    fwrite(slots, sizeof(int), head[4], fPtr);
+    fwrite(strings, 1, head[5], fPtr);
+    if (fclose(fPtr)) {
+        remove(tmpname);
+        return 1;
+    }
+
+    // Windows won't rename over an existing file
+    if (rename(tmpname, filename)) {
+        remove(filename);
+        if (rename(tmpname, filename)) {
+            remove(tmpname);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Checks that a record only points within the catalog
+static int validRecord(CAT_EXT *catx, CAT_RECORD *record) {
+    return record->name >= 0 && record->name < catx->stringsize &&
+        record->file >= 0 && record->file < catx->cat.filenum &&
+        catx->files[record->file] >= 0 &&
+        catx->files[record->file] < catx->stringsize;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Catalog every model in the .geo files under a directory, writing the
+// catalog to filename. Files are probed in parallel on the job system.
+// Returns the number of models catalogued, or -1 on failure
+int catBuild(char *dir, char *filename) {
+    int x, y, z, modelnum, stringsize, slotnum, head[6], *files, *slots;
+    CAT_BUILD *build;
+    CAT_SORT *sorts;
+    char *strings, **paths;
+
+    // Error checking
+    if (dir == NULL || filename == NULL || strlen(dir) >= CAT_PATH ||
+        strlen(filename) >= CAT_PATH) return -1;
+
+    // Find and probe every .geo file
+    build = calloc(1, sizeof(CAT_BUILD));
+    build->dir = dir;
+    paths = tpkFindFiles(dir, ".geo", &build->filenum);
+    if (build->filenum)
+        build->files = calloc(build->filenum, sizeof(CAT_FILE));
+    for (x = 0; x < build->filenum; x++) build->files[x].path = paths[x];
+    if (paths != NULL) free(paths);
+    tpkParallelFor(probeFiles, build, build->filenum, 1);
+
+    // Size the strings: an empty one, paths, then model names
+    for (x = modelnum = 0, stringsize = 1; x < build->filenum; x++) {
+        stringsize += strlen(build->files[x].path) + 1;
+        for (y = 0; y < build->files[x].modelnum; y++, modelnum++)
+            stringsize += strlen(build->files[x].models[y].name) + 1;
+    }
+    strings = malloc(stringsize);
+    files = calloc(build->filenum + 1, sizeof(int));
+    sorts = malloc((modelnum ? modelnum : 1) * sizeof(CAT_SORT));
+
+    // Lay the strings and records out
+    strings[0] = 0;
+    for (x = z = 0, stringsize = 1; x < build->filenum; x++) {
+        files[x] = stringsize;
+        strcpy(&strings[stringsize], build->files[x].path);
+        stringsize += strlen(build->files[x].path) + 1;
+        for (y = 0; y < build->files[x].modelnum; y++, z++) {
+            sorts[z].name = build->files[x].models[y].name;
+            sorts[z].record.hash = hashName(sorts[z].name);
+            sorts[z].record.name = stringsize;
+            sorts[z].record.file = x;
+            sorts[z].record.model = y;
+            sorts[z].record.facenum = build->files[x].models[y].facenum;
+            sorts[z].record.vertexnum = build->files[x].models[y].vertexnum;
+            strcpy(&strings[stringsize], sorts[z].name);
+            stringsize += strlen(sorts[z].name) + 1;
+        }
+    }
+    qsort(sorts, modelnum, sizeof(CAT_SORT), compareSort);
+
+    // Keep the table at most half full, each name gets the slot of its
+    // first model
+    for (slotnum = 16; slotnum < modelnum * 2; slotnum <<= 1);
+    slots = malloc(slotnum * sizeof(int));
+    for (x = 0; x < slotnum; x++) slots[x] = -1;
+    for (x = 0; x < modelnum; x++) {
+        if (x && sorts[x].record.hash == sorts[x - 1].record.hash &&
+            !compareName(sorts[x].name, sorts[x - 1].name)) continue;
+        for (y = sorts[x].record.hash & (slotnum - 1); slots[y] >= 0;
+            y = (y + 1) & (slotnum - 1));
+        slots[y] = x;
+    }
+
+    // Write the catalog
+    memcpy(head, CAT_MAGIC, 4);
+    head[1] = CAT_VERSION; head[2] = build->filenum; head[3] = modelnum;
+    head[4] = slotnum; head[5] = stringsize;
+    if (writeCatalog(filename, head, files, sorts, slots, strings))
+        modelnum = -1;
+
+    // Clean up and return
+    free(slots);
+    free(sorts);
+    free(files);
+    free(strings);
+    freeBuild(build);
+    return modelnum;
+}
+
+// Close a catalog
+void catClose(CAT *cat) {
+    CAT_EXT *catx;
+
+    // Error checking
+    if (cat == NULL) return;
+
+    // Delete object and return
+    catx = (CAT_EXT *) cat;
+    tpkDelete(catx->map);
+    free(catx);
+    return;
+}
+
+// Look the models with a name up, ignoring case. Up to max of them are
+// stored in matches, and the number there are is returned
+int catFind(CAT *cat, char *name, CAT_MATCH *matches, int max) {
+    CAT_EXT *catx = (CAT_EXT *) cat;
+    CAT_RECORD *record, *end;
+    unsigned int hash;
+    int x, y, count;
+
+    // Error checking
+    if (cat == NULL || name == NULL || (matches == NULL && max > 0)) return 0;
+
+    // Probe linearly for the name's first model
+    hash = hashName(name);
+    end = &catx->records[cat->modelnum];
+    for (x = hash & catx->mask, y = 0; y <= catx->mask;
+        x = (x + 1) & catx->mask, y++) {
+        if (catx->slots[x] < 0 || catx->slots[x] >= cat->modelnum) return 0;
+        record = &catx->records[catx->slots[x]];
+        if (record->hash == hash && validRecord(catx, record) &&
+            !compareName(&catx->strings[record->name], name)) break;
+    }
+    if (y > catx->mask) return 0;
+
+    // Models with the same name follow it
+    for (count = 0; record < end && record->hash == hash &&
+        validRecord(catx, record) &&
+        !compareName(&catx->strings[record->name], name); record++, count++) {
+        if (count >= max) continue;
+        matches[count].file = &catx->strings[catx->files[record->file]];
+        matches[count].model = record->model;
+        matches[count].facenum = record->facenum;
+        matches[count].vertexnum = record->vertexnum;
+    }
+
+    return count;
+}
+
+// Open a catalog written by catBuild(). It stays mapped, so opening it
+// costs the same however many models it holds
+CAT* catOpen(char *filename) {
+    long long len = 0;
+    CAT_EXT *catx;
+    TPK_MAP *map;
+    int *head;
+
+    // Error checking
+    if (filename == NULL) return NULL;
+    map = tpkMapFile(filename);
+    if (map == NULL) return NULL;
+
+    // The sections have to add up to the file, and the strings have to end
+    head = (int *) map->data;
+    if (map->length >= CAT_HEADER) len = CAT_HEADER + (long long) head[2] *
+        sizeof(int) + (long long) head[3] * sizeof(CAT_RECORD) +
+        (long long) head[4] * sizeof(int) + head[5];
+    if (map->length < CAT_HEADER || memcmp(head, CAT_MAGIC, 4) ||
+        head[1] != CAT_VERSION || head[2] < 0 || head[3] < 0 ||
+        head[4] < 1 || (head[4] & (head[4] - 1)) || head[5] < 1 ||
+        len != map->length || map->data[map->length - 1]) {
+        tpkDelete(map);
+        return NULL;
+    }
+
+    // Point into the mapping
+    catx = calloc(1, sizeof(CAT_EXT));
+    catx->map = map;
+    catx->cat.filenum = head[2];
+    catx->cat.modelnum = head[3];
+    catx->files = &head[6];
+    catx->records = (CAT_RECORD *) &catx->files[head[2]];
+    catx->slots = (int *) &catx->records[head[3]];
+    catx->mask = head[4] - 1;
+    catx->strings = (char *) &catx->slots[head[4]];
+    catx->stringsize = head[5];
+    return &catx->cat;
+}
@@ -0,0 +1,23 @@
+#ifndef __GEO_CATALOG__
+#define __GEO_CATALOG__
+
+// Catalog of the models in every .geo file under a directory
+typedef struct {
+    int filenum;  // Number of files catalogued
+    int modelnum; // Number of models catalogued
+} CAT;
+
+// Model found by a lookup
+typedef struct {
+    char *file;      // Path of the .geo file, relative to the catalog
+    int   model;     // Index of the model within the file
+    int   facenum;   // Number of faces in the model
+    int   vertexnum; // Number of vertices in the model
+} CAT_MATCH;
+
+int  catBuild(char *, char *);
+void catClose(CAT *);
+int  catFind(CAT *, char *, CAT_MATCH *, int);
+CAT* catOpen(char *);
+
+#endif // __GEO_CATALOG__
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "export.h"
+
+// Exporter constants
+#define EXP_BUFFER  (4 << 20) // Bytes gathered before each write
+#define EXP_LINE    256       // Longest text line put together at once
+
+// glTF constants
+#define GLB_MAGIC   0x46546C67 // "glTF"
+#define GLB_JSON    0x4E4F534A // "JSON"
+#define GLB_BIN     0x004E4942 // "BIN\0"
+#define GL_FLOAT_T  5126
+#define GL_UINT_T   5125
+#define GL_ARRAY_T  34962
+#define GL_INDEX_T  34963
+
+// Output file with a large buffer in front of it
+typedef struct {
+    FILE          *fPtr;
+    unsigned char *data;
+    int            len;
+    int            err;
+} EXP_OUT;
+
+// Growing text, for the glTF JSON
+typedef struct {
+    char *data;
+    int   len;
+    int   max;
+} EXP_TEXT;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Opens an output file. The buffer here replaces the one stdio would add
+static int openOut(EXP_OUT *out, char *filename) {
+    out->fPtr = fopen(filename, "wb");
+    if (out->fPtr == NULL) return 1;
+    setvbuf(out->fPtr, NULL, _IONBF, 0);
+    out->data = malloc(EXP_BUFFER);
+    out->len = out->err = 0;
+    return 0;
+}
+
+// Writes out whatever has been gathered
+static void flushOut(EXP_OUT *out) {
+    if (out->len &&
+        fwrite(out->data, 1, out->len, out->fPtr) != (size_t) out->len)
+        out->err = 1;
+    out->len = 0;
+    return;
+}
+
+// Adds data to the output, writing blocks too big to gather directly
+static void putOut(EXP_OUT *out, void *data, int len) {
+    if (out->len + len > EXP_BUFFER) {
+        flushOut(out);
+        if (len > EXP_BUFFER / 2) {
+            if (fwrite(data, 1, len, out->fPtr) != (size_t) len) out->err = 1;
+            return;
+        }
+    }
+    memcpy(&out->data[out->len], data, len);
+    out->len += len;
+    return;
+}
+
+// Finishes an output file, returning nonzero if any of it failed
+static int closeOut(EXP_OUT *out) {
+    flushOut(out);
+    if (fclose(out->fPtr)) out->err = 1;
+    free(out->data);
+    return out->err;
+}
+
+// Checks every vertex holds only finite values, which is all glTF's JSON
+// and OBJ's text can carry
+static int finiteVertices(GEO_MODEL *mod) {
+    float *value;
+    int x, y;
+
+    for (x = 0; x < mod->vertexnum; x++) {
+        value = &mod->vertices[x].x;
+        for (y = 0; y < 8; y++) if (!isfinite(value[y])) return 0;
+    }
+    return 1;
+}
+
+// Formats an integer, returning its length
+static int putInt(char *text, long long value) {
+    char digits[24];
+    int x = 0, len = 0;
+
+    if (value < 0) { text[len++] = '-'; value = -value; }
+    do { digits[x++] = '0' + value % 10; value /= 10; } while (value);
+    while (x) text[len++] = digits[--x];
+    return len;
+}
+
+// Formats a float to six decimals without trailing zeros, far faster than
+// printf(). Returns its length
+static int putFloat(char *text, float value) {
+    unsigned long long frac;
+    double v = value;
+    int x, len = 0;
+
+    // Fixed point can't hold everything
+    if (!(v > -1e9 && v < 1e9)) return sprintf(text, "%g", v);
+
+    // Round to millionths, then write the whole part and the fraction
+    if (v < 0) { text[len++] = '-'; v = -v; }
+    frac = (unsigned long long) (v * 1e6 + 0.5);
+    len += putInt(&text[len], (long long) (frac / 1000000));
+    frac %= 1000000;
+    if (frac) {
+        text[len++] = '.';
+        for (x = 100000; frac; x /= 10) {
+            text[len++] = '0' + (int) (frac / x);
+            frac %= x;
+        }
+    }
+
+    // Negative values that rounded to nothing
+    if (len == 2 && text[0] == '-' && text[1] == '0') {
+        text[0] = '0';
+        len = 1;
+    }
+    return len;
+}
+
+// Adds formatted text to the JSON
+static void putText(EXP_TEXT *text, char *format, ...) {
+    va_list args;
+    int len;
+
+    // Grow to fit, names can be any length
+    va_start(args, format);
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (text->len + len + 1 > text->max) {
+        text->max = (text->len + len + 1) * 2;
+        text->data = realloc(text->data, text->max);
+    }
+    va_start(args, format);
+    vsprintf(&text->data[text->len], format, args);
+    va_end(args);
+    text->len += len;
+    return;
+}
+
+// Adds a string to the JSON, quoted and escaped
+static void putString(EXP_TEXT *text, char *str) {
+    char esc[8];
+
+    putText(text, "\"");
+    for ( ; *str; str++) {
+        if (*str == '"' || *str == '\\') sprintf(esc, "\\%c", *str);
+        else if ((unsigned char) *str < 0x20)
+            sprintf(esc, "\\u%04x", (unsigned char) *str);
+        else { esc[0] = *str; esc[1] = 0; }
+        putText(text, "%s", esc);
+    }
+    putText(text, "\"");
+    return;
+}
+
+// Orders faces by texture, so each texture is one run. Returns the face
+// order and fills in where each texture's run starts, with the last entry
+// holding faces whose texture is out of range
+static int* sortFaces(GEO_MODEL *mod, int texturenum, int *starts) {
+    int x, tex, *order;
+
+    // Count faces per texture, then turn the counts into starts
+    memset(starts, 0, (texturenum + 2) * sizeof(int));
+    for (x = 0; x < mod->facenum; x++) {
+        tex = mod->faces[x].texture;
+        if (tex < 0 || tex >= texturenum) tex = texturenum;
+        starts[tex + 1]++;
+    }
+    for (x = 0; x <= texturenum; x++) starts[x + 1] += starts[x];
+
+    // Place the faces
+    order = malloc((mod->facenum ? mod->facenum : 1) * sizeof(int));
+    for (x = 0; x < mod->facenum; x++) {
+        tex = mod->faces[x].texture;
+        if (tex < 0 || tex >= texturenum) tex = texturenum;
+        order[starts[tex]++] = x;
+    }
+
+    // Placing moved every start to the next one
+    for (x = texturenum; x > 0; x--) starts[x] = starts[x - 1];
+    starts[0] = 0;
+    return order;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Write a model to a binary glTF file. The vertices go into the binary
+// chunk exactly as they are held, interleaved with a 32 byte stride, and
+// each texture's faces become one primitive. Returns nonzero on failure
+int expWriteGLB(char *filename, GEO_MODEL *mod, char **textures,
+    int texturenum) {
+    int x, y, binlen, head[5], *order, *starts;
+    float lo[3], hi[3], *pos;
+    EXP_TEXT json = {NULL, 0, 0};
+    EXP_OUT out;
+
+    // Error checking
+    if (filename == NULL || mod == NULL || texturenum < 0 ||
+        (textures == NULL && texturenum)) return 1;
+    if (!finiteVertices(mod)) return 1;
+
+    // A mesh needs something in it
+    if (mod->facenum < 1 || mod->vertexnum < 1) {
+        putText(&json, "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,");
+        putText(&json, "\"scenes\":[{}]}");
+        binlen = 0;
+        order = starts = NULL;
+    } else {
+        starts = malloc((texturenum + 2) * sizeof(int));
+        order = sortFaces(mod, texturenum, starts);
+        binlen = mod->vertexnum * sizeof(GEO_VERTEX) +
+            mod->facenum * 3 * sizeof(int);
+
+        // Bounds are required for positions
+        for (x = 0; x < 3; x++) lo[x] = hi[x] = (&mod->vertices[0].x)[x];
+        for (y = 1; y < mod->vertexnum; y++) {
+            pos = &mod->vertices[y].x;
+            for (x = 0; x < 3; x++) {
+                if (pos[x] < lo[x]) lo[x] = pos[x];
+                if (pos[x] > hi[x]) hi[x] = pos[x];
+            }
+        }
+
+        // Scene, node and mesh
+        putText(&json, "{\"asset\":{\"version\":\"2.0\",");
+        putText(&json, "\"generator\":\"geodraw\"},\"scene\":0,");
+        putText(&json, "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0,");
+        putText(&json, "\"name\":");
+        putString(&json, mod->id);
+        putText(&json, "}],\"meshes\":[{\"name\":");
+        putString(&json, mod->id);
+        putText(&json, ",\"primitives\":[");
+        for (x = y = 0; x <= texturenum; x++) {
+            if (starts[x + 1] == starts[x]) continue;
+            putText(&json, "%s{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,",
+                y ? "," : "");
+            putText(&json, "\"TEXCOORD_0\":2},\"indices\":%d", 3 + y++);
+            if (x < texturenum) putText(&json, ",\"material\":%d", x);
+            putText(&json, "}");
+        }
+        putText(&json, "]}],");
+
+        // Materials carry the texture names
+        if (texturenum) {
+            putText(&json, "\"materials\":[");
+            for (x = 0; x < texturenum; x++) {
+                putText(&json, "%s{\"name\":", x ? "," : "");
+                putString(&json, textures[x]);
+                putText(&json, "}");
+            }
+            putText(&json, "],");
+        }
+
+        // One buffer, viewed as vertices and as indices
+        putText(&json, "\"buffers\":[{\"byteLength\":%d}],", binlen);
+        putText(&json, "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,");
+        putText(&json, "\"byteLength\":%d,\"byteStride\":%d,\"target\":%d},",
+            (int) (mod->vertexnum * sizeof(GEO_VERTEX)),
+            (int) sizeof(GEO_VERTEX), GL_ARRAY_T);
+        putText(&json, "{\"buffer\":0,\"byteOffset\":%d,\"byteLength\":%d,",
+            (int) (mod->vertexnum * sizeof(GEO_VERTEX)),
+            (int) (mod->facenum * 3 * sizeof(int)));
+        putText(&json, "\"target\":%d}],", GL_INDEX_T);
+
+        // Attributes, then a run of indices per primitive
+        putText(&json, "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,");
+        putText(&json, "\"componentType\":%d,\"count\":%d,\"type\":\"VEC3\",",
+            GL_FLOAT_T, mod->vertexnum);
+        putText(&json, "\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},",
+            lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+        putText(&json, "{\"bufferView\":0,\"byteOffset\":12,");
+        putText(&json, "\"componentType\":%d,\"count\":%d,\"type\":\"VEC3\"},",
+            GL_FLOAT_T, mod->vertexnum);
+        putText(&json, "{\"bufferView\":0,\"byteOffset\":24,");
+        putText(&json, "\"componentType\":%d,\"count\":%d,\"type\":\"VEC2\"}",
+            GL_FLOAT_T, mod->vertexnum);
+        for (x = 0; x <= texturenum; x++) {
+            if (starts[x + 1] == starts[x]) continue;
+            putText(&json, ",{\"bufferView\":1,\"byteOffset\":%d,",
+                (int) (starts[x] * 3 * sizeof(int)));
+            putText(&json, "\"componentType\":%d,\"count\":%d,", GL_UINT_T,
+                (starts[x + 1] - starts[x]) * 3);
+            putText(&json, "\"type\":\"SCALAR\"}");
+        }
+        putText(&json, "]}");
+    }
+
+    // Chunks are padded to four bytes, JSON with spaces
+    while (json.len & 3) putText(&json, " ");
+    if (openOut(&out, filename)) {
+        free(json.data);
+        if (order != NULL) { free(order); free(starts); }
+        return 1;
+    }
+
+    // Header and JSON chunk. glTF is little endian, like everything this
+    // runs on
+    head[0] = GLB_MAGIC; head[1] = 2;
+    head[2] = 12 + 8 + json.len + (binlen ? 8 + binlen : 0);
+    head[3] = json.len; head[4] = GLB_JSON;
+    putOut(&out, head, 20);
+    putOut(&out, json.data, json.len);
+    free(json.data);
+
+    // Binary chunk, straight from the model
+    if (binlen) {
+        head[0] = binlen; head[1] = GLB_BIN;
+        putOut(&out, head, 8);
+        putOut(&out, mod->vertices, mod->vertexnum * sizeof(GEO_VERTEX));
+        for (x = 0; x < mod->facenum; x++)
+            putOut(&out, &mod->faces[order[x]].v1, 3 * sizeof(int));
+        free(order);
+        free(starts);
+    }
+
+    return closeOut(&out);
+}
+
+// Write a model to a Wavefront OBJ file, grouping faces by texture name.
+// Returns nonzero on failure
+int expWriteOBJ(char *filename, GEO_MODEL *mod, char **textures,
+    int texturenum) {
+    int x, y, z, len, *order, *starts;
+    char line[EXP_LINE];
+    GEO_VERTEX *vert;
+    GEO_FACE *face;
+    EXP_OUT out;
+
+    // Error checking
+    if (filename == NULL || mod == NULL || texturenum < 0 ||
+        (textures == NULL && texturenum)) return 1;
+    if (!finiteVertices(mod)) return 1;
+    if (openOut(&out, filename)) return 1;
+
+    // Object name
+    putOut(&out, "o ", 2);
+    putOut(&out, mod->id, strlen(mod->id));
+    putOut(&out, "\n", 1);
+
+    // Positions, texture coordinates with OBJ's bottom row at 0, normals
+    for (x = 0; x < mod->vertexnum; x++) {
+        vert = &mod->vertices[x];
+        len = 0;
+        line[len++] = 'v';
+        line[len++] = ' '; len += putFloat(&line[len], vert->x);
+        line[len++] = ' '; len += putFloat(&line[len], vert->y);
+        line[len++] = ' '; len += putFloat(&line[len], vert->z);
+        line[len++] = '\n';
+        putOut(&out, line, len);
+    }
+    for (x = 0; x < mod->vertexnum; x++) {
+        vert = &mod->vertices[x];
+        len = 0;
+        line[len++] = 'v'; line[len++] = 't';
+        line[len++] = ' '; len += putFloat(&line[len], vert->s);
+        line[len++] = ' '; len += putFloat(&line[len], 1.0f - vert->t);
+        line[len++] = '\n';
+        putOut(&out, line, len);
+    }
+    for (x = 0; x < mod->vertexnum; x++) {
+        vert = &mod->vertices[x];
+        len = 0;
+        line[len++] = 'v'; line[len++] = 'n';
+        line[len++] = ' '; len += putFloat(&line[len], vert->nx);
+        line[len++] = ' '; len += putFloat(&line[len], vert->ny);
+        line[len++] = ' '; len += putFloat(&line[len], vert->nz);
+        line[len++] = '\n';
+        putOut(&out, line, len);
+    }
+
+    // Faces, with each vertex's three indices the same and counting from 1
+    starts = malloc((texturenum + 2) * sizeof(int));
+    order = sortFaces(mod, texturenum, starts);
+    for (x = 0; x <= texturenum; x++) {
+        if (starts[x + 1] == starts[x]) continue;
+        if (x < texturenum) {
+            putOut(&out, "usemtl ", 7);
+            putOut(&out, textures[x], strlen(textures[x]));
+            putOut(&out, "\n", 1);
+        }
+        for (y = starts[x]; y < starts[x + 1]; y++) {
+            face = &mod->faces[order[y]];
+            len = 0;
+            line[len++] = 'f';
+            for (z = 0; z < 3; z++) {
+                line[len++] = ' ';
+                len += putInt(&line[len], (&face->v1)[z] + 1LL);
+                line[len++] = '/';
+                len += putInt(&line[len], (&face->v1)[z] + 1LL);
+                line[len++] = '/';
+                len += putInt(&line[len], (&face->v1)[z] + 1LL);
+            }
+            line[len++] = '\n';
+            putOut(&out, line, len);
+        }
+    }
+    free(order);
+    free(starts);
+
+    return closeOut(&out);
+}
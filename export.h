@@ -0,0 +1,9 @@
+#ifndef __GEO_EXPORT__
+#define __GEO_EXPORT__
+
+#include "geo.h"
+
+int expWriteGLB(char *, GEO_MODEL *, char **, int);
+int expWriteOBJ(char *, GEO_MODEL *, char **, int);
+
+#endif // __GEO_EXPORT__
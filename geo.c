@@ -6,13 +6,40 @@
 // This will eventually come from zlib.h
 int uncompress(void *, int *, void *, int);
 
+// Position in the texture enums, which run on from one model to the next
+typedef struct {
+    int offset;   // Next enum to read
+    int texcount; // Faces left in the current run
+    int tex;      // Texture of the current run
+} GEO_ENUMS;
+
 // Extended data structure for obscuring control information from applications
 typedef struct {
-    GEO            geo;
-    unsigned char *data;
-    int            len;
+    GEO                 geo;
+    unsigned char      *data;
+    int                 len;
+    unsigned long long *hashes; // Hash of each model's header and streams
+    unsigned char      *shared; // Models whose vertices another GEO frees
+    int                *reused; // Old model each one was taken from, plus 1
+    int                *headers; // Offset of each model's header in data
+    int                 version; // Format version of the file
+    unsigned char      *names;   // Model names
+    int                 namelen;
+    unsigned char      *enums;   // Runs of faces sharing a texture
+    int                 enumlen;
+    int                 pooloff; // Offset of the pool in the file
+    GEO_ENUMS          *starts;   // Where each probed model's texture
+    int                 startnum; // runs start, and how many could be found
 } GEO_EXT;
 
+// Pool bytes a model is decoded from, when streaming
+typedef struct {
+    int first;   // Offset of the model's first stream in the pool
+    int end;     // Offset just past its last stream
+    int model;   // Index of the model
+    int streams; // Offset of its stream table in the meta stream
+} GEO_SPAN;
+
 // Macros to take the place of common functions
 #define GetInt16(x, y) ( \
     ((int) x[y + 1] <<  8) | ((int) x[y]) )
@@ -20,8 +47,23 @@ typedef struct {
     ((int) x[y + 3] << 24) | ((int) x[y + 2] << 16) | \
     ((int) x[y + 1] <<  8) | ((int) x[y]) )
 
+// Thread-local storage qualifier, so parallel loads keep their own errors
+#ifdef _MSC_VER
+#define GEO_TLS __declspec(thread)
+#else
+#define GEO_TLS __thread
+#endif
+
+// Trace zone macros, see geoTrace()
+#define TraceBegin(x) if (GEO_TRACE_BEGIN != NULL) GEO_TRACE_BEGIN(x)
+#define TraceEnd()    if (GEO_TRACE_END   != NULL) GEO_TRACE_END()
+
 // Global data
 static int GEO_VERBOSE = 0;
+static int GEO_RECOVER = 0;
+static void (*GEO_TRACE_BEGIN)(char *) = NULL;
+static void (*GEO_TRACE_END)() = NULL;
+static GEO_TLS char GEO_ERROR[256];
 
 
 
@@ -29,6 +71,30 @@ static int GEO_VERBOSE = 0;
 //                             Non-API Functions                              //
 ////////////////////////////////////////////////////////////////////////////////
 
+// Records why a load failed for geoLastError(), printing it if verbose.
+// The format takes at most one string, with its length limited
+static void loadError(char *format, char *arg) {
+    sprintf(GEO_ERROR, format, (arg != NULL) ? arg : "");
+    if (GEO_VERBOSE) printf("ERROR: %s\n", GEO_ERROR);
+    return;
+}
+
+// Hash a block of bytes, continuing from a previous hash
+static unsigned long long hashBytes(unsigned long long hash, 
+    unsigned char *data, int len) {
+    unsigned long long word;
+    int x;
+
+    // Eight bytes at a time, folding the high bits back down each step
+    for (x = 0; x + 8 <= len; x += 8) {
+        memcpy(&word, &data[x], 8);
+        hash = (hash ^ word) * 0x100000001B3ULL;
+        hash ^= hash >> 29;
+    }
+    for ( ; x < len; x++) hash = (hash ^ data[x]) * 0x100000001B3ULL;
+    return hash;
+}
+
 // Extract a zlib stream
 static unsigned char* getZlib(unsigned char *data, int packed, int unpacked) {
     unsigned char *ret;
@@ -56,7 +122,7 @@ static unsigned char* getZlib(unsigned char *data, int packed, int unpacked) {
 
 // Unpack the meta stream from the file data
 static unsigned char* getMeta(unsigned char *data, 
-    int *len, int *offset, int *version) {
+    int *len, int *offset, int *version, int *packed) {
     int MetaSize, UnpackedSize;
     unsigned char *meta;
     int zipbias = 12;
@@ -82,6 +148,7 @@ static unsigned char* getMeta(unsigned char *data,
 
 
     // Extract the meta stream
+    *packed = MetaSize - zipbias;
     meta = getZlib(&data[dumb], MetaSize - zipbias, UnpackedSize);
     if (meta == NULL) return NULL;
 
@@ -94,7 +161,7 @@ static unsigned char* getMeta(unsigned char *data,
 }
 
 // Decoder function to process data references
-static void* refDecode(
+static void* refDecodeValues(
     unsigned char *data, int len, int count, int members, int mode) {
     int tlen, x, y, offset, bits, *iaccum;
     float exponent, value, *faccum;
@@ -197,6 +264,17 @@ static void* refDecode(
     return values;
 }
 
+// Traced entry point of the reference decoder
+static void* refDecode(
+    unsigned char *data, int len, int count, int members, int mode) {
+    void *values;
+
+    TraceBegin("refDecode");
+    values = refDecodeValues(data, len, count, members, mode);
+    TraceEnd();
+    return values;
+}
+
 // Loads one model from a GEO meta stream
 static int getModel(GEO_MODEL *mod, unsigned char *data, int offset, 
     unsigned char *names, int namelen, unsigned char *pool, int poollen, int version) {
@@ -226,8 +304,7 @@ static int getModel(GEO_MODEL *mod, unsigned char *data, int offset,
     // Load model name
     x = GetInt32(data, offset); offset += 4;
     if (x < 0 || x >= namelen) {
-        if (GEO_VERBOSE)
-            printf("ERROR: Invalid model name offset encountered\n");
+        loadError("Invalid model name offset encountered", NULL);
         return 1;
     }
     mod->id = &names[x];
@@ -279,6 +356,13 @@ static int getModel(GEO_MODEL *mod, unsigned char *data, int offset,
         free(refdata);
     }
 
+    // Normals can be made again from the faces, see geoRecover()
+    if (normals == NULL && GEO_RECOVER && mod->vertexnum > 0) {
+        normals = calloc(mod->vertexnum * 3, sizeof(float));
+        if (GEO_VERBOSE)
+            printf("WARNING: Could not unpack normals for %s\n", mod->id);
+    }
+
     // Check if everything loaded correctly
     if (indexes == NULL || coords == NULL || 
         normals == NULL || texcoords == NULL) {
@@ -286,8 +370,7 @@ static int getModel(GEO_MODEL *mod, unsigned char *data, int offset,
         if (coords    != NULL) free(coords);
         if (normals   != NULL) free(normals);
         if (texcoords != NULL) free(texcoords);
-        if (GEO_VERBOSE)
-            printf("ERROR: Could not unpack data for %s\n", mod->id);
+        loadError("Could not unpack data for %.200s", mod->id);
         return 1;
     }
 
@@ -299,8 +382,7 @@ static int getModel(GEO_MODEL *mod, unsigned char *data, int offset,
             z = indexes[x * 3 + y];
             if (z < 0 || z >= mod->vertexnum) {
                 free(indexes); free(coords); free(normals); free(texcoords);
-                if (GEO_VERBOSE)
-                    printf("ERROR: Invalid vertex index in %s\n", mod->id);
+                loadError("Invalid vertex index in %.200s", mod->id);
                 return 1;
             }
 
@@ -366,8 +448,7 @@ static int getModelv2(GEO_MODEL *mod, unsigned char *data, int offset,
     // Load model name
     x = GetInt32(data, offset); offset += 4;
     if (x < 0 || x >= namelen) {
-        if (GEO_VERBOSE)
-            printf("ERROR: Invalid model name offset encountered\n");
+        loadError("Invalid model name offset encountered", NULL);
         return 1;
     }
     mod->id = &names[x];
@@ -419,6 +500,13 @@ static int getModelv2(GEO_MODEL *mod, unsigned char *data, int offset,
         free(refdata);
     }
 
+    // Normals can be made again from the faces, see geoRecover()
+    if (normals == NULL && GEO_RECOVER && mod->vertexnum > 0) {
+        normals = calloc(mod->vertexnum * 3, sizeof(float));
+        if (GEO_VERBOSE)
+            printf("WARNING: Could not unpack normals for %s\n", mod->id);
+    }
+
     // Check if everything loaded correctly
     if (indexes == NULL || coords == NULL || 
         normals == NULL || texcoords == NULL) {
@@ -426,8 +514,7 @@ static int getModelv2(GEO_MODEL *mod, unsigned char *data, int offset,
         if (coords    != NULL) free(coords);
         if (normals   != NULL) free(normals);
         if (texcoords != NULL) free(texcoords);
-        if (GEO_VERBOSE)
-            printf("ERROR: Could not unpack data for %s\n", mod->id);
+        loadError("Could not unpack data for %.200s", mod->id);
         return 1;
     }
 
@@ -439,8 +526,7 @@ static int getModelv2(GEO_MODEL *mod, unsigned char *data, int offset,
             z = indexes[x * 3 + y];
             if (z < 0 || z >= mod->vertexnum) {
                 free(indexes); free(coords); free(normals); free(texcoords);
-                if (GEO_VERBOSE)
-                    printf("ERROR: Invalid vertex index in %s\n", mod->id);
+                loadError("Invalid vertex index in %.200s", mod->id);
                 return 1;
             }
 
@@ -479,21 +565,195 @@ static int getModelv2(GEO_MODEL *mod, unsigned char *data, int offset,
     return 0;
 }
 
-// Loads the models within a GEO meta stream
+// Reads the counts and name of a model block, see getModel() and
+// getModelv2(). Returns the offset of the stream table, -1 on error
+static int getHeader(GEO_MODEL *mod, unsigned char *data, int offset, 
+    unsigned char *names, int namelen, int version) {
+    int x;
+
+    // Versions 3 and up lead with the block size
+    if (version < 3) {
+        mod->vertexnum = GetInt32(data, offset + 28);
+        mod->facenum   = GetInt32(data, offset + 32);
+        x              = GetInt32(data, offset + 80);
+        offset += 132;
+    } else {
+        mod->vertexnum = GetInt32(data, offset + 16);
+        mod->facenum   = GetInt32(data, offset + 20);
+        if (version < 8) offset -= 4;
+        x              = GetInt32(data, offset + 64);
+        offset += 108;
+    }
+
+    // Check the model name
+    if (x < 0 || x >= namelen) {
+        loadError("Invalid model name offset encountered", NULL);
+        return -1;
+    }
+    mod->id = (char *) &names[x];
+    return offset;
+}
+
+// Hashes what a model is decoded from: its counts, name and the pool bytes
+// of its four streams. Returns 0, which never matches, if a stream is out
+// of bounds
+static unsigned long long hashModel(GEO_MODEL *mod, unsigned char *data, 
+    int datalen, int streams, unsigned char *pool, int poollen) {
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    int x, packed, unpacked, pooloff;
+
+    if (streams < 0 || streams > datalen - 48) return 0;
+    hash = hashBytes(hash, (unsigned char *) &mod->vertexnum, sizeof(int));
+    hash = hashBytes(hash, (unsigned char *) &mod->facenum, sizeof(int));
+    hash = hashBytes(hash, (unsigned char *) mod->id, strlen(mod->id));
+
+    for (x = 0; x < 4; x++, streams += 12) {
+        packed   = GetInt32(data, streams);
+        unpacked = GetInt32(data, streams + 4);
+        pooloff  = GetInt32(data, streams + 8);
+        if (packed) unpacked = packed;
+        if (unpacked < 0 || pooloff < 0 || pooloff > poollen - unpacked)
+            return 0;
+        hash = hashBytes(hash, &data[streams], 8);
+        hash = hashBytes(hash, &pool[pooloff], unpacked);
+    }
+
+    return hash ? hash : 1;
+}
+
+// Checks whether a model of an older version of the file decodes the same
+static int sameModel(GEO_EXT *old, int x, GEO_MODEL *mod, 
+    unsigned long long hash, unsigned char *taken) {
+    GEO_MODEL *src = &old->geo.models[x];
+
+    return !taken[x] && old->hashes[x] == hash && 
+        src->vertexnum == mod->vertexnum && src->facenum == mod->facenum &&
+        !strcmp(src->id, mod->id);
+}
+
+// Find a model of an older version of the file that decodes the same as
+// mod, trying the same position first. Returns its index or -1
+static int findModel(GEO_EXT *old, GEO_MODEL *mod, unsigned long long hash, 
+    int hint, unsigned char *taken) {
+    int x;
+
+    if (!hash) return -1;
+    if (hint < old->geo.modelnum && sameModel(old, hint, mod, hash, taken))
+        return hint;
+    for (x = 0; x < old->geo.modelnum; x++)
+        if (x != hint && sameModel(old, x, mod, hash, taken)) return x;
+    return -1;
+}
+
+// Loads the LOD definitions of version 2 through 6 files
+//   int32 entrynum
+//   entrynum times:
+//     int32 model name offset of the full-detail model
+//     int32 levelnum
+//     levelnum times: float32 distance, int32 model name offset
+static void getLods(GEO *geo, unsigned char *data, int len, 
+    unsigned char *names, int namelen) {
+    int x, y, z, offset, entrynum, levelnum, *lookup;
+    GEO_MODEL *mod;
+    GEO_LOD lod;
+
+    // Check if there is anything to load
+    if (data == NULL || len < 4 || !geo->modelnum) return;
+
+    // Map model name offsets back to model indexes
+    lookup = malloc(namelen * sizeof(int));
+    for (x = 0; x < namelen; x++) lookup[x] = -1;
+    for (x = 0; x < geo->modelnum; x++)
+        lookup[(unsigned char *) geo->models[x].id - names] = x;
+
+    // Process all entries
+    entrynum = GetInt32(data, 0);
+    for (x = 0, offset = 4; x < entrynum; x++) {
+
+        // Identify the model the levels belong to
+        if (offset > len - 8) break;
+        y        = GetInt32(data, offset); offset += 4;
+        levelnum = GetInt32(data, offset); offset += 4;
+        if (y < 0 || y >= namelen || lookup[y] < 0 || levelnum < 0 ||
+            levelnum > (len - offset) / 8) break;
+        mod = &geo->models[lookup[y]];
+        if (mod->lodnum) { offset += levelnum * 8; continue; }
+        if (!levelnum) continue;
+
+        // Load the levels, keeping them sorted by distance
+        mod->lods = malloc(levelnum * sizeof(GEO_LOD));
+        for (y = 0; y < levelnum; y++) {
+            z = GetInt32(data, offset); offset += 4;
+            memcpy(&lod.distance, &z, sizeof z);
+            z = GetInt32(data, offset); offset += 4;
+            if (z < 0 || z >= namelen || lookup[z] < 0 || 
+                !(lod.distance > 0.0f)) continue;
+            lod.model = lookup[z];
+            for (z = mod->lodnum; z > 0 && 
+                mod->lods[z - 1].distance > lod.distance; z--)
+                mod->lods[z] = mod->lods[z - 1];
+            mod->lods[z] = lod;
+            mod->lodnum++;
+        }
+        if (!mod->lodnum) { free(mod->lods); mod->lods = NULL; }
+    }
+
+    // Report malformed data, but keep whatever was loaded
+    if (x < entrynum && GEO_VERBOSE)
+        printf("WARNING: LOD definitions are incomplete\n");
+
+    free(lookup);
+    return;
+}
+
+// Assigns textures to a model's faces from the texture enums. A model
+// without faces only moves the position past them
+static int getTextures(GEO_EXT *geox, GEO_MODEL *mod, GEO_ENUMS *pos) {
+    int y;
+
+    for (y = 0; y < mod->facenum; y++) {
+        // Load information for the next texture
+        if (!pos->texcount) {
+            if (pos->offset > geox->enumlen - 4) {
+                if (GEO_VERBOSE)
+                    printf("WARNING: Unexpected end of texture enums\n");
+                pos->tex = 0;
+            } else {
+                pos->tex      = GetInt16(geox->enums, pos->offset);
+                pos->texcount = GetInt16(geox->enums, pos->offset + 2);
+                pos->offset += 4;
+                if (pos->tex < 0 || pos->tex >= geox->geo.texturenum) {
+                    loadError("Invalid texture enum index encountered", NULL);
+                    return 1;
+                }
+            }
+        }
+
+        // Assign the texture to the face
+        if (mod->faces != NULL) mod->faces[y].texture = pos->tex;
+        pos->texcount--;
+    }
+
+    return 0;
+}
+
+// Loads the models within a GEO meta stream. Models that decode the same
+// as one of old's are taken from it instead of being decoded again, and
+// probing only reads their headers
 static int getModels(GEO_EXT *geox, 
-    unsigned char *pool, int len, int version) {
+    unsigned char *pool, int len, int version, GEO_EXT *old, int probe) {
     int PoolSize, TexNamesSize, ModNamesSize, TexEnumsSize;
-    unsigned char *blockdata;
+    unsigned char *blockdata, *taken = NULL;
     GEO *geo = &geox->geo;
-    int x, y, offset = 16, blocksize;
+    GEO_ENUMS pos;
+    GEO_MODEL *mod;
+    int x, y, err, offset = 16, blocksize, streams;
     int fix = 0;
     int lodsize = 0;
-    int tex, texcount;
 
     // Check if a full header exists
     if (geox->len < 16) {
-        if (GEO_VERBOSE)
-            printf("ERROR: Insufficient data for meta header\n");
+        loadError("Insufficient data for meta header", NULL);
         return 1;
     }
 
@@ -503,11 +763,11 @@ static int getModels(GEO_EXT *geox,
     ModNamesSize = GetInt32(geox->data,  8);
     TexEnumsSize = GetInt32(geox->data, 12);
 
-    // Check header for errors
-    if (PoolSize > len || TexNamesSize < 4 || !ModNamesSize || !TexEnumsSize || 
+    // Check header for errors, probing doesn't need the pool
+    if ((PoolSize > len && !probe) || TexNamesSize < 4 || !ModNamesSize || 
+        !TexEnumsSize || 
         TexNamesSize + ModNamesSize + TexEnumsSize + 16 > geox->len) {
-        if (GEO_VERBOSE)
-            printf("ERROR: Meta stream header contains invalid data\n");
+        loadError("Meta stream header contains invalid data", NULL);
         return 1;
     }
 
@@ -515,6 +775,11 @@ static int getModels(GEO_EXT *geox,
 	    lodsize = GetInt32(geox->data, 16);
 	    offset += 4;
 	    fix = 4;
+	    if (lodsize < 0 || TexNamesSize + ModNamesSize + TexEnumsSize + 
+	        lodsize + 20 > geox->len) {
+	        loadError("Meta stream header contains invalid data", NULL);
+	        return 1;
+	    }
     }
 
     // Load information about texture filenames
@@ -530,8 +795,7 @@ static int getModels(GEO_EXT *geox,
         // Check if the offset is valid
         y = GetInt16(geox->data, offset); offset += 4;
         if (y < 0 || y >= blocksize) {
-            if (GEO_VERBOSE)
-                printf("ERROR: Invalid texture name offset encountered\n");
+            loadError("Invalid texture name offset encountered", NULL);
             return 1;
         }
 
@@ -541,6 +805,11 @@ static int getModels(GEO_EXT *geox,
 
     // Load information about models
     blockdata = &geox->data[16 + fix + TexNamesSize];
+    geox->version = version;
+    geox->names = blockdata;
+    geox->namelen = ModNamesSize;
+    geox->enums = &geox->data[16 + fix + TexNamesSize + ModNamesSize];
+    geox->enumlen = TexEnumsSize;
     offset = TexNamesSize + ModNamesSize + TexEnumsSize + lodsize + fix + 16;
     geo->id = &geox->data[offset]; offset += 0x84;
     offset += 4; // unk1
@@ -549,6 +818,13 @@ static int getModels(GEO_EXT *geox,
 
     // Load models
     geo->models = calloc(geo->modelnum * sizeof(GEO_MODEL), 1);
+    geox->hashes = calloc(geo->modelnum, sizeof(unsigned long long));
+    geox->shared = calloc(geo->modelnum, 1);
+    geox->headers = calloc(geo->modelnum, sizeof(int));
+    if (old != NULL) {
+        geox->reused = calloc(geo->modelnum, sizeof(int));
+        taken = calloc(old->geo.modelnum ? old->geo.modelnum : 1, 1);
+    }
     for (x = 0; x < geo->modelnum; x++) {
 
         // Check if there's enough room for another model
@@ -559,102 +835,497 @@ static int getModels(GEO_EXT *geox,
         	y = GetInt32(geox->data, offset);
 	}
         if (offset > geox->len - y) {
-            if (GEO_VERBOSE)
-                printf("ERROR: Unexpected end of data\n");
+            loadError("Unexpected end of data", NULL);
+            if (taken != NULL) free(taken);
+            return 1;
+        }
+
+        // Take unchanged models from the old version, sharing the vertices
+        mod = &geo->models[x];
+        geox->headers[x] = offset;
+        streams = getHeader(mod, geox->data, offset, blockdata, 
+            ModNamesSize, version);
+        if (streams < 0) {
+            if (taken != NULL) free(taken);
             return 1;
         }
+        if (probe) {
+            offset += y;
+            continue;
+        }
+        geox->hashes[x] = hashModel(mod, geox->data, geox->len, streams, 
+            pool, len);
+        err = (old == NULL) ? -1 : findModel(old, mod, geox->hashes[x], x, 
+            taken);
+        if (err >= 0) {
+            taken[err] = 1;
+            geox->reused[x] = err + 1;
+            geox->shared[x] = 1;
+            mod->vertices = old->geo.models[err].vertices;
+            if (mod->facenum) {
+                mod->faces = malloc(mod->facenum * sizeof(GEO_FACE));
+                memcpy(mod->faces, old->geo.models[err].faces, 
+                    mod->facenum * sizeof(GEO_FACE));
+            }
+            offset += y;
+            continue;
+        }
 
         // Load the model
+        TraceBegin("getModel");
 	if (version < 3) {
-	        if (getModelv2(&geo->models[x], geox->data, offset, 
-	            blockdata, ModNamesSize, pool, len, version))
-	            return 1; // An error coccurred
+	        err = getModelv2(&geo->models[x], geox->data, offset, 
+	            blockdata, ModNamesSize, pool, len, version);
 	} else {
-	        if (getModel(&geo->models[x], geox->data, offset, 
-	            blockdata, ModNamesSize, pool, len, version))
-	            return 1; // An error coccurred
+	        err = getModel(&geo->models[x], geox->data, offset, 
+	            blockdata, ModNamesSize, pool, len, version);
 	}
+        TraceEnd();
+        if (err) { // An error coccurred
+            if (taken != NULL) free(taken);
+            return 1;
+        }
         offset += y;
     }
+    if (taken != NULL) free(taken);
+
+    // Assign textures to faces, probed models have none
+    memset(&pos, 0, sizeof(GEO_ENUMS));
+    for (x = 0; x < geo->modelnum && !probe; x++)
+        if (getTextures(geox, &geo->models[x], &pos)) return 1;
+
+    // Note where each probed model's runs start, so that decoding one later
+    // doesn't walk those of every model before it. Bad runs only fail the
+    // models from there on
+    if (probe) {
+        geox->starts = malloc((geo->modelnum ? geo->modelnum : 1) *
+            sizeof(GEO_ENUMS));
+        for (x = 0; x < geo->modelnum; x++) {
+            geox->starts[x] = pos;
+            if (getTextures(geox, &geo->models[x], &pos)) break;
+        }
+        geox->startnum = x;
+        GEO_ERROR[0] = 0;
+    }
 
-    // Assign textures to faces
-    blockdata = &geox->data[16 + fix + TexNamesSize + ModNamesSize];
-    blocksize = TexEnumsSize;
-
-    for (x = offset = texcount = 0; x < geo->modelnum; x++) {
-        for (y = 0; y < geo->models[x].facenum; y++) {
-            // Load information for the next texture
-            if (!texcount) {
-                if (offset > blocksize - 4) {
-                    if (GEO_VERBOSE)
-                        printf("WARNING: Unexpected end of texture enums\n");
-		    tex = 0;
-                } else {
-	                tex      = GetInt16(blockdata, offset); offset += 2;
-	                texcount = GetInt16(blockdata, offset); offset += 2;
-	                if (tex < 0 || tex >= geo->texturenum) {
-	                    if (GEO_VERBOSE) {
-	                        printf("ERROR: Invalid texture");
-	                        printf(" enum index encountered\n");
-	                    }  return 1;
-        	        }
-		}
-            }
-
-            // Assign the texture to the face
-            geo->models[x].faces[y].texture = tex;
-            texcount--;
-
-        } // y
-    } // x
+    // Load level of detail definitions
+    if (lodsize) getLods(geo, &geox->data[16 + fix + TexNamesSize + 
+        ModNamesSize + TexEnumsSize], lodsize, 
+        &geox->data[16 + fix + TexNamesSize], ModNamesSize);
 
     // Return success
     return 0;
 }
 
+// Adds up the stream sizes and checks the texture enums of a load, as far
+// as its model headers could be read, see geoAudit()
+static void getStats(GEO_EXT *geox, GEO_STATS *stats) {
+    int x, y, streams, packed, unpacked, faces = 0;
+    GEO_MODEL mod;
+
+    // Stored streams take up their unpacked size
+    for (x = 0; x < geox->geo.modelnum && geox->headers != NULL; x++) {
+        if (!geox->headers[x]) break;
+        streams = getHeader(&mod, geox->data, geox->headers[x],
+            geox->names, geox->namelen, geox->version);
+        if (streams < 0 || streams > geox->len - 48) break;
+        for (y = 0; y < 4; y++, streams += 12) {
+            packed   = GetInt32(geox->data, streams);
+            unpacked = GetInt32(geox->data, streams + 4);
+            stats->packed[GEO_STREAM_FACES + y] += packed ? packed : unpacked;
+            stats->unpacked[GEO_STREAM_FACES + y] += unpacked;
+        }
+        faces += mod.facenum;
+    }
 
+    // Walk the runs the way getTextures() does, counting every bad one
+    for (x = 0; faces > 0 && x <= geox->enumlen - 4; x += 4) {
+        if (GetInt16(geox->enums, x) >= geox->geo.texturenum)
+            stats->badenums++;
+        y = GetInt16(geox->enums, x + 2);
+        faces -= y ? y : faces;
+    }
+    return;
+}
 
-////////////////////////////////////////////////////////////////////////////////
-//                               API Functions                                //
-////////////////////////////////////////////////////////////////////////////////
-
-// Load a GEO file into a GEO structure
-GEO* geoLoad(unsigned char *data, int len) {
+// Loads a GEO file, or a new version of one when old isn't NULL. Probing
+// reads the meta stream alone, and stats are filled in for geoAudit()
+static GEO* loadGeo(unsigned char *data, int len, GEO_EXT *old, int probe,
+    GEO_STATS *stats, char *zone) {
     unsigned char *pool;
     GEO_EXT *geox;
-    int offset, version;
-    GEO *geo;
+    int offset, version, x, reused, packed = 0;
 
     // Error checking
+    GEO_ERROR[0] = 0;
     if (data == NULL || len < 16) {
-        if (GEO_VERBOSE)
-            printf("ERROR: Bad parameters passed to geoLoad()\n");
+        loadError("Bad parameters passed to %.200s()", zone);
         return NULL;
     }
 
     // Unpack the meta stream from the data
+    TraceBegin(zone);
     geox = calloc(sizeof(GEO_EXT), 1);
     geox->len = len;
-    geox->data = getMeta(data, &geox->len, &offset, &version);
-    printf("Version: %d\n", version);
+    geox->data = getMeta(data, &geox->len, &offset, &version, &packed);
+    if (!probe && stats == NULL) printf("Version: %d\n", version);
+    if (stats != NULL) {
+        stats->version = version;
+        stats->packed[GEO_STREAM_META] = packed;
+        if (geox->data != NULL) stats->unpacked[GEO_STREAM_META] = geox->len;
+    }
     if (geox->data == NULL) {
         geoFree(&geox->geo);
-        if (GEO_VERBOSE)
-            printf("ERROR: Unsupported .geo container format\n");
+        loadError("Unsupported .geo container format", NULL);
+        TraceEnd();
         return NULL;
     }
     pool = &data[offset];
+    geox->pooloff = offset;
 
     // Extract models
-    if (getModels(geox, pool, len - offset, version)) {
+    x = getModels(geox, pool, len - offset, version, old, probe);
+    if (stats != NULL) getStats(geox, stats);
+    if (x) {
         geoFree(&geox->geo);
+        TraceEnd();
         return NULL;
     }
 
+    // The taken vertices belong to the new version from here on
+    if (old != NULL) {
+        for (x = reused = 0; x < geox->geo.modelnum; x++) {
+            if (!geox->reused[x]) continue;
+            old->shared[geox->reused[x] - 1] = 1;
+            geox->shared[x] = 0;
+            reused++;
+        }
+        if (GEO_VERBOSE) printf("Decoded %d of %d models, reused %d\n", 
+            geox->geo.modelnum - reused, geox->geo.modelnum, reused);
+    }
+
     // Return the loaded GEO object
+    TraceEnd();
     return &geox->geo;
 }
 
+
+// Reads exactly len bytes from a stream, returning nonzero if it ends first
+static int readStream(int (*reader)(void *, unsigned char *, int), 
+    void *data, unsigned char *buf, int len) {
+    int got;
+
+    while (len > 0) {
+        got = reader(data, buf, len);
+        if (got <= 0) return 1;
+        buf += got;
+        len -= got;
+    }
+    return 0;
+}
+
+// Reads past bytes of a stream nothing is decoded from
+static int skipStream(int (*reader)(void *, unsigned char *, int), 
+    void *data, int len) {
+    unsigned char buf[4096];
+    int x;
+
+    for ( ; len > 0; len -= x) {
+        x = len < (int) sizeof(buf) ? len : (int) sizeof(buf);
+        if (readStream(reader, data, buf, x)) return 1;
+    }
+    return 0;
+}
+
+// Finds the pool bytes a model's four streams lie in. Returns nonzero if
+// one of them is invalid
+static int getSpan(GEO_EXT *geox, int x, GEO_SPAN *span) {
+    int y, streams, size, pooloff;
+    GEO_MODEL mod;
+
+    // The header was read by the probe, this only finds the stream table
+    streams = getHeader(&mod, geox->data, geox->headers[x],
+        geox->names, geox->namelen, geox->version);
+    if (streams < 0 || streams > geox->len - 48) return 1;
+    span->model = x;
+    span->streams = streams;
+    span->first = 0x7FFFFFFF;
+    span->end = 0;
+
+    // Stored streams take up their unpacked size
+    for (y = 0; y < 4; y++, streams += 12) {
+        size = GetInt32(geox->data, streams);
+        if (!size) size = GetInt32(geox->data, streams + 4);
+        pooloff = GetInt32(geox->data, streams + 8);
+        if (size < 0 || pooloff < 0 || pooloff > 0x7FFFFFFF - size) return 1;
+        if (!size) continue;
+        if (pooloff < span->first) span->first = pooloff;
+        if (pooloff + size > span->end) span->end = pooloff + size;
+    }
+    if (span->first > span->end) span->first = span->end;
+    return 0;
+}
+
+// Points a model's streams at a window starting at the pool offset given
+static void moveSpan(GEO_EXT *geox, GEO_SPAN *span, int start) {
+    int y, streams, pooloff;
+
+    for (y = 0, streams = span->streams; y < 4; y++, streams += 12) {
+        if (!GetInt32(geox->data, streams) && 
+            !GetInt32(geox->data, streams + 4)) continue;
+        pooloff = GetInt32(geox->data, streams + 8) - start;
+        geox->data[streams +  8] = pooloff;
+        geox->data[streams +  9] = pooloff >> 8;
+        geox->data[streams + 10] = pooloff >> 16;
+        geox->data[streams + 11] = pooloff >> 24;
+    }
+    return;
+}
+
+// Orders spans by where they start in the pool
+static int compareSpans(const void *a, const void *b) {
+    const GEO_SPAN *x = a, *y = b;
+
+    if (x->first != y->first) return x->first < y->first ? -1 : 1;
+    return x->model - y->model;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Load a GEO file like geoLoad(), filling in how it's stored. stats are
+// filled in as far as the file could be read even when loading fails, see
+// geoLastError() for why it did
+GEO* geoAudit(unsigned char *data, int len, GEO_STATS *stats) {
+    GEO_STATS none;
+
+    if (stats == NULL) stats = &none;
+    memset(stats, 0, sizeof(GEO_STATS));
+    return loadGeo(data, len, NULL, 0, stats, "geoAudit");
+}
+
+// Load a GEO file into a GEO structure
+GEO* geoLoad(unsigned char *data, int len) {
+    return loadGeo(data, len, NULL, 0, NULL, "geoLoad");
+}
+
+// Describe why the last load on this thread failed, empty if it didn't
+char* geoLastError() {
+    return GEO_ERROR;
+}
+
+// Decode one model of a file read with geoProbe(), for callers that only
+// keep some of its models. data holds the whole file, and the model's
+// name points into geo, so geo has to outlive it. Models of one geo may
+// be decoded on several threads at once. Free it with geoFreeModel()
+GEO_MODEL* geoLoadModel(GEO *geo, int model, unsigned char *data, int len) {
+    GEO_EXT *geox = (GEO_EXT *) geo;
+    GEO_MODEL *mod;
+    GEO_ENUMS pos;
+    GEO_SPAN span;
+    int err;
+
+    // Error checking
+    GEO_ERROR[0] = 0;
+    if (geo == NULL || data == NULL || model < 0 || 
+        model >= geo->modelnum || geox->starts == NULL || 
+        len < geox->pooloff) {
+        loadError("Bad parameters passed to geoLoadModel()", NULL);
+        return NULL;
+    }
+
+    // Check that its streams are in the data
+    if (getSpan(geox, model, &span) || span.end > len - geox->pooloff) {
+        loadError("Invalid model stream encountered", NULL);
+        return NULL;
+    }
+
+    // Its texture runs start where the probe found them to
+    if (model > geox->startnum) {
+        loadError("Invalid texture enum index encountered", NULL);
+        return NULL;
+    }
+    pos = geox->starts[model];
+
+    // Load the model
+    TraceBegin("geoLoadModel");
+    mod = calloc(1, sizeof(GEO_MODEL));
+    if (geox->version < 3)
+        err = getModelv2(mod, geox->data, geox->headers[model], 
+            geox->names, geox->namelen, &data[geox->pooloff], 
+            len - geox->pooloff, geox->version);
+    else
+        err = getModel(mod, geox->data, geox->headers[model], 
+            geox->names, geox->namelen, &data[geox->pooloff], 
+            len - geox->pooloff, geox->version);
+    if (!err) err = getTextures(geox, mod, &pos);
+    TraceEnd();
+    if (err) {
+        geoFreeModel(mod);
+        return NULL;
+    }
+
+    // Its levels of detail come from the probe
+    if (geo->models[model].lodnum) {
+        mod->lodnum = geo->models[model].lodnum;
+        mod->lods = malloc(mod->lodnum * sizeof(GEO_LOD));
+        memcpy(mod->lods, geo->models[model].lods, 
+            mod->lodnum * sizeof(GEO_LOD));
+    }
+    return mod;
+}
+
+// Load a GEO file from a stream one model at a time, for jobs that visit
+// each model once. reader(data, buffer, length) fills in up to length
+// bytes and returns how many, or 0 at the end of the stream. Each model
+// goes to callback(data, geo, model) fully decoded, in the order the file
+// stores them, and is freed when it returns, so only one model is held
+// at once. geo has the names and counts of all of them. Returns the
+// number of models loaded, or -1 on failure
+int geoLoadStream(int (*reader)(void *, unsigned char *, int),
+    void (*callback)(void *, GEO *, int), void *data) {
+    int x, len, err = 0, winstart = 0, winlen = 0, winmax = 0;
+    unsigned char head[16], *buf, *window = NULL;
+    GEO_SPAN *spans, *span;
+    GEO_MODEL *mod;
+    GEO_EXT *geox;
+    GEO *geo;
+
+    // Error checking
+    GEO_ERROR[0] = 0;
+    if (reader == NULL || callback == NULL) {
+        loadError("Bad parameters passed to geoLoadStream()", NULL);
+        return -1;
+    }
+
+    // The header and meta stream come before the pool
+    if (readStream(reader, data, head, 16)) len = 0;
+    else len = GetInt32(head, 0);
+    if (len < 12 || len > 0x7FFFFFFF - 8) {
+        loadError("Unsupported .geo container format", NULL);
+        return -1;
+    }
+    len += GetInt32(head, 4) ? 8 : 4;
+    buf = malloc(len);
+    memcpy(buf, head, 16);
+    if (readStream(reader, data, &buf[16], len - 16)) {
+        loadError("Unexpected end of data", NULL);
+        free(buf);
+        return -1;
+    }
+    geo = loadGeo(buf, len, NULL, 1, NULL, "geoLoadStream");
+    free(buf);
+    if (geo == NULL) return -1;
+    geox = (GEO_EXT *) geo;
+
+    // Every model's texture runs have to be found before any is decoded
+    // out of order, then where each model lies in the pool
+    if (geox->startnum < geo->modelnum) {
+        loadError("Invalid texture enum index encountered", NULL);
+        err = 1;
+    }
+    spans = malloc((geo->modelnum ? geo->modelnum : 1) * sizeof(GEO_SPAN));
+    for (x = 0; x < geo->modelnum && !err; x++) {
+        err = getSpan(geox, x, &spans[x]);
+        if (err) loadError("Invalid model stream encountered", NULL);
+    }
+    if (!err) qsort(spans, geo->modelnum, sizeof(GEO_SPAN), compareSpans);
+
+    // Decode the models in pool order, holding only the bytes still needed
+    for (x = 0; x < geo->modelnum && !err; x++) {
+        span = &spans[x];
+        mod = &geo->models[span->model];
+
+        // Drop the bytes before the model, then read up to its end
+        if (span->first > winstart) {
+            len = span->first - winstart;
+            if (len > winlen) len = winlen;
+            memmove(window, &window[len], winlen - len);
+            winstart += len;
+            winlen -= len;
+        }
+        if (!winlen && winstart < span->first) {
+            err = skipStream(reader, data, span->first - winstart);
+            winstart = span->first;
+        }
+        if (!err && span->end > winstart + winlen) {
+            len = span->end - winstart;
+            if (len > winmax) {
+                winmax = len;
+                window = realloc(window, winmax);
+            }
+            err = readStream(reader, data, &window[winlen], len - winlen);
+            winlen = len;
+        }
+        if (err) {
+            loadError("Unexpected end of data", NULL);
+            break;
+        }
+
+        // Load the model
+        moveSpan(geox, span, winstart);
+        TraceBegin("getModel");
+        if (geox->version < 3)
+            err = getModelv2(mod, geox->data, geox->headers[span->model], 
+                geox->names, geox->namelen, window, winlen, geox->version);
+        else
+            err = getModel(mod, geox->data, geox->headers[span->model], 
+                geox->names, geox->namelen, window, winlen, geox->version);
+        TraceEnd();
+        if (!err) err = getTextures(geox, mod, &geox->starts[span->model]);
+        if (err) break;
+
+        // Hand it over, then let it go
+        callback(data, geo, span->model);
+        free(mod->faces);
+        free(mod->vertices);
+        mod->faces = NULL;
+        mod->vertices = NULL;
+    }
+
+    // Clean up and return
+    if (window != NULL) free(window);
+    free(spans);
+    geoFree(geo);
+    return err ? -1 : x;
+}
+
+// Read just the meta stream of a GEO file: the names and face and vertex
+// counts of its models, its texture names and its levels of detail. The
+// models have no faces or vertices, and data only has to hold the header
+// and the meta stream, so the geometry never has to be read from disk
+GEO* geoProbe(unsigned char *data, int len) {
+    return loadGeo(data, len, NULL, 1, NULL, "geoProbe");
+}
+
+// Load a new version of a GEO file, taking the models that haven't changed
+// from the old version instead of decoding them again. The old version
+// stays usable, but from now on its geoFree() leaves the taken vertices
+GEO* geoReload(GEO *geo, unsigned char *data, int len) {
+
+    // Error checking
+    if (geo == NULL) {
+        loadError("Bad parameters passed to geoReload()", NULL);
+        return NULL;
+    }
+
+    return loadGeo(data, len, (GEO_EXT *) geo, 0, NULL, "geoReload");
+}
+
+// Check whether geoReload() took a model from the old version, in which
+// case its vertices are the ones the old version was drawing
+int geoReused(GEO *geo, int model) {
+    GEO_EXT *geox = (GEO_EXT *) geo;
+
+    // Error checking
+    if (geo == NULL || model < 0 || model >= geo->modelnum) return 0;
+
+    return geox->reused != NULL && geox->reused[model] != 0;
+}
+
 // Delete a GEO structure
 void geoFree(GEO *geo) {
     GEO_EXT *geox;
@@ -667,10 +1338,14 @@ void geoFree(GEO *geo) {
         return;
     }
 
-    // Delete model members
+    // Delete model members, except vertices another version took over
+    geox = (GEO_EXT *) geo;
     for (x = 0; x < geo->modelnum; x++) {
         if (geo->models[x].facenum)   free(geo->models[x].faces);
-        if (geo->models[x].vertexnum) free(geo->models[x].vertices);
+        if (geo->models[x].vertexnum &&
+            (geox->shared == NULL || !geox->shared[x]))
+            free(geo->models[x].vertices);
+        if (geo->models[x].lodnum)    free(geo->models[x].lods);
     }
 
     // Delete GEO members
@@ -678,14 +1353,73 @@ void geoFree(GEO *geo) {
     if (geo->modelnum)   free(geo->models);
 
     // Delete extended GEO members
-    geox = (GEO_EXT *) geo;
     if (geox->data != NULL) free(geox->data);
+    if (geox->hashes != NULL) free(geox->hashes);
+    if (geox->shared != NULL) free(geox->shared);
+    if (geox->reused != NULL) free(geox->reused);
+    if (geox->headers != NULL) free(geox->headers);
+    if (geox->starts != NULL) free(geox->starts);
 
     // Delete object and return
     free(geox);
     return;
 }
 
+// Delete a model created outside of a GEO structure
+void geoFreeModel(GEO_MODEL *mod) {
+
+    // Error checking
+    if (mod == NULL) {
+        if (GEO_VERBOSE)
+            printf("WARNING: Argument passed to geoFreeModel() was NULL\n");
+        return;
+    }
+
+    // Delete model members and the model itself
+    if (mod->facenum)   free(mod->faces);
+    if (mod->vertexnum) free(mod->vertices);
+    if (mod->lodnum)    free(mod->lods);
+    free(mod);
+    return;
+}
+
+// Select the level of detail to draw at a given distance
+//   current:    level drawn last time, 0 being the model itself
+//   hysteresis: fraction a distance must pass a threshold by to switch
+int geoSelectLod(GEO_LOD *lods, int lodnum, float distance, int current, 
+    float hysteresis) {
+    int level = current;
+
+    // Error checking
+    if (lods == NULL || lodnum < 1) return 0;
+    if (level < 0) level = 0;
+    if (level > lodnum) level = lodnum;
+
+    // Move to coarser levels, then back to finer ones
+    while (level < lodnum && 
+        distance > lods[level].distance * (1.0f + hysteresis))
+        level++;
+    while (level > 0 && 
+        distance < lods[level - 1].distance * (1.0f - hysteresis))
+        level--;
+
+    return level;
+}
+
+// Set the functions that open and close trace zones, NULL to disable
+void geoTrace(void (*begin)(char *), void (*end)()) {
+    GEO_TRACE_BEGIN = begin;
+    GEO_TRACE_END   = end;
+    return;
+}
+
+// Keep models whose normals can't be unpacked, with every normal zero so
+// geoNormals() regenerates them
+void geoRecover(int recover) {
+    GEO_RECOVER = recover;
+    return;
+}
+
 // Set the verbosity level
 void geoVerbose(int verbose) {
     GEO_VERBOSE = verbose;
@@ -12,12 +12,19 @@ typedef struct {
     float  s,  t;
 } GEO_VERTEX;
 
+typedef struct {
+    float distance; // Distance beyond which this level replaces the model
+    int   model;    // Index of the model drawn at this level
+} GEO_LOD;
+
 typedef struct {
     char       *id;
     int         facenum;
     GEO_FACE   *faces;
     int         vertexnum;
     GEO_VERTEX *vertices;
+    int         lodnum;
+    GEO_LOD    *lods;
 } GEO_MODEL;
 
 typedef struct {
@@ -28,8 +35,84 @@ typedef struct {
     GEO_MODEL *models;
 } GEO;
 
+typedef struct {
+    int facenum; // Number of faces the hierarchy was built over
+    int nodenum; // Number of nodes
+    int depth;   // Depth of the deepest leaf
+} GEO_BVH;
+
+// Stream kinds of a file, see GEO_STATS
+#define GEO_STREAM_META      0 // Names, textures and model headers
+#define GEO_STREAM_FACES     1
+#define GEO_STREAM_COORDS    2
+#define GEO_STREAM_NORMALS   3
+#define GEO_STREAM_TEXCOORDS 4
+#define GEO_STREAMS          5
+
+typedef struct {
+    int       version;               // Format version of the file
+    long long packed[GEO_STREAMS];   // Bytes stored of each stream kind
+    long long unpacked[GEO_STREAMS]; // Bytes once unpacked
+    int       badenums;              // Texture runs naming no texture
+} GEO_STATS;
+
+// Cache of models decoded from many files, see geoCreateCache()
+typedef struct {
+    long long budget; // Bytes the decoded models may take up
+} GEO_CACHE;
+
+// Platform functions a model cache maps files and keeps threads apart
+// with. map fills in a file's data and length, returning what destroy
+// unmaps, or NULL if the file can't be mapped
+typedef struct {
+    void* (*map)(char *, unsigned char **, long long *);
+    void* (*createLock)();
+    void* (*createCond)();
+    void  (*lock)(void *);
+    void  (*unlock)(void *);
+    void  (*wait)(void *, void *); // Waits on a cond, letting a lock go
+    void  (*broadcast)(void *);
+    void  (*destroy)(void *);      // Deletes a mapping, lock or cond
+} GEO_CACHE_HOOKS;
+
+typedef struct {
+    long long hits;      // Lookups finding the model decoded
+    long long misses;    // Lookups decoding it
+    long long waits;     // Hits that waited for another lookup to decode it
+    long long evictions; // Models dropped to stay within the budget
+    long long failures;  // Files and models that couldn't be loaded
+    long long bytes;     // Bytes the decoded models take up
+    long long budget;    // Bytes they may take up
+    int       models;    // Models held decoded
+    int       pinned;    // Models held that are looked up and not released
+} GEO_CACHE_STATS;
+
+GEO* geoAudit(unsigned char *, int, GEO_STATS *);
+float* geoBakeAO(GEO_MODEL *, int, float);
+GEO_BVH* geoBuildBvh(GEO_MODEL *);
+void geoCacheStats(GEO_CACHE *, GEO_CACHE_STATS *);
+GEO_CACHE* geoCreateCache(long long, GEO_CACHE_HOOKS *);
+GEO* geoFetchFile(GEO_CACHE *, char *);
+GEO_MODEL* geoFetchModel(GEO_CACHE *, char *, int);
 GEO* geoLoad(unsigned char *, int);
+GEO_MODEL* geoLoadModel(GEO *, int, unsigned char *, int);
+int  geoLoadStream(int (*)(void *, unsigned char *, int),
+    void (*)(void *, GEO *, int), void *);
+GEO* geoProbe(unsigned char *, int);
+GEO* geoReload(GEO *, unsigned char *, int);
 void geoFree(GEO *);
+void geoFreeBvh(GEO_BVH *);
+void geoFreeCache(GEO_CACHE *);
+void geoFreeModel(GEO_MODEL *);
+char* geoLastError();
+int  geoNormals(GEO_MODEL *, float, int);
+int  geoPick(GEO_BVH *, float *, float *, float *);
+void geoRecover(int);
+void geoReleaseModel(GEO_CACHE *, GEO_MODEL *);
+int  geoReused(GEO *, int);
+int  geoSelectLod(GEO_LOD *, int, float, int, float);
+GEO_MODEL* geoSimplify(GEO_MODEL *, float);
+void geoTrace(void (*)(char *), void (*)());
 void geoVerbose(int);
 
 #endif // __GOH_GEO__
@@ -0,0 +1,795 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tpkapi.h"
+#include "geo.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Hierarchy constants
+#define BVH_BINS   16    // Split candidates tried along an axis
+#define BVH_LEAF   4     // Faces in a leaf, one block of four
+#define BVH_DEPTH  40    // Depth past which nodes are split at the median
+#define BVH_STACK  80    // Enough for BVH_DEPTH plus a median split of 2^31
+#define BVH_EPS    1e-9f // Smallest determinant or distance that is a hit
+#define BVH_JOB    65536 // Faces under a node before half of it is a job
+
+// Ambient occlusion constants
+#define AO_PACKET  4     // Rays traced together, one per lane
+#define AO_GRAIN   64    // Vertices baked per parallel range
+#define AO_REACH   0.25f // Default occlusion distance, in bounding diagonals
+#define AO_OFFSET  1e-4f // Ray start above the surface, in bounding diagonals
+#define AO_NUDGE   0.01f // Ray start in over the faces, in face sizes
+#define AO_GOLDEN  2.39996323f // Golden angle, spreads the rays around
+
+// Node of the hierarchy, children are next to each other
+typedef struct {
+    float bmin[3], bmax[3]; // Bounds of everything below
+    int   left;             // First child, or the block of a leaf
+    int   count;            // Faces in a leaf, 0 for an inner node
+} BVH_NODE;
+
+// Four faces of a leaf, laid out a lane per face
+typedef struct {
+    float v0[3][4];         // First corner
+    float e1[3][4];         // Edge to the second corner
+    float e2[3][4];         // Edge to the third corner
+    int   face[4];          // Index of the face, -1 for an empty lane
+} BVH_BLOCK;
+
+// Face as the build sorts it
+typedef struct {
+    float bmin[3], bmax[3]; // Bounds of the face
+    int   face;             // Index of the face
+} BVH_REF;
+
+// Bounds of some faces and of their centers, the centers doubled
+typedef struct {
+    float bmin[3], bmax[3];
+    float cmin[3], cmax[3];
+} BVH_BOUNDS;
+
+// Bounds and count of the faces falling in a bin
+typedef struct {
+    float bmin[3], bmax[3];
+    int   count;
+} BVH_BIN;
+
+// Extended hierarchy information
+typedef struct {
+    GEO_BVH    bvh;
+    BVH_NODE  *nodes;
+    BVH_BLOCK *blocks;
+} BVH_EXT;
+
+// Working state of one build
+typedef struct {
+    GEO_MODEL *mod;
+    BVH_REF   *refs;        // Faces in the order the leaves take them
+    BVH_NODE  *nodes;
+    volatile int nodenum;
+    BVH_BLOCK *blocks;
+    volatile int blocknum;  // Leaves, one block each
+} BVH_BUILD;
+
+// Subtree built as a job
+typedef struct {
+    BVH_BUILD *b;
+    int        index, first, count, depth;
+    BVH_BOUNDS bounds;
+    int        maxdepth;    // Depth of its deepest leaf
+} BVH_TASK;
+
+// Rays sharing an origin, laid out a lane per ray
+typedef struct {
+    float org[3];
+    float dir[3][4];
+    float inv[3][4];        // Reciprocals of dir for the slab tests
+    float far;              // Distance past which nothing occludes
+} AO_RAYS;
+
+// Working state of one bake
+typedef struct {
+    GEO_MODEL *mod;
+    BVH_EXT   *bvhx;
+    float     *ao;          // Result, one value per vertex
+    int        rays;
+    float      reach;       // Distance past which nothing occludes
+    float      offset;      // Ray start above the surface
+    float     *nudge;       // Ray start in over the faces, per vertex
+} AO_WORK;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Grows a box to take in another
+static void growBox(float *bmin, float *bmax, float *omin, float *omax) {
+    int x;
+
+    for (x = 0; x < 3; x++) {
+        if (omin[x] < bmin[x]) bmin[x] = omin[x];
+        if (omax[x] > bmax[x]) bmax[x] = omax[x];
+    }
+    return;
+}
+
+// Resets a box so that anything grows it
+static void emptyBox(float *bmin, float *bmax) {
+    bmin[0] = bmin[1] = bmin[2] =  3.0e38f;
+    bmax[0] = bmax[1] = bmax[2] = -3.0e38f;
+    return;
+}
+
+// Grows bounds to take in a face
+static void growBounds(BVH_BOUNDS *bounds, BVH_REF *ref) {
+    float c;
+    int x;
+
+    for (x = 0; x < 3; x++) {
+        if (ref->bmin[x] < bounds->bmin[x]) bounds->bmin[x] = ref->bmin[x];
+        if (ref->bmax[x] > bounds->bmax[x]) bounds->bmax[x] = ref->bmax[x];
+        c = ref->bmin[x] + ref->bmax[x];
+        if (c < bounds->cmin[x]) bounds->cmin[x] = c;
+        if (c > bounds->cmax[x]) bounds->cmax[x] = c;
+    }
+    return;
+}
+
+// Measures a range of faces
+static void measureRefs(BVH_BUILD *b, int first, int count,
+    BVH_BOUNDS *bounds) {
+    int x;
+
+    emptyBox(bounds->bmin, bounds->bmax);
+    emptyBox(bounds->cmin, bounds->cmax);
+    for (x = first; x < first + count; x++) growBounds(bounds, &b->refs[x]);
+    return;
+}
+
+// Half the surface area of a box, which is all SAH compares
+static float boxArea(float *bmin, float *bmax) {
+    float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1];
+    float dz = bmax[2] - bmin[2];
+
+    if (dx < 0.0f) return 0.0f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Measures every face once before the build
+static void measureFaces(BVH_BUILD *b) {
+    GEO_VERTEX *v = b->mod->vertices, *p[3];
+    BVH_REF *ref;
+    GEO_FACE *f;
+    int x, y;
+
+    for (x = 0; x < b->mod->facenum; x++) {
+        f = &b->mod->faces[x];
+        ref = &b->refs[x];
+        p[0] = &v[f->v1]; p[1] = &v[f->v2]; p[2] = &v[f->v3];
+        emptyBox(ref->bmin, ref->bmax);
+        for (y = 0; y < 3; y++) growBox(ref->bmin, ref->bmax, &p[y]->x,
+            &p[y]->x);
+        ref->face = x;
+    }
+
+    return;
+}
+
+// Finds the best binned SAH split of a node's faces and partitions them,
+// measuring both sides. Returns how many go left, or 0 if none is any good
+static int splitNode(BVH_BUILD *b, int first, int count, int depth,
+    BVH_BOUNDS *in, BVH_BOUNDS *kids) {
+    BVH_BIN bins[BVH_BINS];
+    float lmin[3], lmax[3], larea[BVH_BINS], scale, cost, best = 3.0e38f;
+    int x, y, axis, bin, split = -1, lcount[BVH_BINS], n;
+    BVH_REF *ref, tmp;
+
+    // Split along the longest extent of the centers
+    for (axis = 0, x = 1; x < 3; x++)
+        if (in->cmax[x] - in->cmin[x] > in->cmax[axis] - in->cmin[axis])
+            axis = x;
+    if (!(in->cmax[axis] > in->cmin[axis]) || depth >= BVH_DEPTH)
+        return 0;
+    scale = BVH_BINS * 0.9999f / (in->cmax[axis] - in->cmin[axis]);
+
+    // Bin the faces
+    for (x = 0; x < BVH_BINS; x++) {
+        emptyBox(bins[x].bmin, bins[x].bmax);
+        bins[x].count = 0;
+    }
+    for (x = first; x < first + count; x++) {
+        ref = &b->refs[x];
+        bin = (int) ((ref->bmin[axis] + ref->bmax[axis] - in->cmin[axis]) *
+            scale);
+        if (bin < 0) bin = 0;
+        if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+        growBox(bins[bin].bmin, bins[bin].bmax, ref->bmin, ref->bmax);
+        bins[bin].count++;
+    }
+
+    // Sweep from the left, then from the right costing each split
+    emptyBox(lmin, lmax);
+    for (x = n = 0; x < BVH_BINS - 1; x++) {
+        growBox(lmin, lmax, bins[x].bmin, bins[x].bmax);
+        n += bins[x].count;
+        larea[x] = boxArea(lmin, lmax);
+        lcount[x] = n;
+    }
+    emptyBox(lmin, lmax);
+    for (x = BVH_BINS - 1, n = 0; x > 0; x--) {
+        growBox(lmin, lmax, bins[x].bmin, bins[x].bmax);
+        n += bins[x].count;
+        if (!n || !lcount[x - 1]) continue;
+        cost = larea[x - 1] * lcount[x - 1] + boxArea(lmin, lmax) * n;
+        if (cost < best) { best = cost; split = x; }
+    }
+    if (split < 0) return 0;
+
+    // Move the faces of the left bins to the front, measuring each side
+    measureRefs(b, 0, 0, &kids[0]);
+    measureRefs(b, 0, 0, &kids[1]);
+    for (x = first, y = first + count - 1; x <= y; ) {
+        ref = &b->refs[x];
+        bin = (int) ((ref->bmin[axis] + ref->bmax[axis] - in->cmin[axis]) *
+            scale);
+        if (bin < split) {
+            growBounds(&kids[0], ref);
+            x++;
+            continue;
+        }
+        growBounds(&kids[1], ref);
+        tmp = *ref; *ref = b->refs[y]; b->refs[y--] = tmp;
+    }
+    return x - first;
+}
+
+// Copies the faces of a leaf into its block
+static void fillBlock(BVH_BUILD *b, BVH_BLOCK *block, int first, int count) {
+    GEO_VERTEX *v = b->mod->vertices, *p0, *p1, *p2;
+    GEO_FACE *f;
+    int x, y;
+
+    memset(block, 0, sizeof(BVH_BLOCK));
+    for (x = 0; x < 4; x++) {
+        block->face[x] = -1;
+        if (x >= count) continue;
+        block->face[x] = b->refs[first + x].face;
+        f = &b->mod->faces[block->face[x]];
+        p0 = &v[f->v1]; p1 = &v[f->v2]; p2 = &v[f->v3];
+        for (y = 0; y < 3; y++) {
+            block->v0[y][x] = (&p0->x)[y];
+            block->e1[y][x] = (&p1->x)[y] - (&p0->x)[y];
+            block->e2[y][x] = (&p2->x)[y] - (&p0->x)[y];
+        }
+    }
+
+    return;
+}
+
+// Gives every leaf a block of its faces, once the number of leaves is known
+static int fillBlocks(BVH_BUILD *b) {
+    BVH_NODE *node;
+    int x;
+
+    b->blocks = malloc(b->blocknum * sizeof(BVH_BLOCK));
+    if (b->blocks == NULL) return 1;
+    for (x = b->blocknum = 0; x < b->nodenum; x++) {
+        node = &b->nodes[x];
+        if (!node->count) continue;
+        fillBlock(b, &b->blocks[b->blocknum], node->left, node->count);
+        node->left = b->blocknum++;
+    }
+
+    return 0;
+}
+
+static int buildNode(BVH_BUILD *, int, int, int, BVH_BOUNDS *, int);
+
+// Builds a subtree, run as a job
+static void buildTask(void *param) {
+    BVH_TASK *task = param;
+
+    task->maxdepth = buildNode(task->b, task->index, task->first,
+        task->count, &task->bounds, task->depth);
+    return;
+}
+
+// Builds the node over a range of faces and everything below it, returning
+// the depth of its deepest leaf
+static int buildNode(BVH_BUILD *b, int index, int first, int count,
+    BVH_BOUNDS *bounds, int depth) {
+    BVH_NODE *node = &b->nodes[index];
+    BVH_BOUNDS kids[2];
+    BVH_TASK task;
+    TPK_JOB *job;
+    int left, right;
+
+    memcpy(node->bmin, bounds->bmin, sizeof(node->bmin));
+    memcpy(node->bmax, bounds->bmax, sizeof(node->bmax));
+
+    // Small enough for a leaf, which keeps its first face until it's given
+    // a block
+    if (count <= BVH_LEAF) {
+        node->left = first;
+        node->count = count;
+        tpkAtomicAdd(&b->blocknum, 1);
+        return depth;
+    }
+
+    // Split by SAH, or down the middle of the list when nothing separates
+    left = splitNode(b, first, count, depth, bounds, kids);
+    if (left <= 0 || left >= count) {
+        left = count / 2;
+        measureRefs(b, first, left, &kids[0]);
+        measureRefs(b, first + left, count - left, &kids[1]);
+    }
+    node->left = tpkAtomicAdd(&b->nodenum, 2) - 2;
+    node->count = 0;
+
+    // Large halves are built on another thread while this one does the rest
+    task.b = b;
+    task.index = node->left;
+    task.first = first;
+    task.count = left;
+    task.depth = depth + 1;
+    task.bounds = kids[0];
+    job = (left >= BVH_JOB) ? tpkJobCreate(buildTask, &task, NULL) : NULL;
+    if (job != NULL) tpkJobRun(job);
+    else buildTask(&task);
+    right = buildNode(b, node->left + 1, first + left, count - left,
+        &kids[1], depth + 1);
+    if (job != NULL) tpkJobWait(job);
+    return (task.maxdepth > right) ? task.maxdepth : right;
+}
+
+// Distance at which a ray enters a box, or -1 if it misses it before far
+static float enterBox(BVH_NODE *node, float *org, float *inv, float far) {
+    float t0, t1, near = 0.0f, tmp;
+    int x;
+
+    for (x = 0; x < 3; x++) {
+        t0 = (node->bmin[x] - org[x]) * inv[x];
+        t1 = (node->bmax[x] - org[x]) * inv[x];
+        if (t0 > t1) { tmp = t0; t0 = t1; t1 = tmp; }
+        if (t0 > near) near = t0;
+        if (t1 < far) far = t1;
+        if (!(near <= far)) return -1.0f;
+    }
+
+    return near;
+}
+
+// Tests a ray against the four faces of a block, Moller-Trumbore in four
+// lanes. Returns the lane of the nearest hit before *dist, or -1
+static int hitBlock(BVH_BLOCK *blk, float *org, float *dir, float *dist) {
+    int x, lane = -1;
+
+#ifdef __SSE2__
+    __m128 dx, dy, dz, px, py, pz, tx, ty, tz, qx, qy, qz, det, inv;
+    __m128 u, v, t, hit, e1x, e1y, e1z, e2x, e2y, e2z, zero, one;
+    float ts[4];
+    int mask;
+
+    zero = _mm_setzero_ps();
+    one = _mm_set1_ps(1.0f);
+    dx = _mm_set1_ps(dir[0]); dy = _mm_set1_ps(dir[1]);
+    dz = _mm_set1_ps(dir[2]);
+    e1x = _mm_loadu_ps(blk->e1[0]); e1y = _mm_loadu_ps(blk->e1[1]);
+    e1z = _mm_loadu_ps(blk->e1[2]);
+    e2x = _mm_loadu_ps(blk->e2[0]); e2y = _mm_loadu_ps(blk->e2[1]);
+    e2z = _mm_loadu_ps(blk->e2[2]);
+
+    // p = d x e2, det = e1 . p
+    px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+        _mm_mul_ps(e1z, pz));
+    inv = _mm_div_ps(one, det);
+
+    // u = (o - v0) . p / det
+    tx = _mm_sub_ps(_mm_set1_ps(org[0]), _mm_loadu_ps(blk->v0[0]));
+    ty = _mm_sub_ps(_mm_set1_ps(org[1]), _mm_loadu_ps(blk->v0[1]));
+    tz = _mm_sub_ps(_mm_set1_ps(org[2]), _mm_loadu_ps(blk->v0[2]));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px),
+        _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv);
+
+    // q = (o - v0) x e1, v = d . q / det, t = e2 . q / det
+    qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+        _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+        _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+    // Either side of a face counts, empty lanes have no determinant
+    hit = _mm_or_ps(_mm_cmpgt_ps(det, _mm_set1_ps(BVH_EPS)),
+        _mm_cmplt_ps(det, _mm_set1_ps(-BVH_EPS)));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, _mm_set1_ps(BVH_EPS)));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(*dist)));
+    mask = _mm_movemask_ps(hit);
+    if (!mask) return -1;
+    _mm_storeu_ps(ts, t);
+    for (x = 0; x < 4; x++) {
+        if (!(mask & (1 << x)) || ts[x] >= *dist) continue;
+        *dist = ts[x];
+        lane = x;
+    }
+#else
+    float p[3], s[3], q[3], det, inv, u, v, t;
+
+    for (x = 0; x < 4; x++) {
+        p[0] = dir[1] * blk->e2[2][x] - dir[2] * blk->e2[1][x];
+        p[1] = dir[2] * blk->e2[0][x] - dir[0] * blk->e2[2][x];
+        p[2] = dir[0] * blk->e2[1][x] - dir[1] * blk->e2[0][x];
+        det = blk->e1[0][x] * p[0] + blk->e1[1][x] * p[1] +
+            blk->e1[2][x] * p[2];
+        if (det > -BVH_EPS && det < BVH_EPS) continue;
+        inv = 1.0f / det;
+        s[0] = org[0] - blk->v0[0][x];
+        s[1] = org[1] - blk->v0[1][x];
+        s[2] = org[2] - blk->v0[2][x];
+        u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+        if (u < 0.0f || u > 1.0f) continue;
+        q[0] = s[1] * blk->e1[2][x] - s[2] * blk->e1[1][x];
+        q[1] = s[2] * blk->e1[0][x] - s[0] * blk->e1[2][x];
+        q[2] = s[0] * blk->e1[1][x] - s[1] * blk->e1[0][x];
+        v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv;
+        if (v < 0.0f || u + v > 1.0f) continue;
+        t = (blk->e2[0][x] * q[0] + blk->e2[1][x] * q[1] +
+            blk->e2[2][x] * q[2]) * inv;
+        if (t <= BVH_EPS || t >= *dist) continue;
+        *dist = t;
+        lane = x;
+    }
+#endif
+
+    return lane;
+}
+
+// Lanes of a packet entering a box before its far distance, as a bit mask
+static int enterPacket(BVH_NODE *node, AO_RAYS *p, int live) {
+    int x;
+
+#ifdef __SSE2__
+    __m128 near, far, t0, t1, inv;
+
+    near = _mm_setzero_ps();
+    far = _mm_set1_ps(p->far);
+    for (x = 0; x < 3; x++) {
+        inv = _mm_loadu_ps(p->inv[x]);
+        t0 = _mm_mul_ps(_mm_set1_ps(node->bmin[x] - p->org[x]), inv);
+        t1 = _mm_mul_ps(_mm_set1_ps(node->bmax[x] - p->org[x]), inv);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+    }
+    return live & _mm_movemask_ps(_mm_cmple_ps(near, far));
+#else
+    float near, far, t0, t1, tmp;
+    int y, mask = 0;
+
+    for (x = 0; x < AO_PACKET; x++) {
+        if (!(live & (1 << x))) continue;
+        near = 0.0f;
+        far = p->far;
+        for (y = 0; y < 3 && near <= far; y++) {
+            t0 = (node->bmin[y] - p->org[y]) * p->inv[y][x];
+            t1 = (node->bmax[y] - p->org[y]) * p->inv[y][x];
+            if (t0 > t1) { tmp = t0; t0 = t1; t1 = tmp; }
+            if (t0 > near) near = t0;
+            if (t1 < far) far = t1;
+        }
+        if (near <= far) mask |= 1 << x;
+    }
+    return mask;
+#endif
+}
+
+// Lanes of a packet hitting any face of a block, as a bit mask
+static int hitPacket(BVH_BLOCK *blk, AO_RAYS *p, int live) {
+    float dir[3], dist;
+    int x, mask = 0;
+
+    for (x = 0; x < AO_PACKET; x++) {
+        if (!(live & (1 << x))) continue;
+        dir[0] = p->dir[0][x]; dir[1] = p->dir[1][x]; dir[2] = p->dir[2][x];
+        dist = p->far;
+        if (hitBlock(blk, p->org, dir, &dist) >= 0) mask |= 1 << x;
+    }
+    return mask;
+}
+
+// Lanes of a packet that hit a face before its far distance, as a bit mask.
+// Any hit will do, so a lane drops out of the traversal at its first one
+static int occludePacket(BVH_EXT *bvhx, AO_RAYS *p, int live) {
+    int stack[BVH_STACK], masks[BVH_STACK], top = 0, hits = 0, mask, x;
+    BVH_NODE *node;
+
+    mask = enterPacket(bvhx->nodes, p, live);
+    if (!mask) return 0;
+
+    // Each node carries the lanes that entered it
+    stack[top] = 0;
+    masks[top++] = mask;
+    while (top) {
+        node = &bvhx->nodes[stack[--top]];
+        mask = masks[top] & ~hits;
+        if (!mask) continue;
+        if (node->count) {
+            hits |= hitPacket(&bvhx->blocks[node->left], p, mask);
+            if (hits == live) break;
+            continue;
+        }
+        for (x = 0; x < 2; x++) {
+            masks[top] = enterPacket(&bvhx->nodes[node->left + x], p, mask);
+            if (masks[top]) stack[top++] = node->left + x;
+        }
+    }
+
+    return hits;
+}
+
+// Points each vertex a little toward the middle of the faces using it. It
+// cancels out inside a surface, but moves vertices along a hard crease off
+// the faces on the other side, which would otherwise pass through them
+static float* nudgeVertices(GEO_MODEL *mod) {
+    GEO_VERTEX *v[3];
+    float *nudge, c;
+    int *count, x, y, z;
+
+    nudge = calloc(mod->vertexnum * 3, sizeof(float));
+    count = calloc(mod->vertexnum, sizeof(int));
+    if (nudge == NULL || count == NULL) {
+        free(nudge);
+        free(count);
+        return NULL;
+    }
+
+    // Add up the way to each face's center
+    for (x = 0; x < mod->facenum; x++) {
+        v[0] = &mod->vertices[mod->faces[x].v1];
+        v[1] = &mod->vertices[mod->faces[x].v2];
+        v[2] = &mod->vertices[mod->faces[x].v3];
+        for (y = 0; y < 3; y++) {
+            z = (int) (v[y] - mod->vertices);
+            c = (v[0]->x + v[1]->x + v[2]->x) / 3.0f;
+            nudge[z * 3]     += c - v[y]->x;
+            c = (v[0]->y + v[1]->y + v[2]->y) / 3.0f;
+            nudge[z * 3 + 1] += c - v[y]->y;
+            c = (v[0]->z + v[1]->z + v[2]->z) / 3.0f;
+            nudge[z * 3 + 2] += c - v[y]->z;
+            count[z]++;
+        }
+    }
+
+    for (x = 0; x < mod->vertexnum; x++) {
+        if (!count[x]) continue;
+        for (y = 0; y < 3; y++) nudge[x * 3 + y] *= AO_NUDGE / count[x];
+    }
+    free(count);
+    return nudge;
+}
+
+// Bakes a range of vertices, run by tpkParallelFor()
+static void bakeRange(AO_WORK *w, int first, int last) {
+    float n[3], t[3], s[3], len, sign, a, b, spin, r, phi, lx, ly, lz, d;
+    int x, y, z, k, i, live, mask, hits;
+    unsigned int h;
+    GEO_VERTEX *v;
+    AO_RAYS p;
+
+    for (x = first; x < last; x++) {
+        v = &w->mod->vertices[x];
+        len = (float) sqrt(v->nx * v->nx + v->ny * v->ny + v->nz * v->nz);
+        if (!(len > 1e-12f)) {
+            w->ao[x] = 1.0f;
+            continue;
+        }
+        n[0] = v->nx / len; n[1] = v->ny / len; n[2] = v->nz / len;
+
+        // Tangents around the normal, without a branch on its direction
+        sign = (n[2] >= 0.0f) ? 1.0f : -1.0f;
+        a = -1.0f / (sign + n[2]);
+        b = n[0] * n[1] * a;
+        t[0] = 1.0f + sign * n[0] * n[0] * a; t[1] = sign * b;
+        t[2] = -sign * n[0];
+        s[0] = b; s[1] = sign + n[1] * n[1] * a; s[2] = -n[1];
+
+        // Rays start just above the surface, so it doesn't occlude itself,
+        // and a little in over its faces, off the other side of a crease
+        p.org[0] = v->x + n[0] * w->offset + w->nudge[x * 3];
+        p.org[1] = v->y + n[1] * w->offset + w->nudge[x * 3 + 1];
+        p.org[2] = v->z + n[2] * w->offset + w->nudge[x * 3 + 2];
+        p.far = w->reach;
+
+        // Neighbouring vertices turn the spiral differently, which trades
+        // banding for noise
+        h = (unsigned int) x * 2654435761u;
+        h ^= h >> 15;
+        spin = h * 1.46291808e-9f;
+
+        // Points spread evenly over a disk, raised onto the hemisphere,
+        // are cosine distributed
+        for (y = hits = 0; y < w->rays; y += AO_PACKET) {
+            for (z = live = 0; z < AO_PACKET; z++) {
+                i = (y + z < w->rays) ? y + z : w->rays - 1;
+                if (y + z < w->rays) live |= 1 << z;
+                r = (float) sqrt((i + 0.5f) / w->rays);
+                phi = i * AO_GOLDEN + spin;
+                lx = r * (float) cos(phi);
+                ly = r * (float) sin(phi);
+                lz = (float) sqrt(1.0f - ((r < 1.0f) ? r * r : 1.0f));
+                for (k = 0; k < 3; k++) {
+                    d = t[k] * lx + s[k] * ly + n[k] * lz;
+                    p.dir[k][z] = d;
+                    if (d > 1e-30f || d < -1e-30f) p.inv[k][z] = 1.0f / d;
+                    else p.inv[k][z] = (d < 0.0f) ? -1e30f : 1e30f;
+                }
+            }
+            mask = occludePacket(w->bvhx, &p, live);
+            for (z = 0; z < AO_PACKET; z++) hits += (mask >> z) & 1;
+        }
+
+        w->ao[x] = 1.0f - (float) hits / w->rays;
+    }
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Build a bounding volume hierarchy over a model's faces for ray picking
+//   The faces are copied into the hierarchy, the model may change or go
+//   away afterwards without affecting it
+GEO_BVH* geoBuildBvh(GEO_MODEL *mod) {
+    BVH_BOUNDS bounds;
+    BVH_BUILD b;
+    BVH_EXT *bvhx;
+    int err, depth;
+
+    // Error checking
+    if (mod == NULL || mod->facenum < 1 || mod->vertexnum < 1) return NULL;
+
+    // A leaf has at least one face and every inner node two children
+    memset(&b, 0, sizeof(BVH_BUILD));
+    b.mod = mod;
+    b.refs = malloc(mod->facenum * sizeof(BVH_REF));
+    b.nodes = malloc(mod->facenum * 2 * sizeof(BVH_NODE));
+    if (b.refs == NULL || b.nodes == NULL) {
+        free(b.refs);
+        free(b.nodes);
+        return NULL;
+    }
+
+    measureFaces(&b);
+    measureRefs(&b, 0, mod->facenum, &bounds);
+    b.nodenum = 1;
+    depth = buildNode(&b, 0, 0, mod->facenum, &bounds, 0);
+    err = fillBlocks(&b);
+    free(b.refs);
+    if (err) {
+        free(b.nodes);
+        return NULL;
+    }
+
+    // Give back what the bound on the nodes reserved
+    bvhx = calloc(1, sizeof(BVH_EXT));
+    bvhx->nodes = realloc(b.nodes, b.nodenum * sizeof(BVH_NODE));
+    bvhx->blocks = b.blocks;
+    bvhx->bvh.facenum = mod->facenum;
+    bvhx->bvh.nodenum = b.nodenum;
+    bvhx->bvh.depth = depth;
+    return (GEO_BVH *) bvhx;
+}
+
+// Free a bounding volume hierarchy
+void geoFreeBvh(GEO_BVH *bvh) {
+    BVH_EXT *bvhx = (BVH_EXT *) bvh;
+
+    if (bvh == NULL) return;
+    free(bvhx->nodes);
+    free(bvhx->blocks);
+    free(bvhx);
+    return;
+}
+
+// Find the nearest face a ray hits, in the model's coordinates
+//   *dist is how far along dir to look on the way in, and how far along
+//   the hit was on the way out. Returns the face, or -1 if there's none
+int geoPick(GEO_BVH *bvh, float *org, float *dir, float *dist) {
+    BVH_EXT *bvhx = (BVH_EXT *) bvh;
+    int stack[BVH_STACK], top = 0, x, lane, face = -1;
+    float inv[3], far, near0, near1;
+    BVH_NODE *node, *child;
+
+    // Error checking
+    if (bvh == NULL || org == NULL || dir == NULL || dist == NULL) return -1;
+    far = *dist;
+
+    // Axes the ray runs along never reach the slabs across them
+    for (x = 0; x < 3; x++) {
+        if (dir[x] > 1e-30f || dir[x] < -1e-30f) inv[x] = 1.0f / dir[x];
+        else inv[x] = (dir[x] < 0.0f) ? -1e30f : 1e30f;
+    }
+    if (enterBox(bvhx->nodes, org, inv, far) < 0.0f) return -1;
+
+    // Nearer child first, so farther ones are mostly culled by the hit
+    stack[top++] = 0;
+    while (top) {
+        node = &bvhx->nodes[stack[--top]];
+        if (node->count) {
+            lane = hitBlock(&bvhx->blocks[node->left], org, dir, &far);
+            if (lane >= 0) face = bvhx->blocks[node->left].face[lane];
+            continue;
+        }
+        child = &bvhx->nodes[node->left];
+        near0 = enterBox(child, org, inv, far);
+        near1 = enterBox(child + 1, org, inv, far);
+        if (near0 >= 0.0f && near1 >= 0.0f) {
+            stack[top++] = (near0 <= near1) ? node->left + 1 : node->left;
+            stack[top++] = (near0 <= near1) ? node->left : node->left + 1;
+        } else if (near0 >= 0.0f) stack[top++] = node->left;
+        else if (near1 >= 0.0f) stack[top++] = node->left + 1;
+    }
+
+    if (face >= 0) *dist = far;
+    return face;
+}
+
+// Bake ambient occlusion into a value per vertex, by tracing cosine
+// distributed rays over the hemisphere around each normal
+//   rays:     rays per vertex, traced in packets of four
+//   distance: how far away faces still occlude, <= 0 uses a quarter of the
+//             model's bounding diagonal
+//   Returns vertexnum values to free(), from 0 for fully occluded to 1 for
+//   open, or NULL on failure. Vertices without a normal are left open
+float* geoBakeAO(GEO_MODEL *mod, int rays, float distance) {
+    BVH_NODE *root;
+    AO_WORK w;
+    float diag;
+
+    // Error checking
+    if (mod == NULL || mod->facenum < 1 || mod->vertexnum < 1) return NULL;
+    if (rays < 1) return NULL;
+
+    // The faces are copied into the hierarchy, the model isn't touched
+    w.bvhx = (BVH_EXT *) geoBuildBvh(mod);
+    if (w.bvhx == NULL) return NULL;
+    w.ao = malloc(mod->vertexnum * sizeof(float));
+    w.nudge = nudgeVertices(mod);
+    if (w.ao == NULL || w.nudge == NULL) {
+        geoFreeBvh((GEO_BVH *) w.bvhx);
+        free(w.ao);
+        free(w.nudge);
+        return NULL;
+    }
+
+    // Distances scale with the model
+    root = w.bvhx->nodes;
+    diag = (float) sqrt((root->bmax[0] - root->bmin[0]) *
+        (root->bmax[0] - root->bmin[0]) + (root->bmax[1] - root->bmin[1]) *
+        (root->bmax[1] - root->bmin[1]) + (root->bmax[2] - root->bmin[2]) *
+        (root->bmax[2] - root->bmin[2]));
+    w.mod = mod;
+    w.rays = rays;
+    w.reach = (distance > 0.0f) ? distance : diag * AO_REACH;
+    w.offset = diag * AO_OFFSET;
+
+    tpkParallelFor(bakeRange, &w, mod->vertexnum, AO_GRAIN);
+    geoFreeBvh((GEO_BVH *) w.bvhx);
+    free(w.nudge);
+    return w.ao;
+}
@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "geo.h"
+
+// Cache constants
+#define CACHE_BUCKETS 256 // Hash buckets to start with, doubled as needed
+
+// Load states of files and models
+#define CACHE_LOADING 0 // A thread is loading it, the others wait for it
+#define CACHE_READY   1
+#define CACHE_FAILED  2 // Couldn't be loaded, lookups fail without retrying
+
+// File whose models are cached
+typedef struct CACHE_FILE_ {
+    char         *path;
+    unsigned int  hash;
+    GEO          *geo;                // Probed meta stream, no geometry
+    int           state;
+    struct CACHE_FILE_ *chain;        // Next file in the same bucket
+} CACHE_FILE;
+
+// Model of a file, the model first so geoReleaseModel() finds the rest
+typedef struct CACHE_ENTRY_ {
+    GEO_MODEL     mod;
+    CACHE_FILE   *file;
+    int           model;              // Index of the model in the file
+    int           state;
+    int           pins;               // Lookups that haven't released it
+    int           used;               // Looked up since the hand passed
+    long long     bytes;              // Memory taken up once decoded
+    struct CACHE_ENTRY_ *chain;       // Next entry in the same bucket
+    struct CACHE_ENTRY_ *prev, *next; // Neighbours around the clock
+} CACHE_ENTRY;
+
+// Extended cache information
+typedef struct {
+    GEO_CACHE        cache;
+    GEO_CACHE_HOOKS  hooks;           // Platform functions it runs on
+    void            *lock;
+    void            *done;            // Broadcast whenever a load finishes
+    CACHE_FILE     **files;
+    int              filenum;
+    int              filebuckets;
+    CACHE_ENTRY    **entries;
+    int              entrynum;
+    int              entrybuckets;
+    CACHE_ENTRY     *hand;            // Next decoded model to look at
+    GEO_CACHE_STATS  stats;
+} CACHE_EXT;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Hashes a path
+static unsigned int hashPath(char *path) {
+    unsigned int hash = 2166136261U;
+
+    for ( ; *path; path++) hash = (hash ^ (unsigned char) *path) * 16777619U;
+    return hash;
+}
+
+// Hashes a model of a file
+static unsigned int hashEntry(CACHE_FILE *file, int model) {
+    return file->hash ^ ((unsigned int) model * 2654435761U);
+}
+
+// Memory a decoded model takes up, counting its entry
+static long long modelBytes(GEO_MODEL *mod) {
+    return (long long) sizeof(CACHE_ENTRY) +
+        (long long) mod->facenum * sizeof(GEO_FACE) +
+        (long long) mod->vertexnum * sizeof(GEO_VERTEX) +
+        (long long) mod->lodnum * sizeof(GEO_LOD);
+}
+
+// Doubles the buckets of the file table
+static void growFiles(CACHE_EXT *cx) {
+    CACHE_FILE **files, *file, *chain;
+    int x, buckets = cx->filebuckets * 2;
+
+    files = calloc(buckets, sizeof(CACHE_FILE *));
+    if (files == NULL) return;
+    for (x = 0; x < cx->filebuckets; x++) {
+        for (file = cx->files[x]; file != NULL; file = chain) {
+            chain = file->chain;
+            file->chain = files[file->hash & (buckets - 1)];
+            files[file->hash & (buckets - 1)] = file;
+        }
+    }
+    free(cx->files);
+    cx->files = files;
+    cx->filebuckets = buckets;
+    return;
+}
+
+// Doubles the buckets of the model table
+static void growEntries(CACHE_EXT *cx) {
+    CACHE_ENTRY **entries, *entry, *chain;
+    int x, y, buckets = cx->entrybuckets * 2;
+
+    entries = calloc(buckets, sizeof(CACHE_ENTRY *));
+    if (entries == NULL) return;
+    for (x = 0; x < cx->entrybuckets; x++) {
+        for (entry = cx->entries[x]; entry != NULL; entry = chain) {
+            chain = entry->chain;
+            y = hashEntry(entry->file, entry->model) & (buckets - 1);
+            entry->chain = entries[y];
+            entries[y] = entry;
+        }
+    }
+    free(cx->entries);
+    cx->entries = entries;
+    cx->entrybuckets = buckets;
+    return;
+}
+
+// Finds the model of a file, NULL if it hasn't been looked up
+static CACHE_ENTRY* findEntry(CACHE_EXT *cx, CACHE_FILE *file, int model) {
+    CACHE_ENTRY *entry;
+
+    entry = cx->entries[hashEntry(file, model) & (cx->entrybuckets - 1)];
+    for ( ; entry != NULL; entry = entry->chain)
+        if (entry->file == file && entry->model == model) return entry;
+    return NULL;
+}
+
+// Puts a decoded model on the clock, just behind the hand so it's the last
+// to be looked at
+static void linkEntry(CACHE_EXT *cx, CACHE_ENTRY *entry) {
+    if (cx->hand == NULL) {
+        entry->prev = entry->next = entry;
+        cx->hand = entry;
+        return;
+    }
+    entry->next = cx->hand;
+    entry->prev = cx->hand->prev;
+    entry->prev->next = entry;
+    cx->hand->prev = entry;
+    return;
+}
+
+// Drops a decoded model from the cache
+static void dropEntry(CACHE_EXT *cx, CACHE_ENTRY *entry) {
+    CACHE_ENTRY **link;
+
+    // Take it off the clock
+    if (entry->next == entry) cx->hand = NULL;
+    else {
+        if (cx->hand == entry) cx->hand = entry->next;
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+    }
+
+    // Take it out of its bucket
+    link = &cx->entries[hashEntry(entry->file, entry->model) &
+        (cx->entrybuckets - 1)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    cx->entrynum--;
+
+    // Delete it
+    cx->stats.bytes -= entry->bytes;
+    cx->stats.models--;
+    if (entry->mod.facenum)   free(entry->mod.faces);
+    if (entry->mod.vertexnum) free(entry->mod.vertices);
+    if (entry->mod.lodnum)    free(entry->mod.lods);
+    free(entry);
+    return;
+}
+
+// Drops models nobody is using until the rest fit the budget. Each one
+// the hand passes gets a second chance if it was looked up since it last
+// came by, so two turns are enough to find every model that can go
+static void evictModels(CACHE_EXT *cx) {
+    CACHE_ENTRY *entry;
+    int steps;
+
+    steps = cx->stats.models * 2;
+    for ( ; cx->stats.bytes > cx->cache.budget && cx->hand != NULL &&
+        steps > 0; steps--) {
+        entry = cx->hand;
+        cx->hand = entry->next;
+        if (entry->pins) continue;
+        if (entry->used) {
+            entry->used = 0;
+            continue;
+        }
+        dropEntry(cx, entry);
+        cx->stats.evictions++;
+    }
+    return;
+}
+
+// Finds a file, probing it the first time it's looked up. Called and
+// returns with the lock held, but lets it go while probing. Returns NULL
+// if the file couldn't be read
+static CACHE_FILE* getFile(CACHE_EXT *cx, char *path) {
+    unsigned int hash = hashPath(path);
+    CACHE_FILE *file;
+    unsigned char *data;
+    long long length;
+    GEO *geo = NULL;
+    void *map;
+
+    // Wait for any thread already probing it
+    file = cx->files[hash & (cx->filebuckets - 1)];
+    for ( ; file != NULL; file = file->chain)
+        if (file->hash == hash && !strcmp(file->path, path)) break;
+    if (file != NULL) {
+        while (file->state == CACHE_LOADING)
+            cx->hooks.wait(cx->done, cx->lock);
+        return (file->state == CACHE_READY) ? file : NULL;
+    }
+
+    // Add the file, so other lookups of it wait for this one
+    if (cx->filenum >= cx->filebuckets) growFiles(cx);
+    file = calloc(1, sizeof(CACHE_FILE));
+    file->path = malloc(strlen(path) + 1);
+    strcpy(file->path, path);
+    file->hash = hash;
+    file->state = CACHE_LOADING;
+    file->chain = cx->files[hash & (cx->filebuckets - 1)];
+    cx->files[hash & (cx->filebuckets - 1)] = file;
+    cx->filenum++;
+
+    // Probe it while other lookups go on
+    cx->hooks.unlock(cx->lock);
+    map = cx->hooks.map(path, &data, &length);
+    if (map != NULL) {
+        if (length <= 0x7FFFFFFF) geo = geoProbe(data, (int) length);
+        cx->hooks.destroy(map);
+    }
+    cx->hooks.lock(cx->lock);
+
+    // Let the waiting lookups have it
+    file->geo = geo;
+    file->state = (geo != NULL) ? CACHE_READY : CACHE_FAILED;
+    if (geo == NULL) cx->stats.failures++;
+    cx->hooks.broadcast(cx->done);
+    return (geo != NULL) ? file : NULL;
+}
+
+// Decodes a model the first time it's looked up, pinned for the lookup.
+// Called and returns with the lock held, but lets it go while decoding
+static void loadEntry(CACHE_EXT *cx, CACHE_ENTRY *entry) {
+    GEO_MODEL *mod = NULL;
+    unsigned char *data;
+    long long length;
+    void *map;
+
+    // Decode it while other lookups go on
+    cx->hooks.unlock(cx->lock);
+    map = cx->hooks.map(entry->file->path, &data, &length);
+    if (map != NULL) {
+        if (length <= 0x7FFFFFFF)
+            mod = geoLoadModel(entry->file->geo, entry->model, data,
+                (int) length);
+        cx->hooks.destroy(map);
+    }
+    cx->hooks.lock(cx->lock);
+
+    // Failed models stay in the table so they aren't tried again
+    if (mod == NULL) {
+        entry->state = CACHE_FAILED;
+        cx->stats.failures++;
+        cx->hooks.broadcast(cx->done);
+        return;
+    }
+
+    // Put it on the clock, making room for it
+    entry->mod = *mod;
+    free(mod);
+    entry->bytes = modelBytes(&entry->mod);
+    entry->state = CACHE_READY;
+    entry->pins = 1;
+    entry->used = 1;
+    linkEntry(cx, entry);
+    cx->stats.bytes += entry->bytes;
+    cx->stats.models++;
+    cx->stats.pinned++;
+    evictModels(cx);
+    cx->hooks.broadcast(cx->done);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Copy the counters of a model cache, taken together
+void geoCacheStats(GEO_CACHE *cache, GEO_CACHE_STATS *stats) {
+    CACHE_EXT *cx = (CACHE_EXT *) cache;
+
+    // Error checking
+    if (cache == NULL || stats == NULL) return;
+
+    cx->hooks.lock(cx->lock);
+    *stats = cx->stats;
+    cx->hooks.unlock(cx->lock);
+    return;
+}
+
+// Create a cache of models decoded from any number of .geo files, keyed by
+// path and model index. The decoded models are held within a budget in
+// bytes, dropping those least recently used that nobody has pinned. Each
+// file's meta stream stays resident outside of the budget, being needed
+// to decode its models. Files are mapped and threads kept apart with the
+// platform's own functions, given in hooks. Safe to use from any number
+// of threads
+GEO_CACHE* geoCreateCache(long long budget, GEO_CACHE_HOOKS *hooks) {
+    CACHE_EXT *cx;
+
+    // Error checking
+    if (budget < 0 || hooks == NULL || hooks->map == NULL ||
+        hooks->createLock == NULL || hooks->createCond == NULL ||
+        hooks->lock == NULL || hooks->unlock == NULL || hooks->wait == NULL ||
+        hooks->broadcast == NULL || hooks->destroy == NULL) return NULL;
+
+    cx = calloc(1, sizeof(CACHE_EXT));
+    cx->hooks = *hooks;
+    cx->lock = hooks->createLock();
+    cx->done = hooks->createCond();
+    cx->filebuckets = cx->entrybuckets = CACHE_BUCKETS;
+    cx->files = calloc(CACHE_BUCKETS, sizeof(CACHE_FILE *));
+    cx->entries = calloc(CACHE_BUCKETS, sizeof(CACHE_ENTRY *));
+    if (cx->lock == NULL || cx->done == NULL || cx->files == NULL ||
+        cx->entries == NULL) {
+        if (cx->lock != NULL) hooks->destroy(cx->lock);
+        if (cx->done != NULL) hooks->destroy(cx->done);
+        free(cx->files);
+        free(cx->entries);
+        free(cx);
+        return NULL;
+    }
+    cx->cache.budget = cx->stats.budget = budget;
+    return &cx->cache;
+}
+
+// Look up the meta stream of a file in a model cache, for its model names
+// and counts. It has no geometry, and lasts as long as the cache does.
+// Returns NULL if the file can't be read
+GEO* geoFetchFile(GEO_CACHE *cache, char *path) {
+    CACHE_EXT *cx = (CACHE_EXT *) cache;
+    CACHE_FILE *file;
+
+    // Error checking
+    if (cache == NULL || path == NULL) return NULL;
+
+    cx->hooks.lock(cx->lock);
+    file = getFile(cx, path);
+    cx->hooks.unlock(cx->lock);
+    return (file != NULL) ? file->geo : NULL;
+}
+
+// Look up a model in a model cache, decoding it if it isn't held. Lookups
+// of a model being decoded wait for it rather than decoding it again. The
+// model is pinned, so it stays until geoReleaseModel() is called for this
+// lookup, and must not be changed. Returns NULL if it can't be loaded
+GEO_MODEL* geoFetchModel(GEO_CACHE *cache, char *path, int model) {
+    CACHE_EXT *cx = (CACHE_EXT *) cache;
+    CACHE_ENTRY *entry;
+    GEO_MODEL *mod;
+    CACHE_FILE *file;
+    int waited = 0;
+
+    // Error checking
+    if (cache == NULL || path == NULL || model < 0) return NULL;
+
+    // Find the file, then wait for any thread already decoding the model.
+    // It may be dropped again before this thread wakes, so look it up anew
+    cx->hooks.lock(cx->lock);
+    file = getFile(cx, path);
+    if (file == NULL || model >= file->geo->modelnum) {
+        cx->hooks.unlock(cx->lock);
+        return NULL;
+    }
+    while ((entry = findEntry(cx, file, model)) != NULL &&
+        entry->state == CACHE_LOADING) {
+        waited = 1;
+        cx->hooks.wait(cx->done, cx->lock);
+    }
+
+    // Pin it if it's held
+    if (entry != NULL) {
+        mod = (entry->state == CACHE_READY) ? &entry->mod : NULL;
+        if (mod != NULL) {
+            cx->stats.hits++;
+            if (waited) cx->stats.waits++;
+            if (!entry->pins++) cx->stats.pinned++;
+            entry->used = 1;
+        }
+        cx->hooks.unlock(cx->lock);
+        return mod;
+    }
+
+    // Add it, so other lookups of it wait for this one
+    if (cx->entrynum >= cx->entrybuckets) growEntries(cx);
+    entry = calloc(1, sizeof(CACHE_ENTRY));
+    entry->file = file;
+    entry->model = model;
+    entry->state = CACHE_LOADING;
+    entry->chain = cx->entries[hashEntry(file, model) &
+        (cx->entrybuckets - 1)];
+    cx->entries[hashEntry(file, model) & (cx->entrybuckets - 1)] = entry;
+    cx->entrynum++;
+    cx->stats.misses++;
+    loadEntry(cx, entry);
+    mod = (entry->state == CACHE_READY) ? &entry->mod : NULL;
+    cx->hooks.unlock(cx->lock);
+    return mod;
+}
+
+// Delete a model cache and every model in it, pinned or not
+void geoFreeCache(GEO_CACHE *cache) {
+    CACHE_EXT *cx = (CACHE_EXT *) cache;
+    CACHE_ENTRY *entry, *echain;
+    CACHE_FILE *file, *fchain;
+    int x;
+
+    // Error checking
+    if (cache == NULL) return;
+
+    // Delete the models, then the files they came from
+    for (x = 0; x < cx->entrybuckets; x++) {
+        for (entry = cx->entries[x]; entry != NULL; entry = echain) {
+            echain = entry->chain;
+            if (entry->mod.facenum)   free(entry->mod.faces);
+            if (entry->mod.vertexnum) free(entry->mod.vertices);
+            if (entry->mod.lodnum)    free(entry->mod.lods);
+            free(entry);
+        }
+    }
+    for (x = 0; x < cx->filebuckets; x++) {
+        for (file = cx->files[x]; file != NULL; file = fchain) {
+            fchain = file->chain;
+            if (file->geo != NULL) geoFree(file->geo);
+            free(file->path);
+            free(file);
+        }
+    }
+
+    // Delete the cache itself
+    cx->hooks.destroy(cx->done);
+    cx->hooks.destroy(cx->lock);
+    free(cx->entries);
+    free(cx->files);
+    free(cx);
+    return;
+}
+
+// Unpin a model looked up with geoFetchModel(), once for each lookup. It
+// may be dropped from the cache from then on
+void geoReleaseModel(GEO_CACHE *cache, GEO_MODEL *mod) {
+    CACHE_EXT *cx = (CACHE_EXT *) cache;
+    CACHE_ENTRY *entry = (CACHE_ENTRY *) mod;
+
+    // Error checking
+    if (cache == NULL || mod == NULL) return;
+
+    cx->hooks.lock(cx->lock);
+    if (entry->pins > 0 && !--entry->pins) {
+        cx->stats.pinned--;
+        evictModels(cx);
+    }
+    cx->hooks.unlock(cx->lock);
+    return;
+}
@@ -4,6 +4,11 @@
 #include <math.h>
 #include "tpkapi.h"
 #include "geo.h"
+#include "pigg.h"
+#include "catalog.h"
+#include "audit.h"
+#include "export.h"
+#include "raster.h"
 
 // Macros to take the place of common functions
 #define GetInt16(x, y) ( \
@@ -12,27 +17,476 @@
     ((int) x[y] << 24) | ((int) x[y + 1] << 16) | \
     ((int) x[y + 2] <<  8) | ((int) x[y + 3]) )
 
-typedef __stdcall int (*ZL_UNC)(unsigned char *, int *, unsigned char *, int);
+// zlib is loaded at run time; its length type follows the platform's uLong
+#ifdef __windows__
+#define ZLIB_NAME "zlib1.dll"
+#define DIR_SEP   "\\"
+typedef int ZL_LEN;
+typedef __stdcall int (*ZL_UNC)(unsigned char *, ZL_LEN *, unsigned char *,
+    ZL_LEN);
+typedef __stdcall int (*ZL_COM)(unsigned char *, ZL_LEN *, unsigned char *,
+    ZL_LEN, int);
+#endif
+#ifdef __linux__
+#include <dlfcn.h>
+#define ZLIB_NAME "libz.so.1"
+#define DIR_SEP   "/"
+#define HMODULE              void *
+#define LoadLibrary(x)       dlopen(x, RTLD_NOW | RTLD_LOCAL)
+#define GetProcAddress(x, y) dlsym(x, y)
+#define FreeLibrary(x)       dlclose(x)
+typedef unsigned long ZL_LEN;
+typedef int (*ZL_UNC)(unsigned char *, ZL_LEN *, unsigned char *, ZL_LEN);
+typedef int (*ZL_COM)(unsigned char *, ZL_LEN *, unsigned char *, ZL_LEN,
+    int);
+#endif
+
+// One run of same-textured triangles within a model's index list
+typedef struct {
+    int texture; // Index into the textures[] list
+    int first;   // Position of the first index within the index list
+    int count;   // Number of indexes in the run
+} DRAW_BATCH;
+
+// Drawing information for one model
+typedef struct VIEW_MODEL_ {
+    GEO_MODEL *mod;         // The model being drawn
+    float cx, cy, cz;       // Center of the model's bounding box
+    float radius;           // Bounding sphere radius after scaling
+    float scale;            // Scale factor to fit the model into a cell
+    float gx, gy;           // Center of the model's cell in the gallery
+    int lod;                // Level of detail drawn in the last frame
+    int lodnum;             // Number of coarser levels available
+    GEO_LOD *lods;          // Distances at which the levels take over
+    struct VIEW_MODEL_ **lodviews; // Drawing information of each level
+    int generated;          // The levels were made by geoSimplify()
+    unsigned int *indexes;  // Vertex indexes, grouped by texture
+    int batchnum;           // Number of batches in the model
+    DRAW_BATCH *batches;    // Texture batches over the index list
+} VIEW_MODEL;
+
+// Reference to one batch of one visible model, used when sorting draws
+typedef struct {
+    VIEW_MODEL *view;
+    DRAW_BATCH *batch;
+    float      *matrix;
+} DRAW_ITEM;
+
+// Textures of a file being decoded out of the archive
+typedef struct {
+    GEO         *geo;
+    RAS_TEXTURE *tex;
+} TEX_SET;
+
+// A model prepared for single-model view, possibly still in the background
+typedef struct {
+    VIEW_MODEL view; // Bounds and batches, view.mod is NULL if unused
+    int bytes;       // Memory held by the index and batch lists
+    TPK_JOB *job;    // Job preparing the model, NULL once waited on
+} PREP_MODEL;
+
+// Picking hierarchy of one model, built in the background on first use
+typedef struct {
+    GEO_MODEL *mod;  // The model, NULL until the build is started
+    GEO_BVH   *bvh;  // The hierarchy, NULL until it's waited on
+    TPK_JOB   *job;  // Job building it, NULL once waited on
+} PICK_BVH;
+
+// Ambient occlusion of one model, baked in the background on first use
+typedef struct {
+    GEO_MODEL     *mod;    // The model, NULL until the bake is started
+    unsigned char *colors; // Material color per vertex, NULL if it failed
+    TPK_JOB       *job;    // Job baking it, NULL once waited on
+} BAKE_AO;
+
+// Gallery layout constants
+#define GALLERY_CELL 14.0f // Distance between neighbouring cell centers
+#define GALLERY_FIT  10.0f // Size of the largest model dimension in a cell
+
+// Thumbnail constants
+#define THUMB_XROT    20.0f // Fixed tilt and turn of the thumbnails in degrees,
+#define THUMB_YROT    30.0f // applied the way drawscene() applies xrot and yrot
+#define THUMB_PATH    1024  // Longest path of a batch file handled
+
+// Level of detail selection constants
+#define LOD_HEIGHT     480.0f // Window height the LOD distances are tuned for
+#define LOD_HYSTERESIS 0.1f   // Margin to pass a LOD distance by to switch
+
+// Level of detail generation constants
+#define LOD_LEVELS     3      // Generated levels per model
+#define LOD_MINFACES   1024   // Models smaller than this get no levels
+#define LOD_DISTANCE   2.9f   // First level distance, in bounding radii
+
+// Frame pacing constants
+#define ANIM_RATE      120.0  // Animation steps per second
+#define FRAME_RATE     120    // Frame rate when vsync isn't available
+#define FRAME_LAG      2      // Frames the CPU may queue ahead of the GPU
+#define LOD_POLL       50     // Milliseconds between checks for new LODs
+#define WATCH_POLL     250    // Milliseconds between checks of the file
+
+// Render thread constants
+#define STATE_FRESH    4      // Set on the shared slot until it's taken
+
+// Latency measurement constants
+#define LAT_WINDOW     256    // Recent samples the percentiles cover
+#define LAT_IDLE       100    // Milliseconds between frames counted as idle
+#define LAT_BUCKETS    40     // Frame time histogram buckets, 1 ms wide
+
+// Capture constants
+#define CAPTURE_RING   (FRAME_LAG + 1) // Pixel buffers frames are read into
+#define CAPTURE_JOBS   8      // Most captured frames being encoded at once
+#define TURN_FRAMES    120    // Frames in a turntable, unless given
+
+// Window constants
+#define WINDOW_WIDTH   640    // Client area of the window, and of the
+#define WINDOW_HEIGHT  480    // offscreen context benchmarks draw into
+
+// Benchmark script commands, in the order of their names in ReadBench()
+#define BENCH_MODEL    0      // Select a model
+#define BENCH_GALLERY  1      // Leave or enter gallery mode
+#define BENCH_VIEW     2      // Place the camera
+#define BENCH_TURN     3      // Rotate the camera every frame
+#define BENCH_MOVE     4      // Shift the camera every frame
+#define BENCH_WARMUP   5      // Draw frames without measuring them
+#define BENCH_FRAMES   6      // Draw measured frames
+#define BENCH_COMMANDS 7
+
+// Neighbour prefetch constants
+#define PREFETCH_MODELS 4          // Models kept ready on either side
+#define PREFETCH_BUDGET (64 << 20) // Bytes the prepared models may hold
+#define PREFETCH_SLOTS  (PREFETCH_MODELS * 2 + 1)
+
+// Catalog constants
+#define CATALOG_SHOW    32         // Most lookup matches printed
+#define CATALOG_CACHE   (64 << 20) // Bytes of matches checked at once
+#define MATCH_OK        0          // Match still as catalogued
+#define MATCH_CHANGED   1          // File changed since it was catalogued
+#define MATCH_MISSING   2          // File or model can't be loaded
+
+// Audit constants
+#define AUDIT_SHOW      10         // Files listed under each worst case
+
+// Normal constants
+#define NORMAL_CREASE   60.0f      // Degrees regenerated normals smooth across
+
+// Ambient occlusion constants
+#define AO_RAYS         64         // Rays traced per vertex
+#define AO_DIFFUSE      0.8f       // Default material diffuse, scaled by it
+#define AO_AMBIENT      0.3f       // Light ambient that, with the diffuse as
+                                   // material ambient, keeps the usual 0.24
+
+// Normal rescaling, from OpenGL 1.2
+#ifndef GL_RESCALE_NORMAL
+#define GL_RESCALE_NORMAL 0x803A
+#endif
+
+// Fence sync entry points, from OpenGL 3.2 or ARB_sync
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT    0x00000001
+#endif
+typedef void*  (APIENTRY *GL_FENCESYNC)(GLenum, GLbitfield);
+typedef GLenum (APIENTRY *GL_CLIENTWAITSYNC)(void *, GLbitfield,
+    unsigned long long);
+typedef void   (APIENTRY *GL_DELETESYNC)(void *);
+
+// Pixel buffer object entry points, from OpenGL 2.1 or ARB_pixel_buffer_object
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#define GL_STREAM_READ       0x88E1
+#define GL_READ_ONLY         0x88B8
+#endif
+typedef void   (APIENTRY *GL_GENBUFFERS)(GLsizei, GLuint *);
+typedef void   (APIENTRY *GL_DELETEBUFFERS)(GLsizei, const GLuint *);
+typedef void   (APIENTRY *GL_BINDBUFFER)(GLenum, GLuint);
+typedef void   (APIENTRY *GL_BUFFERDATA)(GLenum, size_t, const void *, GLenum);
+typedef void*  (APIENTRY *GL_MAPBUFFER)(GLenum, GLenum);
+typedef GLboolean (APIENTRY *GL_UNMAPBUFFER)(GLenum);
+
+// Everything a frame is drawn from, published by the main thread for the
+// render thread. The models it points to only change under scenelock
+typedef struct {
+    float xrot, yrot;        // Camera rotation
+    float xsft, ysft, zsft;  // Camera shift
+    int gallery;             // Gallery mode rather than single-model view
+    int model;               // Selected model
+    VIEW_MODEL *view;        // Drawing information of the selected model
+    unsigned char *colors;   // Its ambient occlusion colors, NULL for none
+    int pickmodel, pickface; // Face under the cursor, -1 for none
+    int width, height;       // Client area of the window, at least 1
+    double znear, zfar, aspect;
+    int overlay;             // Latency overlay shown
+    int turn;                // Turntable frame to capture, -1 for none
+    int turnserial;          // Its number over all turntables
+    int bench;               // Benchmark frame to measure, -1 for none
+    int benchserial;         // Its number over all frames, 0 outside one
+    unsigned long long input; // Earliest input since the state before it
+    unsigned long long carry; // Earliest input of the state before it
+} VIEW_STATE;
+
+// Input latency and frame times, measured by the render thread
+typedef struct {
+    double latency[LAT_WINDOW]; // Recent input to display times, in ms
+    double frames[LAT_WINDOW];  // Recent times between frames, in ms
+    int latnum, framenum;       // Samples taken in total
+    unsigned int count;         // Frames measured
+    unsigned long long shown;   // Latest input stamp a frame has shown
+    unsigned long long start;   // tpkClock() value of the first frame
+    unsigned long long last;    // tpkClock() value of the frame before
+    FILE *log;                  // CSV log of every frame, NULL for none
+} LATENCY;
+
+// Frame being read back from the GPU through a pixel buffer
+typedef struct {
+    unsigned int buffer;  // Pixel buffer object
+    int size;             // Bytes it holds
+    int width, height;    // Frame read into it
+    int frame;            // Frame number it was read at, -1 when unused
+    char name[1024];      // File the frame is saved to
+} CAPTURE_READ;
+
+// Captured frame being saved on the job system
+typedef struct {
+    char name[1024];       // File it's saved to
+    int width, height;
+    unsigned char *pixels; // RGBA, top row first
+    TPK_JOB *job;          // Job saving it, NULL when the slot is free
+} CAPTURE_JOB;
+
+// One command of a benchmark script
+typedef struct {
+    int type;              // BENCH_* command
+    float args[5];         // Its arguments
+} BENCH_STEP;
+
+// What drawing one frame took, counted by the render thread
+typedef struct {
+    double ms;             // Start of drawing to the GPU finishing it
+    int draws;             // glDrawElements() calls
+    int triangles;         // Triangles they drew
+    int binds;             // Texture binds
+} BENCH_FRAME;
+
+// Levels of detail generated for one model
+typedef struct GEN_LOD_ {
+    int model;                      // Index of the model
+    int lodnum;                     // Number of levels
+    GEO_LOD lods[LOD_LEVELS];       // Distances of the levels
+    VIEW_MODEL *levels[LOD_LEVELS]; // Drawing information of the levels
+    struct GEN_LOD_ *next;          // Next entry in the ready list
+} GEN_LOD;
+
+// .geo file of a batch being rendered as it streams in
+typedef struct {
+    FILE *fPtr;
+    char *prefix;          // Leads the names of its thumbnails
+    RAS_TEXTURE *tex;      // Its textures, once its first model is in
+    int texnum;
+    int slices;            // Bands each thumbnail is rendered in
+    unsigned char *pixels;
+    int count;             // Thumbnails written
+    int err;               // One of them couldn't be written
+} THUMB_FILE;
 
 HMODULE hZlib = NULL;
 ZL_UNC huncompress = NULL;
+ZL_COM hcompress = NULL;
 TPK_WINDOW *hWnd;
 TPK_GLRC   *hRC;
 unsigned int lastms, model = 0, *textures;
 float xrot = 0.0f, yrot = 0.0f, zrot = 0.0f;
-float cx, cy, cz, scale;
-GEO_MODEL *mod;
+VIEW_MODEL *current = NULL;
+PREP_MODEL preps[PREFETCH_SLOTS];
 int rot[10] = {0, 0, 0, 0, 0, 0, 0, 0};
 float xsft = 0.0f, ysft = 0.0f, zsft = 0.0f;
+double znear = 0.1, zfar = 100.0, aspect = 1.0;
+int gallery = 0, viewnum = 0, texturenum = 0;
+VIEW_MODEL *views = NULL;
+DRAW_ITEM *drawitems = NULL;
+int drawitemnum = 0;
+float *drawmatrices = NULL;
+char *geofile = NULL;
+char *thumbdir = NULL;
+char *batchdir = NULL;
+char *tracefile = NULL;
+char *piggfile = NULL;
+char *catdir = NULL;
+char *auditdir = NULL;
+char *auditout = ".";
+char *findname = NULL;
+GEO_CACHE *modelcache = NULL;
+int matchstate[CATALOG_SHOW];
+char *exportdir = NULL;
+int exportobj = 0;
+volatile int exportfails = 0;
+TPK_MAP *piggmap = NULL;
+PIGG *pigg = NULL;
+int thumbsize = 256;
+int geolen = 0, lodcache = 0, lodstop = 0, lodloaded = 0;
+unsigned int geohash = 0, reloadhash = 0;
+TPK_MUTEX *lodlock = NULL;
+TPK_JOB *lodjob = NULL;
+GEN_LOD *lodready = NULL, *lodcached = NULL;
+int framerate = 0, vsync = 0, redraw = 1, fencenext = 0;
+void *fences[FRAME_LAG];
+GL_FENCESYNC glFenceSyncP = NULL;
+GL_CLIENTWAITSYNC glClientWaitSyncP = NULL;
+GL_DELETESYNC glDeleteSyncP = NULL;
+TPK_WATCH *watch = NULL;
+TPK_READ *reloadread = NULL;
+GEO *reloadnext = NULL;
+RAS_TEXTURE *reloadtex = NULL;
+int reloaddone = 0, reloadlen = 0;
+PICK_BVH *picks = NULL;
+int picknum = 0, pickdirty = 0, pickmodel = -1, pickface = -1;
+int mousex = -1, mousey = -1;
+BAKE_AO *bakes = NULL;
+int bakenum = 0, aobake = 0;
+VIEW_STATE states[3];
+volatile int statemid = 2;
+int statewrite = 0, stateread = 1;
+TPK_THREAD *renderthread = NULL;
+TPK_MUTEX *scenelock = NULL, *renderlock = NULL;
+TPK_COND *renderwake = NULL;
+int renderstop = 0, uploadnum = 0;
+RAS_TEXTURE *texnext = NULL;
+char *latfile = NULL;
+int overlay = 0;
+unsigned long long inputnext = 0, inputcarry = 0;
+LATENCY lat;
+char *capturedir = ".";
+int rawcapture = 0, turnframes = TURN_FRAMES, turnframe = -1, turnserial = 0;
+float turnbase = 0.0f;
+volatile int shotwant = 0, turnacked = 0, capturebusy = 0;
+CAPTURE_READ reads[CAPTURE_RING];
+CAPTURE_JOB captures[CAPTURE_JOBS];
+int readnext = 0, framecount = 0, shotnum = 0, turnnum = 0;
+GL_GENBUFFERS glGenBuffersP = NULL;
+GL_DELETEBUFFERS glDeleteBuffersP = NULL;
+GL_BINDBUFFER glBindBufferP = NULL;
+GL_BUFFERDATA glBufferDataP = NULL;
+GL_MAPBUFFER glMapBufferP = NULL;
+GL_UNMAPBUFFER glUnmapBufferP = NULL;
+char *benchfile = NULL, *reportfile = NULL, *recordfile = NULL;
+int offscreen = 0, viewwidth = 1, viewheight = 1;
+BENCH_STEP *benchsteps = NULL;
+BENCH_FRAME *benchframes = NULL, drawstats;
+int benchstepnum = 0, benchnum = 0, benchframe = -1, benchserial = 0;
+volatile int benchacked = 0;
+TPK_COND *benchwake = NULL;
+FILE *recordlog = NULL;
+float recview[5];
+int recmodel = -1, recgallery = 0, recframes = 0;
 
 int uncompress(void *dest, int *destlen, void *src, int srclen) {
+    ZL_LEN len = *destlen;
+    int ret;
+
     if (huncompress == NULL) return 1;
-    return huncompress(dest, destlen, src, srclen);
+    ret = huncompress(dest, &len, src, srclen);
+    *destlen = (int) len;
+    return ret;
+}
+
+int compress(void *dest, int *destlen, void *src, int srclen) {
+    ZL_LEN len = *destlen;
+    int ret;
+
+    if (hcompress == NULL) return 1;
+    ret = hcompress(dest, &len, src, srclen, 6);
+    *destlen = (int) len;
+    return ret;
 }
 
 int CheckArgs(int argc, char **argv) {
-    if (argc != 2) {
-        printf("Usage: %s <geofile>\n", argv[0]);
+    int x;
+
+    for (x = 1; x < argc; x++) {
+        if (!strcmp(argv[x], "--lodcache")) lodcache = 1;
+        else if (!strcmp(argv[x], "--thumbs") && x + 1 < argc)
+            thumbdir = argv[++x];
+        else if (!strcmp(argv[x], "--batch") && x + 1 < argc)
+            batchdir = argv[++x];
+        else if (!strcmp(argv[x], "--size") && x + 1 < argc)
+            thumbsize = atoi(argv[++x]);
+        else if (!strcmp(argv[x], "--fps") && x + 1 < argc)
+            framerate = atoi(argv[++x]);
+        else if (!strcmp(argv[x], "--trace") && x + 1 < argc)
+            tracefile = argv[++x];
+        else if (!strcmp(argv[x], "--pigg") && x + 1 < argc)
+            piggfile = argv[++x];
+        else if (!strcmp(argv[x], "--catalog") && x + 1 < argc)
+            catdir = argv[++x];
+        else if (!strcmp(argv[x], "--audit") && x + 1 < argc)
+            auditdir = argv[++x];
+        else if (!strcmp(argv[x], "--out") && x + 1 < argc)
+            auditout = argv[++x];
+        else if (!strcmp(argv[x], "--find") && x + 1 < argc)
+            findname = argv[++x];
+        else if (!strcmp(argv[x], "--export") && x + 1 < argc)
+            exportdir = argv[++x];
+        else if (!strcmp(argv[x], "--obj")) exportobj = 1;
+        else if (!strcmp(argv[x], "--ao")) aobake = 1;
+        else if (!strcmp(argv[x], "--latency") && x + 1 < argc)
+            latfile = argv[++x];
+        else if (!strcmp(argv[x], "--overlay")) overlay = 1;
+        else if (!strcmp(argv[x], "--capture") && x + 1 < argc)
+            capturedir = argv[++x];
+        else if (!strcmp(argv[x], "--frames") && x + 1 < argc)
+            turnframes = atoi(argv[++x]);
+        else if (!strcmp(argv[x], "--raw")) rawcapture = 1;
+        else if (!strcmp(argv[x], "--bench") && x + 1 < argc)
+            benchfile = argv[++x];
+        else if (!strcmp(argv[x], "--report") && x + 1 < argc)
+            reportfile = argv[++x];
+        else if (!strcmp(argv[x], "--offscreen")) offscreen = 1;
+        else if (!strcmp(argv[x], "--record") && x + 1 < argc)
+            recordfile = argv[++x];
+        else if (geofile == NULL) geofile = argv[x];
+        else { geofile = NULL; break; }
+    }
+
+    // Looking a model up doesn't take a file, and defaults to here
+    if (findname != NULL && catdir == NULL) catdir = ".";
+    if ((catdir == NULL && auditdir == NULL && batchdir == NULL) ==
+        (geofile == NULL) ||
+        (catdir != NULL) + (auditdir != NULL) + (batchdir != NULL) > 1 ||
+        (batchdir != NULL && (thumbdir == NULL || piggfile != NULL)) ||
+        (strcmp(auditout, ".") && auditdir == NULL) ||
+        thumbsize < 1 || framerate < 0 || turnframes < 1 ||
+        ((offscreen || reportfile != NULL) && benchfile == NULL) ||
+        (benchfile != NULL && recordfile != NULL)) {
+        printf("Usage: %s [options] <geofile>\n", argv[0]);
+        printf("  --lodcache     Keep generated LODs in <geofile>.lod\n");
+        printf("  --thumbs <dir> Render every model to <dir>/<model>.png\n");
+        printf("  --size <n>     Thumbnail width and height (256)\n");
+        printf("  --fps <n>      Frame rate limit, 0 follows vsync (0)\n");
+        printf("  --trace <file> Write a Chrome trace of loading and frames\n");
+        printf("  --pigg <file>  Read <geofile> and textures from a .pigg\n");
+        printf("  --export <dir> Write every model to <dir>/<model>.glb\n");
+        printf("  --obj          Export to .obj instead of .glb\n");
+        printf("  --ao           Shade models with baked ambient occlusion\n");
+        printf("  --latency <f>  Log input latency and frame times to <f>\n");
+        printf("  --overlay      Show latency and frame times, L toggles it\n");
+        printf("  --capture <d>  Save screenshots (C) and turntables (T) "
+            "to <d>\n");
+        printf("  --frames <n>   Frames in a turntable (120)\n");
+        printf("  --raw          Save captures as raw RGBA instead of PNG\n");
+        printf("  --record <f>   Record the frames drawn to <f> as a script\n");
+        printf("  --bench <f>    Replay script <f>, reporting frame costs\n");
+        printf("  --report <f>   Write the benchmark report to <f>\n");
+        printf("  --offscreen    Benchmark without a window\n");
+        printf("Usage: %s --catalog <dir> [--find <model>]\n", argv[0]);
+        printf("  Catalog the models of every .geo file under <dir>, or\n");
+        printf("  look <model> up in <dir>/catalog.gcat, checking each\n");
+        printf("  match against its file\n");
+        printf("Usage: %s --thumbs <dir> --batch <src> [--size <n>] "
+            "[--ao]\n", argv[0]);
+        printf("  Render the models of every .geo file under <src> to\n");
+        printf("  <dir>/<file>.<model>.png\n");
+        printf("Usage: %s --audit <dir> [--out <d>]\n", argv[0]);
+        printf("  Load every .geo file under <dir>, writing what was found\n");
+        printf("  to <d>/audit.csv and <d>/audit.json, here by default\n");
         return 1;
     }
 
@@ -40,9 +494,9 @@ int CheckArgs(int argc, char **argv) {
 }
 
 int InitZlib() {
-    hZlib = LoadLibrary("zlib1.dll");
+    hZlib = LoadLibrary(ZLIB_NAME);
     if (hZlib == NULL) {
-        printf("ERROR: Could not load zlib1.dll\n");
+        printf("ERROR: Could not load %s\n", ZLIB_NAME);
         return 2;
     }
 
@@ -53,6 +507,9 @@ int InitZlib() {
         return 3;
     }
 
+    // Only needed for writing images
+    hcompress = (ZL_COM) GetProcAddress(hZlib, "compress2");
+
     return 0;
 }
 
@@ -78,9 +535,56 @@ int LoadFile(char *filename, unsigned char **buffer) {
     return fLen;
 }
 
+// Maps an archive and indexes its entries
+int OpenPigg() {
+
+    // Mapping files needs the API
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+
+    piggmap = tpkMapFile(piggfile);
+    if (piggmap == NULL) {
+        printf("ERROR: Could not map %s\n", piggfile);
+        return 1;
+    }
+    pigg = piggOpen(piggmap->data, piggmap->length);
+    if (pigg == NULL) {
+        printf("ERROR: Could not open %s\n", piggfile);
+        tpkDelete(piggmap);
+        piggmap = NULL;
+        return 1;
+    }
+
+    printf("Opened %s, %d entries\n", piggfile, pigg->entrynum);
+    return 0;
+}
+
+// Releases the archive, if one is open
+void ClosePigg() {
+    if (pigg != NULL) piggClose(pigg);
+    tpkDelete(piggmap);
+    pigg = NULL;
+    piggmap = NULL;
+    return;
+}
+
+// Gets an entry out of the archive, which keeps ownership of the contents
+int LoadEntry(char *name, unsigned char **buffer) {
+    PIGG_ENTRY *entry;
+
+    entry = piggFind(pigg, name);
+    *buffer = piggRead(pigg, entry);
+    return (*buffer != NULL) ? entry->size : 0;
+}
+
 void Breakdown(GEO *geo) {
     if (geo != NULL) geoFree(geo);
+    ClosePigg();
     FreeLibrary(hZlib);
+    if (tracefile != NULL && tpkTraceDump(tracefile) != TPK_ERR_NONE)
+        printf("ERROR: Could not write %s\n", tracefile);
     return;
 }
 
@@ -113,19 +617,19 @@ void gluPerspective(double fovy, double aspect, double zNear, double zFar) {
     return;
 }
 
-// Configures the OpenGL viewport given dimensions
-void configviewport(int width, int height) {
-    double aspect;
-
-    // Calculate aspect ratio
-    width  = (width  < 1) ? 1 : width;
-    height = (height < 1) ? 1 : height;
+// Calculates the aspect ratio of the window's client area
+void configaspect(int width, int height) {
+    viewwidth  = width  = (width  < 1) ? 1 : width;
+    viewheight = height = (height < 1) ? 1 : height;
     aspect = (double) width / (double) height;
+    return;
+}
 
-    // Adjust viewport settings
-    glViewport(0, 0, width, height);
+// Configures the OpenGL viewport for a view state
+void configviewport(VIEW_STATE *s) {
+    glViewport(0, 0, s->width, s->height);
     glMatrixMode(GL_PROJECTION); glLoadIdentity();
-    gluPerspective(45.0, aspect, 0.1, 100.0);
+    gluPerspective(45.0, s->aspect, s->znear, s->zfar);
     glMatrixMode(GL_MODELVIEW);  glLoadIdentity();
     return;
 }
@@ -134,22 +638,28 @@ void configviewport(int width, int height) {
 int initialize() {
     float param[4];
 
-    // Start up the API
+    // Start up the API, the job system and the input thread, which has to
+    // be running before the window is made so the window's events go to it
     if (tpkStartup() != TPK_ERR_NONE) {
         printf("Error starting up the API\n");
         return 1;
     }
-
-    // Make a window
-    hWnd = tpkCreateWindow(640, 480, "GeoDraw");
-    if (hWnd == NULL) {
-        tpkShutdown();
-        printf("Could not create window.\n");
-        return 1;
+    tpkJobStartup(0);
+    if (!offscreen) tpkInputThread(1);
+
+    // Make a window, unless benchmarking offscreen
+    if (!offscreen) {
+        hWnd = tpkCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "GeoDraw");
+        if (hWnd == NULL) {
+            tpkShutdown();
+            printf("Could not create window.\n");
+            return 1;
+        }
     }
 
-    // Make an OpenGL rendering context
-    hRC = tpkCreateGLRC(hWnd);
+    // Make an OpenGL rendering context, of the window's size offscreen
+    if (offscreen) hRC = tpkCreateOffscreenGLRC(WINDOW_WIDTH, WINDOW_HEIGHT);
+    else hRC = tpkCreateGLRC(hWnd);
     if (hRC == NULL) {
         tpkDelete(hWnd);
         tpkShutdown();
@@ -157,10 +667,11 @@ int initialize() {
         return 1;
     }
 
-    // Configuring OpenGL parameters
+    // Configuring OpenGL parameters, the viewport is set by every frame
     tpkMakeCurrent(hRC);
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    configviewport(hWnd->width, hWnd->height);
+    if (offscreen) configaspect(WINDOW_WIDTH, WINDOW_HEIGHT);
+    else configaspect(hWnd->width, hWnd->height);
 
     glCullFace(GL_FRONT);
     //glEnable(GL_CULL_FACE);
@@ -183,317 +694,3122 @@ int initialize() {
 
 // Pack up the program for exiting
 void uninitialize() {
+    ClosePigg();
     tpkDelete(hWnd);
     tpkShutdown();
     return;
 }
 
 
-// Loads a model
-void LoadModel(GEO *geo) {
+// Compares two draw items by texture, then by geometry and placement
+int CompareItems(const void *a, const void *b) {
+    const DRAW_ITEM *x = a, *y = b;
+    if (x->batch->texture != y->batch->texture)
+        return x->batch->texture - y->batch->texture;
+    if (x->view != y->view)
+        return (x->view > y->view) - (x->view < y->view);
+    return (x->matrix > y->matrix) - (x->matrix < y->matrix);
+}
+
+// Groups a model's faces into one index list per texture
+void BuildBatches(VIEW_MODEL *view, GEO_MODEL *mod, int texnum) {
+    int *counts, *starts, x, t, n;
+
+    // Count the faces using each texture
+    if (texnum < 1) texnum = 1;
+    counts = calloc(texnum, sizeof(int));
+    starts = malloc(texnum * sizeof(int));
+    for (x = 0; x < mod->facenum; x++) {
+        t = mod->faces[x].texture;
+        counts[(t >= 0 && t < texnum) ? t : 0]++;
+    }
+
+    // Make one batch for every texture that is used
+    view->batchnum = 0;
+    for (t = 0; t < texnum; t++) if (counts[t]) view->batchnum++;
+    view->batches = malloc(view->batchnum * sizeof(DRAW_BATCH));
+    for (t = n = x = 0; t < texnum; t++) {
+        starts[t] = n;
+        if (!counts[t]) continue;
+        view->batches[x].texture = t;
+        view->batches[x].first   = n;
+        view->batches[x].count   = counts[t] * 3;
+        n += counts[t] * 3; x++;
+    }
+
+    // Scatter the vertex indexes into their batches
+    view->indexes = malloc(mod->facenum * 3 * sizeof(unsigned int));
+    for (x = 0; x < mod->facenum; x++) {
+        t = mod->faces[x].texture;
+        if (t < 0 || t >= texnum) t = 0;
+        view->indexes[starts[t]++] = mod->faces[x].v1;
+        view->indexes[starts[t]++] = mod->faces[x].v2;
+        view->indexes[starts[t]++] = mod->faces[x].v3;
+    }
+
+    free(counts);
+    free(starts);
+    return;
+}
+
+// Measures a model's bounding box and scales it to GALLERY_FIT
+void MeasureModel(VIEW_MODEL *view) {
     float maxx, maxy, maxz, minx, miny, minz, dist;
-    int x, y; GEO_VERTEX *v;
+    GEO_VERTEX *v;
+    int x;
 
-    mod = &geo->models[model];
-    sprintf(hWnd->text, "%d %s", model, mod->id);
-    tpkUpdate(hWnd);
+    view->cx = view->cy = view->cz = view->radius = 0.0f;
+    view->scale = 1.0f;
+    if (!view->mod->vertexnum) return;
 
-    v = &mod->vertices[mod->faces[0].v1];
+    v = view->mod->vertices;
     maxx = minx = v->x;
     maxy = miny = v->y;
     maxz = minz = v->z;
-
-    for (x = 1; x < mod->facenum; x++) {
-        for (y = 0; y < 3; y++) {
-            if (y == 0) v = &mod->vertices[mod->faces[x].v1];
-            if (y == 1) v = &mod->vertices[mod->faces[x].v2];
-            if (y == 2) v = &mod->vertices[mod->faces[x].v3];
-
-            if (v->x < minx) minx = v->x;
-            if (v->x > maxx) maxx = v->x;
-            if (v->y < miny) miny = v->y;
-            if (v->y > maxy) maxy = v->y;
-            if (v->z < minz) minz = v->z;
-            if (v->z > maxz) maxz = v->z;
-        }
+    for (x = 1, v++; x < view->mod->vertexnum; x++, v++) {
+        if (v->x < minx) minx = v->x;
+        if (v->x > maxx) maxx = v->x;
+        if (v->y < miny) miny = v->y;
+        if (v->y > maxy) maxy = v->y;
+        if (v->z < minz) minz = v->z;
+        if (v->z > maxz) maxz = v->z;
     }
 
-    cx = minx + (maxx - minx) / 2;
-    cy = miny + (maxy - miny) / 2;
-    cz = minz + (maxz - minz) / 2;
+    view->cx = minx + (maxx - minx) / 2;
+    view->cy = miny + (maxy - miny) / 2;
+    view->cz = minz + (maxz - minz) / 2;
 
     maxx -= minx; maxy -= miny; maxz -= minz;
     dist = maxx;
     if (maxy > dist) dist = maxy;
     if (maxz > dist) dist = maxz;
-    scale = 10.0f / dist;
+    view->scale = (dist > 0.0f) ? GALLERY_FIT / dist : 1.0f;
+    view->radius = 0.5f * view->scale *
+        (float) sqrt(maxx * maxx + maxy * maxy + maxz * maxz);
+    return;
+}
 
-    xrot = yrot = zrot = xsft = ysft = zsft = 0.0f;
+// Memory a model's preparation takes, counted against PREFETCH_BUDGET
+int PrepareBytes(GEO_MODEL *mod) {
+    return mod->facenum * 3 * sizeof(unsigned int) +
+        (texturenum ? texturenum : 1) * sizeof(DRAW_BATCH);
+}
 
+// Measures and batches a model for single-model view, run as a job
+void PrepareModel(void *param) {
+    VIEW_MODEL *view = param;
+
+    tpkTraceBegin("PrepareModel");
+    MeasureModel(view);
+    BuildBatches(view, view->mod, texturenum);
+    tpkTraceEnd();
     return;
 }
 
+// Returns the slot a model is prepared in, NULL if it isn't
+PREP_MODEL* FindPrep(GEO_MODEL *mod) {
+    int x;
 
-// Process window events
-int events(GEO *geo) {
-    int arg1, arg2, event, closing = 0, old = model;
+    for (x = 0; x < PREFETCH_SLOTS; x++)
+        if (preps[x].view.mod == mod) return &preps[x];
+    return NULL;
+}
 
-    // Read all supported events
-    event = TPK_EVENT_NONE;
-    do {
-        event = tpkNextEvent(hWnd, &arg1, &arg2);
-        switch (event) {
-        case TPK_EVENT_CLOSE:
-            closing = 1;
-            break;
-        case TPK_EVENT_RESIZE:
-            configviewport(hWnd->width, hWnd->height);
-            break;
-        case TPK_EVENT_KEYUP:
-            if (arg1 == 37) rot[0] = 0;
-            if (arg1 == 39) rot[1] = 0;
-            if (arg1 == 38) rot[2] = 0;
-            if (arg1 == 40) rot[3] = 0;
-            if (arg1 == 46) rot[4] = 0;
-            if (arg1 == 34) rot[5] = 0;
-            if (arg1 == 36) rot[6] = 0;
-            if (arg1 == 35) rot[7] = 0;
-            if (arg1 == 45) rot[8] = 0;
-            if (arg1 == 33) rot[9] = 0;
-            break;
-        case TPK_EVENT_KEYDOWN:
-            if (arg1 == 37) rot[0] = 1;
-            if (arg1 == 39) rot[1] = 1;
-            if (arg1 == 38) rot[2] = 1;
-            if (arg1 == 40) rot[3] = 1;
-            if (arg1 == 46) rot[4] = 1;
-            if (arg1 == 34) rot[5] = 1;
-            if (arg1 == 36) rot[6] = 1;
-            if (arg1 == 35) rot[7] = 1;
-            if (arg1 == 45) rot[8] = 1;
-            if (arg1 == 33) rot[9] = 1;
+// Empties a slot, waiting for its job first
+void FreePrep(PREP_MODEL *prep) {
+    if (prep->job != NULL) tpkJobWait(prep->job);
+    if (prep->view.indexes != NULL) free(prep->view.indexes);
+    if (prep->view.batches != NULL) free(prep->view.batches);
+    memset(prep, 0, sizeof(PREP_MODEL));
+    return;
+}
 
-            if (arg1 == 32) model++;
-            if (arg1 ==  8) model--;
-            if (model == -1) model += geo->modelnum;
-            if (model == geo->modelnum) model = 0;
-            if (model != old) LoadModel(geo);
-            break;
-        default: break;
-        }
+// Keeps the current model and its neighbours prepared, so that stepping
+// to one of them is only a pointer swap. The current model is prepared
+// right away, the neighbours in the background, nearest first, for as
+// long as they fit in PREFETCH_BUDGET
+void Prefetch(GEO *geo) {
+    GEO_MODEL *want[PREFETCH_SLOTS];
+    PREP_MODEL *prep;
+    int x, y, n, step, bytes;
+
+    // Alternate forward and backward from the current model
+    want[0] = &geo->models[model];
+    bytes = PrepareBytes(want[0]);
+    for (x = n = 1; x < PREFETCH_SLOTS; x++) {
+        step = (x + 1) / 2;
+        y = (x & 1) ? model + step : model - step;
+        y = ((y % geo->modelnum) + geo->modelnum) % geo->modelnum;
+        for (step = 0; step < n && want[step] != &geo->models[y]; step++);
+        if (step < n) continue; // Small files wrap around onto themselves
+
+        bytes += PrepareBytes(&geo->models[y]);
+        if (bytes > PREFETCH_BUDGET) break;
+        want[n++] = &geo->models[y];
+    }
 
-    } while (event != TPK_EVENT_NONE);
+    // Drop the models that have fallen out of range
+    for (x = 0; x < PREFETCH_SLOTS; x++) {
+        if (preps[x].view.mod == NULL) continue;
+        for (y = 0; y < n && want[y] != preps[x].view.mod; y++);
+        if (y == n) FreePrep(&preps[x]);
+    }
 
-    // Skip remaining events
-    tpkDoEvents();
-    return closing;
+    // Prepare the ones coming into range, there's a free slot for each
+    for (x = 0; x < n; x++) {
+        if (FindPrep(want[x]) != NULL) continue;
+        prep = FindPrep(NULL);
+        prep->view.mod = want[x];
+        prep->bytes = PrepareBytes(want[x]);
+        if (!x) { PrepareModel(&prep->view); continue; }
+        prep->job = tpkJobCreate(PrepareModel, &prep->view, NULL);
+        tpkJobRun(prep->job);
+    }
+    return;
 }
 
-// Animate one frame's worth
-void animate() {
-    if (rot[0]) yrot -= 1.0f;
-    if (rot[1]) yrot += 1.0f;
-    if (rot[2]) xrot -= 1.0f;
-    if (rot[3]) xrot += 1.0f;
-    if (yrot < 0.0f) yrot += 360.0f;
-    if (yrot > 360.0f) yrot -= 360.0f;
-    if (xrot < -90.0f) xrot = -90.0;
-    if (xrot > 90.0f) xrot = 90.0f;
+// Releases the prepared models
+void FreePrefetch() {
+    int x;
 
-    if (rot[4]) xsft -= 0.03f;
-    if (rot[5]) xsft += 0.03f;
-    if (rot[6]) ysft += 0.03f;
-    if (rot[7]) ysft -= 0.03f;
-    if (rot[8]) zsft -= 0.05f;
-    if (rot[9]) zsft += 0.05f;
+    for (x = 0; x < PREFETCH_SLOTS; x++)
+        if (preps[x].view.mod != NULL) FreePrep(&preps[x]);
+    current = NULL;
+    return;
+}
 
+// Bakes a model's ambient occlusion into material colors, run as a job
+void AoJob(void *param) {
+    BAKE_AO *bake = param;
+    unsigned char *c;
+    float *ao;
+    int x;
+
+    tpkTraceBegin("AoJob");
+    ao = geoBakeAO(bake->mod, AO_RAYS, 0.0f);
+    if (ao != NULL) bake->colors = malloc(bake->mod->vertexnum * 4);
+    if (bake->colors != NULL) {
+        for (x = 0; x < bake->mod->vertexnum; x++) {
+            c = &bake->colors[x * 4];
+            c[0] = c[1] = c[2] = (unsigned char)
+                (ao[x] * AO_DIFFUSE * 255.0f + 0.5f);
+            c[3] = 255;
+        }
+    }
+    free(ao);
+    tpkTraceEnd();
     return;
 }
 
-// Draw the OpenGL scene
-void drawscene() {
-    GEO_VERTEX *v;
-    int x, pass;
+// Returns a model's ambient occlusion colors, starting to bake them the
+// first time. NULL while they're being baked
+unsigned char* ModelAO(GEO *geo, int x) {
+    BAKE_AO *bake;
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (bakes == NULL) {
+        bakenum = geo->modelnum;
+        bakes = calloc(bakenum ? bakenum : 1, sizeof(BAKE_AO));
+    }
+    bake = &bakes[x];
+    if (bake->mod == NULL) {
+        bake->mod = &geo->models[x];
+        bake->job = tpkJobCreate(AoJob, bake, NULL);
+        if (bake->job == NULL) AoJob(bake);
+        else tpkJobRun(bake->job);
+    }
+    return (bake->job == NULL) ? bake->colors : NULL;
+}
 
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
-    //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_CULL_FACE);
+// Picks up the selected model's ambient occlusion once it's baked.
+// Returns whether it arrived
+int CollectAO() {
+    BAKE_AO *bake;
+
+    if (bakes == NULL || gallery || model >= (unsigned int) bakenum) return 0;
+    bake = &bakes[model];
+    if (bake->job == NULL || !tpkJobDone(bake->job)) return 0;
+    tpkJobWait(bake->job);
+    bake->job = NULL;
+    return 1;
+}
 
-    glPushMatrix();
-        glTranslatef(xsft, ysft, -15.0f + zsft);
-        glRotatef(xrot, 1.0f, 0.0f, 0.0f);
-        glRotatef(yrot, 0.0f, 1.0f, 0.0f);
+// Whether the selected model's ambient occlusion is still being baked
+int AoPending() {
+    if (bakes == NULL || gallery || model >= (unsigned int) bakenum) return 0;
+    return bakes[model].job != NULL;
+}
 
-        glScalef(-scale, scale, scale);
-        glTranslatef(-cx, -cy, -cz);
+// Releases the ambient occlusion colors, waiting for the ones being baked
+void FreeBakes() {
+    int x;
 
-        //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        for (x = 0; x < mod->facenum; x++) {
-            glBindTexture(GL_TEXTURE_2D, textures[mod->faces[x].texture]);
-
-            glBegin(GL_TRIANGLES);
-            v = &mod->vertices[mod->faces[x].v1];
-            glNormal3f(v->nx * scale, v->ny * scale, v->nz * scale);
-            glTexCoord2f(v->s, v->t);
-            glVertex3f(v->x, v->y, v->z);
-            v = &mod->vertices[mod->faces[x].v2];
-            glNormal3f(v->nx * scale, v->ny * scale, v->nz * scale);
-            glTexCoord2f(v->s, v->t);
-            glVertex3f(v->x, v->y, v->z);
-            v = &mod->vertices[mod->faces[x].v3];
-            glNormal3f(v->nx * scale, v->ny * scale, v->nz * scale);
-            glTexCoord2f(v->s, v->t);
-            glVertex3f(v->x, v->y, v->z);
-            glEnd();
-        }
+    for (x = 0; x < bakenum; x++) {
+        if (bakes[x].job != NULL) tpkJobWait(bakes[x].job);
+        if (bakes[x].colors != NULL) free(bakes[x].colors);
+    }
+    free(bakes);
+    bakes = NULL;
+    bakenum = 0;
+    return;
+}
 
-    glPopMatrix();
+// Shows the selected model in single-model view
+void SelectModel(GEO *geo) {
+    PREP_MODEL *prep;
 
-    glFinish();
-    tpkSwapBuffers(hRC);
+    tpkTraceBegin("SelectModel");
+    Prefetch(geo);
+    prep = FindPrep(&geo->models[model]);
+    if (prep->job != NULL) {
+        tpkJobWait(prep->job);
+        prep->job = NULL;
+    }
+    current = &prep->view;
+    if (aobake) ModelAO(geo, model);
+
+    if (hWnd != NULL) {
+        sprintf(hWnd->text, "%d %s", model, current->mod->id);
+        tpkUpdate(hWnd);
+    }
+
+    tpkTraceEnd();
     return;
 }
 
-// Main program loop
-void prgloop(GEO *geo) {
-    double target = 1000.0 / 120.0; // Number of milliseconds per frame
-    double accum = 0.0;             // Milliseconds accumulated
-    int closing = 0;
+// Switches single-model view to the selected model
+void LoadModel(GEO *geo) {
+    SelectModel(geo);
+    xrot = yrot = zrot = xsft = ysft = zsft = 0.0f;
+    return;
+}
 
-    // Loop until program exit is requested
-    while (!closing) {
+// Places a level where its model is drawn. Only what never changes after
+// the gallery is laid out is copied, the render thread keeps writing the
+// model's current level while levels are made in the background
+void PlaceLevel(VIEW_MODEL *level, VIEW_MODEL *view, GEO_MODEL *lod) {
+    level->mod = lod;
+    level->cx = view->cx; level->cy = view->cy; level->cz = view->cz;
+    level->radius = view->radius;
+    level->scale = view->scale;
+    level->gx = view->gx; level->gy = view->gy;
+    return;
+}
 
-        // Wait until at least 1 frame elapses
-        while (accum < 1.0) {
-            accum += ((double) tpkTimer(&lastms) / target);
-            if (accum < 1.0) tpkSleep(1); // Give the CPU some slack
+// Makes a chain of simplified levels for one model
+GEN_LOD* GenerateLods(VIEW_MODEL *view) {
+    GEO_MODEL *src = view->mod, *lod;
+    VIEW_MODEL *level;
+    GEN_LOD *gen;
+    float dist;
+
+    gen = calloc(1, sizeof(GEN_LOD));
+    gen->model = view - views;
+    dist = view->radius / view->scale * LOD_DISTANCE;
+
+    // Halve the triangle count at every level, starting from the last one
+    while (gen->lodnum < LOD_LEVELS) {
+        lod = geoSimplify(src, 0.5f);
+        if (lod == NULL) break;
+        if (lod->facenum > src->facenum * 3 / 4 || !lod->facenum) {
+            geoFreeModel(lod);
+            break; // Mostly locked by seams, not worth another level
         }
 
-        // Perform control operations for any skipped frames
-        for ( ; accum >= 1.0; accum -= 1.0)
-            animate();
-
-        // Draw one frame
-        drawscene(geo);
+        level = calloc(1, sizeof(VIEW_MODEL));
+        PlaceLevel(level, view, lod);
+        BuildBatches(level, lod, texturenum);
 
-        // Process window events
-        closing = events(geo);
+        gen->lods[gen->lodnum].distance = dist;
+        gen->lods[gen->lodnum].model = gen->model;
+        gen->levels[gen->lodnum++] = level;
+        dist *= 2.0f;
+        src = lod;
     }
-    
+
+    if (!gen->lodnum) { free(gen); return NULL; }
+    return gen;
 }
 
-void LoadTexture(char *filename, int dest) {
-    char fname[256];
-    unsigned char *fData, *pData;
-    int fLen, width, height, depth, clen, plen, fOff, ulen;
+// Background job generating levels of detail for a range of models
+void LodJob(void *param, int first, int last) {
+    GEN_LOD *gen;
+    int x;
 
-    glBindTexture(GL_TEXTURE_2D, textures[dest]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    (void) param;
+    for (x = first; x < last; x++) {
 
-    sprintf(fname, "textures\\%s", filename);
-    fLen = strlen(fname);
-    if (fname[fLen - 4] != '.') strcat(fname, ".png");
-    strcpy(&fname[strlen(fname) - 3], "png");
+        // The gallery is going away
+        if (tpkAtomicGet(&lodstop)) return;
 
-    fLen = LoadFile(fname, &fData);
-    if (fData == NULL) return;
+        // Only models without levels of their own are worth simplifying
+        if (views[x].mod->lodnum || views[x].mod->facenum < LOD_MINFACES)
+            continue;
+        gen = GenerateLods(&views[x]);
+        if (gen == NULL) continue;
 
-    width = GetInt32(fData, 0x10);
-    height = GetInt32(fData, 0x14);
-    fOff = 0x21;
-    plen = 0;
-    while (fOff < fLen) {
-        clen = GetInt32(fData, fOff); fOff += 4;
+        // Hand the result to the main thread
+        tpkLockMutex(lodlock);
+        gen->next = lodready;
+        lodready = gen;
+        tpkUnlockMutex(lodlock);
+    }
+    return;
+}
 
-        if (!strncmp(&fData[fOff], "IDAT", 4)) {
-            fOff += 4;
-            if (clen) memmove(&fData[plen], &fData[fOff], clen);
-            plen += clen;
-        } else fOff += 4;
+// Deletes a set of generated levels
+void FreeLods(GEN_LOD *gen) {
+    int x;
 
-        fOff += clen + 4;
+    for (x = 0; x < gen->lodnum; x++) {
+        free(gen->levels[x]->indexes);
+        free(gen->levels[x]->batches);
+        geoFreeModel(gen->levels[x]->mod);
+        free(gen->levels[x]);
     }
+    free(gen);
+    return;
+}
 
-    ulen = width * height * 4 + height * 2;
-    pData = malloc(ulen);
-    fLen = uncompress(pData, &ulen, fData, plen);
-    free(fData);
+// Most batches a model adds to the draw list, at whichever level it's
+// drawn. Levels that come with the file are other models, which may use
+// more textures than it does
+int ViewBatches(VIEW_MODEL *view) {
+    int x, most = view->batchnum;
 
-    if (fLen) { free(pData); return; }
+    for (x = 0; x < view->lodnum; x++)
+        if (view->lodviews[x]->batchnum > most)
+            most = view->lodviews[x]->batchnum;
+    return most;
+}
 
-    fData = malloc(ulen);
+// Attaches a set of generated levels to its model
+void AttachLods(GEN_LOD *gen) {
+    VIEW_MODEL *view = &views[gen->model];
+    int old = ViewBatches(view);
+
+    view->lod = 0;
+    view->lodnum = gen->lodnum;
+    view->lods = gen->lods;
+    view->lodviews = gen->levels;
+    view->generated = 1;
+    gen->next = lodcached;
+    lodcached = gen;
+
+    // The draw list has to hold the model at any of its new levels
+    drawitemnum += ViewBatches(view) - old;
+    drawitems = realloc(drawitems, (drawitemnum ? drawitemnum : 1) *
+        sizeof(DRAW_ITEM));
+    return;
+}
 
-    for (fLen = clen = 0; fLen < height; fLen++) {
-        ulen = height - fLen - 1;
-        memmove(&fData[clen], 
-            &pData[ulen * (width * 4 + 1) + 1], 
-            width * 4);
-        clen += width * 4;
+// Attaches levels of detail finished by the background threads
+int CollectLods() {
+    GEN_LOD *gen, *next;
+    int count = 0;
+
+    if (lodlock == NULL) return 0;
+    tpkLockMutex(lodlock);
+    gen = lodready;
+    lodready = NULL;
+    tpkUnlockMutex(lodlock);
+
+    for ( ; gen != NULL; gen = next, count++) {
+        next = gen->next;
+        AttachLods(gen);
     }
-    free(pData);
+    return count;
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, 
-        GL_RGBA, GL_UNSIGNED_BYTE, fData);
-    free(fData);
+// Checks whether background jobs have finished levels to attach
+int LodsReady() {
+    int ready;
 
+    if (lodlock == NULL) return 0;
+    tpkLockMutex(lodlock);
+    ready = (lodready != NULL);
+    tpkUnlockMutex(lodlock);
+    return ready;
+}
+
+// Checks whether background jobs are still generating levels
+int LodsPending() {
+    return lodjob != NULL && !tpkJobDone(lodjob);
+}
+
+// Hashes a file's contents with FNV-1a, to tell versions of the same
+// length apart. Only the LOD cache needs it
+unsigned int HashFile(unsigned char *fData, int fLen) {
+    unsigned int hash = 2166136261U;
+    int x;
+
+    for (x = 0; x < fLen; x++) hash = (hash ^ fData[x]) * 16777619U;
+    return hash;
+}
+
+// Identifies the version of the file the LOD cache belongs to, by the
+// modification time of what it was read from and the hash of its contents
+void LodCacheKey(long long *key) {
+    long long size;
+
+    if (!tpkFileStamp((pigg != NULL) ? piggfile : geofile, &key[0], &size))
+        key[0] = 0;
+    key[1] = geohash;
     return;
 }
 
-int main(int argc, char **argv) {
-    unsigned char *fData;
-    GEO *geo = NULL;
-    int err, fLen, x;
+// Checks that every face of a level uses only its own vertices
+int LodFacesValid(GEO_MODEL *lod) {
+    GEO_FACE *face;
+    int x;
 
-    err = CheckArgs(argc, argv); if (err) return err;
-    err = InitZlib();            if (err) return err;
-    geoVerbose(1);
+    for (x = 0; x < lod->facenum; x++) {
+        face = &lod->faces[x];
+        if (face->v1 < 0 || face->v1 >= lod->vertexnum ||
+            face->v2 < 0 || face->v2 >= lod->vertexnum ||
+            face->v3 < 0 || face->v3 >= lod->vertexnum) return 0;
+    }
+    return 1;
+}
 
-    fLen = LoadFile(argv[1], &fData);
-    if (!fLen) {
-        printf("ERROR: Could not load %s\n", argv[1]);
-        return 4;
+// Loads previously generated levels of detail from <geofile>.lod
+void ReadLodCache() {
+    int x, y, head[4], entry[2], counts[2];
+    long long key[2], want[2];
+    char fname[1024];
+    GEN_LOD *gen, *list = NULL;
+    VIEW_MODEL *level;
+    GEO_MODEL *lod;
+    FILE *fPtr;
+    float dist;
+
+    sprintf(fname, "%.1000s.lod", geofile);
+    fPtr = fopen(fname, "rb");
+    if (fPtr == NULL) return;
+
+    // The cache only applies to the version of the file it was made from
+    LodCacheKey(want);
+    if (fread(head, sizeof(int), 4, fPtr) != 4 || 
+        memcmp(head, "GLOD", 4) || head[1] != 2 || head[2] != geolen ||
+        fread(key, sizeof(long long), 2, fPtr) != 2 ||
+        key[0] != want[0] || key[1] != want[1]) {
+        fclose(fPtr);
+        return;
     }
 
-    geo = geoLoad(fData, fLen);
-    free(fData);
-    if (geo == NULL) {
-        Breakdown(geo);
-        return 5;
+    for (x = 0; x < head[3]; x++) {
+        if (fread(entry, sizeof(int), 2, fPtr) != 2 || entry[0] < 0 ||
+            entry[0] >= viewnum || entry[1] < 1 || entry[1] > LOD_LEVELS) 
+            break;
+        gen = calloc(1, sizeof(GEN_LOD));
+        gen->model = entry[0];
+
+        for (y = 0; y < entry[1]; y++) {
+            if (fread(&dist, sizeof(float), 1, fPtr) != 1 ||
+                fread(counts, sizeof(int), 2, fPtr) != 2 ||
+                counts[0] < 1 || counts[1] < 1) break;
+            lod = calloc(1, sizeof(GEO_MODEL));
+            lod->id = views[gen->model].mod->id;
+            lod->facenum = counts[0];
+            lod->vertexnum = counts[1];
+            lod->faces = malloc(counts[0] * sizeof(GEO_FACE));
+            lod->vertices = malloc(counts[1] * sizeof(GEO_VERTEX));
+            if (fread(lod->faces, sizeof(GEO_FACE), counts[0], fPtr) != 
+                (size_t) counts[0] || fread(lod->vertices,
+                sizeof(GEO_VERTEX), counts[1], fPtr) != (size_t) counts[1] ||
+                !LodFacesValid(lod)) {
+                geoFreeModel(lod);
+                break;
+            }
+
+            level = calloc(1, sizeof(VIEW_MODEL));
+            PlaceLevel(level, &views[gen->model], lod);
+            BuildBatches(level, lod, texturenum);
+            gen->lods[y].distance = dist;
+            gen->lods[y].model = gen->model;
+            gen->levels[y] = level;
+            gen->lodnum++;
+        }
+
+        gen->next = list;
+        list = gen;
+        if (y < entry[1]) break;
     }
+    fclose(fPtr);
 
-    printf("Loaded %s\n", argv[1]);
-    printf("ID = %s\n", geo->id);
+    // Use the cache only if all of it could be read
+    lodloaded = (x == head[3]);
+    for ( ; list != NULL; list = gen) {
+        gen = list->next;
+        if (lodloaded) AttachLods(list);
+        else FreeLods(list);
+    }
+    return;
+}
 
-    printf("\nTextures: %d\n", geo->texturenum);
-    for (x = 0; x < geo->texturenum; x++)
-        printf("  %3d  %s\n", x, geo->textures[x]);
+// Saves generated levels of detail to <geofile>.lod
+void WriteLodCache() {
+    int x, head[4], count;
+    long long key[2];
+    char fname[1024];
+    GEN_LOD *gen;
+    FILE *fPtr;
 
-    printf("\nModels: %d\n", geo->modelnum);
-    for (x = 0; x < geo->modelnum; x++)
-        printf("  %3d  %s\n", x, geo->models[x].id);
+    for (gen = lodcached, count = 0; gen != NULL; gen = gen->next) count++;
+    sprintf(fname, "%.1000s.lod", geofile);
+    fPtr = fopen(fname, "wb");
+    if (fPtr == NULL) return;
+
+    // Header: signature, format version, source length, entry count, then
+    // the source's modification time and hash
+    memcpy(head, "GLOD", 4);
+    head[1] = 2; head[2] = geolen; head[3] = count;
+    fwrite(head, sizeof(int), 4, fPtr);
+    LodCacheKey(key);
+    fwrite(key, sizeof(long long), 2, fPtr);
+
+    // Levels are stored in native byte order
+    for (gen = lodcached; gen != NULL; gen = gen->next) {
+        fwrite(&gen->model, sizeof(int), 1, fPtr);
+        fwrite(&gen->lodnum, sizeof(int), 1, fPtr);
+        for (x = 0; x < gen->lodnum; x++) {
+            fwrite(&gen->lods[x].distance, sizeof(float), 1, fPtr);
+            fwrite(&gen->levels[x]->mod->facenum, sizeof(int), 1, fPtr);
+            fwrite(&gen->levels[x]->mod->vertexnum, sizeof(int), 1, fPtr);
+            fwrite(gen->levels[x]->mod->faces, sizeof(GEO_FACE), 
+                gen->levels[x]->mod->facenum, fPtr);
+            fwrite(gen->levels[x]->mod->vertices, sizeof(GEO_VERTEX), 
+                gen->levels[x]->mod->vertexnum, fPtr);
+        }
+    }
 
+    fclose(fPtr);
+    return;
+}
 
+// Prepares every model in the file for gallery mode
+void LoadGallery(GEO *geo) {
+    int x, y, cols, rows;
+    VIEW_MODEL *view;
+
+    // Only needs to be done once
+    if (views != NULL) return;
+
+    // Lay the models out on a square grid
+    viewnum = geo->modelnum;
+    views = calloc(viewnum, sizeof(VIEW_MODEL));
+    for (cols = 1; cols * cols < viewnum; cols++);
+    rows = (viewnum + cols - 1) / cols;
+
+    for (x = 0; x < viewnum; x++) {
+        view = &views[x];
+        view->mod = &geo->models[x];
+        view->gx = ((float) (x % cols) - (cols - 1) * 0.5f) * GALLERY_CELL;
+        view->gy = ((rows - 1) * 0.5f - (float) (x / cols)) * GALLERY_CELL;
+        if (!view->mod->vertexnum || !view->mod->facenum) continue;
+
+        // Fit the model to its cell and group its faces by texture
+        MeasureModel(view);
+        BuildBatches(view, view->mod, texturenum);
+    }
 
-    if (initialize()) { Breakdown(geo); return 1; }
-    textures = malloc(geo->texturenum * sizeof(int));
-    glGenTextures(geo->texturenum, textures);
-    for (x = 0; x < geo->texturenum; x++)
-        LoadTexture(geo->textures[x], x);
+    // Levels of detail that come with the file
+    for (x = 0; x < viewnum; x++) {
+        view = &views[x];
+        if (!view->mod->lodnum) continue;
+        view->lodnum = view->mod->lodnum;
+        view->lods = view->mod->lods;
+        view->lodviews = malloc(view->lodnum * sizeof(VIEW_MODEL *));
+        for (y = 0; y < view->lodnum; y++)
+            view->lodviews[y] = &views[view->lods[y].model];
+    }
 
-    LoadModel(geo);
-    prgloop(geo);
+    // Storage for the per-frame draw list, with room for every model at
+    // its largest level
+    for (x = drawitemnum = 0; x < viewnum; x++)
+        drawitemnum += ViewBatches(&views[x]);
+    drawitems = malloc((drawitemnum ? drawitemnum : 1) * sizeof(DRAW_ITEM));
+    drawmatrices = malloc((viewnum ? viewnum : 1) * 16 * sizeof(float));
+
+    // Generate levels of detail for the remaining models in the background
+    if (lodcache) ReadLodCache();
+    if (lodloaded) return;
+    lodlock = tpkCreateMutex();
+    lodjob = tpkJobCreateRange(LodJob, NULL, viewnum, 1, NULL);
+    tpkJobRun(lodjob);
+    return;
+}
 
-    glDeleteTextures(geo->texturenum, textures);
-    free(textures);
+// Releases gallery mode resources
+void FreeGallery() {
+    GEN_LOD *gen;
+    int x, complete;
+
+    if (views == NULL) return;
+
+    // Stop generating levels of detail, only a complete set gets cached
+    if (lodlock != NULL) {
+        complete = tpkJobDone(lodjob);
+        tpkAtomicSet(&lodstop, 1);
+        tpkJobWait(lodjob);
+        lodjob = NULL;
+        CollectLods();
+        tpkDelete(lodlock);
+        lodlock = NULL;
+        if (lodcache && complete) WriteLodCache();
+    }
 
-    uninitialize();
-    Breakdown(geo);
+    // Generated levels belong to the viewer
+    while (lodcached != NULL) {
+        gen = lodcached;
+        lodcached = gen->next;
+        FreeLods(gen);
+    }
 
-    return 0;
+    for (x = 0; x < viewnum; x++) {
+        if (views[x].indexes != NULL) free(views[x].indexes);
+        if (views[x].batches != NULL) free(views[x].batches);
+        if (views[x].lodviews != NULL && !views[x].generated)
+            free(views[x].lodviews);
+    }
+    free(views);
+    free(drawitems);
+    free(drawmatrices);
+    views = NULL;
+    return;
+}
+
+// Centers the gallery camera on the selected model
+void FocusGallery() {
+    VIEW_MODEL *view = &views[model];
+
+    if (hWnd != NULL) {
+        sprintf(hWnd->text, "Gallery: %d %s", model, view->mod->id);
+        tpkUpdate(hWnd);
+    }
+    xsft = -view->gx;
+    ysft = -view->gy;
+    return;
+}
+
+// Switches between single-model view and gallery mode
+void SetGallery(GEO *geo, int enable) {
+    gallery = enable;
+    if (gallery) {
+        LoadGallery(geo);
+        znear = 1.0; zfar = 2000.0;
+        xrot = yrot = zrot = 0.0f;
+        zsft = -70.0f;
+        FocusGallery();
+    } else {
+        znear = 0.1; zfar = 100.0;
+        LoadModel(geo);
+    }
+    return;
+}
+
+// Captures what the next frame is drawn from
+void MakeState(GEO *geo, VIEW_STATE *s) {
+    s->xrot = xrot; s->yrot = yrot;
+    s->xsft = xsft; s->ysft = ysft; s->zsft = zsft;
+    s->gallery = gallery;
+    s->model = model;
+    s->view = current;
+    s->colors = (aobake && !gallery) ? ModelAO(geo, model) : NULL;
+    s->pickmodel = pickmodel;
+    s->pickface = pickface;
+    s->width  = viewwidth;
+    s->height = viewheight;
+    s->znear = znear; s->zfar = zfar; s->aspect = aspect;
+    s->overlay = overlay;
+    s->turn = turnframe;
+    s->turnserial = turnserial;
+    if (turnframe >= 0) s->pickmodel = s->pickface = -1;
+    s->bench = benchframe;
+    s->benchserial = benchserial;
+    return;
+}
+
+// Exchanges a slot of the triple buffer for the shared one, returning the
+// shared one as it was
+int SwapState(int slot) {
+    int old;
+
+    do old = tpkAtomicGet(&statemid);
+    while (!tpkAtomicCas(&statemid, old, slot));
+    return old;
+}
+
+// Hands the render thread a new view state, replacing any it hasn't taken.
+// The state carries the input of the one before it, which may be replaced
+// before it's drawn, and keeps its own input for the next one the same way
+void PublishState(GEO *geo) {
+    VIEW_STATE *s = &states[statewrite];
+    unsigned long long input = inputnext, carry = inputcarry;
+    int old;
+
+    MakeState(geo, s);
+    s->input = input;
+    s->carry = carry;
+    old = SwapState(statewrite | STATE_FRESH);
+    statewrite = old & 3;
+    inputnext = 0;
+
+    // Getting a fresh slot back means the state before was never taken
+    inputcarry = input;
+    if ((old & STATE_FRESH) && carry && (!input || carry < input))
+        inputcarry = carry;
+
+    tpkLockMutex(renderlock);
+    tpkSignalCond(renderwake);
+    tpkUnlockMutex(renderlock);
+    return;
+}
+
+// Takes the latest view state on the render thread, NULL if there's none
+// newer than the last one taken
+VIEW_STATE* TakeState() {
+    if (!(tpkAtomicGet(&statemid) & STATE_FRESH)) return NULL;
+    stateread = SwapState(stateread) & 3;
+    return &states[stateread];
+}
+
+// Holds the render thread off the scene while what it draws changes
+void LockScene() {
+    tpkLockMutex(scenelock);
+    return;
+}
+
+// Lets the render thread back onto the scene, with a view state that has
+// the changes, so it never draws an older one pointing at what's gone
+void UnlockScene(GEO *geo) {
+    PublishState(geo);
+    tpkUnlockMutex(scenelock);
+    return;
+}
+
+// Rotation shared by all models: glRotatef(xrot, X) * glRotatef(yrot, Y)
+void ViewRotation(VIEW_STATE *s, float *r) {
+    float sa, ca, sb, cb;
+
+    sa = (float) sin(s->xrot * 0.0174532925);
+    ca = (float) cos(s->xrot * 0.0174532925);
+    sb = (float) sin(s->yrot * 0.0174532925);
+    cb = (float) cos(s->yrot * 0.0174532925);
+    r[0] =  cb;      r[3] = 0.0f; r[6] =  sb;
+    r[1] =  sa * sb; r[4] = ca;   r[7] = -sa * cb;
+    r[2] = -ca * sb; r[5] = sa;   r[8] =  ca * cb;
+    return;
+}
+
+// Eye space position of a model's center, as drawn in either mode
+void ViewEye(VIEW_STATE *s, VIEW_MODEL *view, float *e) {
+    e[0] = s->xsft;
+    e[1] = s->ysft;
+    e[2] = -15.0f + s->zsft;
+    if (s->gallery) { e[0] += view->gx; e[1] += view->gy; }
+    return;
+}
+
+// Model matrix: T(eye) * R * S(-scale, scale, scale) * T(-center)
+void ModelMatrix(VIEW_MODEL *view, float *e, float *r, float *m) {
+    int y;
+
+    for (y = 0; y < 3; y++) {
+        m[y]     = -r[y]     * view->scale;
+        m[y + 4] =  r[y + 3] * view->scale;
+        m[y + 8] =  r[y + 6] * view->scale;
+    }
+    m[12] = e[0] - m[0] * view->cx - m[4] * view->cy - m[8]  * view->cz;
+    m[13] = e[1] - m[1] * view->cx - m[5] * view->cy - m[9]  * view->cz;
+    m[14] = e[2] - m[2] * view->cx - m[6] * view->cy - m[10] * view->cz;
+    m[3] = m[7] = m[11] = 0.0f; m[15] = 1.0f;
+    return;
+}
+
+// Builds a model's picking hierarchy, run as a job
+void BvhJob(void *param) {
+    PICK_BVH *pick = param;
+
+    tpkTraceBegin("BvhJob");
+    pick->bvh = geoBuildBvh(pick->mod);
+    tpkTraceEnd();
+    return;
+}
+
+// Returns a model's picking hierarchy, starting to build it the first time.
+// NULL while it's being built, unless told to wait for it
+GEO_BVH* ModelBvh(GEO *geo, int x, int wait) {
+    PICK_BVH *pick;
+
+    if (picks == NULL) {
+        picknum = geo->modelnum;
+        picks = calloc(picknum ? picknum : 1, sizeof(PICK_BVH));
+    }
+    pick = &picks[x];
+    if (pick->mod == NULL) {
+        pick->mod = &geo->models[x];
+        pick->job = tpkJobCreate(BvhJob, pick, NULL);
+        if (pick->job == NULL) BvhJob(pick);
+        else tpkJobRun(pick->job);
+    }
+    if (pick->job != NULL && (wait || tpkJobDone(pick->job))) {
+        tpkJobWait(pick->job);
+        pick->job = NULL;
+    }
+    return (pick->job == NULL) ? pick->bvh : NULL;
+}
+
+// Releases the picking hierarchies, waiting for the ones being built
+void FreePicks() {
+    int x;
+
+    for (x = 0; x < picknum; x++) {
+        if (picks[x].job != NULL) tpkJobWait(picks[x].job);
+        if (picks[x].bvh != NULL) geoFreeBvh(picks[x].bvh);
+    }
+    free(picks);
+    picks = NULL;
+    picknum = 0;
+    pickmodel = pickface = -1;
+    return;
+}
+
+// Casts an eye space ray from the camera at one model, keeping the hit if
+// it's nearer than *dist. Returns the face hit, -1 if none or -2 if the
+// model's hierarchy isn't ready yet
+int PickView(GEO *geo, VIEW_STATE *s, int x, VIEW_MODEL *view, float *r,
+    float *d, float *dist, int wait) {
+    float e[3], o[3], md[3], tc, dd, ee;
+    GEO_BVH *bvh;
+    int y;
+
+    // Skip models whose bounding sphere the ray misses or starts beyond
+    ViewEye(s, view, e);
+    dd = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    tc = (e[0] * d[0] + e[1] * d[1] + e[2] * d[2]) / dd;
+    ee = e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+    if (ee - tc * tc * dd > view->radius * view->radius) return -1;
+    if ((tc - view->radius / (float) sqrt(dd)) > *dist) return -1;
+
+    bvh = ModelBvh(geo, x, wait);
+    if (bvh == NULL) return view->mod->facenum ? -2 : -1;
+
+    // Into model space: p = center + S^-1 * R^T * (q - eye)
+    for (y = 0; y < 3; y++) {
+        o[y]  = -(r[y * 3] * e[0] + r[y * 3 + 1] * e[1] +
+            r[y * 3 + 2] * e[2]) / view->scale;
+        md[y] = (r[y * 3] * d[0] + r[y * 3 + 1] * d[1] +
+            r[y * 3 + 2] * d[2]) / view->scale;
+    }
+    o[0] = view->cx - o[0]; md[0] = -md[0];
+    o[1] += view->cy;
+    o[2] += view->cz;
+    return geoPick(bvh, o, md, dist);
+}
+
+// Finds the model and face under the cursor. Returns 1 if they changed,
+// and keeps pickdirty set while a hierarchy that may be hit is being built
+int UpdatePick(GEO *geo, int wait) {
+    int x, face, hitmodel = -1, hitface = -1, changed;
+    float r[9], d[3], dist, ty;
+    VIEW_STATE s;
+
+    // A ray from the camera through the center of the cursor's pixel
+    pickdirty = 0;
+    MakeState(geo, &s);
+    if (mousex >= 0 && hWnd->width > 0 && hWnd->height > 0) {
+        ty = (float) tan(45.0 * 0.0087266463);
+        d[0] = (2.0f * (mousex + 0.5f) / hWnd->width - 1.0f) * ty *
+            (float) aspect;
+        d[1] = (1.0f - 2.0f * (mousey + 0.5f) / hWnd->height) * ty;
+        d[2] = -1.0f;
+        dist = (float) zfar;
+        ViewRotation(&s, r);
+
+        // Every model in the gallery, or the one on its own
+        if (gallery) {
+            for (x = 0; x < viewnum; x++) {
+                if (!views[x].batchnum) continue;
+                face = PickView(geo, &s, x, &views[x], r, d, &dist, wait);
+                if (face == -2) pickdirty = 1;
+                if (face >= 0) { hitmodel = x; hitface = face; }
+            }
+        } else if (current != NULL && current->batchnum) {
+            face = PickView(geo, &s, model, current, r, d, &dist, wait);
+            if (face == -2) pickdirty = 1;
+            if (face >= 0) { hitmodel = model; hitface = face; }
+        }
+    }
+
+    changed = (hitmodel != pickmodel || hitface != pickface);
+    pickmodel = hitmodel;
+    pickface = hitface;
+    return changed;
+}
+
+// Names the model, face and texture under the cursor in the title bar
+void ShowPick(GEO *geo) {
+    GEO_MODEL *mod;
+    int tex;
+
+    UpdatePick(geo, 1);
+    if (pickmodel < 0) return;
+    mod = &geo->models[pickmodel];
+    tex = mod->faces[pickface].texture;
+    sprintf(hWnd->text, "%d %.100s: face %d, %.100s", pickmodel, mod->id,
+        pickface, (tex >= 0 && tex < geo->texturenum) ?
+        geo->textures[tex] : "no texture");
+    tpkUpdate(hWnd);
+    return;
+}
+
+// Outlines the face under the cursor over everything else
+void DrawPick(VIEW_STATE *s) {
+    float e[3], r[9], m[16];
+    VIEW_MODEL *view;
+    GEO_VERTEX *v;
+    GEO_FACE *f;
+
+    if (s->pickmodel < 0 || (!s->gallery && s->pickmodel != s->model))
+        return;
+    view = s->gallery ? &views[s->pickmodel] : s->view;
+    if (view == NULL || view->mod == NULL) return;
+    f = &view->mod->faces[s->pickface];
+    v = view->mod->vertices;
+
+    ViewRotation(s, r);
+    ViewEye(s, view, e);
+    ModelMatrix(view, e, r, m);
+    glLoadMatrixf(m);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glColor3f(1.0f, 1.0f, 0.0f);
+    glBegin(GL_LINE_LOOP);
+        glVertex3fv(&v[f->v1].x);
+        glVertex3fv(&v[f->v2].x);
+        glVertex3fv(&v[f->v3].x);
+    glEnd();
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_TEXTURE_2D);
+    glLoadIdentity();
+    return;
+}
+
+// Starts recording a turntable of the view as it is
+void StartTurntable() {
+    turnbase = yrot;
+    turnframe = 0;
+    turnserial = tpkAtomicGet(&turnacked);
+    printf("Recording a turntable of %d frames\n", turnframes);
+    return;
+}
+
+// Process window events
+int events(GEO *geo) {
+    int arg1, arg2, event, closing = 0;
+    unsigned int old = model;
+    unsigned long long time;
+
+    // Read all supported events
+    tpkTraceBegin("events");
+    event = TPK_EVENT_NONE;
+    do {
+        event = tpkNextEventEx(hWnd, &arg1, &arg2, &time);
+
+        // The next view state answers the earliest input since the last one
+        if ((event == TPK_EVENT_KEYDOWN || event == TPK_EVENT_MOUSEDOWN ||
+            event == TPK_EVENT_MOUSEMOVE) && !inputnext) inputnext = time;
+
+        switch (event) {
+        case TPK_EVENT_CLOSE:
+            closing = 1;
+            break;
+        case TPK_EVENT_RESIZE:
+            configaspect(hWnd->width, hWnd->height);
+            redraw = pickdirty = 1;
+            break;
+        case TPK_EVENT_MOUSEMOVE:
+            mousex = arg1;
+            mousey = arg2;
+            pickdirty = 1;
+            break;
+        case TPK_EVENT_MOUSEDOWN:
+            if (arg1 != TPK_MOUSE_LEFT) break;
+            ShowPick(geo);
+            redraw = 1;
+            break;
+        case TPK_EVENT_PAINT:
+            redraw = 1;
+            break;
+        case TPK_EVENT_KEYUP:
+            if (arg1 == 37) rot[0] = 0;
+            if (arg1 == 39) rot[1] = 0;
+            if (arg1 == 38) rot[2] = 0;
+            if (arg1 == 40) rot[3] = 0;
+            if (arg1 == 46) rot[4] = 0;
+            if (arg1 == 34) rot[5] = 0;
+            if (arg1 == 36) rot[6] = 0;
+            if (arg1 == 35) rot[7] = 0;
+            if (arg1 == 45) rot[8] = 0;
+            if (arg1 == 33) rot[9] = 0;
+            break;
+        case TPK_EVENT_KEYDOWN:
+            if (arg1 == 37) rot[0] = 1;
+            if (arg1 == 39) rot[1] = 1;
+            if (arg1 == 38) rot[2] = 1;
+            if (arg1 == 40) rot[3] = 1;
+            if (arg1 == 46) rot[4] = 1;
+            if (arg1 == 34) rot[5] = 1;
+            if (arg1 == 36) rot[6] = 1;
+            if (arg1 == 35) rot[7] = 1;
+            if (arg1 == 45) rot[8] = 1;
+            if (arg1 == 33) rot[9] = 1;
+
+            redraw = pickdirty = 1;
+            if (arg1 == 76) overlay = !overlay;
+            if (arg1 == 67) tpkAtomicSet(&shotwant, 1);
+            if (arg1 == 84 && turnframe < 0) StartTurntable();
+            if (arg1 == 71) {
+                LockScene();
+                SetGallery(geo, !gallery);
+                UnlockScene(geo);
+                break;
+            }
+
+            if (arg1 == 32) model++;
+            if (arg1 ==  8) model--;
+            if (model == (unsigned int) -1) model += geo->modelnum;
+            if (model == (unsigned int) geo->modelnum) model = 0;
+            if (model != old) {
+                if (gallery) FocusGallery();
+                else {
+                    LockScene();
+                    LoadModel(geo);
+                    UnlockScene(geo);
+                }
+            }
+            break;
+        default: break;
+        }
+
+    } while (event != TPK_EVENT_NONE);
+
+    tpkTraceEnd();
+    return closing;
+}
+
+// Animate one frame's worth
+void animate() {
+    float step = gallery ? 8.0f : 1.0f; // Gallery spans a much larger area
+
+    tpkTraceBegin("animate");
+    if (rot[0]) yrot -= 1.0f;
+    if (rot[1]) yrot += 1.0f;
+    if (rot[2]) xrot -= 1.0f;
+    if (rot[3]) xrot += 1.0f;
+    if (yrot < 0.0f) yrot += 360.0f;
+    if (yrot > 360.0f) yrot -= 360.0f;
+    if (xrot < -90.0f) xrot = -90.0;
+    if (xrot > 90.0f) xrot = 90.0f;
+
+    if (rot[4]) xsft -= 0.03f * step;
+    if (rot[5]) xsft += 0.03f * step;
+    if (rot[6]) ysft += 0.03f * step;
+    if (rot[7]) ysft -= 0.03f * step;
+    if (rot[8]) zsft -= 0.05f * step;
+    if (rot[9]) zsft += 0.05f * step;
+
+    tpkTraceEnd();
+    return;
+}
+
+// Turns the view to the next turntable frame once the render thread has
+// captured the one before and has room to save another. Returns whether
+// it moved
+int StepTurntable() {
+    if (turnframe < 0 || tpkAtomicGet(&turnacked) <= turnserial ||
+        tpkAtomicGet(&capturebusy) >= CAPTURE_JOBS) return 0;
+    turnframe++;
+    turnserial++;
+    if (turnframe == turnframes) {
+        turnframe = -1;
+        yrot = turnbase;
+        printf("Recorded the turntable to %s\n", capturedir);
+        return 1;
+    }
+    yrot = (float) fmod(turnbase + 360.0 * turnframe / turnframes, 360.0);
+    return 1;
+}
+
+// Picks vsync or a timed frame rate and looks up the fence functions
+void InitPacing() {
+    const char *version, *exts;
+    int x;
+
+    // Benchmarks draw flat out, and an explicit frame rate replaces vsync,
+    // which would only slow either down
+    if (benchfile != NULL) framerate = 0;
+    if (framerate || benchfile != NULL) tpkSwapInterval(hRC, 0);
+    else if (tpkSwapInterval(hRC, 1)) vsync = 1;
+    else framerate = FRAME_RATE;
+
+    // Fences bound how far the CPU runs ahead without a glFinish() stall
+    version = (const char *) glGetString(GL_VERSION);
+    exts = (const char *) glGetString(GL_EXTENSIONS);
+    if ((version != NULL && atof(version) >= 3.2) ||
+        (exts != NULL && strstr(exts, "GL_ARB_sync") != NULL)) {
+        glFenceSyncP = (GL_FENCESYNC) tpkGetProcAddress("glFenceSync");
+        glClientWaitSyncP =
+            (GL_CLIENTWAITSYNC) tpkGetProcAddress("glClientWaitSync");
+        glDeleteSyncP = (GL_DELETESYNC) tpkGetProcAddress("glDeleteSync");
+    }
+    if (!glFenceSyncP || !glClientWaitSyncP || !glDeleteSyncP)
+        glFenceSyncP = NULL;
+    for (x = 0; x < FRAME_LAG; x++) fences[x] = NULL;
+    return;
+}
+
+// Presents a frame, then waits for the GPU to finish the frame FRAME_LAG ago.
+// Gives the tpkClock() values of the swap and of the GPU finishing the frame,
+// which is only waited for when asked to, and is 0 when it isn't known
+void EndFrame(int wait, unsigned long long *swap, unsigned long long *done) {
+    void **fence;
+
+    tpkSwapBuffers(hRC);
+    *swap = tpkClock();
+    *done = 0;
+    if (glFenceSyncP == NULL) return;
+
+    fence = &fences[fencenext];
+    fencenext = (fencenext + 1) % FRAME_LAG;
+    if (*fence != NULL) {
+        glClientWaitSyncP(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+        glDeleteSyncP(*fence);
+    }
+    *fence = glFenceSyncP(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // Waiting now costs the overlap with the next frame, so only on request
+    if (wait && *fence != NULL) {
+        glClientWaitSyncP(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+        *done = tpkClock();
+    }
+    return;
+}
+
+// Picks the earliest input a view state is the first to show, 0 for none.
+// Only the render thread calls this, in the order the states are drawn
+unsigned long long NewInput(VIEW_STATE *s) {
+    unsigned long long input = 0;
+
+    // The carried input is older than the state's own
+    if (s->carry > lat.shown) input = s->carry;
+    else if (s->input > lat.shown) input = s->input;
+    if (s->carry > lat.shown) lat.shown = s->carry;
+    if (s->input > lat.shown) lat.shown = s->input;
+    return input;
+}
+
+// Adds a presented frame to the latency measurements and the log
+void RecordFrame(unsigned long long input, unsigned long long swap,
+    unsigned long long done) {
+    double frame = -1.0;
+
+    // Time since the frame before, unless nothing was drawn in between
+    if (!lat.count) lat.start = swap;
+    if (lat.last && swap - lat.last < LAT_IDLE * 1000000ULL) {
+        frame = (double) (swap - lat.last) / 1000000.0;
+        lat.frames[lat.framenum++ % LAT_WINDOW] = frame;
+    }
+    lat.last = swap;
+    lat.count++;
+
+    // Input is on screen once the GPU has finished, or at least swapped
+    if (input && input < swap)
+        lat.latency[lat.latnum++ % LAT_WINDOW] =
+            (double) ((done ? done : swap) - input) / 1000000.0;
+
+    // One line per frame, leaving out what wasn't measured
+    if (lat.log == NULL) return;
+    fprintf(lat.log, "%u,%.3f,", lat.count,
+        (double) (swap - lat.start) / 1000000.0);
+    if (frame >= 0.0) fprintf(lat.log, "%.3f", frame);
+    fprintf(lat.log, ",");
+    if (input && input < swap)
+        fprintf(lat.log, "%.3f", (double) (swap - input) / 1000000.0);
+    fprintf(lat.log, ",");
+    if (input && input < done)
+        fprintf(lat.log, "%.3f", (double) (done - input) / 1000000.0);
+    fprintf(lat.log, "\n");
+    return;
+}
+
+// Compares two times for qsort()
+int CompareTimes(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Picks the 50th, 95th and 99th percentiles out of sorted times by
+// nearest rank
+void RankTimes(double *sorted, int num, double *p) {
+    static const double ranks[3] = {0.5, 0.95, 0.99};
+    int x, rank;
+
+    for (x = 0; x < 3; x++) {
+        rank = (int) ceil(ranks[x] * num) - 1;
+        p[x] = sorted[(rank < 0) ? 0 : rank];
+    }
+    return;
+}
+
+// Finds the 50th, 95th and 99th percentiles of the samples in a window,
+// returning how many there are
+int Percentiles(double *window, int num, double *p) {
+    double sorted[LAT_WINDOW];
+
+    // Only the samples still in the window count
+    if (num > LAT_WINDOW) num = LAT_WINDOW;
+    if (num < 1) { p[0] = p[1] = p[2] = 0.0; return 0; }
+    memcpy(sorted, window, num * sizeof(double));
+    qsort(sorted, num, sizeof(double), CompareTimes);
+    RankTimes(sorted, num, p);
+    return num;
+}
+
+// Draws text of digits, '.', '-', 'F' and 'P' as seven segment characters,
+// with the bottom left corner of the first at x, y
+void DrawDigits(float x, float y, float size, char *text) {
+    static const unsigned char digits[10] =
+        {0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F};
+    static const float segs[7][4] = { // a to g, in half heights
+        {0, 2, 1, 2}, {1, 2, 1, 1}, {1, 1, 1, 0}, {0, 0, 1, 0},
+        {0, 0, 0, 1}, {0, 1, 0, 2}, {0, 1, 1, 1}};
+    float w = size * 0.5f, h = size * 0.5f;
+    int bits, seg;
+
+    glBegin(GL_LINES);
+    for (; *text; text++) {
+        if (*text == '.') {
+            glVertex2f(x, y); glVertex2f(x + 1.0f, y);
+            x += w * 0.6f;
+            continue;
+        }
+
+        // Look the segments up, anything unknown is a space
+        if (*text >= '0' && *text <= '9') bits = digits[*text - '0'];
+        else if (*text == '-') bits = 0x40;
+        else if (*text == 'F') bits = 0x71;
+        else if (*text == 'P') bits = 0x73;
+        else bits = 0;
+        for (seg = 0; seg < 7; seg++) {
+            if (!(bits & (1 << seg))) continue;
+            glVertex2f(x + segs[seg][0] * w, y + segs[seg][1] * h);
+            glVertex2f(x + segs[seg][2] * w, y + segs[seg][3] * h);
+        }
+        x += w * 1.6f;
+    }
+    glEnd();
+    return;
+}
+
+// Draws the latency percentiles and a histogram of recent frame times over
+// the top left of the frame
+void DrawOverlay(VIEW_STATE *s) {
+    static const float colors[3][3] =
+        {{0.3f, 1.0f, 0.3f}, {1.0f, 1.0f, 0.3f}, {1.0f, 0.3f, 0.3f}};
+    static char *names[3] = {"P50", "P95", "P99"};
+    int counts[LAT_BUCKETS], x, num, most;
+    float top = (float) s->height - 24.0f;
+    double p[3];
+    char text[32];
+
+    // Screen space, in pixels from the bottom left
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glMatrixMode(GL_PROJECTION); glLoadIdentity();
+    glOrtho(0.0, s->width, 0.0, s->height, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);  glLoadIdentity();
+
+    // Input latency percentiles, in milliseconds
+    num = Percentiles(lat.latency, lat.latnum, p);
+    for (x = 0; x < 3; x++) {
+        if (num) sprintf(text, "%s %.1f", names[x], p[x]);
+        else sprintf(text, "%s -", names[x]);
+        glColor3fv(colors[x]);
+        DrawDigits(10.0f, top - x * 22.0f, 14.0f, text);
+    }
+
+    // Median frame time, then how recent frame times spread out below it
+    num = Percentiles(lat.frames, lat.framenum, p);
+    if (num) sprintf(text, "F %.1f", p[0]);
+    else sprintf(text, "F -");
+    glColor3f(1.0f, 1.0f, 1.0f);
+    DrawDigits(10.0f, top - 66.0f, 14.0f, text);
+    for (x = 0; x < LAT_BUCKETS; x++) counts[x] = 0;
+    for (x = 0; x < num; x++)
+        counts[(lat.frames[x] < LAT_BUCKETS - 1) ?
+            (int) lat.frames[x] : LAT_BUCKETS - 1]++;
+    for (x = most = 0; x < LAT_BUCKETS; x++)
+        if (counts[x] > most) most = counts[x];
+    glBegin(GL_QUADS);
+    for (x = 0; x < LAT_BUCKETS && most; x++) {
+        glVertex2f(10.0f + x * 4.0f, top - 130.0f);
+        glVertex2f(13.0f + x * 4.0f, top - 130.0f);
+        glVertex2f(13.0f + x * 4.0f, top - 130.0f + 50.0f * counts[x] / most);
+        glVertex2f(10.0f + x * 4.0f, top - 130.0f + 50.0f * counts[x] / most);
+    }
+    glEnd();
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_TEXTURE_2D);
+    return;
+}
+
+// Opens the latency log given on the command line, returning nonzero if it
+// couldn't be made
+int OpenLatency() {
+    lat.log = fopen(latfile, "w");
+    if (lat.log == NULL) {
+        printf("ERROR: Could not write %s\n", latfile);
+        return 1;
+    }
+    fprintf(lat.log, "frame,present_ms,frame_ms,swap_latency_ms,"
+        "done_latency_ms\n");
+    return 0;
+}
+
+// Prints how the latency measured turned out and closes the log
+void CloseLatency() {
+    double p[3];
+    int num;
+
+    num = Percentiles(lat.latency, lat.latnum, p);
+    if (num) printf("Input latency over the last %d inputs: p50 %.1f, "
+        "p95 %.1f, p99 %.1f ms\n", num, p[0], p[1], p[2]);
+    num = Percentiles(lat.frames, lat.framenum, p);
+    if (num) printf("Frame time over the last %d frames: p50 %.1f, "
+        "p95 %.1f, p99 %.1f ms\n", num, p[0], p[1], p[2]);
+    if (lat.log != NULL) fclose(lat.log);
+    lat.log = NULL;
+    return;
+}
+
+// Keeps what a benchmark frame took to draw, then lets the main thread hand
+// over the next one. Without fences the GPU is waited for here instead
+void BenchFrame(VIEW_STATE *s, unsigned long long start,
+    unsigned long long done) {
+    if (!done) {
+        glFinish();
+        done = tpkClock();
+    }
+    if (s->bench >= 0) {
+        benchframes[s->bench] = drawstats;
+        benchframes[s->bench].ms = (double) (done - start) / 1000000.0;
+    }
+
+    tpkLockMutex(renderlock);
+    tpkAtomicSet(&benchacked, s->benchserial);
+    tpkSignalCond(benchwake);
+    tpkUnlockMutex(renderlock);
+    return;
+}
+
+// Looks up the pixel buffer functions frames are captured through, which
+// without them are read back straight away
+void InitCapture() {
+    const char *version, *exts;
+    int x;
+
+    version = (const char *) glGetString(GL_VERSION);
+    exts = (const char *) glGetString(GL_EXTENSIONS);
+    if ((version != NULL && atof(version) >= 2.1) || (exts != NULL &&
+        strstr(exts, "GL_ARB_pixel_buffer_object") != NULL)) {
+        glGenBuffersP = (GL_GENBUFFERS) tpkGetProcAddress("glGenBuffers");
+        glDeleteBuffersP =
+            (GL_DELETEBUFFERS) tpkGetProcAddress("glDeleteBuffers");
+        glBindBufferP = (GL_BINDBUFFER) tpkGetProcAddress("glBindBuffer");
+        glBufferDataP = (GL_BUFFERDATA) tpkGetProcAddress("glBufferData");
+        glMapBufferP = (GL_MAPBUFFER) tpkGetProcAddress("glMapBuffer");
+        glUnmapBufferP = (GL_UNMAPBUFFER) tpkGetProcAddress("glUnmapBuffer");
+    }
+    if (!glGenBuffersP || !glDeleteBuffersP || !glBindBufferP ||
+        !glBufferDataP || !glMapBufferP || !glUnmapBufferP)
+        glGenBuffersP = NULL;
+    for (x = 0; x < CAPTURE_RING; x++) {
+        reads[x].buffer = 0;
+        reads[x].size = 0;
+        reads[x].frame = -1;
+    }
+    return;
+}
+
+// Saves a captured frame, as PNG with the rows spread over the job system
+void SaveJob(void *param) {
+    CAPTURE_JOB *cap = param;
+    FILE *fPtr;
+    int err;
+
+    tpkTraceBegin("SaveJob");
+    if (rawcapture) {
+        fPtr = fopen(cap->name, "wb");
+        err = (fPtr == NULL);
+        if (fPtr != NULL) {
+            err = fwrite(cap->pixels, cap->width * 4, cap->height, fPtr) !=
+                (size_t) cap->height;
+            if (fclose(fPtr)) err = 1;
+        }
+    } else err = rasWritePNGFast(cap->name, cap->width, cap->height,
+        cap->pixels, tpkCpuCount());
+    if (err) printf("ERROR: Could not write %s\n", cap->name);
+    free(cap->pixels);
+    cap->pixels = NULL;
+    tpkAtomicAdd(&capturebusy, -1);
+    tpkTraceEnd();
+    return;
+}
+
+// Hands a captured frame, bottom row first, to a job that saves it
+void SaveFrame(char *name, int width, int height, unsigned char *pixels) {
+    CAPTURE_JOB *cap = NULL;
+    int x;
+
+    // Take a free slot, or one whose frame is saved, or wait for the first
+    for (x = 0; x < CAPTURE_JOBS && cap == NULL; x++)
+        if (captures[x].job == NULL || tpkJobDone(captures[x].job))
+            cap = &captures[x];
+    if (cap == NULL) cap = &captures[0];
+    if (cap->job != NULL) tpkJobWait(cap->job);
+
+    // Files start with the top row
+    cap->pixels = malloc(width * height * 4);
+    for (x = 0; x < height; x++)
+        memcpy(&cap->pixels[x * width * 4],
+            &pixels[(height - 1 - x) * width * 4], width * 4);
+    strcpy(cap->name, name);
+    cap->width = width;
+    cap->height = height;
+    tpkAtomicAdd(&capturebusy, 1);
+    cap->job = tpkJobCreate(SaveJob, cap, NULL);
+    if (cap->job == NULL) SaveJob(cap);
+    else tpkJobRun(cap->job);
+    return;
+}
+
+// Copies a frame out of its pixel buffer once it has arrived
+void FinishRead(CAPTURE_READ *read) {
+    unsigned char *pixels;
+
+    glBindBufferP(GL_PIXEL_PACK_BUFFER, read->buffer);
+    pixels = glMapBufferP(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels != NULL) {
+        SaveFrame(read->name, read->width, read->height, pixels);
+        glUnmapBufferP(GL_PIXEL_PACK_BUFFER);
+    } else printf("ERROR: Could not read back %s\n", read->name);
+    glBindBufferP(GL_PIXEL_PACK_BUFFER, 0);
+    read->frame = -1;
+    return;
+}
+
+// Finishes the reads of frames the GPU is done with, going by the fences
+// EndFrame() waits on, or all of them
+void CollectReads(int all) {
+    int x;
+
+    for (x = 0; x < CAPTURE_RING; x++) {
+        if (reads[x].frame < 0) continue;
+        if (all || framecount - reads[x].frame >= FRAME_LAG)
+            FinishRead(&reads[x]);
+    }
+    return;
+}
+
+// Starts reading the frame just drawn back to be saved as name. Through a
+// pixel buffer the copy happens while the next frames are drawn
+void ReadFrame(VIEW_STATE *s, char *name) {
+    CAPTURE_READ *read;
+    unsigned char *pixels;
+    int size = s->width * s->height * 4;
+
+    // Without pixel buffers, the copy stalls until the frame is done
+    if (glGenBuffersP == NULL) {
+        pixels = malloc(size);
+        glReadPixels(0, 0, s->width, s->height, GL_RGBA, GL_UNSIGNED_BYTE,
+            pixels);
+        SaveFrame(name, s->width, s->height, pixels);
+        free(pixels);
+        return;
+    }
+
+    // The next buffer of the ring, finishing what it holds first
+    read = &reads[readnext];
+    readnext = (readnext + 1) % CAPTURE_RING;
+    if (read->frame >= 0) FinishRead(read);
+    if (!read->buffer) glGenBuffersP(1, &read->buffer);
+    glBindBufferP(GL_PIXEL_PACK_BUFFER, read->buffer);
+    if (read->size != size) {
+        glBufferDataP(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        read->size = size;
+    }
+    glReadPixels(0, 0, s->width, s->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBufferP(GL_PIXEL_PACK_BUFFER, 0);
+    read->width = s->width;
+    read->height = s->height;
+    read->frame = framecount;
+    strcpy(read->name, name);
+    return;
+}
+
+// Captures the frame just drawn when it's a turntable frame or a
+// screenshot was asked for
+void CaptureFrame(VIEW_STATE *s) {
+    char fname[1024], *ext = rawcapture ? "rgba" : "png";
+
+    // Turntable frames are each captured once, in order
+    if (s->turn >= 0 && s->turnserial == tpkAtomicGet(&turnacked)) {
+        if (!s->turn) turnnum++;
+        sprintf(fname, "%.900s/turn%02d_%04d.%s", capturedir, turnnum,
+            s->turn, ext);
+        ReadFrame(s, fname);
+        tpkAtomicSet(&turnacked, s->turnserial + 1);
+    }
+    if (tpkAtomicCas(&shotwant, 1, 0)) {
+        sprintf(fname, "%.900s/shot%04d.%s", capturedir, ++shotnum, ext);
+        ReadFrame(s, fname);
+        printf("Saving %s\n", fname);
+    }
+    return;
+}
+
+// Finishes every capture and releases the pixel buffers
+void FinishCaptures() {
+    int x;
+
+    if (glGenBuffersP != NULL) CollectReads(1);
+    for (x = 0; x < CAPTURE_JOBS; x++) {
+        if (captures[x].job != NULL) tpkJobWait(captures[x].job);
+        captures[x].job = NULL;
+    }
+    for (x = 0; x < CAPTURE_RING; x++)
+        if (reads[x].buffer) glDeleteBuffersP(1, &reads[x].buffer);
+    return;
+}
+
+// Checks whether any movement key is held down
+int Animating() {
+    int x;
+
+    for (x = 0; x < 10; x++)
+        if (rot[x]) return 1;
+    return 0;
+}
+
+// Draw every visible model in the gallery, one texture at a time
+void drawgallery(VIEW_STATE *s) {
+    float ty, tx, ny, nx, ex, ey, ez, e[3], r[9], *m, *lastm;
+    float dist, lodscale;
+    int x, y, items, visible, bound;
+    VIEW_MODEL *view, *src, *last;
+    DRAW_ITEM *item;
+
+    ViewRotation(s, r);
+
+    // Side planes of the view frustum in eye space
+    ty = (float) tan(45.0 * 0.0087266463);
+    tx = ty * (float) s->aspect;
+    ny = 1.0f / (float) sqrt(1.0f + ty * ty);
+    nx = 1.0f / (float) sqrt(1.0f + tx * tx);
+
+    // Convert eye distances to model distances at the LOD reference size
+    lodscale = LOD_HEIGHT / (float) s->height;
+
+    // Cull models by bounding sphere and collect the batches of the rest
+    for (x = items = visible = 0; x < viewnum; x++) {
+        view = &views[x];
+        if (!view->batchnum) continue;
+        ex = view->gx + s->xsft;
+        ey = view->gy + s->ysft;
+        ez = -15.0f + s->zsft;
+        if (( ey + ez * ty) * ny > view->radius ||
+            (-ey + ez * ty) * ny > view->radius ||
+            ( ex + ez * tx) * nx > view->radius ||
+            (-ex + ez * tx) * nx > view->radius ||
+            ez > view->radius - s->znear || ez < -s->zfar - view->radius)
+            continue;
+
+        // Pick the level of detail by the model's size on screen
+        src = view;
+        if (view->lodnum) {
+            dist = (float) sqrt(ex * ex + ey * ey + ez * ez);
+            view->lod = geoSelectLod(view->lods, view->lodnum, 
+                dist / view->scale * lodscale, view->lod, LOD_HYSTERESIS);
+            if (view->lod) src = view->lodviews[view->lod - 1];
+            if (!src->batchnum) src = view;
+        }
+
+        m = &drawmatrices[visible * 16];
+        e[0] = ex; e[1] = ey; e[2] = ez;
+        ModelMatrix(view, e, r, m);
+        visible++;
+
+        for (y = 0; y < src->batchnum; y++, items++) {
+            drawitems[items].view   = src;
+            drawitems[items].batch  = &src->batches[y];
+            drawitems[items].matrix = m;
+        }
+    }
+
+    // Sort so that every texture is bound only once
+    qsort(drawitems, items, sizeof(DRAW_ITEM), CompareItems);
+
+    glEnable(GL_RESCALE_NORMAL);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    for (x = 0, bound = -1, last = NULL, lastm = NULL; x < items; x++) {
+        item = &drawitems[x];
+        if (item->batch->texture != bound) {
+            bound = item->batch->texture;
+            glBindTexture(GL_TEXTURE_2D,
+                (bound < texturenum) ? textures[bound] : 0);
+            drawstats.binds++;
+        }
+        if (item->matrix != lastm) {
+            lastm = item->matrix;
+            glLoadMatrixf(lastm);
+        }
+        if (item->view != last) {
+            last = item->view;
+            glVertexPointer(3, GL_FLOAT, sizeof(GEO_VERTEX),
+                &last->mod->vertices[0].x);
+            glNormalPointer(GL_FLOAT, sizeof(GEO_VERTEX),
+                &last->mod->vertices[0].nx);
+            glTexCoordPointer(2, GL_FLOAT, sizeof(GEO_VERTEX),
+                &last->mod->vertices[0].s);
+        }
+        glDrawElements(GL_TRIANGLES, item->batch->count, GL_UNSIGNED_INT,
+            &item->view->indexes[item->batch->first]);
+        drawstats.draws++;
+        drawstats.triangles += item->batch->count / 3;
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisable(GL_RESCALE_NORMAL);
+    glLoadIdentity();
+    return;
+}
+
+// Draw the OpenGL scene as a view state has it, leaving the frame to be
+// presented and its draws, triangles and binds counted in drawstats
+void drawscene(VIEW_STATE *s) {
+    VIEW_MODEL *view = s->view;
+    unsigned char *colors;
+    DRAW_BATCH *batch;
+    float param[4];
+    int x;
+
+    tpkTraceBegin("drawscene");
+    memset(&drawstats, 0, sizeof(BENCH_FRAME));
+    configviewport(s);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_CULL_FACE);
+
+    if (s->gallery) {
+        drawgallery(s);
+        DrawPick(s);
+        tpkTraceEnd();
+        return;
+    }
+
+    glPushMatrix();
+        glTranslatef(s->xsft, s->ysft, -15.0f + s->zsft);
+        glRotatef(s->xrot, 1.0f, 0.0f, 0.0f);
+        glRotatef(s->yrot, 0.0f, 1.0f, 0.0f);
+
+        glScalef(-view->scale, view->scale, view->scale);
+        glTranslatef(-view->cx, -view->cy, -view->cz);
+
+        // Same arrays and batches as the gallery, prepared by LoadModel()
+        glEnable(GL_RESCALE_NORMAL);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(GEO_VERTEX),
+            &view->mod->vertices[0].x);
+        glNormalPointer(GL_FLOAT, sizeof(GEO_VERTEX),
+            &view->mod->vertices[0].nx);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(GEO_VERTEX),
+            &view->mod->vertices[0].s);
+
+        // Baked occlusion stands in for the material, with the ambient
+        // light turned down to match, so it darkens both terms like
+        // rasRender() does
+        colors = s->colors;
+        if (colors != NULL) {
+            glEnableClientState(GL_COLOR_ARRAY);
+            glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
+            glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+            glEnable(GL_COLOR_MATERIAL);
+            param[0] = param[1] = param[2] = 0.0f; param[3] = 1.0f;
+            glLightModelfv(GL_LIGHT_MODEL_AMBIENT, param);
+            param[0] = param[1] = param[2] = AO_AMBIENT;
+            glLightfv(GL_LIGHT0, GL_AMBIENT, param);
+        }
+
+        //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        for (x = 0; x < view->batchnum; x++) {
+            batch = &view->batches[x];
+            glBindTexture(GL_TEXTURE_2D, (batch->texture < texturenum) ?
+                textures[batch->texture] : 0);
+            glDrawElements(GL_TRIANGLES, batch->count, GL_UNSIGNED_INT,
+                &view->indexes[batch->first]);
+            drawstats.binds++;
+            drawstats.draws++;
+            drawstats.triangles += batch->count / 3;
+        }
+
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisable(GL_RESCALE_NORMAL);
+
+        // Back to the default material and lights
+        if (colors != NULL) {
+            glDisableClientState(GL_COLOR_ARRAY);
+            glDisable(GL_COLOR_MATERIAL);
+            param[0] = param[1] = param[2] = 0.2f; param[3] = 1.0f;
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, param);
+            glLightModelfv(GL_LIGHT_MODEL_AMBIENT, param);
+            param[0] = param[1] = param[2] = AO_DIFFUSE;
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, param);
+            param[0] = param[1] = param[2] = 1.0f;
+            glLightfv(GL_LIGHT0, GL_AMBIENT, param);
+        }
+
+    glPopMatrix();
+
+    DrawPick(s);
+    tpkTraceEnd();
+    return;
+}
+
+// Builds the path of a texture's PNG file
+void TexturePath(char *filename, char *fname) {
+    int fLen;
+
+    sprintf(fname, "textures" DIR_SEP "%.200s", filename);
+    fLen = strlen(fname);
+    if (fname[fLen - 4] != '.') strcat(fname, ".png");
+    strcpy(&fname[strlen(fname) - 3], "png");
+    return;
+}
+
+// Decodes a texture into RGBA rows, bottom row first. The PNG data is only
+// read, so it can come straight out of an archive
+unsigned char* DecodeTexture(unsigned char *fData, int fLen, int *w, int *h) {
+    unsigned char *pData, *zData = NULL;
+    int width, height, clen, plen, fOff, ulen, chunks;
+
+    width = GetInt32(fData, 0x10);
+    height = GetInt32(fData, 0x14);
+
+    // Find the image data, which only needs joining up if it's split
+    fOff = 0x21;
+    plen = chunks = 0;
+    while (fOff < fLen) {
+        clen = GetInt32(fData, fOff); fOff += 4;
+        if (!strncmp((char *) &fData[fOff], "IDAT", 4)) {
+            if (!chunks++) zData = &fData[fOff + 4];
+            plen += clen;
+        }
+        fOff += clen + 8;
+    }
+    if (chunks > 1) {
+        zData = malloc(plen);
+        for (fOff = 0x21, plen = 0; fOff < fLen; fOff += clen + 8) {
+            clen = GetInt32(fData, fOff); fOff += 4;
+            if (strncmp((char *) &fData[fOff], "IDAT", 4)) continue;
+            memcpy(&zData[plen], &fData[fOff + 4], clen);
+            plen += clen;
+        }
+    }
+
+    ulen = width * height * 4 + height * 2;
+    pData = malloc(ulen);
+    fLen = uncompress(pData, &ulen, zData, plen);
+    if (chunks > 1) free(zData);
+
+    if (fLen) { free(pData); return NULL; }
+
+    fData = malloc(ulen);
+
+    for (fLen = clen = 0; fLen < height; fLen++) {
+        ulen = height - fLen - 1;
+        memmove(&fData[clen], 
+            &pData[ulen * (width * 4 + 1) + 1], 
+            width * 4);
+        clen += width * 4;
+    }
+    free(pData);
+
+    *w = width;
+    *h = height;
+    return fData;
+}
+
+// Read callback decoding a texture on a job system thread
+void TextureRead(void *param, unsigned char *fData, int fLen) {
+    RAS_TEXTURE *tex = param;
+
+    if (fData == NULL) return;
+    tpkTraceBegin("DecodeTexture");
+    tex->pixels = DecodeTexture(fData, fLen, &tex->width, &tex->height);
+    tpkTraceEnd();
+    return;
+}
+
+// Range job decoding the textures that are in the archive
+void TextureEntries(void *param, int first, int last) {
+    TEX_SET *set = param;
+    PIGG_ENTRY *entry;
+    char fname[256];
+    int x;
+
+    for (x = first; x < last; x++) {
+        TexturePath(set->geo->textures[x], fname);
+        entry = piggFind(pigg, fname);
+        if (entry != NULL)
+            TextureRead(&set->tex[x], piggRead(pigg, entry), entry->size);
+    }
+    return;
+}
+
+// Starts reading every texture of a file at once, decoding each one into
+// tex[] as soon as it's in. Textures in the archive are decoded before this
+// returns, the others are left in the reads to wait on
+TPK_READ** ReadTextures(GEO *geo, RAS_TEXTURE *tex) {
+    TPK_READ **reads;
+    char fname[256];
+    TEX_SET set;
+    int x;
+
+    reads = malloc((geo->texturenum ? geo->texturenum : 1) *
+        sizeof(TPK_READ *));
+    for (x = 0; x < geo->texturenum; x++) {
+        tex[x].pixels = NULL;
+        TexturePath(geo->textures[x], fname);
+        if (pigg != NULL && piggFind(pigg, fname) != NULL) reads[x] = NULL;
+        else reads[x] = tpkReadFile(fname, TextureRead, &tex[x]);
+    }
+    tpkReadSubmit();
+
+    // Decode out of the archive while the disk reads are under way
+    if (pigg != NULL) {
+        set.geo = geo;
+        set.tex = tex;
+        tpkParallelFor(TextureEntries, &set, geo->texturenum, 1);
+    }
+    return reads;
+}
+
+// Uploads a decoded texture, releasing its pixels
+void LoadTexture(RAS_TEXTURE *tex, int dest) {
+    glBindTexture(GL_TEXTURE_2D, textures[dest]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if (tex->pixels == NULL) return;
+
+    tpkTraceBegin("LoadTexture");
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex->width, tex->height, 0, 
+        GL_RGBA, GL_UNSIGNED_BYTE, tex->pixels);
+    free(tex->pixels);
+    tex->pixels = NULL;
+
+    tpkTraceEnd();
+    return;
+}
+
+// Reads, decodes and uploads every texture of a file. Decoding happens in
+// the background, uploads here in order as the textures come in
+void LoadTextures(GEO *geo) {
+    RAS_TEXTURE *tex;
+    TPK_READ **reads;
+    int x;
+
+    texturenum = uploadnum = geo->texturenum;
+    textures = malloc((geo->texturenum ? geo->texturenum : 1) * sizeof(int));
+    glGenTextures(geo->texturenum, textures);
+    tex = calloc(geo->texturenum ? geo->texturenum : 1, sizeof(RAS_TEXTURE));
+    reads = ReadTextures(geo, tex);
+    for (x = 0; x < geo->texturenum; x++) {
+        tpkReadWait(reads[x], NULL);
+        LoadTexture(&tex[x], x);
+    }
+    free(reads);
+    free(tex);
+    return;
+}
+
+// Reads and decodes every texture of a file, for the thread holding the
+// OpenGL context to upload with SwapTextures()
+RAS_TEXTURE* DecodeTextures(GEO *geo) {
+    RAS_TEXTURE *tex;
+    TPK_READ **reads;
+    int x;
+
+    tex = calloc(geo->texturenum ? geo->texturenum : 1, sizeof(RAS_TEXTURE));
+    reads = ReadTextures(geo, tex);
+    for (x = 0; x < geo->texturenum; x++) tpkReadWait(reads[x], NULL);
+    free(reads);
+    return tex;
+}
+
+// Replaces the uploaded textures with the decoded ones in texnext, of
+// which there are texturenum
+void SwapTextures() {
+    int x;
+
+    glDeleteTextures(uploadnum, textures);
+    free(textures);
+    uploadnum = texturenum;
+    textures = malloc((texturenum ? texturenum : 1) * sizeof(int));
+    glGenTextures(texturenum, textures);
+    for (x = 0; x < texturenum; x++) LoadTexture(&texnext[x], x);
+    free(texnext);
+    texnext = NULL;
+    return;
+}
+
+// Regenerates the broken normals of a range of models and scales the rest
+// to unit length. Models a reload took over were fixed up already, and
+// their vertices are still being drawn
+void NormalJob(GEO *geo, int first, int last) {
+    int x, made;
+
+    for (x = first; x < last; x++) {
+        if (geoReused(geo, x)) continue;
+        made = geoNormals(&geo->models[x], NORMAL_CREASE, 0);
+        if (made) printf("Regenerated %d normals of %s\n", made,
+            geo->models[x].id);
+    }
+
+    return;
+}
+
+// Fixes up the normals of every model, spread across the job system
+void FixNormals(GEO *geo) {
+    if (geo != NULL) tpkParallelFor(NormalJob, geo, geo->modelnum, 1);
+    return;
+}
+
+// Checks whether two versions of a file use the same textures
+int SameTextures(GEO *a, GEO *b) {
+    int x;
+
+    if (a->texturenum != b->texturenum) return 0;
+    for (x = 0; x < a->texturenum; x++)
+        if (strcmp(a->textures[x], b->textures[x])) return 0;
+    return 1;
+}
+
+// Read callback decoding a new version of the file on a job system thread,
+// taking the unchanged models from the one on screen. New textures are
+// decoded here too, for the render thread to upload after the swap
+void ReloadRead(void *param, unsigned char *fData, int fLen) {
+    if (fData != NULL) {
+        if (lodcache) reloadhash = HashFile(fData, fLen);
+        reloadnext = geoReload(param, fData, fLen);
+        reloadlen = fLen;
+        FixNormals(reloadnext);
+        if (reloadnext != NULL && reloadnext->modelnum &&
+            !SameTextures(param, reloadnext))
+            reloadtex = DecodeTextures(reloadnext);
+    }
+    tpkAtomicSet(&reloaddone, 1);
+    return;
+}
+
+// Starts decoding the file when it changes, and swaps the new version in
+// between frames once it's done. Returns whether the version changed
+int CheckReload(GEO **geo) {
+    GEO *old = *geo, *next;
+    RAS_TEXTURE *tex;
+    int x;
+
+    // Read the file in the background when it changes
+    if (reloadread == NULL) {
+        if (!tpkWatchChanged(watch)) return 0;
+        printf("Reloading %s\n", geofile);
+        reloadread = tpkReadFile(geofile, ReloadRead, old);
+        tpkReadSubmit();
+        return 0;
+    }
+    if (!tpkAtomicGet(&reloaddone)) return 0;
+    tpkReadWait(reloadread, NULL);
+    reloadread = NULL;
+    reloaddone = 0;
+    next = reloadnext;
+    tex = reloadtex;
+    reloadnext = NULL;
+    reloadtex = NULL;
+
+    // A file caught halfway through being written gets another change
+    if (next == NULL || !next->modelnum) {
+        printf("ERROR: Could not reload %s\n", geofile);
+        if (next != NULL) geoFree(next);
+        return 0;
+    }
+
+    // Nothing may still be working on the old version
+    tpkTraceBegin("SwapGeo");
+    LockScene();
+    FreePrefetch();
+    FreeGallery();
+    FreePicks();
+    FreeBakes();
+    if (tex != NULL) {
+        if (texnext != NULL) {
+            for (x = 0; x < texturenum; x++) free(texnext[x].pixels);
+            free(texnext);
+        }
+        texnext = tex;
+        texturenum = next->texturenum;
+    }
+
+    // Stay on the same model, as far as it still exists
+    for (x = 0; x < next->modelnum; x++)
+        if (!strcmp(next->models[x].id, old->models[model].id)) break;
+    if (x == next->modelnum)
+        x = (model < (unsigned int) next->modelnum) ? model : 0;
+    model = x;
+
+    geoFree(old);
+    *geo = next;
+    geolen = reloadlen;
+    geohash = reloadhash;
+    if (gallery) {
+        LoadGallery(next);
+        FocusGallery();
+    } else SelectModel(next);
+    UnlockScene(next);
+
+    tpkTraceEnd();
+    return 1;
+}
+
+// Stops watching the file, dropping a reload still in progress
+void StopReload() {
+    int x;
+
+    if (reloadread != NULL) tpkReadWait(reloadread, NULL);
+    if (reloadtex != NULL) {
+        for (x = 0; x < reloadnext->texturenum; x++)
+            free(reloadtex[x].pixels);
+        free(reloadtex);
+    }
+    if (reloadnext != NULL) geoFree(reloadnext);
+    reloadread = NULL;
+    reloadnext = NULL;
+    reloadtex = NULL;
+    tpkDelete(watch);
+    watch = NULL;
+    return;
+}
+
+// Draws the latest view state whenever there's a new one, holding the
+// OpenGL context until told to stop. Frames are presented outside of the
+// scene lock, so the main thread only ever waits on drawing itself
+void RenderThread(void *param) {
+    double frame, now = 0.0, due = 0.0; // Milliseconds per frame, and times
+    unsigned long long input, swap, done, start;
+    unsigned int lastframe;
+    VIEW_STATE *s;
+    int stop = 0, wait, measure;
+
+    (void) param;
+    tpkMakeCurrent(hRC);
+    InitPacing();
+    InitCapture();
+    frame = (vsync || !framerate) ? 0.0 : 1000.0 / framerate;
+    tpkTimer(&lastframe);
+
+    while (!stop) {
+
+        // Sleep until there's a new view state, or until told to stop
+        if (!(tpkAtomicGet(&statemid) & STATE_FRESH)) CollectReads(1);
+        tpkLockMutex(renderlock);
+        while (!(tpkAtomicGet(&statemid) & STATE_FRESH) && !renderstop)
+            tpkWaitCond(renderwake, renderlock);
+        stop = renderstop;
+        tpkUnlockMutex(renderlock);
+        if (stop) break;
+
+        // Keep to the frame rate, vsync paces by blocking in the swap instead
+        now += (double) tpkTimer(&lastframe);
+        if (now < due) {
+            wait = (int) ceil(due - now);
+            tpkSleep(wait);
+            now += (double) tpkTimer(&lastframe);
+        }
+
+        // Draw the latest state, which nothing changes until it's drawn
+        tpkLockMutex(scenelock);
+        s = TakeState();
+        if (texnext != NULL) SwapTextures();
+        start = tpkClock();
+        if (s != NULL) drawscene(s);
+        tpkUnlockMutex(scenelock);
+        if (s == NULL) continue;
+
+        // Time the input this frame is the first to show, when asked to.
+        // Benchmark frames are timed until the GPU has finished them
+        measure = s->overlay || lat.log != NULL;
+        input = NewInput(s);
+        CaptureFrame(s);
+        if (s->overlay) DrawOverlay(s);
+        EndFrame((measure && input) || s->benchserial, &swap, &done);
+        if (s->benchserial) BenchFrame(s, start, done);
+        if (measure) RecordFrame(input, swap, done);
+        else lat.last = 0;
+        framecount++;
+        CollectReads(0);
+        due = (now - due > frame) ? now + frame : due + frame;
+    }
+
+    FinishCaptures();
+    for (wait = 0; wait < FRAME_LAG; wait++)
+        if (fences[wait] != NULL) glDeleteSyncP(fences[wait]);
+    tpkMakeCurrent(NULL);
+    return;
+}
+
+// Hands the OpenGL context over to a new render thread, drawing the file
+// as it is now. Returns nonzero if the thread couldn't be started
+int StartRender(GEO *geo) {
+    scenelock = tpkCreateMutex();
+    renderlock = tpkCreateMutex();
+    renderwake = tpkCreateCond();
+    benchwake = tpkCreateCond();
+    renderstop = 0;
+    PublishState(geo);
+
+    tpkMakeCurrent(NULL);
+    renderthread = tpkCreateThread(RenderThread, NULL);
+    if (renderthread == NULL) {
+        tpkMakeCurrent(hRC);
+        tpkDelete(benchwake);
+        tpkDelete(renderwake);
+        tpkDelete(renderlock);
+        tpkDelete(scenelock);
+        printf("Could not start the render thread.\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Stops the render thread and takes the OpenGL context back
+void StopRender() {
+    tpkLockMutex(renderlock);
+    renderstop = 1;
+    tpkSignalCond(renderwake);
+    tpkUnlockMutex(renderlock);
+    tpkWaitForThread(renderthread);
+    tpkDelete(renderthread);
+    renderthread = NULL;
+
+    tpkMakeCurrent(hRC);
+    if (texnext != NULL) SwapTextures();
+    tpkDelete(benchwake);
+    tpkDelete(renderwake);
+    tpkDelete(renderlock);
+    tpkDelete(scenelock);
+    return;
+}
+
+// Starts the script the frames drawn are recorded to, returning nonzero if
+// it couldn't be made
+int OpenRecord() {
+    recordlog = fopen(recordfile, "w");
+    if (recordlog == NULL) {
+        printf("ERROR: Could not write %s\n", recordfile);
+        return 1;
+    }
+    fprintf(recordlog, "# Recorded by geodraw from %s\n", geofile);
+    return 0;
+}
+
+// Records the view about to be handed over as one more frame of the
+// script, after whatever commands it takes to get there
+void RecordState() {
+    float view[5];
+
+    // Runs of the same view are recorded as one command
+    view[0] = xrot; view[1] = yrot;
+    view[2] = xsft; view[3] = ysft; view[4] = zsft;
+    if ((int) model == recmodel && gallery == recgallery &&
+        !memcmp(view, recview, sizeof(view))) {
+        recframes++;
+        return;
+    }
+    if (recframes) fprintf(recordlog, "frames %d\n", recframes);
+
+    // Switching models or modes moves the camera, so it's placed after
+    if (gallery != recgallery) fprintf(recordlog, "gallery %d\n", gallery);
+    if ((int) model != recmodel) fprintf(recordlog, "model %u\n", model);
+    fprintf(recordlog, "view %.9g %.9g %.9g %.9g %.9g\n", view[0], view[1],
+        view[2], view[3], view[4]);
+    memcpy(recview, view, sizeof(view));
+    recmodel = model;
+    recgallery = gallery;
+    recframes = 1;
+    return;
+}
+
+// Finishes the recorded script
+void CloseRecord() {
+    int err;
+
+    if (recordlog == NULL) return;
+    if (recframes) fprintf(recordlog, "frames %d\n", recframes);
+    err = ferror(recordlog);
+    if (fclose(recordlog) || err)
+        printf("ERROR: Could not write %s\n", recordfile);
+    else printf("Recorded the frames drawn to %s\n", recordfile);
+    recordlog = NULL;
+    return;
+}
+
+// Main program loop. Input, animation and everything else that changes
+// the view happen here, and each change is handed to the render thread as
+// a new view state, so input is never held up by drawing. Returns the
+// version of the file in use when it exits
+GEO* prgloop(GEO *geo) {
+    double tick = 1000.0 / ANIM_RATE; // Milliseconds per animation step
+    double accum = 0.0;               // Animation steps accumulated
+    int closing = 0, wait;
+
+    if (StartRender(geo)) return geo;
+    tpkTimer(&lastms);
+    redraw = 0;
+
+    // Loop until program exit is requested
+    while (!closing) {
+
+        // Process window events
+        closing = events(geo);
+
+        // Animate in fixed steps, but don't bank time while nothing moves
+        if (Animating()) {
+            for (accum += tpkTimer(&lastms) / tick; accum >= 1.0;
+                accum -= 1.0) animate();
+            redraw = pickdirty = 1;
+        } else {
+            tpkTimer(&lastms);
+            accum = 0.0;
+        }
+
+        // Pick up levels of detail finished in the background
+        if (LodsReady()) {
+            LockScene();
+            CollectLods();
+            UnlockScene(geo);
+        }
+
+        // Swap in a new version of the file once it's decoded
+        if (CheckReload(&geo)) pickdirty = 1;
+
+        // Find the face under the cursor again once anything moved
+        if (pickdirty && UpdatePick(geo, 0)) redraw = 1;
+
+        // Shade with ambient occlusion once it's baked
+        if (CollectAO()) redraw = 1;
+
+        // Turn a turntable being recorded on to its next frame
+        if (StepTurntable()) redraw = 1;
+
+        // Hand over a new view state whenever anything on screen changed
+        if (redraw) {
+            if (recordlog != NULL) RecordState();
+            PublishState(geo);
+            redraw = 0;
+        }
+        inputnext = 0; // Input that changed nothing isn't waiting on a frame
+
+        // Sleep until the next animation step, or until input when idle
+        if (Animating()) {
+            wait = (int) ceil((1.0 - accum) * tick);
+            if (wait < 1) wait = 1;
+        } else if (turnframe >= 0) wait = 1;
+        else wait = (LodsPending() || pickdirty || AoPending()) ?
+            LOD_POLL : WATCH_POLL;
+        tpkWaitEvents(hWnd, wait);
+    }
+
+    StopRender();
+    return geo;
+}
+
+// Reads the benchmark script, one command to a line:
+//   model <n>      Select model n, putting the camera back
+//   gallery <0|1>  Leave or enter gallery mode
+//   view <xrot> <yrot> <xsft> <ysft> <zsft>
+//                  Place the camera
+//   turn <x> <y>   Rotate the camera by this much every frame drawn
+//   move <x> <y> <z>
+//                  Shift the camera by this much every frame drawn
+//   warmup <n>     Draw n frames without measuring them
+//   frames <n>     Draw n measured frames
+// Anything after a '#' is left out. Returns nonzero if it couldn't be read
+int ReadBench(GEO *geo) {
+    static char *names[BENCH_COMMANDS] =
+        {"model", "gallery", "view", "turn", "move", "warmup", "frames"};
+    static const int argnums[BENCH_COMMANDS] = {1, 1, 5, 2, 3, 1, 1};
+    char line[256], word[16], *c, *error = NULL;
+    int x, num, room = 0, lineno = 0;
+    BENCH_STEP *step;
+    FILE *fPtr;
+
+    fPtr = fopen(benchfile, "r");
+    if (fPtr == NULL) {
+        printf("ERROR: Could not load %s\n", benchfile);
+        return 1;
+    }
+
+    while (error == NULL && fgets(line, sizeof(line), fPtr) != NULL) {
+        lineno++;
+        c = strchr(line, '#');
+        if (c != NULL) *c = 0;
+
+        // Make room for one more step, doubling it as needed
+        if (benchstepnum == room) {
+            room = room ? room * 2 : 64;
+            benchsteps = realloc(benchsteps, room * sizeof(BENCH_STEP));
+        }
+        step = &benchsteps[benchstepnum];
+        memset(step, 0, sizeof(BENCH_STEP));
+        num = sscanf(line, "%15s %f %f %f %f %f", word, &step->args[0],
+            &step->args[1], &step->args[2], &step->args[3], &step->args[4]);
+        if (num < 1) continue;
+
+        // Look the command up and check its arguments
+        for (x = 0; x < BENCH_COMMANDS && strcmp(word, names[x]); x++);
+        step->type = x;
+        if (x == BENCH_COMMANDS) error = "unknown command";
+        else if (num - 1 != argnums[x]) error = "wrong number of arguments";
+        else if (x == BENCH_MODEL && (step->args[0] < 0.0f ||
+            step->args[0] >= geo->modelnum)) error = "no such model";
+        else if (x == BENCH_GALLERY && step->args[0] != 0.0f &&
+            step->args[0] != 1.0f) error = "gallery is 0 or 1";
+        else if ((x == BENCH_WARMUP || x == BENCH_FRAMES) &&
+            step->args[0] < 0.0f) error = "negative frame count";
+        if (x == BENCH_FRAMES) benchnum += (int) step->args[0];
+        benchstepnum++;
+    }
+    fclose(fPtr);
+
+    // Something has to be measured
+    if (error == NULL && !benchnum) {
+        error = "no frames to measure";
+        lineno = 0;
+    }
+    if (error != NULL) {
+        if (lineno) printf("ERROR: %s line %d: %s\n", benchfile, lineno,
+            error);
+        else printf("ERROR: %s: %s\n", benchfile, error);
+        free(benchsteps);
+        benchsteps = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// Waits until the render thread has drawn the latest benchmark frame, so
+// none is ever replaced before it's seen. Returns nonzero if the window
+// was closed meanwhile
+int BenchWait() {
+    int arg1, arg2, event, closing = 0;
+
+    tpkLockMutex(renderlock);
+    while (tpkAtomicGet(&benchacked) != benchserial)
+        tpkWaitCond(benchwake, renderlock);
+    tpkUnlockMutex(renderlock);
+
+    // Input is left out, only closing the window stops a benchmark
+    if (hWnd == NULL) return 0;
+    do {
+        event = tpkNextEvent(hWnd, &arg1, &arg2);
+        if (event == TPK_EVENT_CLOSE) closing = 1;
+    } while (event != TPK_EVENT_NONE);
+    return closing;
+}
+
+// Hands the render thread the next benchmark frame, measured as the given
+// one or not at all for -1, and waits until it's drawn. Returns nonzero if
+// the window was closed
+int BenchDraw(GEO *geo, int measured) {
+    benchframe = measured;
+    benchserial++;
+    PublishState(geo);
+    benchframe = -1;
+    return BenchWait();
+}
+
+// Finishes a change to the scene, made holding the scene lock, once
+// everything being prepared for it in the background is in, then draws it
+// once. Levels are picked going by the ones drawn before, so every run has
+// to draw the same frames, with nothing else busy. Returns nonzero if the
+// window was closed
+int BenchSettle(GEO *geo) {
+    int x;
+
+    for (x = 0; x < PREFETCH_SLOTS; x++) {
+        if (preps[x].job == NULL) continue;
+        tpkJobWait(preps[x].job);
+        preps[x].job = NULL;
+    }
+    while (LodsPending() || (AoPending() && !CollectAO())) tpkSleep(1);
+    CollectLods();
+    benchserial++;
+    UnlockScene(geo);
+    return BenchWait();
+}
+
+// Writes a string as a JSON value
+void WriteJSONString(FILE *fPtr, char *s) {
+    fputc('"', fPtr);
+    for ( ; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', fPtr);
+        if ((unsigned char) *s >= 32) fputc(*s, fPtr);
+        else fprintf(fPtr, "\\u%04x", (unsigned char) *s);
+    }
+    fputc('"', fPtr);
+    return;
+}
+
+// Writes what the measured frames took as JSON, to the report file or
+// stdout. Returns nonzero if it couldn't be written
+int WriteBench(char *renderer) {
+    static char *names[4] =
+        {"frame_ms", "draw_calls", "triangles", "texture_binds"};
+    double *sorted, p[3], mean[4], most[4], value[4];
+    FILE *fPtr = stdout;
+    BENCH_FRAME *f;
+    int x, y, err;
+
+    // Means and maximums of everything, percentiles of the frame times
+    sorted = malloc(benchnum * sizeof(double));
+    for (y = 0; y < 4; y++) mean[y] = most[y] = 0.0;
+    for (x = 0; x < benchnum; x++) {
+        f = &benchframes[x];
+        value[0] = f->ms;
+        value[1] = f->draws;
+        value[2] = f->triangles;
+        value[3] = f->binds;
+        for (y = 0; y < 4; y++) {
+            mean[y] += value[y] / benchnum;
+            if (value[y] > most[y]) most[y] = value[y];
+        }
+        sorted[x] = f->ms;
+    }
+    qsort(sorted, benchnum, sizeof(double), CompareTimes);
+    RankTimes(sorted, benchnum, p);
+    free(sorted);
+    printf("Benchmarked %d frames: p50 %.2f, p95 %.2f, p99 %.2f ms, "
+        "%.0f draws, %.0f triangles, %.0f binds per frame\n", benchnum,
+        p[0], p[1], p[2], mean[1], mean[2], mean[3]);
+
+    if (reportfile != NULL) {
+        fPtr = fopen(reportfile, "w");
+        if (fPtr == NULL) {
+            printf("ERROR: Could not write %s\n", reportfile);
+            return 1;
+        }
+    }
+
+    fprintf(fPtr, "{\"file\":");
+    WriteJSONString(fPtr, geofile);
+    fprintf(fPtr, ",\"script\":");
+    WriteJSONString(fPtr, benchfile);
+    fprintf(fPtr, ",\"renderer\":");
+    WriteJSONString(fPtr, renderer);
+    fprintf(fPtr, ",\"offscreen\":%s,\"width\":%d,\"height\":%d,"
+        "\"frames\":%d", offscreen ? "true" : "false", viewwidth,
+        viewheight, benchnum);
+    for (y = 0; y < 4; y++) {
+        fprintf(fPtr, ",\n\"%s\":{\"mean\":%.3f", names[y], mean[y]);
+        if (!y) fprintf(fPtr, ",\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f",
+            p[0], p[1], p[2]);
+        fprintf(fPtr, y ? ",\"max\":%.0f}" : ",\"max\":%.3f}", most[y]);
+    }
+
+    // Every frame, so runs can be compared beyond the summary
+    fprintf(fPtr, ",\n\"per_frame\":[");
+    for (x = 0; x < benchnum; x++) {
+        f = &benchframes[x];
+        fprintf(fPtr, "%s\n{\"ms\":%.3f,\"draw_calls\":%d,\"triangles\":%d,"
+            "\"texture_binds\":%d}", x ? "," : "", f->ms, f->draws,
+            f->triangles, f->binds);
+    }
+    fprintf(fPtr, "\n]}\n");
+    if (fPtr == stdout) return 0;
+
+    // Report whether everything was written
+    err = ferror(fPtr);
+    if (fclose(fPtr) || err) {
+        printf("ERROR: Could not write %s\n", reportfile);
+        return 1;
+    }
+    printf("Wrote %s\n", reportfile);
+    return 0;
+}
+
+// Replays the benchmark script instead of taking input, drawing each frame
+// it asks for once, then reports what the measured ones took. Returns
+// nonzero if it was stopped or the report couldn't be written
+int Bench(GEO *geo) {
+    float motion[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    int x, y, measured = 0, closing = 0;
+    const char *renderer;
+    BENCH_STEP *step;
+    char name[256];
+
+    // The renderer is named in the report, so runs on different ones stand
+    // out
+    renderer = (const char *) glGetString(GL_RENDERER);
+    sprintf(name, "%.255s", (renderer != NULL) ? renderer : "unknown");
+    benchframes = calloc(benchnum, sizeof(BENCH_FRAME));
+    if (StartRender(geo)) return 1;
+    LockScene();
+    closing = BenchSettle(geo);
+
+    for (x = 0; x < benchstepnum && !closing; x++) {
+        step = &benchsteps[x];
+        switch (step->type) {
+        case BENCH_MODEL:
+            LockScene();
+            model = (unsigned int) step->args[0];
+            if (gallery) FocusGallery();
+            else LoadModel(geo);
+            closing = BenchSettle(geo);
+            break;
+        case BENCH_GALLERY:
+            LockScene();
+            SetGallery(geo, (int) step->args[0]);
+            closing = BenchSettle(geo);
+            break;
+        case BENCH_VIEW:
+            xrot = step->args[0]; yrot = step->args[1];
+            xsft = step->args[2]; ysft = step->args[3]; zsft = step->args[4];
+            break;
+        case BENCH_TURN:
+            motion[0] = step->args[0]; motion[1] = step->args[1];
+            break;
+        case BENCH_MOVE:
+            motion[2] = step->args[0]; motion[3] = step->args[1];
+            motion[4] = step->args[2];
+            break;
+        default:
+
+            // Move as animate() would, then draw
+            for (y = 0; y < (int) step->args[0] && !closing; y++) {
+                xrot += motion[0]; yrot += motion[1];
+                if (yrot < 0.0f) yrot += 360.0f;
+                if (yrot > 360.0f) yrot -= 360.0f;
+                if (xrot < -90.0f) xrot = -90.0;
+                if (xrot > 90.0f) xrot = 90.0f;
+                xsft += motion[2]; ysft += motion[3]; zsft += motion[4];
+                closing = BenchDraw(geo,
+                    (step->type == BENCH_FRAMES) ? measured++ : -1);
+            }
+            break;
+        }
+    }
+
+    StopRender();
+    benchserial = 0;
+    free(benchsteps);
+    benchsteps = NULL;
+    if (closing) printf("Benchmark stopped after %d of %d frames\n",
+        measured, benchnum);
+    else closing = WriteBench(name);
+    free(benchframes);
+    benchframes = NULL;
+    return closing;
+}
+
+// Names the file a model is written to in dir, after a prefix
+void ModelFile(char *fname, char *dir, char *prefix, GEO_MODEL *mod,
+    char *ext) {
+    char name[256];
+    int x;
+
+    // Model names may contain characters not allowed in file names
+    for (x = 0; x < 255 && mod->id[x]; x++) {
+        name[x] = mod->id[x];
+        if (strchr("\\/:*?\"<>|", name[x])) name[x] = '_';
+    }
+    name[x] = 0;
+    sprintf(fname, "%.700s/%.200s%s.%s", dir, prefix, name, ext);
+    return;
+}
+
+// Renders a model to a PNG file in thumbdir, after a prefix. Returns
+// nonzero if it couldn't be written
+int RenderThumbnail(GEO_MODEL *mod, RAS_TEXTURE *tex, int texnum,
+    char *prefix, int slices, unsigned char *pixels) {
+    char fname[1024];
+    float *ao = NULL;
+
+    ModelFile(fname, thumbdir, prefix, mod, "png");
+    if (aobake) ao = geoBakeAO(mod, AO_RAYS, 0.0f);
+    rasRender(mod, ao, tex, texnum, THUMB_XROT, THUMB_YROT, thumbsize,
+        thumbsize, slices, pixels);
+    free(ao);
+    if (rasWritePNG(fname, thumbsize, thumbsize, pixels)) {
+        printf("ERROR: Could not write %s\n", fname);
+        return 1;
+    }
+    return 0;
+}
+
+// Releases decoded textures
+void FreeTextures(RAS_TEXTURE *tex, int texnum) {
+    int x;
+
+    for (x = 0; x < texnum; x++)
+        if (tex[x].pixels != NULL) free(tex[x].pixels);
+    free(tex);
+    return;
+}
+
+// Renders every model to a PNG file without a window or GPU
+int Thumbnails(GEO *geo) {
+    unsigned char *pixels;
+    RAS_TEXTURE *tex;
+    int x, slices, err = 0;
+
+    // Only the job system is needed from the API
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+    slices = tpkJobStartup(0) + 1;
+    FixNormals(geo);
+
+    tex = DecodeTextures(geo);
+    pixels = malloc(thumbsize * thumbsize * 4);
+    for (x = 0; x < geo->modelnum && !err; x++)
+        err = RenderThumbnail(&geo->models[x], tex, geo->texturenum, "",
+            slices, pixels);
+    if (!err) printf("\nWrote %d thumbnails to %s\n", x, thumbdir);
+
+    FreeTextures(tex, geo->texturenum);
+    free(pixels);
+    ClosePigg();
+    tpkShutdown();
+    return err;
+}
+
+// Reads more of the file a batch is rendering
+int BatchRead(void *data, unsigned char *buffer, int len) {
+    THUMB_FILE *file = data;
+
+    return (int) fread(buffer, 1, len, file->fPtr);
+}
+
+// Renders a model of the file a batch is rendering as it arrives. The
+// file's textures are decoded once its names have been read
+void BatchModel(void *data, GEO *geo, int x) {
+    THUMB_FILE *file = data;
+
+    if (file->err) return;
+    if (file->tex == NULL) {
+        file->tex = DecodeTextures(geo);
+        file->texnum = geo->texturenum;
+    }
+    geoNormals(&geo->models[x], NORMAL_CREASE, 0);
+    file->err = RenderThumbnail(&geo->models[x], file->tex, file->texnum,
+        file->prefix, file->slices, file->pixels);
+    if (!file->err) file->count++;
+    return;
+}
+
+// Orders file paths, so a batch always renders in the same order
+int ComparePaths(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Renders the models of every .geo file under batchdir without a window or
+// GPU, to thumbdir/<file>.<model>.png with the file's directories joined
+// by underscores. Files are streamed in, so only one model of each is held
+// at once. Files that can't be loaded are reported and skipped
+int Batch() {
+    char path[THUMB_PATH * 2 + 2], prefix[THUMB_PATH];
+    unsigned int start = 0;
+    THUMB_FILE file;
+    int x, y, loaded, filenum, total = 0, failed = 0;
+    char **files;
+
+    // Only the job system is needed from the API, and the loader's reports
+    // would bury the progress
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+    geoVerbose(0);
+    memset(&file, 0, sizeof(THUMB_FILE));
+    file.slices = tpkJobStartup(0) + 1;
+
+    tpkTimer(&start);
+    files = tpkFindFiles(batchdir, ".geo", &filenum);
+    if (filenum) qsort(files, filenum, sizeof(char *), ComparePaths);
+
+    file.pixels = malloc(thumbsize * thumbsize * 4);
+    file.prefix = prefix;
+    for (x = 0; x < filenum && !file.err; x++) {
+        sprintf(path, "%s/%s", batchdir, files[x]);
+        file.fPtr = fopen(path, "rb");
+        if (file.fPtr == NULL) {
+            printf("ERROR: Could not open %s\n", path);
+            failed++;
+            continue;
+        }
+
+        // The file's path, less its extension, leads its models' names
+        strcpy(prefix, files[x]);
+        prefix[strlen(prefix) - 3] = 0;
+        for (y = 0; prefix[y]; y++) if (prefix[y] == '/') prefix[y] = '_';
+
+        file.count = 0;
+        loaded = geoLoadStream(BatchRead, BatchModel, &file);
+        if (loaded < 0 && !file.err) {
+            printf("ERROR: Could not load %s: %s\n", path, geoLastError());
+            failed++;
+        }
+        total += file.count;
+        fclose(file.fPtr);
+        if (file.tex != NULL) FreeTextures(file.tex, file.texnum);
+        file.tex = NULL;
+    }
+    if (!file.err)
+        printf("Wrote %d thumbnails of %d files to %s in %u ms\n", total,
+            filenum - failed, thumbdir, tpkTimer(&start));
+
+    for (x = 0; x < filenum; x++) free(files[x]);
+    if (files != NULL) free(files);
+    free(file.pixels);
+    tpkShutdown();
+    if (file.err) return 4;
+    return failed ? 5 : 0;
+}
+
+// Exports a range of models, each to its own file
+void ExportModels(GEO *geo, int first, int last) {
+    char fname[1024];
+    int x, err;
+
+    for (x = first; x < last; x++) {
+        ModelFile(fname, exportdir, "", &geo->models[x],
+            exportobj ? "obj" : "glb");
+        if (exportobj) err = expWriteOBJ(fname, &geo->models[x], 
+            geo->textures, geo->texturenum);
+        else err = expWriteGLB(fname, &geo->models[x], geo->textures, 
+            geo->texturenum);
+        if (err) {
+            printf("ERROR: Could not write %s\n", fname);
+            tpkAtomicAdd(&exportfails, 1);
+        }
+    }
+
+    return;
+}
+
+// Writes every model to exportdir, spread across the job system
+int Export(GEO *geo) {
+    unsigned int start = 0;
+
+    // Only the job system is needed from the API
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+    tpkJobStartup(0);
+    FixNormals(geo);
+
+    tpkTimer(&start);
+    tpkParallelFor(ExportModels, geo, geo->modelnum, 1);
+    if (!exportfails) printf("\nExported %d models to %s in %u ms\n", 
+        geo->modelnum, exportdir, tpkTimer(&start));
+
+    ClosePigg();
+    tpkShutdown();
+    return exportfails ? 1 : 0;
+}
+
+// Maps a file for the model cache
+void* CacheMap(char *path, unsigned char **data, long long *length) {
+    TPK_MAP *map = tpkMapFile(path);
+
+    if (map == NULL) return NULL;
+    *data = map->data;
+    *length = map->length;
+    return map;
+}
+
+// Checks a range of lookup matches against their files through the model
+// cache, in case the files changed since they were catalogued
+void CheckMatches(CAT_MATCH *matches, int first, int last) {
+    char path[2048];
+    GEO_MODEL *mod;
+    GEO *geo;
+    int x;
+
+    for (x = first; x < last; x++) {
+        sprintf(path, "%.1000s/%.1000s", catdir, matches[x].file);
+        geo = geoFetchFile(modelcache, path);
+        mod = geoFetchModel(modelcache, path, matches[x].model);
+        if (geo == NULL || mod == NULL) matchstate[x] = MATCH_MISSING;
+        else if (tpkCaseComp(mod->id, findname) ||
+            mod->facenum != matches[x].facenum ||
+            mod->vertexnum != matches[x].vertexnum)
+            matchstate[x] = MATCH_CHANGED;
+        else matchstate[x] = MATCH_OK;
+        geoReleaseModel(modelcache, mod);
+    }
+
+    return;
+}
+
+// Catalogs the models under catdir, or looks one up
+int Catalog() {
+    GEO_CACHE_HOOKS hooks = {CacheMap, tpkCreateMutex, tpkCreateCond,
+        tpkLockMutex, tpkUnlockMutex, tpkWaitCond, tpkBroadcastCond,
+        tpkDelete};
+    static char *states[] = {"", "  (changed since catalogued)",
+        "  (can't be loaded)"};
+    GEO_CACHE_STATS stats;
+    CAT_MATCH matches[CATALOG_SHOW];
+    unsigned int start = 0;
+    char fname[1024];
+    int x, count;
+    CAT *cat;
+
+    // Mapping files and probing them in parallel needs the API
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+    sprintf(fname, "%.1000s/catalog.gcat", catdir);
+
+    // Build it
+    if (findname == NULL) {
+        tpkJobStartup(0);
+        tpkTimer(&start);
+        count = catBuild(catdir, fname);
+        if (count < 0) printf("ERROR: Could not write %s\n", fname);
+        else printf("Catalogued %d models to %s in %u ms\n", count, fname,
+            tpkTimer(&start));
+        tpkShutdown();
+        return count < 0 ? 4 : 0;
+    }
+
+    // Look the model up
+    cat = catOpen(fname);
+    if (cat == NULL) {
+        printf("ERROR: Could not open %s\n", fname);
+        tpkShutdown();
+        return 4;
+    }
+    count = catFind(cat, findname, matches, CATALOG_SHOW);
+
+    // Decode the matches to check them, files with several matches are
+    // only probed once
+    tpkJobStartup(0);
+    modelcache = geoCreateCache(CATALOG_CACHE, &hooks);
+    tpkParallelFor(CheckMatches, matches,
+        count < CATALOG_SHOW ? count : CATALOG_SHOW, 1);
+
+    for (x = 0; x < count && x < CATALOG_SHOW; x++)
+        printf("%s  model %d  %d faces  %d vertices%s\n", matches[x].file,
+            matches[x].model, matches[x].facenum, matches[x].vertexnum,
+            states[matchstate[x]]);
+    if (count > CATALOG_SHOW) 
+        printf("...and %d more\n", count - CATALOG_SHOW);
+    if (!count) printf("%s not found in %s\n", findname, fname);
+    geoCacheStats(modelcache, &stats);
+    if (count) printf("Model cache: %lld hits, %lld misses, %lld waits, "
+        "%lld evictions, %lld failures\n", stats.hits, stats.misses,
+        stats.waits, stats.evictions, stats.failures);
+
+    geoFreeCache(modelcache);
+    modelcache = NULL;
+    catClose(cat);
+    tpkShutdown();
+    return count ? 0 : 5;
+}
+
+// Loads every .geo file under auditdir, reporting what was found to
+// auditout so the corpus itself is left alone
+int Audit() {
+    unsigned int start = 0;
+    char fname[1024];
+    int err = 0;
+    AUD *aud;
+
+    // Loading in parallel needs the API, reasons are collected instead of
+    // printed and nothing is patched up
+    if (tpkStartup() != TPK_ERR_NONE) {
+        printf("Error starting up the API\n");
+        return 1;
+    }
+    geoVerbose(0);
+    geoRecover(0);
+    tpkJobStartup(0);
+
+    tpkTimer(&start);
+    aud = audRun(auditdir);
+    if (aud == NULL) {
+        printf("ERROR: Could not audit %s\n", auditdir);
+        tpkShutdown();
+        return 4;
+    }
+    printf("Audited %s in %u ms\n", auditdir, tpkTimer(&start));
+    audSummary(aud, AUDIT_SHOW);
+
+    sprintf(fname, "%.1000s/audit.csv", auditout);
+    if (audWriteCSV(aud, fname)) {
+        printf("ERROR: Could not write %s\n", fname);
+        err = 4;
+    }
+    sprintf(fname, "%.1000s/audit.json", auditout);
+    if (audWriteJSON(aud, fname)) {
+        printf("ERROR: Could not write %s\n", fname);
+        err = 4;
+    }
+    if (!err) printf("Wrote %s/audit.csv and .json\n", auditout);
+    if (!err && aud->failed) err = 5;
+
+    audFree(aud);
+    tpkShutdown();
+    return err;
+}
+
+int main(int argc, char **argv) {
+    unsigned char *fData;
+    char fname[1024];
+    GEO *geo = NULL;
+    int err, fLen, x;
+
+    err = CheckArgs(argc, argv); if (err) return err;
+    err = InitZlib();            if (err) return err;
+    geoVerbose(1);
+    geoRecover(1);
+    piggVerbose(1);
+    if (tracefile != NULL) {
+        tpkTraceEnable(1);
+        geoTrace(tpkTraceBegin, tpkTraceEnd);
+    }
+    if (catdir != NULL) return Catalog();
+    if (auditdir != NULL) return Audit();
+    if (batchdir != NULL) return Batch();
+
+    // Models and textures can come straight out of an archive
+    if (piggfile != NULL && OpenPigg()) return 4;
+    if (pigg != NULL) fLen = LoadEntry(geofile, &fData);
+    else fLen = LoadFile(geofile, &fData);
+    if (!fLen) {
+        printf("ERROR: Could not load %s\n", geofile);
+        Breakdown(geo);
+        return 4;
+    }
+
+    geo = geoLoad(fData, fLen);
+    geolen = fLen;
+    if (lodcache) geohash = HashFile(fData, fLen);
+    if (pigg == NULL) free(fData);
+    if (geo == NULL) {
+        Breakdown(geo);
+        return 5;
+    }
+
+    printf("Loaded %s\n", geofile);
+    printf("ID = %s\n", geo->id);
+
+    printf("\nTextures: %d\n", geo->texturenum);
+    for (x = 0; x < geo->texturenum; x++)
+        printf("  %3d  %s\n", x, geo->textures[x]);
+
+    printf("\nModels: %d\n", geo->modelnum);
+    for (x = 0; x < geo->modelnum; x++)
+        printf("  %3d  %s\n", x, geo->models[x].id);
+
+    if (thumbdir != NULL) {
+        err = Thumbnails(geo);
+        Breakdown(geo);
+        return err;
+    }
+    if (exportdir != NULL) {
+        err = Export(geo);
+        Breakdown(geo);
+        return err;
+    }
+
+    if (benchfile != NULL && ReadBench(geo)) { Breakdown(geo); return 6; }
+    if (latfile != NULL && OpenLatency()) { Breakdown(geo); return 6; }
+    if (recordfile != NULL && OpenRecord()) {
+        CloseLatency();
+        Breakdown(geo);
+        return 6;
+    }
+    if (initialize()) {
+        CloseRecord();
+        CloseLatency();
+        Breakdown(geo);
+        return 1;
+    }
+    FixNormals(geo);
+
+    // The LOD cache is read when the gallery opens, get the system started
+    if (lodcache) {
+        sprintf(fname, "%.1000s.lod", geofile);
+        tpkReadAhead(fname);
+    }
+
+    LoadTextures(geo);
+    LoadModel(geo);
+    if (benchfile != NULL) err = Bench(geo) ? 7 : 0;
+    else {
+        if (pigg == NULL) watch = tpkWatchFile(geofile);
+        geo = prgloop(geo);
+    }
+    StopReload();
+    CloseRecord();
+    CloseLatency();
+
+    glDeleteTextures(uploadnum, textures);
+    free(textures);
+    FreeGallery();
+    FreePrefetch();
+    FreePicks();
+    FreeBakes();
+
+    uninitialize();
+    Breakdown(geo);
+
+    return err;
 }
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tpkapi.h"
+#include "geo.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Normal constants
+#define NORM_GRAIN   4096    // Faces or vertices per job
+#define NORM_LARGE   16384   // Models with fewer vertices stay on one thread
+#define NORM_EMPTY   1e-12f  // Squared lengths below this aren't a direction
+#define NORM_HUGE    1e30f   // Squared lengths above this aren't either
+#define NORM_UNIT    2e-5f   // Squared lengths this close to 1 are left alone
+
+// Work shared by the stages
+typedef struct {
+    GEO_MODEL *mod;
+    float     *fx, *fy, *fz; // Area weighted face normals
+    float     *fl;           // Their lengths
+    int       *weld;         // Position each vertex is at
+    int       *pstart;       // First face reference of each position
+    int       *pfaces;       // Faces around each position
+    float      cosine;       // Cosine of the crease angle
+    float      sign;         // Which side of the faces is out
+    int        all;          // Regenerate every normal, not just broken ones
+    volatile int made;       // Normals regenerated
+} NORM_WORK;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Checks whether a stored normal has no usable direction
+static int brokenNormal(GEO_VERTEX *v) {
+    float len = v->nx * v->nx + v->ny * v->ny + v->nz * v->nz;
+
+    return !(len > NORM_EMPTY && len < NORM_HUGE);
+}
+
+// Hashes a position, with both zeros the same
+static unsigned int hashPosition(GEO_VERTEX *v) {
+    unsigned int hash = 2166136261U, bits[3];
+    float p[3];
+    int x;
+
+    p[0] = v->x + 0.0f; p[1] = v->y + 0.0f; p[2] = v->z + 0.0f;
+    memcpy(bits, p, sizeof(bits));
+    for (x = 0; x < 3; x++) hash = (hash ^ bits[x]) * 16777619U;
+    return hash ^ (hash >> 15);
+}
+
+// Gives vertices at the same position the same number, returning how many
+// positions there are
+static int weldPositions(NORM_WORK *work) {
+    GEO_VERTEX *v = work->mod->vertices, *u;
+    int x, y, size, num, *table;
+
+    // Keep the table at most half full
+    for (size = 16; size < work->mod->vertexnum * 2; size <<= 1);
+    table = malloc(size * sizeof(int));
+    for (x = 0; x < size; x++) table[x] = -1;
+
+    // Probe linearly, the first vertex at a position numbers it
+    for (x = num = 0; x < work->mod->vertexnum; x++) {
+        for (y = hashPosition(&v[x]) & (size - 1); table[y] >= 0;
+            y = (y + 1) & (size - 1)) {
+            u = &v[table[y]];
+            if (u->x == v[x].x && u->y == v[x].y && u->z == v[x].z) break;
+        }
+        if (table[y] < 0) {
+            table[y] = x;
+            work->weld[x] = num++;
+        } else work->weld[x] = work->weld[table[y]];
+    }
+
+    free(table);
+    return num;
+}
+
+// Lists the faces around each position
+static void listFaces(NORM_WORK *work, int num) {
+    GEO_MODEL *mod = work->mod;
+    int x, y, p[3];
+
+    // Count, then turn the counts into starts. A face with two corners at
+    // one position is only listed there once
+    work->pstart = calloc(num + 1, sizeof(int));
+    for (x = 0; x < mod->facenum; x++) {
+        p[0] = work->weld[mod->faces[x].v1];
+        p[1] = work->weld[mod->faces[x].v2];
+        p[2] = work->weld[mod->faces[x].v3];
+        work->pstart[p[0] + 1]++;
+        if (p[1] != p[0]) work->pstart[p[1] + 1]++;
+        if (p[2] != p[0] && p[2] != p[1]) work->pstart[p[2] + 1]++;
+    }
+    for (x = 0; x < num; x++) work->pstart[x + 1] += work->pstart[x];
+
+    // Place the faces, then move the starts back
+    work->pfaces = malloc((work->pstart[num] ? work->pstart[num] : 1) *
+        sizeof(int));
+    for (x = 0; x < mod->facenum; x++) {
+        p[0] = work->weld[mod->faces[x].v1];
+        p[1] = work->weld[mod->faces[x].v2];
+        p[2] = work->weld[mod->faces[x].v3];
+        for (y = 0; y < 3; y++) {
+            if ((y > 0 && p[y] == p[0]) || (y > 1 && p[y] == p[1])) continue;
+            work->pfaces[work->pstart[p[y]]++] = x;
+        }
+    }
+    for (x = num; x > 0; x--) work->pstart[x] = work->pstart[x - 1];
+    work->pstart[0] = 0;
+    return;
+}
+
+// Computes the normals of a range of faces, their lengths being twice
+// their areas
+static void faceNormals(void *data, int first, int last) {
+    NORM_WORK *work = data;
+    GEO_VERTEX *v = work->mod->vertices;
+    GEO_FACE *f = work->mod->faces;
+    float ex, ey, ez, gx, gy, gz;
+    int x = first;
+
+#ifdef __SSE2__
+    // Four faces at a time
+    __m128 ax, ay, az, bx, by, bz, cx, cy, cz, nx, ny, nz;
+    for ( ; x + 4 <= last; x += 4) {
+        ax = _mm_setr_ps(v[f[x].v1].x, v[f[x + 1].v1].x,
+            v[f[x + 2].v1].x, v[f[x + 3].v1].x);
+        ay = _mm_setr_ps(v[f[x].v1].y, v[f[x + 1].v1].y,
+            v[f[x + 2].v1].y, v[f[x + 3].v1].y);
+        az = _mm_setr_ps(v[f[x].v1].z, v[f[x + 1].v1].z,
+            v[f[x + 2].v1].z, v[f[x + 3].v1].z);
+        bx = _mm_sub_ps(_mm_setr_ps(v[f[x].v2].x, v[f[x + 1].v2].x,
+            v[f[x + 2].v2].x, v[f[x + 3].v2].x), ax);
+        by = _mm_sub_ps(_mm_setr_ps(v[f[x].v2].y, v[f[x + 1].v2].y,
+            v[f[x + 2].v2].y, v[f[x + 3].v2].y), ay);
+        bz = _mm_sub_ps(_mm_setr_ps(v[f[x].v2].z, v[f[x + 1].v2].z,
+            v[f[x + 2].v2].z, v[f[x + 3].v2].z), az);
+        cx = _mm_sub_ps(_mm_setr_ps(v[f[x].v3].x, v[f[x + 1].v3].x,
+            v[f[x + 2].v3].x, v[f[x + 3].v3].x), ax);
+        cy = _mm_sub_ps(_mm_setr_ps(v[f[x].v3].y, v[f[x + 1].v3].y,
+            v[f[x + 2].v3].y, v[f[x + 3].v3].y), ay);
+        cz = _mm_sub_ps(_mm_setr_ps(v[f[x].v3].z, v[f[x + 1].v3].z,
+            v[f[x + 2].v3].z, v[f[x + 3].v3].z), az);
+        nx = _mm_sub_ps(_mm_mul_ps(by, cz), _mm_mul_ps(bz, cy));
+        ny = _mm_sub_ps(_mm_mul_ps(bz, cx), _mm_mul_ps(bx, cz));
+        nz = _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(by, cx));
+        _mm_storeu_ps(&work->fx[x], nx);
+        _mm_storeu_ps(&work->fy[x], ny);
+        _mm_storeu_ps(&work->fz[x], nz);
+        _mm_storeu_ps(&work->fl[x], _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz))));
+    }
+#endif
+
+    for ( ; x < last; x++) {
+        ex = v[f[x].v2].x - v[f[x].v1].x;
+        ey = v[f[x].v2].y - v[f[x].v1].y;
+        ez = v[f[x].v2].z - v[f[x].v1].z;
+        gx = v[f[x].v3].x - v[f[x].v1].x;
+        gy = v[f[x].v3].y - v[f[x].v1].y;
+        gz = v[f[x].v3].z - v[f[x].v1].z;
+        work->fx[x] = ey * gz - ez * gy;
+        work->fy[x] = ez * gx - ex * gz;
+        work->fz[x] = ex * gy - ey * gx;
+        work->fl[x] = (float) sqrt(work->fx[x] * work->fx[x] +
+            work->fy[x] * work->fy[x] + work->fz[x] * work->fz[x]);
+    }
+
+    return;
+}
+
+// Scales a range of vertices' normals to unit length, writing only the
+// ones that aren't already
+static void unitNormals(NORM_WORK *work, int first, int last) {
+    GEO_VERTEX *v = work->mod->vertices;
+    float len, inv[4];
+    int x = first, y, mask;
+
+#ifdef __SSE2__
+    // Four vertices at a time
+    __m128 nx, ny, nz, len2;
+    for ( ; x + 4 <= last; x += 4) {
+        nx = _mm_setr_ps(v[x].nx, v[x + 1].nx, v[x + 2].nx, v[x + 3].nx);
+        ny = _mm_setr_ps(v[x].ny, v[x + 1].ny, v[x + 2].ny, v[x + 3].ny);
+        nz = _mm_setr_ps(v[x].nz, v[x + 1].nz, v[x + 2].nz, v[x + 3].nz);
+        len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+            _mm_mul_ps(nz, nz));
+        mask = _mm_movemask_ps(_mm_and_ps(
+            _mm_cmpgt_ps(len2, _mm_set1_ps(NORM_EMPTY)),
+            _mm_or_ps(_mm_cmplt_ps(len2, _mm_set1_ps(1.0f - NORM_UNIT)),
+            _mm_cmpgt_ps(len2, _mm_set1_ps(1.0f + NORM_UNIT)))));
+        if (!mask) continue;
+        _mm_storeu_ps(inv, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len2)));
+        for (y = 0; y < 4; y++) {
+            if (!(mask & (1 << y))) continue;
+            v[x + y].nx *= inv[y];
+            v[x + y].ny *= inv[y];
+            v[x + y].nz *= inv[y];
+        }
+    }
+#endif
+
+    for ( ; x < last; x++) {
+        len = v[x].nx * v[x].nx + v[x].ny * v[x].ny + v[x].nz * v[x].nz;
+        if (!(len > NORM_EMPTY) ||
+            (len >= 1.0f - NORM_UNIT && len <= 1.0f + NORM_UNIT)) continue;
+        len = 1.0f / (float) sqrt(len);
+        v[x].nx *= len;
+        v[x].ny *= len;
+        v[x].nz *= len;
+    }
+
+    return;
+}
+
+// Finds which side of the faces the model's intact normals are on, taking
+// the game's counterclockwise winding when none of them are intact
+static float faceSide(NORM_WORK *work) {
+    GEO_MODEL *mod = work->mod;
+    GEO_VERTEX *v;
+    double side = 0.0;
+    int x;
+
+    for (x = 0; x < mod->facenum; x++) {
+        v = &mod->vertices[mod->faces[x].v1];
+        if (brokenNormal(v)) continue;
+        side += v->nx * work->fx[x] + v->ny * work->fy[x] +
+            v->nz * work->fz[x];
+    }
+
+    return side < 0.0 ? -1.0f : 1.0f;
+}
+
+// Regenerates the normals of a range of vertices that need it from the
+// faces around them, then scales the range to unit length
+static void vertexNormals(void *data, int first, int last) {
+    NORM_WORK *work = data;
+    GEO_MODEL *mod = work->mod;
+    float sx, sy, sz, tx, ty, tz, slen;
+    int x, y, f, p, made = 0;
+    GEO_FACE *face;
+    GEO_VERTEX *v;
+
+    for (x = first; work->fx != NULL && x < last; x++) {
+        v = &mod->vertices[x];
+        if (!work->all && !brokenNormal(v)) continue;
+        p = work->weld[x];
+
+        // The vertex's own faces always count
+        sx = sy = sz = tx = ty = tz = 0.0f;
+        for (y = work->pstart[p]; y < work->pstart[p + 1]; y++) {
+            f = work->pfaces[y];
+            face = &mod->faces[f];
+            if (face->v1 != x && face->v2 != x && face->v3 != x) continue;
+            sx += work->fx[f]; sy += work->fy[f]; sz += work->fz[f];
+        }
+
+        // Other faces at the same position count if they're within the
+        // crease angle, or all of them if the vertex has none of its own
+        slen = (float) sqrt(sx * sx + sy * sy + sz * sz);
+        for (y = work->pstart[p]; y < work->pstart[p + 1]; y++) {
+            f = work->pfaces[y];
+            face = &mod->faces[f];
+            if (face->v1 == x || face->v2 == x || face->v3 == x) continue;
+            if (slen > 0.0f && sx * work->fx[f] + sy * work->fy[f] +
+                sz * work->fz[f] < work->cosine * slen * work->fl[f])
+                continue;
+            tx += work->fx[f]; ty += work->fy[f]; tz += work->fz[f];
+        }
+
+        // Something has to be there for the lighting
+        v->nx = (sx + tx) * work->sign;
+        v->ny = (sy + ty) * work->sign;
+        v->nz = (sz + tz) * work->sign;
+        if (brokenNormal(v)) { v->nx = v->ny = 0.0f; v->nz = 1.0f; }
+        made++;
+    }
+
+    if (made) tpkAtomicAdd(&work->made, made);
+    unitNormals(work, first, last);
+    return;
+}
+
+// Runs a stage over a range, across the job system for large models
+static void runStage(NORM_WORK *work, void *func, int count) {
+    if (work->mod->vertexnum >= NORM_LARGE)
+        tpkParallelFor(func, work, count, NORM_GRAIN);
+    else if (count > 0)
+        ((void (*)(void *, int, int)) func)(work, 0, count);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Scale a model's normals to unit length, first regenerating the missing
+// or broken ones, or all of them. Regenerated normals are area weighted,
+// and smooth across the faces at the same position that are within crease
+// degrees of the vertex's own. Returns the number regenerated
+int geoNormals(GEO_MODEL *mod, float crease, int all) {
+    NORM_WORK work;
+    int x, num;
+
+    // Error checking
+    if (mod == NULL || mod->vertexnum < 1) return 0;
+    memset(&work, 0, sizeof(NORM_WORK));
+    work.mod = mod;
+    work.all = all;
+    work.cosine = (float) cos(crease * 0.0174532925);
+
+    // Only find the faces if something needs them
+    for (x = 0; !all && x < mod->vertexnum; x++)
+        if (brokenNormal(&mod->vertices[x])) break;
+    if (x < mod->vertexnum && mod->facenum > 0) {
+        work.weld = malloc(mod->vertexnum * sizeof(int));
+        num = weldPositions(&work);
+        listFaces(&work, num);
+        work.fx = malloc(mod->facenum * sizeof(float));
+        work.fy = malloc(mod->facenum * sizeof(float));
+        work.fz = malloc(mod->facenum * sizeof(float));
+        work.fl = malloc(mod->facenum * sizeof(float));
+        runStage(&work, faceNormals, mod->facenum);
+        work.sign = faceSide(&work);
+    }
+    runStage(&work, vertexNormals, mod->vertexnum);
+
+    // Clean up and return
+    if (work.fx != NULL) {
+        free(work.fx); free(work.fy); free(work.fz); free(work.fl);
+        free(work.weld); free(work.pstart); free(work.pfaces);
+    }
+    return work.made;
+}
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "geo.h"
+
+// Internal triangle information
+typedef struct {
+    int    v[3];    // Vertex indexes
+    int    texture; // Texture index carried over from the source face
+    double n[3];    // Unit normal
+    double err[4];  // Collapse cost of each edge, and the lowest of the three
+    int    dir;     // Bit j set: edge j keeps v[j] and removes v[j + 1]
+    int    deleted; // The triangle has collapsed
+    int    dirty;   // The triangle changed during the current pass
+} SIMP_TRI;
+
+// Internal vertex information
+typedef struct {
+    double q[10];   // Symmetric error quadric
+    double p[3];    // Position
+    int    tstart;  // First reference to a triangle using the vertex
+    int    tcount;  // Number of references to triangles using the vertex
+    int    locked;  // Vertex lies on a border, UV seam or texture boundary
+} SIMP_VERT;
+
+// Reference from a vertex to one of its triangles
+typedef struct {
+    int tid;        // Triangle index
+    int tvertex;    // Which corner of the triangle the vertex is
+} SIMP_REF;
+
+// Working state of one simplification
+typedef struct {
+    SIMP_TRI  *tris;
+    int        trinum;
+    SIMP_VERT *verts;
+    int        vertnum;
+    SIMP_REF  *refs;
+    int        refnum;
+    int        refmax;
+} SIMP;
+
+// Collapse cost used for edges that must not collapse
+#define SIMP_NEVER 1.0e30
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Evaluates the error of a quadric at a point
+static double quadricError(double *q, double *p) {
+    double x = p[0], y = p[1], z = p[2];
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+           q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+           q[7] * z * z + 2 * q[8] * z + q[9];
+}
+
+// Calculates the cheapest way to collapse an edge
+//   Returns 1 in *dir if a is kept and b removed, 0 for the reverse
+static double edgeError(SIMP *s, int a, int b, int *dir) {
+    SIMP_VERT *va = &s->verts[a], *vb = &s->verts[b];
+    double q[10], ea, eb;
+    int x;
+
+    // Locked vertices may be collapsed onto, but never removed
+    if (va->locked && vb->locked) { *dir = 0; return SIMP_NEVER; }
+    for (x = 0; x < 10; x++) q[x] = va->q[x] + vb->q[x];
+    ea = vb->locked ? SIMP_NEVER : quadricError(q, va->p);
+    eb = va->locked ? SIMP_NEVER : quadricError(q, vb->p);
+
+    *dir = (ea <= eb);
+    return (ea <= eb) ? ea : eb;
+}
+
+// Recalculates a triangle's normal and edge costs
+static void updateTri(SIMP *s, SIMP_TRI *t) {
+    double *p0, *p1, *p2, e1[3], e2[3], len;
+    int x, dir;
+
+    p0 = s->verts[t->v[0]].p;
+    p1 = s->verts[t->v[1]].p;
+    p2 = s->verts[t->v[2]].p;
+    for (x = 0; x < 3; x++) { e1[x] = p1[x] - p0[x]; e2[x] = p2[x] - p0[x]; }
+    t->n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    t->n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    t->n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    len = sqrt(t->n[0] * t->n[0] + t->n[1] * t->n[1] + t->n[2] * t->n[2]);
+    if (len > 0.0) { t->n[0] /= len; t->n[1] /= len; t->n[2] /= len; }
+
+    t->dir = 0;
+    t->err[3] = SIMP_NEVER;
+    for (x = 0; x < 3; x++) {
+        t->err[x] = edgeError(s, t->v[x], t->v[(x + 1) % 3], &dir);
+        t->dir |= dir << x;
+        if (t->err[x] < t->err[3]) t->err[3] = t->err[x];
+    }
+    return;
+}
+
+// Removes collapsed triangles and rebuilds the vertex references
+static void compactMesh(SIMP *s) {
+    int x, y, n;
+
+    // Drop deleted triangles
+    for (x = n = 0; x < s->trinum; x++)
+        if (!s->tris[x].deleted) s->tris[n++] = s->tris[x];
+    s->trinum = n;
+
+    // Count the triangles around each vertex
+    for (x = 0; x < s->vertnum; x++) s->verts[x].tcount = 0;
+    for (x = 0; x < s->trinum; x++)
+        for (y = 0; y < 3; y++) s->verts[s->tris[x].v[y]].tcount++;
+    for (x = n = 0; x < s->vertnum; x++) {
+        s->verts[x].tstart = n;
+        n += s->verts[x].tcount;
+        s->verts[x].tcount = 0;
+    }
+
+    // Fill in the references
+    s->refnum = n;
+    for (x = 0; x < s->trinum; x++) {
+        for (y = 0; y < 3; y++) {
+            SIMP_VERT *v = &s->verts[s->tris[x].v[y]];
+            s->refs[v->tstart + v->tcount].tid     = x;
+            s->refs[v->tstart + v->tcount].tvertex = y;
+            v->tcount++;
+        }
+    }
+    return;
+}
+
+// Locks vertices on open borders and where textures meet
+//   UV seams split vertices, so they show up as open borders as well
+static void lockVertices(SIMP *s) {
+    int x, y, z, w, *seen, *count, tex;
+    SIMP_VERT *v;
+    SIMP_TRI *t;
+
+    seen  = malloc(s->vertnum * sizeof(int));
+    count = malloc(s->vertnum * sizeof(int));
+    for (x = 0; x < s->vertnum; x++) seen[x] = -1;
+
+    for (x = 0; x < s->vertnum; x++) {
+        v = &s->verts[x];
+        if (!v->tcount) continue;
+
+        // Count the triangles sharing each edge around the vertex
+        tex = s->tris[s->refs[v->tstart].tid].texture;
+        for (y = 0; y < v->tcount; y++) {
+            t = &s->tris[s->refs[v->tstart + y].tid];
+            if (t->texture != tex) v->locked = 1;
+            for (z = 0; z < 3; z++) {
+                w = t->v[z];
+                if (w == x) continue;
+                if (seen[w] != x) { seen[w] = x; count[w] = 0; }
+                count[w]++;
+            }
+        }
+
+        // An edge used by only one triangle is an open border
+        for (y = 0; y < v->tcount; y++) {
+            t = &s->tris[s->refs[v->tstart + y].tid];
+            for (z = 0; z < 3; z++) {
+                w = t->v[z];
+                if (w != x && count[w] == 1)
+                    v->locked = s->verts[w].locked = 1;
+            }
+        }
+    }
+
+    free(seen);
+    free(count);
+    return;
+}
+
+// Checks whether moving vertex r onto vertex k would fold a triangle over
+static int flipped(SIMP *s, int r, int k) {
+    double *p[3], e1[3], e2[3], n[3], len;
+    SIMP_VERT *v = &s->verts[r];
+    SIMP_TRI *t;
+    int x, y;
+
+    for (x = 0; x < v->tcount; x++) {
+        t = &s->tris[s->refs[v->tstart + x].tid];
+        if (t->deleted) continue;
+        if (t->v[0] == k || t->v[1] == k || t->v[2] == k) continue;
+
+        // Normal of the triangle after the collapse
+        for (y = 0; y < 3; y++)
+            p[y] = s->verts[(t->v[y] == r) ? k : t->v[y]].p;
+        for (y = 0; y < 3; y++) {
+            e1[y] = p[1][y] - p[0][y];
+            e2[y] = p[2][y] - p[0][y];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len <= 0.0) return 1; // Degenerate
+
+        // Reject large changes in orientation
+        if ((n[0] * t->n[0] + n[1] * t->n[1] + n[2] * t->n[2]) / len < 0.2)
+            return 1;
+    }
+    return 0;
+}
+
+// Appends a vertex reference, growing the list as needed
+static void addRef(SIMP *s, int tid, int tvertex) {
+    if (s->refnum == s->refmax) {
+        s->refmax *= 2;
+        s->refs = realloc(s->refs, s->refmax * sizeof(SIMP_REF));
+    }
+    s->refs[s->refnum].tid     = tid;
+    s->refs[s->refnum].tvertex = tvertex;
+    s->refnum++;
+    return;
+}
+
+// Removes vertex r by moving it onto vertex k
+//   Returns the number of triangles that collapsed
+static int collapse(SIMP *s, int r, int k) {
+    SIMP_VERT *vr = &s->verts[r], *vk = &s->verts[k];
+    int x, tstart, rstart, rcount, kstart, kcount, removed = 0;
+    SIMP_REF ref;
+    SIMP_TRI *t;
+
+    for (x = 0; x < 10; x++) vk->q[x] += vr->q[x];
+    rstart = vr->tstart; rcount = vr->tcount;
+    kstart = vk->tstart; kcount = vk->tcount;
+    tstart = s->refnum;
+
+    // Triangles of the removed vertex either collapse or move to the kept one
+    for (x = 0; x < rcount; x++) {
+        ref = s->refs[rstart + x];
+        t = &s->tris[ref.tid];
+        if (t->deleted) continue;
+        if (t->v[0] == k || t->v[1] == k || t->v[2] == k) {
+            t->deleted = 1;
+            removed++;
+            continue;
+        }
+        t->v[ref.tvertex] = k;
+        t->dirty = 1;
+        addRef(s, ref.tid, ref.tvertex);
+    }
+
+    // Triangles of the kept vertex see its new quadric
+    for (x = 0; x < kcount; x++) {
+        ref = s->refs[kstart + x];
+        t = &s->tris[ref.tid];
+        if (t->deleted) continue;
+        t->dirty = 1;
+        addRef(s, ref.tid, ref.tvertex);
+    }
+
+    // The kept vertex now owns the references just appended
+    vr->tcount = 0;
+    vk->tstart = tstart;
+    vk->tcount = s->refnum - tstart;
+    for (x = tstart; x < s->refnum; x++)
+        updateTri(s, &s->tris[s->refs[x].tid]);
+    return removed;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Simplify a model to a fraction of its triangles using quadric error metrics
+//   The new model shares the id string of the source model
+//   Vertices keep their original attributes, so UV seams and textures stay
+GEO_MODEL* geoSimplify(GEO_MODEL *mod, float ratio) {
+    int x, y, z, target, iteration, deleted, dir, r, k, *remap;
+    double threshold, p[4], *q;
+    GEO_MODEL *ret;
+    SIMP_TRI *t;
+    SIMP s;
+
+    // Error checking
+    if (mod == NULL || !mod->facenum || !mod->vertexnum ||
+        !(ratio > 0.0f) || ratio > 1.0f) return NULL;
+    target = (int) (mod->facenum * ratio);
+
+    // Copy the model into the working state
+    s.trinum  = mod->facenum;
+    s.vertnum = mod->vertexnum;
+    s.tris    = calloc(s.trinum,  sizeof(SIMP_TRI));
+    s.verts   = calloc(s.vertnum, sizeof(SIMP_VERT));
+    s.refmax  = s.trinum * 6;
+    s.refs    = malloc(s.refmax * sizeof(SIMP_REF));
+    for (x = 0; x < s.vertnum; x++) {
+        s.verts[x].p[0] = mod->vertices[x].x;
+        s.verts[x].p[1] = mod->vertices[x].y;
+        s.verts[x].p[2] = mod->vertices[x].z;
+    }
+    for (x = 0; x < s.trinum; x++) {
+        s.tris[x].v[0]    = mod->faces[x].v1;
+        s.tris[x].v[1]    = mod->faces[x].v2;
+        s.tris[x].v[2]    = mod->faces[x].v3;
+        s.tris[x].texture = mod->faces[x].texture;
+    }
+    compactMesh(&s);
+    lockVertices(&s);
+
+    // Accumulate the plane of every triangle into its vertices' quadrics
+    for (x = 0; x < s.trinum; x++) {
+        t = &s.tris[x];
+        updateTri(&s, t);
+        p[0] = t->n[0]; p[1] = t->n[1]; p[2] = t->n[2];
+        p[3] = -(p[0] * s.verts[t->v[0]].p[0] +
+                 p[1] * s.verts[t->v[0]].p[1] +
+                 p[2] * s.verts[t->v[0]].p[2]);
+        for (y = 0; y < 3; y++) {
+            q = s.verts[t->v[y]].q;
+            q[0] += p[0] * p[0]; q[1] += p[0] * p[1]; q[2] += p[0] * p[2];
+            q[3] += p[0] * p[3]; q[4] += p[1] * p[1]; q[5] += p[1] * p[2];
+            q[6] += p[1] * p[3]; q[7] += p[2] * p[2]; q[8] += p[2] * p[3];
+            q[9] += p[3] * p[3];
+        }
+    }
+    for (x = 0; x < s.trinum; x++) updateTri(&s, &s.tris[x]);
+
+    // Collapse edges under a slowly rising error threshold
+    for (iteration = deleted = 0; iteration < 100; iteration++) {
+        if (s.trinum - deleted <= target) break;
+
+        // Clean up from time to time to keep the reference list small
+        if (iteration % 5 == 0) { compactMesh(&s); deleted = 0; }
+        for (x = 0; x < s.trinum; x++) s.tris[x].dirty = 0;
+        threshold = 0.000000001 * pow((double) (iteration + 3), 7.0);
+
+        for (x = 0; x < s.trinum && s.trinum - deleted > target; x++) {
+            t = &s.tris[x];
+            if (t->deleted || t->dirty || t->err[3] > threshold) continue;
+
+            for (y = 0; y < 3; y++) {
+                if (t->err[y] > threshold) continue;
+                dir = (t->dir >> y) & 1;
+                k = t->v[dir ? y : (y + 1) % 3];
+                r = t->v[dir ? (y + 1) % 3 : y];
+                if (s.verts[r].locked || flipped(&s, r, k)) continue;
+                deleted += collapse(&s, r, k);
+                break;
+            }
+        }
+    }
+    compactMesh(&s);
+
+    // Build the output model from the vertices still in use
+    ret = calloc(1, sizeof(GEO_MODEL));
+    ret->id = mod->id;
+    remap = malloc(s.vertnum * sizeof(int));
+    for (x = 0; x < s.vertnum; x++)
+        remap[x] = s.verts[x].tcount ? ret->vertexnum++ : -1;
+    ret->facenum = s.trinum;
+    if (ret->facenum) ret->faces = malloc(ret->facenum * sizeof(GEO_FACE));
+    if (ret->vertexnum)
+        ret->vertices = malloc(ret->vertexnum * sizeof(GEO_VERTEX));
+    for (x = 0; x < s.vertnum; x++)
+        if (remap[x] >= 0) ret->vertices[remap[x]] = mod->vertices[x];
+    for (x = 0; x < s.trinum; x++) {
+        z = s.tris[x].texture;
+        ret->faces[x].v1 = remap[s.tris[x].v[0]];
+        ret->faces[x].v2 = remap[s.tris[x].v[1]];
+        ret->faces[x].v3 = remap[s.tris[x].v[2]];
+        ret->faces[x].texture = z;
+    }
+
+    // Clean up and return the simplified model
+    free(remap);
+    free(s.tris);
+    free(s.verts);
+    free(s.refs);
+    return ret;
+}
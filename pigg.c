@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pigg.h"
+
+// This will eventually come from zlib.h
+int uncompress(void *, int *, void *, int);
+
+// Archive layout
+//   Header:          int32 0x123, int16 x2, int16 header size,
+//                    int16 entry size, int32 entrynum
+//   Directory:       entrynum entries of int32 0x3456, int32 name index,
+//                    int32 size, int32 timestamp, int32 offset, int32 x2,
+//                    byte[16] md5, int32 packed size
+//   String table:    int32 0x6789, int32 count, int32 bytes, then count
+//                    times int32 length and that many bytes with the NUL
+#define PIGG_MAGIC   0x123
+#define PIGG_ENTRY_MAGIC  0x3456
+#define PIGG_STRING_MAGIC 0x6789
+
+// Extended data structure for obscuring control information from applications
+typedef struct {
+    PIGG            pigg;
+    unsigned char  *data;    // Archive contents, which stay the caller's
+    long long       len;     // Length of the archive
+    int            *index;   // Hash table of entry numbers, -1 where empty
+    int             mask;    // Hash table size minus one
+    unsigned char **cache;   // Inflated contents of compressed entries
+} PIGG_EXT;
+
+// Macros to take the place of common functions
+#define GetInt16(x, y) ( \
+    ((int) x[y + 1] <<  8) | ((int) x[y]) )
+#define GetInt32(x, y) ( \
+    ((int) x[y + 3] << 24) | ((int) x[y + 2] << 16) | \
+    ((int) x[y + 1] <<  8) | ((int) x[y]) )
+
+// Global data
+static int PIGG_VERBOSE = 0;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Folds a path character so lookups ignore case and separator style
+static int foldChar(int c) {
+    if (c == '\\') return '/';
+    if (c >= 'A' && c <= 'Z') return c + 'a' - 'A';
+    return c;
+}
+
+// Hash a path the way lookups compare it
+static unsigned int hashName(char *name) {
+    unsigned int hash = 2166136261U;
+
+    for ( ; *name; name++)
+        hash = (hash ^ (unsigned int) foldChar((unsigned char) *name)) *
+            16777619U;
+    return hash;
+}
+
+// Compare two paths the way lookups do
+static int sameName(char *a, char *b) {
+    for ( ; *a && foldChar((unsigned char) *a) ==
+        foldChar((unsigned char) *b); a++, b++);
+    return !*a && !*b;
+}
+
+// Reads the string table, pointing each name into the archive
+static char** getStrings(unsigned char *data, long long len, long long offset,
+    int *count) {
+    int x, y, num;
+    char **names;
+
+    // Check the table header
+    if (offset > len - 12 || GetInt32(data, offset) != PIGG_STRING_MAGIC) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Archive string table is missing\n");
+        return NULL;
+    }
+    num = GetInt32(data, offset + 4);
+    offset += 12;
+    if (num < 0 || num > (len - offset) / 4) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Archive string table contains invalid data\n");
+        return NULL;
+    }
+
+    // Every name has to end within its slot
+    names = malloc((num ? num : 1) * sizeof(char *));
+    for (x = 0; x < num; x++) {
+        if (offset > len - 4) break;
+        y = GetInt32(data, offset); offset += 4;
+        if (y < 1 || y > len - offset || data[offset + y - 1]) break;
+        names[x] = (char *) &data[offset];
+        offset += y;
+    }
+    if (x < num) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Invalid archive string encountered\n");
+        free(names);
+        return NULL;
+    }
+
+    *count = num;
+    return names;
+}
+
+// Builds the hash table the entries are looked up in
+static void getIndex(PIGG_EXT *pigx) {
+    PIGG *pigg = &pigx->pigg;
+    int x, y, size;
+
+    // Keep the table at most half full
+    for (size = 16; size < pigg->entrynum * 2; size <<= 1);
+    pigx->mask = size - 1;
+    pigx->index = malloc(size * sizeof(int));
+    for (x = 0; x < size; x++) pigx->index[x] = -1;
+
+    // Probe linearly, the first of two entries with the same path wins
+    for (x = 0; x < pigg->entrynum; x++) {
+        y = hashName(pigg->entries[x].name) & pigx->mask;
+        for ( ; pigx->index[y] >= 0; y = (y + 1) & pigx->mask)
+            if (sameName(pigg->entries[pigx->index[y]].name,
+                pigg->entries[x].name)) break;
+        if (pigx->index[y] < 0) pigx->index[y] = x;
+    }
+
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Release an archive, along with every entry inflated from it
+void piggClose(PIGG *pigg) {
+    PIGG_EXT *pigx;
+    int x;
+
+    // Error checking
+    if (pigg == NULL) {
+        if (PIGG_VERBOSE)
+            printf("WARNING: Argument passed to piggClose() was NULL\n");
+        return;
+    }
+
+    // Delete extended members
+    pigx = (PIGG_EXT *) pigg;
+    for (x = 0; x < pigg->entrynum; x++)
+        if (pigx->cache[x] != NULL) free(pigx->cache[x]);
+    if (pigx->cache != NULL) free(pigx->cache);
+    if (pigx->index != NULL) free(pigx->index);
+
+    // Delete object and return
+    if (pigg->entries != NULL) free(pigg->entries);
+    free(pigx);
+    return;
+}
+
+// Look an entry up by its path, ignoring case and separator style
+PIGG_ENTRY* piggFind(PIGG *pigg, char *name) {
+    PIGG_EXT *pigx = (PIGG_EXT *) pigg;
+    int x;
+
+    // Error checking
+    if (pigg == NULL || name == NULL) return NULL;
+
+    for (x = hashName(name) & pigx->mask; pigx->index[x] >= 0;
+        x = (x + 1) & pigx->mask)
+        if (sameName(pigg->entries[pigx->index[x]].name, name))
+            return &pigg->entries[pigx->index[x]];
+    return NULL;
+}
+
+// Open an archive held in memory, normally a mapping of the file. The
+// memory has to stay valid until piggClose()
+PIGG* piggOpen(unsigned char *data, long long len) {
+    int x, y, hsize, esize, namenum;
+    PIGG_ENTRY *entry;
+    long long offset;
+    PIGG_EXT *pigx;
+    char **names;
+
+    // Error checking
+    if (data == NULL || len < 16) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Bad parameters passed to piggOpen()\n");
+        return NULL;
+    }
+
+    // Check the header
+    hsize = GetInt16(data, 8);
+    esize = GetInt16(data, 10);
+    x     = GetInt32(data, 12);
+    if (GetInt32(data, 0) != PIGG_MAGIC || hsize < 16 || esize < 48 ||
+        x < 0 || x > (len - hsize) / esize) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Unsupported .pigg archive format\n");
+        return NULL;
+    }
+
+    // Names come after the directory
+    names = getStrings(data, len, hsize + (long long) x * esize, &namenum);
+    if (names == NULL) return NULL;
+
+    // Load the directory
+    pigx = calloc(1, sizeof(PIGG_EXT));
+    pigx->data = data;
+    pigx->len = len;
+    pigx->pigg.entrynum = x;
+    pigx->pigg.entries = malloc((x ? x : 1) * sizeof(PIGG_ENTRY));
+    pigx->cache = calloc(x ? x : 1, sizeof(unsigned char *));
+    for (x = 0, offset = hsize; x < pigx->pigg.entrynum; x++, offset += esize) {
+        entry = &pigx->pigg.entries[x];
+        y                = GetInt32(data, offset + 4);
+        entry->size      = GetInt32(data, offset + 8);
+        entry->timestamp = (unsigned int) GetInt32(data, offset + 12);
+        entry->offset    = (unsigned int) GetInt32(data, offset + 16);
+        entry->packsize  = GetInt32(data, offset + 44);
+
+        // The stored data has to lie within the archive
+        if (GetInt32(data, offset) != PIGG_ENTRY_MAGIC || y < 0 ||
+            y >= namenum || entry->size < 0 || entry->packsize < 0 ||
+            entry->offset > len - (entry->packsize ? entry->packsize :
+            entry->size)) break;
+        entry->name = names[y];
+    }
+    free(names);
+    if (x < pigx->pigg.entrynum) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Invalid archive directory entry encountered\n");
+        piggClose(&pigx->pigg);
+        return NULL;
+    }
+
+    // Return the opened archive
+    getIndex(pigx);
+    return &pigx->pigg;
+}
+
+// Get the contents of an entry. Stored entries are read in place, and
+// compressed ones are inflated the first time and kept until piggClose().
+// Safe to call from several threads at once
+unsigned char* piggRead(PIGG *pigg, PIGG_ENTRY *entry) {
+    PIGG_EXT *pigx = (PIGG_EXT *) pigg;
+    unsigned char *data, *cached = NULL, **slot;
+    int len;
+
+    // Error checking
+    if (pigg == NULL || entry == NULL) return NULL;
+    if (!entry->packsize) return &pigx->data[entry->offset];
+
+    // Inflated before
+    slot = &pigx->cache[entry - pigg->entries];
+    data = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (data != NULL) return data;
+
+    // Inflate it, a thread losing the race uses the winner's copy
+    data = malloc(entry->size ? entry->size : 1);
+    len = entry->size;
+    if (uncompress(data, &len, &pigx->data[entry->offset], entry->packsize) ||
+        len != entry->size) {
+        if (PIGG_VERBOSE)
+            printf("ERROR: Could not inflate %s\n", entry->name);
+        free(data);
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(slot, &cached, data, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(data);
+        data = cached;
+    }
+
+    return data;
+}
+
+// Set the verbosity level
+void piggVerbose(int verbose) {
+    PIGG_VERBOSE = verbose;
+    return;
+}
@@ -0,0 +1,23 @@
+#ifndef __COH_PIGG__
+#define __COH_PIGG__
+
+typedef struct {
+    char        *name;      // Path of the entry within the archive
+    int          size;      // Length of the contents
+    int          packsize;  // Length as stored, 0 if stored uncompressed
+    unsigned int timestamp; // Modification time, seconds since 1970
+    unsigned int offset;    // Position of the stored data in the archive
+} PIGG_ENTRY;
+
+typedef struct {
+    int         entrynum;
+    PIGG_ENTRY *entries;
+} PIGG;
+
+void  piggClose(PIGG *);
+PIGG_ENTRY* piggFind(PIGG *, char *);
+PIGG* piggOpen(unsigned char *, long long);
+unsigned char* piggRead(PIGG *, PIGG_ENTRY *);
+void  piggVerbose(int);
+
+#endif // __COH_PIGG__
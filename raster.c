@@ -0,0 +1,1091 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tpkapi.h"
+#include "raster.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// This will eventually come from zlib.h
+int compress(void *, int *, void *, int);
+
+// Rasterizer constants
+#define RAS_TILE    32  // Width and height of a tile, in pixels
+#define RAS_SLICES  64  // Most geometry slices one render will use
+#define RAS_NEAR    0.1 // Same projection as configviewport() in geodraw.c
+#define RAS_FAR     100.0
+
+// Deflate constants
+#define RAS_HASHBITS 15          // Bits of the match finder's hash
+#define RAS_WINDOW   32768       // Farthest back a match may reach
+#define RAS_MINMATCH 4           // Shortest match the hash finds
+#define RAS_MAXMATCH 258         // Longest match deflate can code
+#define RAS_SLICEMIN 65536       // Fewest image bytes per slice
+#define RAS_BLOCK    65536       // Most symbols in one deflate block
+#define RAS_SYMBOLS  288         // Literal/length symbols, last two unused
+#define RAS_MATCH    0x80000000U // Marks a parsed symbol as a match
+#define RAS_ADLER    65521       // Adler-32 modulus
+
+// Vertex after transformation and lighting, in clip space
+typedef struct {
+    float x, y, z, w; // Clip coordinates
+    float s, t;       // Texture coordinates
+    float l;          // Light intensity
+} RAS_VERT;
+
+// Triangle ready for rasterization
+typedef struct {
+    float edge[3][3];  // Edge functions: A * x + B * y + C
+    float plane[5][3]; // Depth, 1/w, s/w, t/w and light/w over the screen
+    int   minx, miny;  // Bounding box in pixels, inclusive
+    int   maxx, maxy;
+    int   texture;     // Index of the texture to sample
+} RAS_TRI;
+
+// List of triangles touching one tile, made by one geometry slice
+typedef struct {
+    int *tris;
+    int  count;
+    int  max;
+} RAS_BIN;
+
+// State shared by all jobs of one render
+typedef struct {
+    GEO_MODEL   *mod;
+    float       *ao;         // Light scale per vertex, NULL for none
+    RAS_TEXTURE *textures;
+    int          texturenum;
+    int          width, height;
+    int          tilesx, tilesy;
+    int          slices;     // Parts the faces are split into for binning
+    float        m[12];      // Model to eye transformation
+    float        nm[9];      // Model to eye transformation for normals
+    float        px, py;     // Projection scale factors
+    float        pz, pw;     // Projection depth factors
+    RAS_TRI     *tris;       // Two slots per face, for near plane clipping
+    RAS_BIN     *bins;       // slices * tiles bins
+    unsigned char *pixels;
+    float       *depth;
+} RAS_CONTEXT;
+
+// Deflate output, written least significant bit first
+typedef struct {
+    unsigned char *out;   // Large enough for the worst case
+    int            len;   // Bytes written
+    unsigned int   bits;  // Bits not written yet
+    int            count; // Number of them
+} RAS_BITS;
+
+// Rows of a PNG compressed as their own run of deflate blocks
+typedef struct {
+    int            first, last; // Rows covered
+    unsigned char *out;         // Compressed rows
+    int            outlen;
+    unsigned int   adler;       // Adler-32 of the filtered rows
+    unsigned int   crc;         // CRC-32 of the IDAT chunk holding them
+} RAS_SLICE;
+
+// State shared by all jobs of one PNG
+typedef struct {
+    int            width, height;
+    unsigned char *pixels;      // RGBA, top row first
+    RAS_SLICE     *slices;
+    int            slicenum;
+} RAS_PNG;
+
+// Deflate length and distance codes: the smallest value of each, and the
+// extra bits telling values under the same code apart
+static const short rasLenBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17,
+    19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const char rasLenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+    2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short rasDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33,
+    49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577};
+static const char rasDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5,
+    5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// CRC-32 of each byte value for PNG chunks, polynomial 0xEDB88320
+static const unsigned int rasCRCTable[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Non-API Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Transforms and lights one vertex, like the fixed pipeline in geodraw.c
+static void rasVertex(RAS_CONTEXT *ctx, int index, RAS_VERT *out) {
+    float *m = ctx->m, *nm = ctx->nm, ex, ey, ez, nx, ny, nz, len, d;
+    GEO_VERTEX *v = &ctx->mod->vertices[index];
+
+    // Eye space position and normal
+    ex = m[0] * v->x + m[1] * v->y + m[2]  * v->z + m[3];
+    ey = m[4] * v->x + m[5] * v->y + m[6]  * v->z + m[7];
+    ez = m[8] * v->x + m[9] * v->y + m[10] * v->z + m[11];
+    nx = nm[0] * v->nx + nm[1] * v->ny + nm[2] * v->nz;
+    ny = nm[3] * v->nx + nm[4] * v->ny + nm[5] * v->nz;
+    nz = nm[6] * v->nx + nm[7] * v->ny + nm[8] * v->nz;
+
+    // Light 0 sits at the eye: ambient 1, diffuse 1, default material
+    len = (float) sqrt(ex * ex + ey * ey + ez * ez);
+    d = (len > 0.0f) ? -(nx * ex + ny * ey + nz * ez) / len : 0.0f;
+    out->l = 0.24f + 0.8f * ((d > 0.0f) ? d : 0.0f);
+    if (out->l > 1.0f) out->l = 1.0f;
+    if (ctx->ao != NULL) out->l *= ctx->ao[index];
+
+    // Clip space position
+    out->x = ctx->px * ex;
+    out->y = ctx->py * ey;
+    out->z = ctx->pz * ez + ctx->pw;
+    out->w = -ez;
+    out->s = v->s;
+    out->t = v->t;
+    return;
+}
+
+// Interpolates between two clip space vertices
+static void rasLerp(RAS_VERT *a, RAS_VERT *b, float f, RAS_VERT *out) {
+    out->x = a->x + (b->x - a->x) * f;
+    out->y = a->y + (b->y - a->y) * f;
+    out->z = a->z + (b->z - a->z) * f;
+    out->w = a->w + (b->w - a->w) * f;
+    out->s = a->s + (b->s - a->s) * f;
+    out->t = a->t + (b->t - a->t) * f;
+    out->l = a->l + (b->l - a->l) * f;
+    return;
+}
+
+// Prepares a screen space triangle, returning 0 if nothing is visible
+static int rasSetup(RAS_CONTEXT *ctx, RAS_VERT **v, int texture,
+    RAS_TRI *tri) {
+    float sx[3], sy[3], sz[3], iw[3], area, f[3], minx, miny, maxx, maxy;
+    int x, y;
+
+    // Project onto the screen, top row first
+    for (x = 0; x < 3; x++) {
+        iw[x] = 1.0f / v[x]->w;
+        sx[x] = (v[x]->x * iw[x] + 1.0f) * 0.5f * ctx->width;
+        sy[x] = (1.0f - v[x]->y * iw[x]) * 0.5f * ctx->height;
+        sz[x] = v[x]->z * iw[x];
+    }
+
+    // GL_FRONT faces are culled; y points down here, so keep positive area
+    area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if (!(area > 0.0f)) return 0;
+
+    // Bounding box, clipped to the image
+    minx = maxx = sx[0]; miny = maxy = sy[0];
+    for (x = 1; x < 3; x++) {
+        if (sx[x] < minx) minx = sx[x];
+        if (sx[x] > maxx) maxx = sx[x];
+        if (sy[x] < miny) miny = sy[x];
+        if (sy[x] > maxy) maxy = sy[x];
+    }
+    tri->minx = (minx < 0.0f) ? 0 : (int) minx;
+    tri->miny = (miny < 0.0f) ? 0 : (int) miny;
+    tri->maxx = (maxx >= ctx->width)  ? ctx->width  - 1 : (int) maxx;
+    tri->maxy = (maxy >= ctx->height) ? ctx->height - 1 : (int) maxy;
+    if (tri->minx > tri->maxx || tri->miny > tri->maxy) return 0;
+
+    // Edge function x opposes vertex x
+    for (x = 0; x < 3; x++) {
+        int a = (x + 1) % 3, b = (x + 2) % 3;
+        tri->edge[x][0] = -(sy[b] - sy[a]);
+        tri->edge[x][1] =   sx[b] - sx[a];
+        tri->edge[x][2] =  (sy[b] - sy[a]) * sx[a] - (sx[b] - sx[a]) * sy[a];
+    }
+
+    // Attribute planes, weighted by the normalized edge functions
+    for (y = 0; y < 5; y++) {
+        for (x = 0; x < 3; x++) {
+            switch (y) {
+            case 0: f[x] = sz[x];                 break;
+            case 1: f[x] = iw[x];                 break;
+            case 2: f[x] = v[x]->s * iw[x];       break;
+            case 3: f[x] = v[x]->t * iw[x];       break;
+            default: f[x] = v[x]->l * iw[x];      break;
+            }
+        }
+        for (x = 0; x < 3; x++)
+            tri->plane[y][x] = (f[0] * tri->edge[0][x] +
+                f[1] * tri->edge[1][x] + f[2] * tri->edge[2][x]) / area;
+    }
+
+    tri->texture = texture;
+    return 1;
+}
+
+// Adds a triangle to a bin
+static void rasBin(RAS_BIN *bin, int tri) {
+    if (bin->count == bin->max) {
+        bin->max = bin->max ? bin->max * 2 : 64;
+        bin->tris = realloc(bin->tris, bin->max * sizeof(int));
+    }
+    bin->tris[bin->count++] = tri;
+    return;
+}
+
+// Transforms, clips, sets up and bins one slice of the faces
+static void rasGeometry(RAS_CONTEXT *ctx, int index) {
+    int x, y, z, in, out, first, last, tiles, slot, count;
+    RAS_VERT v[3], poly[4], *tv[3];
+    RAS_BIN *bins;
+    RAS_TRI *tri;
+    GEO_FACE *f;
+    float d0, d1;
+
+    tiles = ctx->tilesx * ctx->tilesy;
+    bins  = &ctx->bins[index * tiles];
+    first = (int) ((long long) ctx->mod->facenum * index / ctx->slices);
+    last  = (int) ((long long) ctx->mod->facenum * (index + 1) / ctx->slices);
+
+    for (x = first; x < last; x++) {
+        f = &ctx->mod->faces[x];
+        rasVertex(ctx, f->v1, &v[0]);
+        rasVertex(ctx, f->v2, &v[1]);
+        rasVertex(ctx, f->v3, &v[2]);
+
+        // Clip against the near plane, z >= -w
+        for (y = in = 0; y < 3; y++) in += (v[y].z >= -v[y].w);
+        if (!in) continue;
+        if (in == 3) {
+            for (y = 0; y < 3; y++) poly[y] = v[y];
+            count = 3;
+        } else {
+            for (y = count = 0; y < 3; y++) {
+                z = (y + 1) % 3;
+                d0 = v[y].z + v[y].w;
+                d1 = v[z].z + v[z].w;
+                if (d0 >= 0.0f) poly[count++] = v[y];
+                if ((d0 >= 0.0f) != (d1 >= 0.0f))
+                    rasLerp(&v[y], &v[z], d0 / (d0 - d1), &poly[count++]);
+            }
+        }
+
+        // Set up the one or two resulting triangles and bin them by tile
+        for (y = 0, out = 0; y + 2 < count; y++, out++) {
+            slot = x * 2 + out;
+            tri = &ctx->tris[slot];
+            tv[0] = &poly[0]; tv[1] = &poly[y + 1]; tv[2] = &poly[y + 2];
+            if (!rasSetup(ctx, tv, f->texture, tri)) continue;
+            for (z = tri->miny / RAS_TILE; z <= tri->maxy / RAS_TILE; z++)
+                for (in = tri->minx / RAS_TILE;
+                    in <= tri->maxx / RAS_TILE; in++)
+                    rasBin(&bins[z * ctx->tilesx + in], slot);
+        }
+    }
+    return;
+}
+
+// Samples a texture with bilinear filtering and wrapping
+static void rasSample(RAS_TEXTURE *tex, float s, float t, float *rgba) {
+    int x0, y0, x1, y1, c;
+    unsigned char *p00, *p01, *p10, *p11;
+    float u, v, fu, fv;
+
+    // Textures that failed to load are ignored, as OpenGL does
+    if (tex == NULL || tex->pixels == NULL) {
+        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 1.0f;
+        return;
+    }
+
+    u = s * tex->width  - 0.5f;
+    v = t * tex->height - 0.5f;
+    x0 = (int) floor(u); fu = u - x0;
+    y0 = (int) floor(v); fv = v - y0;
+    x0 %= tex->width;  if (x0 < 0) x0 += tex->width;
+    y0 %= tex->height; if (y0 < 0) y0 += tex->height;
+    x1 = (x0 + 1) % tex->width;
+    y1 = (y0 + 1) % tex->height;
+
+    p00 = &tex->pixels[(y0 * tex->width + x0) * 4];
+    p01 = &tex->pixels[(y0 * tex->width + x1) * 4];
+    p10 = &tex->pixels[(y1 * tex->width + x0) * 4];
+    p11 = &tex->pixels[(y1 * tex->width + x1) * 4];
+    for (c = 0; c < 4; c++)
+        rgba[c] = ((p00[c] * (1.0f - fu) + p01[c] * fu) * (1.0f - fv) +
+                   (p10[c] * (1.0f - fu) + p11[c] * fu) * fv) / 255.0f;
+    return;
+}
+
+// Shades one covered pixel that passed the depth test
+static void rasShade(RAS_CONTEXT *ctx, RAS_TRI *tri, int px, int py,
+    float fx, float fy) {
+    float iw, s, t, l, rgba[4];
+    unsigned char *out;
+    int c;
+
+    // Perspective correct attributes
+    iw = tri->plane[1][0] * fx + tri->plane[1][1] * fy + tri->plane[1][2];
+    s  = (tri->plane[2][0] * fx + tri->plane[2][1] * fy + tri->plane[2][2]) / iw;
+    t  = (tri->plane[3][0] * fx + tri->plane[3][1] * fy + tri->plane[3][2]) / iw;
+    l  = (tri->plane[4][0] * fx + tri->plane[4][1] * fy + tri->plane[4][2]) / iw;
+
+    // GL_MODULATE with the lit color
+    rasSample((tri->texture >= 0 && tri->texture < ctx->texturenum) ?
+        &ctx->textures[tri->texture] : NULL, s, t, rgba);
+    out = &ctx->pixels[(py * ctx->width + px) * 4];
+    for (c = 0; c < 3; c++) {
+        rgba[c] *= l;
+        out[c] = (unsigned char) (rgba[c] * 255.0f + 0.5f);
+    }
+    out[3] = (unsigned char) (rgba[3] * 255.0f + 0.5f);
+    return;
+}
+
+// Rasterizes one triangle within one tile
+static void rasTriangle(RAS_CONTEXT *ctx, RAS_TRI *tri, int tx, int ty) {
+    int minx, miny, maxx, maxy, x, y, lane;
+    float fy, *depth;
+
+    // Restrict the bounding box to the tile
+    minx = tx * RAS_TILE; maxx = minx + RAS_TILE - 1;
+    miny = ty * RAS_TILE; maxy = miny + RAS_TILE - 1;
+    if (tri->minx > minx) minx = tri->minx;
+    if (tri->maxx < maxx) maxx = tri->maxx;
+    if (tri->miny > miny) miny = tri->miny;
+    if (tri->maxy < maxy) maxy = tri->maxy;
+
+    for (y = miny; y <= maxy; y++) {
+        fy = y + 0.5f;
+        depth = &ctx->depth[y * ctx->width];
+
+#ifdef __SSE2__
+        {
+            __m128 e0, e1, e2, z, step, xs, zero, one, mask;
+            float zs[4];
+            int bits;
+
+            // Four pixels at a time along the row
+            zero = _mm_setzero_ps();
+            one  = _mm_set1_ps(1.0f);
+            step = _mm_set1_ps(4.0f);
+            xs = _mm_add_ps(_mm_set1_ps(minx + 0.5f),
+                _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+            for (x = minx; x <= maxx; x += 4) {
+                e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri->edge[0][0]), xs),
+                    _mm_set1_ps(tri->edge[0][1] * fy + tri->edge[0][2]));
+                e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri->edge[1][0]), xs),
+                    _mm_set1_ps(tri->edge[1][1] * fy + tri->edge[1][2]));
+                e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri->edge[2][0]), xs),
+                    _mm_set1_ps(tri->edge[2][1] * fy + tri->edge[2][2]));
+                mask = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+                    _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+                z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri->plane[0][0]), xs),
+                    _mm_set1_ps(tri->plane[0][1] * fy + tri->plane[0][2]));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(z, one));
+
+                // Depth test all four lanes when they are inside the tile
+                if (x + 3 <= maxx) mask = _mm_and_ps(mask,
+                    _mm_cmple_ps(z, _mm_loadu_ps(&depth[x])));
+                bits = _mm_movemask_ps(mask);
+                if (bits) {
+                    _mm_storeu_ps(zs, z);
+                    for (lane = 0; lane < 4; lane++) {
+                        if (!(bits & (1 << lane)) || x + lane > maxx ||
+                            zs[lane] > depth[x + lane]) continue;
+                        depth[x + lane] = zs[lane];
+                        rasShade(ctx, tri, x + lane, y, x + lane + 0.5f, fy);
+                    }
+                }
+                xs = _mm_add_ps(xs, step);
+            }
+        }
+#else
+        for (x = minx; x <= maxx; x++) {
+            float fx = x + 0.5f, zl;
+            for (lane = 0; lane < 3; lane++)
+                if (tri->edge[lane][0] * fx + tri->edge[lane][1] * fy +
+                    tri->edge[lane][2] < 0.0f) break;
+            if (lane < 3) continue;
+            zl = tri->plane[0][0] * fx + tri->plane[0][1] * fy +
+                tri->plane[0][2];
+            if (zl > depth[x] || zl > 1.0f) continue;
+            depth[x] = zl;
+            rasShade(ctx, tri, x, y, fx, fy);
+        }
+#endif
+    }
+    return;
+}
+
+// Job function binning a range of geometry slices
+static void rasGeometryRange(RAS_CONTEXT *ctx, int first, int last) {
+    for ( ; first < last; first++)
+        rasGeometry(ctx, first);
+    return;
+}
+
+// Job function rasterizing a range of tiles
+static void rasTilesRange(RAS_CONTEXT *ctx, int first, int last) {
+    int tile, tiles, x, y;
+    RAS_BIN *bin;
+
+    tiles = ctx->tilesx * ctx->tilesy;
+    for (tile = first; tile < last; tile++) {
+
+        // Bins are visited in slice order to keep the submission order
+        for (x = 0; x < ctx->slices; x++) {
+            bin = &ctx->bins[x * tiles + tile];
+            for (y = 0; y < bin->count; y++)
+                rasTriangle(ctx, &ctx->tris[bin->tris[y]],
+                    tile % ctx->tilesx, tile / ctx->tilesx);
+        }
+    }
+    return;
+}
+
+// Table driven CRC-32 for PNG chunks
+static unsigned int rasCRC(unsigned int crc, unsigned char *data, int len) {
+    int x;
+
+    crc = ~crc;
+    for (x = 0; x < len; x++)
+        crc = rasCRCTable[(crc ^ data[x]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Writes one PNG chunk, given the CRC-32 of its type and data
+static void rasChunkCRC(FILE *fPtr, char *type, unsigned char *data, int len,
+    unsigned int crc) {
+    unsigned char head[8];
+
+    head[0] = len >> 24; head[1] = len >> 16; head[2] = len >> 8; head[3] = len;
+    memcpy(&head[4], type, 4);
+    fwrite(head, 1, 8, fPtr);
+    if (len) fwrite(data, 1, len, fPtr);
+    head[0] = crc >> 24; head[1] = crc >> 16; head[2] = crc >> 8; head[3] = crc;
+    fwrite(head, 1, 4, fPtr);
+    return;
+}
+
+// Writes one PNG chunk
+static void rasChunk(FILE *fPtr, char *type, unsigned char *data, int len) {
+    rasChunkCRC(fPtr, type, data, len,
+        rasCRC(rasCRC(0, (unsigned char *) type, 4), data, len));
+    return;
+}
+
+// Adler-32 of a buffer, continuing from a previous value
+static unsigned int rasAdler(unsigned int adler, unsigned char *data,
+    int len) {
+    unsigned int a = adler & 0xFFFF, b = adler >> 16;
+    int x, run;
+
+    // Sums are reduced before they can overflow
+    while (len > 0) {
+        run = (len < 5552) ? len : 5552;
+        for (x = 0; x < run; x++) { a += data[x]; b += a; }
+        a %= RAS_ADLER; b %= RAS_ADLER;
+        data += run; len -= run;
+    }
+    return a | (b << 16);
+}
+
+// Adler-32 of two buffers one after the other, from the Adler-32 of each
+// and the length of the second
+static unsigned int rasAdlerJoin(unsigned int a1, unsigned int a2,
+    unsigned int len2) {
+    unsigned int rem = len2 % RAS_ADLER, a, b;
+
+    a = (a1 & 0xFFFF) + (a2 & 0xFFFF) + RAS_ADLER - 1;
+    b = (rem * (a1 & 0xFFFF)) % RAS_ADLER;
+    b += (a1 >> 16) + (a2 >> 16) + RAS_ADLER - rem;
+    if (a >= RAS_ADLER) a -= RAS_ADLER;
+    if (a >= RAS_ADLER) a -= RAS_ADLER;
+    if (b >= RAS_ADLER * 2) b -= RAS_ADLER * 2;
+    if (b >= RAS_ADLER) b -= RAS_ADLER;
+    return a | (b << 16);
+}
+
+// Adds bits to deflate output
+static void rasPutBits(RAS_BITS *b, unsigned int bits, int count) {
+    b->bits |= bits << b->count;
+    b->count += count;
+    while (b->count >= 8) {
+        b->out[b->len++] = (unsigned char) b->bits;
+        b->bits >>= 8;
+        b->count -= 8;
+    }
+    return;
+}
+
+// Finds which of a list of code bases a value falls under
+static int rasCodeBase(const short *base, int num, int value) {
+    int lo = 0, hi = num - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (base[mid] <= value) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Builds code lengths of at most limit bits from symbol counts, the
+// two-queue way, flattening the counts until the longest code fits
+static void rasHuffman(unsigned int *counts, int num, int limit,
+    unsigned char *sizes) {
+    unsigned int work[RAS_SYMBOLS], weight[2 * RAS_SYMBOLS];
+    int order[RAS_SYMBOLS], parent[2 * RAS_SYMBOLS], depth[2 * RAS_SYMBOLS];
+    int used, nodes, leaf, inner, longest, x, y, pick[2];
+
+    // Deflate wants two codes at least, even if fewer are used
+    for (x = used = 0; x < num; x++) {
+        work[x] = counts[x];
+        if (work[x]) used++;
+    }
+    for (x = 0; x < num && used < 2; x++)
+        if (!work[x]) { work[x] = 1; used++; }
+
+    do {
+        // Used symbols in order of count
+        for (x = used = 0; x < num; x++) {
+            sizes[x] = 0;
+            if (!work[x]) continue;
+            for (y = used++; y > 0 && work[order[y - 1]] > work[x]; y--)
+                order[y] = order[y - 1];
+            order[y] = x;
+        }
+
+        // Join the two lightest of the leaves and joined nodes until one
+        // is left, joined nodes coming out in order of weight
+        for (x = 0; x < used; x++) weight[x] = work[order[x]];
+        for (leaf = 0, inner = nodes = used; nodes < 2 * used - 1; nodes++) {
+            for (y = 0; y < 2; y++) {
+                if (leaf < used && (inner >= nodes ||
+                    weight[leaf] <= weight[inner])) pick[y] = leaf++;
+                else pick[y] = inner++;
+                parent[pick[y]] = nodes;
+            }
+            weight[nodes] = weight[pick[0]] + weight[pick[1]];
+        }
+
+        // Depths from the root down, which was joined last
+        depth[nodes - 1] = 0;
+        for (x = nodes - 2, longest = 0; x >= 0; x--) {
+            depth[x] = depth[parent[x]] + 1;
+            if (x < used && depth[x] > longest) longest = depth[x];
+        }
+        for (x = 0; x < used; x++) sizes[order[x]] = depth[x];
+
+        // Flatter counts make a shallower tree
+        if (longest > limit)
+            for (x = 0; x < num; x++)
+                if (work[x]) work[x] = (work[x] >> 1) | 1;
+    } while (longest > limit);
+    return;
+}
+
+// Makes the canonical codes for a list of code lengths, bit reversed the
+// way deflate writes them
+static void rasCanonical(unsigned char *sizes, int num,
+    unsigned short *codes) {
+    int counts[16], next[16], code, x, y;
+
+    for (x = 0; x < 16; x++) counts[x] = 0;
+    for (x = 0; x < num; x++) counts[sizes[x]]++;
+    for (x = 1, code = 0, counts[0] = 0; x < 16; x++) {
+        code = (code + counts[x - 1]) << 1;
+        next[x] = code;
+    }
+    for (x = 0; x < num; x++) {
+        if (!sizes[x]) continue;
+        code = next[sizes[x]]++;
+        for (y = 0, codes[x] = 0; y < sizes[x]; y++)
+            codes[x] |= ((code >> y) & 1) << (sizes[x] - 1 - y);
+    }
+    return;
+}
+
+// Writes one block of parsed symbols, with Huffman codes made for them or
+// the fixed ones, whichever comes out smaller
+static void rasPutBlock(RAS_BITS *b, unsigned int *syms, int num, int last) {
+    static const unsigned char order[19] =
+        {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    static const unsigned char rlebits[3] = {2, 3, 7};
+    unsigned int counts[RAS_SYMBOLS + 30], rlecounts[19], sym;
+    unsigned char sizes[RAS_SYMBOLS + 30], rlesizes[19];
+    unsigned char rle[RAS_SYMBOLS + 30], rlex[RAS_SYMBOLS + 30];
+    unsigned short codes[RAS_SYMBOLS + 30], rlecodes[19];
+    unsigned char *dsizes = &sizes[RAS_SYMBOLS];
+    unsigned short *dcodes = &codes[RAS_SYMBOLS];
+    int litnum, distnum, rlenum, total, run, lens, x;
+    long long dynamic, fixed;
+
+    // Symbol counts, lengths and distances side by side
+    for (x = 0; x < RAS_SYMBOLS + 30; x++) counts[x] = 0;
+    for (x = 0; x < num; x++) {
+        sym = syms[x];
+        if (!(sym & RAS_MATCH)) counts[sym]++;
+        else {
+            counts[257 + ((sym >> 23) & 0x1F)]++;
+            counts[RAS_SYMBOLS + ((sym >> 18) & 0x1F)]++;
+        }
+    }
+    counts[256] = 1;
+    rasHuffman(counts, RAS_SYMBOLS - 2, 15, sizes);
+    sizes[RAS_SYMBOLS - 2] = sizes[RAS_SYMBOLS - 1] = 0;
+    rasHuffman(&counts[RAS_SYMBOLS], 30, 15, dsizes);
+
+    // Code lengths of both alphabets, run length coded into one list
+    for (litnum = RAS_SYMBOLS - 2; !sizes[litnum - 1]; litnum--);
+    for (distnum = 30; distnum > 1 && !dsizes[distnum - 1]; distnum--);
+    memmove(&sizes[litnum], dsizes, distnum);
+    total = litnum + distnum;
+    for (x = rlenum = 0; x < total; x += run) {
+        for (run = 1; x + run < total && sizes[x + run] == sizes[x]; run++);
+        if (!sizes[x] && run >= 3) {
+            if (run > 138) run = 138;
+            rle[rlenum] = (run >= 11) ? 18 : 17;
+            rlex[rlenum++] = run - ((run >= 11) ? 11 : 3);
+        } else if (sizes[x] && run >= 4) {
+            if (run > 7) run = 7;
+            rle[rlenum] = sizes[x]; rlex[rlenum++] = 0;
+            rle[rlenum] = 16; rlex[rlenum++] = run - 4;
+        } else {
+            run = 1;
+            rle[rlenum] = sizes[x]; rlex[rlenum++] = 0;
+        }
+    }
+    for (x = 0; x < 19; x++) rlecounts[x] = 0;
+    for (x = 0; x < rlenum; x++) rlecounts[rle[x]]++;
+    rasHuffman(rlecounts, 19, 7, rlesizes);
+    rasCanonical(rlesizes, 19, rlecodes);
+    for (lens = 19; lens > 4 && !rlesizes[order[lens - 1]]; lens--);
+
+    // Bits each way would take, leaving out the extra bits both share
+    dynamic = 14 + lens * 3;
+    for (x = 0; x < rlenum; x++) {
+        dynamic += rlesizes[rle[x]];
+        if (rle[x] >= 16) dynamic += rlebits[rle[x] - 16];
+    }
+    for (x = fixed = 0; x < RAS_SYMBOLS; x++) {
+        dynamic += (long long) counts[x] * (x < litnum ? sizes[x] : 0);
+        fixed += (long long) counts[x] *
+            ((x < 144) ? 8 : (x < 256) ? 9 : (x < 280) ? 7 : 8);
+    }
+    for (x = 0; x < 30; x++) {
+        dynamic += (long long) counts[RAS_SYMBOLS + x] *
+            (x < distnum ? sizes[litnum + x] : 0);
+        fixed += (long long) counts[RAS_SYMBOLS + x] * 5;
+    }
+
+    // Header, then the codes themselves
+    if (dynamic < fixed) {
+        rasPutBits(b, last | 4, 3);
+        rasPutBits(b, litnum - 257, 5);
+        rasPutBits(b, distnum - 1, 5);
+        rasPutBits(b, lens - 4, 4);
+        for (x = 0; x < lens; x++) rasPutBits(b, rlesizes[order[x]], 3);
+        for (x = 0; x < rlenum; x++) {
+            rasPutBits(b, rlecodes[rle[x]], rlesizes[rle[x]]);
+            if (rle[x] >= 16) rasPutBits(b, rlex[x], rlebits[rle[x] - 16]);
+        }
+        memmove(dsizes, &sizes[litnum], distnum);
+        for (x = litnum; x < RAS_SYMBOLS; x++) sizes[x] = 0;
+        for (x = distnum; x < 30; x++) dsizes[x] = 0;
+    } else {
+        rasPutBits(b, last | 2, 3);
+        for (x = 0; x < RAS_SYMBOLS; x++)
+            sizes[x] = (x < 144) ? 8 : (x < 256) ? 9 : (x < 280) ? 7 : 8;
+        for (x = 0; x < 30; x++) dsizes[x] = 5;
+    }
+    rasCanonical(sizes, RAS_SYMBOLS, codes);
+    rasCanonical(dsizes, 30, dcodes);
+
+    // Literals, then matches as length code, extra bits, distance code
+    // and extra bits, then the end of the block
+    for (x = 0; x < num; x++) {
+        sym = syms[x];
+        if (!(sym & RAS_MATCH)) {
+            rasPutBits(b, codes[sym], sizes[sym]);
+            continue;
+        }
+        run = (sym >> 23) & 0x1F;
+        rasPutBits(b, codes[257 + run], sizes[257 + run]);
+        if (rasLenExtra[run])
+            rasPutBits(b, (sym >> 13) & 0x1F, rasLenExtra[run]);
+        run = (sym >> 18) & 0x1F;
+        rasPutBits(b, dcodes[run], dsizes[run]);
+        if (rasDistExtra[run])
+            rasPutBits(b, sym & 0x1FFF, rasDistExtra[run]);
+    }
+    rasPutBits(b, codes[256], sizes[256]);
+    return;
+}
+
+// Parses a match into a symbol: the length and distance codes and the
+// extra bits of each
+static unsigned int rasMatch(int len, int dist) {
+    int lcode = rasCodeBase(rasLenBase, 29, len);
+    int dcode = rasCodeBase(rasDistBase, 30, dist);
+
+    return RAS_MATCH | (lcode << 23) | (dcode << 18) |
+        ((len - rasLenBase[lcode]) << 13) | (dist - rasDistBase[dcode]);
+}
+
+// Deflates a buffer, matching only within it. Unless it ends the stream,
+// an empty stored block brings it to a byte boundary so the next buffer's
+// blocks can follow straight on
+static void rasDeflate(RAS_BITS *b, unsigned char *data, int len, int last) {
+    unsigned int word, *syms;
+    int *head, pos = 0, cand, run, num = 0, h;
+
+    head = malloc((1 << RAS_HASHBITS) * sizeof(int));
+    syms = malloc(RAS_BLOCK * sizeof(int));
+    memset(head, 0xFF, (1 << RAS_HASHBITS) * sizeof(int));
+
+    // Greedy matching on a hash of the next four bytes
+    while (pos < len) {
+        if (num == RAS_BLOCK) {
+            rasPutBlock(b, syms, num, 0);
+            num = 0;
+        }
+        if (pos + RAS_MINMATCH > len) {
+            syms[num++] = data[pos++];
+            continue;
+        }
+        memcpy(&word, &data[pos], 4);
+        h = (word * 2654435761U) >> (32 - RAS_HASHBITS);
+        cand = head[h];
+        head[h] = pos;
+        if (cand < 0 || pos - cand > RAS_WINDOW ||
+            memcmp(&data[cand], &data[pos], RAS_MINMATCH)) {
+            syms[num++] = data[pos++];
+            continue;
+        }
+        for (run = RAS_MINMATCH; run < RAS_MAXMATCH && pos + run < len &&
+            data[cand + run] == data[pos + run]; run++);
+        syms[num++] = rasMatch(run, pos - cand);
+
+        // Short matches leave their positions findable, long ones are
+        // mostly runs that are found again from where they end
+        if (run < 32) {
+            for (h = 1; h < run && pos + h + 4 <= len; h++) {
+                memcpy(&word, &data[pos + h], 4);
+                head[(word * 2654435761U) >> (32 - RAS_HASHBITS)] = pos + h;
+            }
+        }
+        pos += run;
+    }
+    rasPutBlock(b, syms, num, last);
+
+    // Byte align, with an empty stored block if more blocks follow
+    if (!last) {
+        rasPutBits(b, 0, 3);
+        if (b->count) rasPutBits(b, 0, 8 - b->count);
+        rasPutBits(b, 0x0000, 16);
+        rasPutBits(b, 0xFFFF, 16);
+    } else if (b->count) rasPutBits(b, 0, 8 - b->count);
+    free(syms);
+    free(head);
+    return;
+}
+
+// Filters and compresses ranges of PNG slices. Every row uses the Up
+// filter, which reads the row above from the pixels, so slices don't wait
+// on each other
+static void rasSliceRange(RAS_PNG *png, int first, int last) {
+    unsigned char *raw, *row, *above;
+    int stride = png->width * 4, x, y, len;
+    RAS_SLICE *slice;
+    RAS_BITS bits;
+
+    for (; first < last; first++) {
+        slice = &png->slices[first];
+
+        // Filtered rows, each starting with its filter type
+        len = (slice->last - slice->first) * (stride + 1);
+        raw = malloc(len);
+        for (y = slice->first; y < slice->last; y++) {
+            row = &png->pixels[y * stride];
+            above = y ? row - stride : NULL;
+            raw[(y - slice->first) * (stride + 1)] = 2;
+            for (x = 0; x < stride; x++)
+                raw[(y - slice->first) * (stride + 1) + 1 + x] =
+                    row[x] - (above ? above[x] : 0);
+        }
+
+        // Room for the worst case, nine bits a byte with the fixed codes,
+        // and for the zlib header before and the checksum after
+        bits.out = malloc(len + len / 4 + 64);
+        bits.len = bits.bits = bits.count = 0;
+        if (first == 0) {
+            rasPutBits(&bits, 0x78, 8);
+            rasPutBits(&bits, 0x01, 8);
+        }
+        rasDeflate(&bits, raw, len, first == png->slicenum - 1);
+        slice->adler = rasAdler(1, raw, len);
+        slice->out = bits.out;
+        slice->outlen = bits.len;
+        slice->crc = rasCRC(rasCRC(0, (unsigned char *) "IDAT", 4),
+            slice->out, slice->outlen);
+        free(raw);
+    }
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               API Functions                                //
+////////////////////////////////////////////////////////////////////////////////
+
+// Render a model into an RGBA buffer, framed the way geodraw.c frames it
+//   ao:         light scale per vertex, as geoBakeAO() makes, or NULL
+//   xrot, yrot: rotation in degrees, as in drawscene()
+//   slices:     parts to split the faces into for binning, usually one per
+//               job system thread; both stages run on the job system
+//   pixels:     width * height * 4 bytes, top row first
+int rasRender(GEO_MODEL *mod, float *ao, RAS_TEXTURE *textures,
+    int texturenum, float xrot, float yrot, int width, int height, int slices,
+    unsigned char *pixels) {
+    float minx, miny, minz, maxx, maxy, maxz, cx, cy, cz, scale, dist;
+    float sa, ca, sb, cb, r[9], f;
+    GEO_VERTEX *v;
+    RAS_CONTEXT ctx;
+    int x, y;
+
+    // Error checking
+    if (mod == NULL || pixels == NULL || width < 1 || height < 1) return 1;
+    if (slices < 1) slices = 1;
+    if (slices > RAS_SLICES) slices = RAS_SLICES;
+    memset(pixels, 0, width * height * 4);
+    if (!mod->facenum || !mod->vertexnum) return 0;
+
+    // Frame the model the way LoadModel() does
+    v = &mod->vertices[mod->faces[0].v1];
+    maxx = minx = v->x; maxy = miny = v->y; maxz = minz = v->z;
+    for (x = 0; x < mod->facenum; x++) {
+        for (y = 0; y < 3; y++) {
+            if (y == 0) v = &mod->vertices[mod->faces[x].v1];
+            if (y == 1) v = &mod->vertices[mod->faces[x].v2];
+            if (y == 2) v = &mod->vertices[mod->faces[x].v3];
+            if (v->x < minx) minx = v->x;
+            if (v->x > maxx) maxx = v->x;
+            if (v->y < miny) miny = v->y;
+            if (v->y > maxy) maxy = v->y;
+            if (v->z < minz) minz = v->z;
+            if (v->z > maxz) maxz = v->z;
+        }
+    }
+    cx = minx + (maxx - minx) / 2;
+    cy = miny + (maxy - miny) / 2;
+    cz = minz + (maxz - minz) / 2;
+    dist = maxx - minx;
+    if (maxy - miny > dist) dist = maxy - miny;
+    if (maxz - minz > dist) dist = maxz - minz;
+    scale = (dist > 0.0f) ? 10.0f / dist : 1.0f;
+
+    // Modelview: T(0, 0, -15) * Rx * Ry * S(-scale, scale, scale) * T(-c)
+    sa = (float) sin(xrot * 0.0174532925); ca = (float) cos(xrot * 0.0174532925);
+    sb = (float) sin(yrot * 0.0174532925); cb = (float) cos(yrot * 0.0174532925);
+    r[0] =  cb;      r[1] = 0.0f; r[2] =  sb;
+    r[3] =  sa * sb; r[4] = ca;   r[5] = -sa * cb;
+    r[6] = -ca * sb; r[7] = sa;   r[8] =  ca * cb;
+    for (x = 0; x < 3; x++) {
+        ctx.m[x * 4 + 0] = -r[x * 3 + 0] * scale;
+        ctx.m[x * 4 + 1] =  r[x * 3 + 1] * scale;
+        ctx.m[x * 4 + 2] =  r[x * 3 + 2] * scale;
+        ctx.m[x * 4 + 3] = -(ctx.m[x * 4] * cx + ctx.m[x * 4 + 1] * cy +
+            ctx.m[x * 4 + 2] * cz);
+        ctx.nm[x * 3 + 0] = -r[x * 3 + 0];
+        ctx.nm[x * 3 + 1] =  r[x * 3 + 1];
+        ctx.nm[x * 3 + 2] =  r[x * 3 + 2];
+    }
+    ctx.m[11] -= 15.0f;
+
+    // Projection: gluPerspective(45, aspect, near, far)
+    f = (float) (1.0 / tan(45.0 * 0.0087266463));
+    ctx.px = f * height / width;
+    ctx.py = f;
+    ctx.pz = (float) ((RAS_FAR + RAS_NEAR) / (RAS_NEAR - RAS_FAR));
+    ctx.pw = (float) (2.0 * RAS_FAR * RAS_NEAR / (RAS_NEAR - RAS_FAR));
+
+    // Working memory
+    ctx.mod        = mod;
+    ctx.ao         = ao;
+    ctx.textures   = textures;
+    ctx.texturenum = (textures == NULL) ? 0 : texturenum;
+    ctx.width      = width;
+    ctx.height     = height;
+    ctx.slices     = slices;
+    ctx.tilesx     = (width  + RAS_TILE - 1) / RAS_TILE;
+    ctx.tilesy     = (height + RAS_TILE - 1) / RAS_TILE;
+    ctx.tris       = malloc(mod->facenum * 2 * sizeof(RAS_TRI));
+    ctx.bins       = calloc(slices * ctx.tilesx * ctx.tilesy, sizeof(RAS_BIN));
+    ctx.depth      = malloc(width * height * sizeof(float));
+    ctx.pixels     = pixels;
+    for (x = 0; x < width * height; x++) ctx.depth[x] = 1.0f;
+
+    // Bin the triangles, then rasterize the tiles
+    tpkParallelFor(rasGeometryRange, &ctx, slices, 1);
+    tpkParallelFor(rasTilesRange, &ctx, ctx.tilesx * ctx.tilesy, 1);
+
+    // Clean up and exit
+    for (x = 0; x < slices * ctx.tilesx * ctx.tilesy; x++)
+        if (ctx.bins[x].tris != NULL) free(ctx.bins[x].tris);
+    free(ctx.bins);
+    free(ctx.tris);
+    free(ctx.depth);
+    return 0;
+}
+
+// Write an RGBA buffer, top row first, to a PNG file
+int rasWritePNG(char *filename, int width, int height, unsigned char *pixels) {
+    unsigned char head[13], *raw, *packed;
+    int x, rawlen, packlen;
+    FILE *fPtr;
+
+    // Every row starts with filter type 0
+    rawlen = (width * 4 + 1) * height;
+    raw = malloc(rawlen);
+    for (x = 0; x < height; x++) {
+        raw[x * (width * 4 + 1)] = 0;
+        memcpy(&raw[x * (width * 4 + 1) + 1], &pixels[x * width * 4],
+            width * 4);
+    }
+
+    // Compress the image data
+    packlen = rawlen + rawlen / 1000 + 64;
+    packed = malloc(packlen);
+    if (compress(packed, &packlen, raw, rawlen)) {
+        free(raw); free(packed);
+        return 1;
+    }
+    free(raw);
+
+    fPtr = fopen(filename, "wb");
+    if (fPtr == NULL) { free(packed); return 1; }
+
+    // Signature, header, data and terminator
+    fwrite("\x89PNG\r\n\x1A\n", 1, 8, fPtr);
+    head[0] = width  >> 24; head[1] = width  >> 16;
+    head[2] = width  >> 8;  head[3] = width;
+    head[4] = height >> 24; head[5] = height >> 16;
+    head[6] = height >> 8;  head[7] = height;
+    head[8] = 8; head[9] = 6; head[10] = head[11] = head[12] = 0;
+    rasChunk(fPtr, "IHDR", head, 13);
+    rasChunk(fPtr, "IDAT", packed, packlen);
+    rasChunk(fPtr, "IEND", NULL, 0);
+
+    fclose(fPtr);
+    free(packed);
+    return 0;
+}
+
+// Write an RGBA buffer, top row first, to a PNG file quickly, splitting the
+// rows into up to slices parts that are filtered and compressed as jobs.
+// Files come out larger than from rasWritePNG()
+int rasWritePNGFast(char *filename, int width, int height,
+    unsigned char *pixels, int slices) {
+    unsigned char head[13];
+    unsigned int adler;
+    RAS_SLICE *slice;
+    RAS_PNG png;
+    FILE *fPtr;
+    int x, rows, err = 0;
+
+    // Error checking
+    if (filename == NULL || pixels == NULL || width < 1 || height < 1)
+        return 1;
+
+    // Enough rows in each slice to be worth it
+    rows = RAS_SLICEMIN / (width * 4 + 1) + 1;
+    rows = (height + rows - 1) / rows;
+    if (slices > rows) slices = rows;
+    if (slices < 1) slices = 1;
+    png.width = width;
+    png.height = height;
+    png.pixels = pixels;
+    png.slicenum = slices;
+    png.slices = calloc(slices, sizeof(RAS_SLICE));
+    for (x = 0; x < slices; x++) {
+        png.slices[x].first = (int) ((long long) height * x / slices);
+        png.slices[x].last = (int) ((long long) height * (x + 1) / slices);
+    }
+    tpkParallelFor(rasSliceRange, &png, slices, 1);
+
+    // The checksum of the whole stream ends the last slice
+    adler = png.slices[0].adler;
+    for (x = 1; x < slices; x++) {
+        slice = &png.slices[x];
+        adler = rasAdlerJoin(adler, slice->adler,
+            (slice->last - slice->first) * (width * 4 + 1));
+    }
+    slice = &png.slices[slices - 1];
+    head[0] = adler >> 24; head[1] = adler >> 16;
+    head[2] = adler >> 8;  head[3] = adler;
+    memcpy(&slice->out[slice->outlen], head, 4);
+    slice->crc = rasCRC(slice->crc, head, 4);
+    slice->outlen += 4;
+
+    // Signature, header, one data chunk per slice and terminator
+    fPtr = fopen(filename, "wb");
+    if (fPtr == NULL) err = 1;
+    else {
+        fwrite("\x89PNG\r\n\x1A\n", 1, 8, fPtr);
+        head[0] = width  >> 24; head[1] = width  >> 16;
+        head[2] = width  >> 8;  head[3] = width;
+        head[4] = height >> 24; head[5] = height >> 16;
+        head[6] = height >> 8;  head[7] = height;
+        head[8] = 8; head[9] = 6; head[10] = head[11] = head[12] = 0;
+        rasChunk(fPtr, "IHDR", head, 13);
+        for (x = 0; x < slices; x++)
+            rasChunkCRC(fPtr, "IDAT", png.slices[x].out,
+                png.slices[x].outlen, png.slices[x].crc);
+        rasChunk(fPtr, "IEND", NULL, 0);
+        if (fclose(fPtr)) err = 1;
+    }
+
+    for (x = 0; x < slices; x++) free(png.slices[x].out);
+    free(png.slices);
+    return err;
+}
@@ -0,0 +1,18 @@
+#ifndef __GEO_RASTER__
+#define __GEO_RASTER__
+
+#include "geo.h"
+
+// Decoded texture, laid out the way glTexImage2D() receives it
+typedef struct {
+    int            width;  // Width in texels
+    int            height; // Height in texels
+    unsigned char *pixels; // RGBA texels, first row at t = 0, NULL if missing
+} RAS_TEXTURE;
+
+int rasRender(GEO_MODEL *, float *, RAS_TEXTURE *, int, float, float,
+    int, int, int, unsigned char *);
+int rasWritePNG(char *, int, int, unsigned char *);
+int rasWritePNGFast(char *, int, int, unsigned char *, int);
+
+#endif // __GEO_RASTER__
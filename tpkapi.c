@@ -9,24 +9,228 @@
 #define TPK_TYPE_WINDOW 2
 #define TPK_TYPE_THREAD 3
 #define TPK_TYPE_MUTEX  4
+#define TPK_TYPE_SEMAPHORE 5
+#define TPK_TYPE_COND   6
+#define TPK_TYPE_WATCH  7
+#define TPK_TYPE_MAP    8
+
+// Trace zone storage limits
+#define TPK_TRACE_SIZE  8192 // Completed zones kept per thread
+#define TPK_TRACE_DEPTH 32   // Zones that can be open at once per thread
+
+// Job system limits
+#define TPK_JOB_WORKERS 64   // Most worker threads the job system starts
+#define TPK_JOB_DEQUE   4096 // Jobs one thread can have queued, a power of 2
+#define TPK_JOB_SPINS   64   // Empty looks for work before a worker sleeps
+#define TPK_JOB_SPLIT   8    // Ranges per thread tpkParallelFor() aims for
+
+// Longest path tpkFindFiles() handles, in bytes
+#define TPK_FIND_PATH   1024
+
+// Thread-local storage qualifier
+#ifdef _MSC_VER
+#define TPK_TLS __declspec(thread)
+#else
+#define TPK_TLS __thread
+#endif
+
+// Window event queue limits
+#define TPK_QUEUE_SIZE    1024 // Events one window can hold, a power of 2
+#define TPK_QUEUE_RESERVE 64   // Room kept for events the system sends directly
+
+// Asynchronous read limits
+#define TPK_READ_DEPTH    256  // Reads the system can have in flight at once
+
+// Type field every object starts with. It's as wide as the strictest
+// alignment of what follows, a TPK_MAP's long long on 32-bit targets, so
+// the public part always starts right after it
+#define TPK_HEADER union { int type; long long align; void *ptr; }
+
+// Resolves a public handle to its object, whose type field sits just
+// ahead of it
+#define TPK_OBJECT(x) ((void *) (((char *) (x)) - sizeof (TPK_HEADER)))
+
+// One queued window event
+typedef struct {
+    int event, arg1, arg2;
+    unsigned long long time; // tpkClock() value when the system delivered it
+} TPK_QEVENT;
+
+// Ring of window events filled by one thread and emptied by another. Only
+// the producer moves tail and only the consumer moves head, so neither locks
+typedef struct {
+    volatile unsigned int head;
+    char                  pad[60]; // Keep the two ends on separate lines
+    volatile unsigned int tail;
+    volatile int          waiting; // Consumer is asleep in tpkWaitEvents()
+    TPK_QEVENT            events[TPK_QUEUE_SIZE];
+} TPK_QUEUE;
+
+// One asynchronous read of a whole file
+typedef struct TPK_READ_EX_ {
+    char          *filename;          // File to read
+    void (*func)(void *, unsigned char *, int); // Callback, may be NULL
+    void          *data;              // Parameter passed to the callback
+    unsigned char *buffer;            // File contents, NULL if the read failed
+    int            length;            // Length of the contents
+    int            fd;                // Open file while the system reads it
+    int            ring;              // The system reads it, not a job
+    volatile int   arrived;           // The system has finished reading it
+    void          *job;               // Job running the callback
+    struct TPK_READ_EX_ *next;        // Next read queued or being read
+    struct TPK_READ_EX_ *prev;        // Previous read being read
+} TPK_READ_EX;
+
+// Watch on one file, through the system's notifications or by polling
+typedef struct {
+    TPK_HEADER;          // Object type field
+    char      *filename; // File being watched, stored after the structure
+    char      *base;     // Name of the file within its directory
+    long long  mtime;    // Modification time last reported
+    long long  size;     // Length last reported
+    int        fd;       // Notification handle, -1 when polling
+} TPK_WATCH_EX;
+
+// Event queue functions the backends feed
+static int queueEvent(TPK_QUEUE *, int, int, int);
+static int queueRoom(TPK_QUEUE *);
+
+// Asynchronous read functions the backends start and stop
+static void startReads();
+static void stopReads();
+
+// Input thread state, started and stopped by the backends
+static TPK_THREAD  *iThread = NULL;
+static TPK_MUTEX   *iLock = NULL;
+static TPK_COND    *iWake = NULL;
+static volatile int iStop = 0;
 
 // Include Linux implementations
 #ifdef __linux__
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
 #include <X11/Xlib.h>
-#include <GL/glx.h> 
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <GL/glx.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <strings.h>
+#if defined __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define TPK_URING
+#endif
+#endif
 #include "tpkapi_linux.c"
 #endif
 
 // Include Windows implementations
 #ifdef __windows__
 #include <ws2tcpip.h>
+#include <mmsystem.h>
 #include "tpkapi_windows.c"
 #endif
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//                              Trace Structures                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// One completed trace zone
+typedef struct {
+    const char        *name;   // Zone name, must outlive the trace
+    unsigned long long start;  // tpkClock() value at the start of the zone
+    unsigned long long length; // Duration of the zone in nanoseconds
+} TPK_ZONE;
+
+// Ring of completed zones belonging to one thread
+typedef struct TPK_TRACE_ {
+    int                 tid;    // Thread number reported in the trace file
+    unsigned int        count;  // Zones completed, the ring keeps the latest
+    int                 depth;  // Number of zones currently open
+    const char         *names[TPK_TRACE_DEPTH];  // Names of open zones
+    unsigned long long  starts[TPK_TRACE_DEPTH]; // Start times of open zones
+    TPK_ZONE            zones[TPK_TRACE_SIZE];   // Completed zones
+    struct TPK_TRACE_  *next;   // Next thread in the registry
+} TPK_TRACE;
+
+// Trace state, rings are only touched by their own thread until dumped
+static volatile int TPK_TRACING = TPK_FALSE;
+static volatile int tLock = 0;
+static TPK_TRACE *tList = NULL;
+static int tCount = 0;
+static TPK_TLS TPK_TRACE *tSelf = NULL;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Job Structures                                 //
+////////////////////////////////////////////////////////////////////////////////
+
+// One unit of work, finished once it and all of its children have run
+typedef struct TPK_JOB_EX_ {
+    void (*func)(void *);            // Job function, may be NULL
+    void (*range)(void *, int, int); // Range function of tpkParallelFor()
+    void *data;                      // Parameter passed to the function
+    int   first, last, grain;        // Index range of a range job
+    struct TPK_JOB_EX_ *parent;      // Job waiting on this one, if any
+    struct TPK_JOB_EX_ *next;        // Next job in the injection queue
+    volatile int unfinished;         // This job plus its unfinished children
+} TPK_JOB_EX;
+
+// Work-stealing deque: the owner pushes and pops at the bottom while other
+// threads steal from the top, after Chase and Lev
+typedef struct {
+    volatile long top;
+    char          pad[60];           // Keep thieves off the owner's line
+    volatile long bottom;
+    TPK_JOB_EX   *jobs[TPK_JOB_DEQUE];
+} TPK_DEQUE;
+
+// Job system state, deque 0 belongs to the thread that started it
+static TPK_DEQUE      *jDeques = NULL;
+static TPK_THREAD     *jThreads[TPK_JOB_WORKERS];
+static TPK_SEMAPHORE  *jWake = NULL;
+static TPK_MUTEX      *jLock = NULL;
+static TPK_JOB_EX     *jInject = NULL, *jInjectTail = NULL;
+static volatile int    jInjected = 0, jSleepers = 0, jStop = 0;
+static int             jWorkers = 0;
+static TPK_TLS int          tWorker = -1;
+static TPK_TLS unsigned int tSeed = 0;
+
+// Reads waiting for tpkReadSubmit(), which hands them to the system or to
+// the job system
+static TPK_MUTEX      *rLock = NULL;
+static TPK_READ_EX    *rPending = NULL, *rPendingTail = NULL;
+
+// State of a tpkFindFiles() walk
+typedef struct {
+    char  *dir;                // Directory the walk started in
+    char  *ext;                // Extension of the files wanted
+    char   rel[TPK_FIND_PATH]; // Directory being walked, relative to dir
+    char **files;              // Paths found, relative to dir
+    int    filenum;
+    int    filemax;
+} TPK_FIND;
+
+static void findDir(TPK_FIND *);
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //                              Common Functions                              //
 ////////////////////////////////////////////////////////////////////////////////
@@ -49,14 +253,18 @@ void tpkDelete(void *objptr) {
     if (!API_ACTIVE || objptr == NULL) return;
 
     // Get the pointer type field;
-    objptr = (void *) (((char *) objptr) - sizeof (int));
+    objptr = TPK_OBJECT(objptr);
     type = *((int *) objptr);
 
     // Process by object type
     switch (type) {
+        case TPK_TYPE_COND:   deleteCond(objptr);   break;
         case TPK_TYPE_GLRC:   deleteGLRC(objptr);   break;
+        case TPK_TYPE_MAP:    deleteMap(objptr);    break;
         case TPK_TYPE_MUTEX:  deleteMutex(objptr);  break;
+        case TPK_TYPE_SEMAPHORE: deleteSemaphore(objptr); break;
         case TPK_TYPE_THREAD: deleteThread(objptr); break;
+        case TPK_TYPE_WATCH:  deleteWatch(objptr);  break;
         case TPK_TYPE_WINDOW: deleteWindow(objptr); break;
         default: break;
     }
@@ -64,25 +272,29 @@ void tpkDelete(void *objptr) {
     return;
 }
 
-// Select the current window and rendering context for the OpenGL pipeline
+// Select the current window and rendering context for the OpenGL pipeline.
+// NULL releases the current context, so another thread can select it
 void tpkMakeCurrent(TPK_GLRC *rc) {
     TPK_WINDOW_EXT *wnd;
     TPK_GLRC_EXT   *xrc;
 
     // Error checking
-    if (!API_ACTIVE || rc == NULL) return;
+    if (!API_ACTIVE) return;
+
+    // Release the context from the calling thread
+    if (rc == NULL) {
+        if (gCur != NULL) releaseGLRC(gCur);
+        wCur = NULL; gCur = NULL;
+        return;
+    }
 
-    // Resolve the window and GLRC references
-    xrc = (TPK_GLRC_EXT *)   (((char *) rc) - sizeof (int));
-    wnd = (TPK_WINDOW_EXT *) (((char *) xrc->self.window) - sizeof (int));
+    // Resolve the window and GLRC references, offscreen contexts have no window
+    xrc = (TPK_GLRC_EXT *) TPK_OBJECT(rc);
+    wnd = (xrc->self.window == NULL) ? NULL :
+        (TPK_WINDOW_EXT *) TPK_OBJECT(xrc->self.window);
 
     // Select the window and rendering context
-    #ifdef __linux__
-        glXMakeCurrent(hDpy, wnd->hwnd, xrc->rc);
-    #endif
-    #ifdef __windows__
-        wglMakeCurrent(wnd->hdc, xrc->rc);
-    #endif
+    selectGLRC(wnd, xrc);
 
     // Update the current window and rendering context and exit
     wCur = wnd;
@@ -92,26 +304,7 @@ void tpkMakeCurrent(TPK_GLRC *rc) {
 
 // Retrieves the next event for a given object
 int tpkNextEvent(void *objptr, int *arg1, int *arg2) {
-    int type;
-
-    // Error checking
-    if (!API_ACTIVE) return TPK_EVENT_NONE;
-
-    // Get the pointer type field;
-    if (objptr == NULL) return TPK_EVENT_NONE;
-    objptr = (void *) (((char *) objptr) - sizeof (int));
-    type = *((int *) objptr);
-
-    // Process by object type
-    switch (type) {
-    case TPK_TYPE_WINDOW:
-        return nextEventWindow(objptr, arg1, arg2); break;
-    default: break;
-    }
-
-    // Default return value
-    *arg1 = *arg2 = 0;
-    return TPK_EVENT_NONE;
+    return tpkNextEventEx(objptr, arg1, arg2, NULL);
 }
 
 // Issue a SwapBuffers command
@@ -121,9 +314,9 @@ void tpkSwapBuffers(TPK_GLRC *rc) {
 
     // Error checking
     if (!API_ACTIVE || rc == NULL) return;
-    xrc = (TPK_GLRC_EXT *) (((char *) rc) - sizeof (int));
+    xrc = (TPK_GLRC_EXT *) TPK_OBJECT(rc);
     if (xrc->self.window == NULL) return;
-    wnd = (TPK_WINDOW_EXT *) (((char *) xrc->self.window) - sizeof (int));
+    wnd = (TPK_WINDOW_EXT *) TPK_OBJECT(xrc->self.window);
 
     // Issue the command
     #ifdef __linux__
@@ -145,7 +338,7 @@ void tpkUpdate(void *objptr) {
 
     // Get the pointer type field;
     if (objptr == NULL) return;
-    objptr = (void *) (((char *) objptr) - sizeof (int));
+    objptr = TPK_OBJECT(objptr);
     type = *((int *) objptr);
 
     // Process by object type
@@ -156,3 +349,972 @@ void tpkUpdate(void *objptr) {
 
     return;
 }
+
+// Opens a trace zone on the calling thread, does nothing unless enabled
+void tpkTraceBegin(char *name) {
+    TPK_TRACE *trace = tSelf;
+
+    // Error checking
+    if (!TPK_TRACING) return;
+
+    // First zone on this thread, register a ring for it
+    if (trace == NULL) {
+        trace = calloc(1, sizeof(TPK_TRACE));
+        if (trace == NULL) return;
+        while (__sync_lock_test_and_set(&tLock, 1));
+        trace->tid = ++tCount;
+        trace->next = tList;
+        tList = trace;
+        __sync_lock_release(&tLock);
+        tSelf = trace;
+    }
+
+    // Zones nested too deeply are counted but not recorded
+    if (trace->depth < TPK_TRACE_DEPTH) {
+        trace->names[trace->depth] = name;
+        trace->starts[trace->depth] = tpkClock();
+    }
+    trace->depth++;
+    return;
+}
+
+// Closes the most recently opened trace zone on the calling thread
+void tpkTraceEnd() {
+    TPK_TRACE *trace = tSelf;
+    TPK_ZONE *zone;
+
+    // Error checking, zones opened before tracing was enabled are ignored
+    if (trace == NULL || trace->depth < 1) return;
+
+    // Record the zone, overwriting the oldest one when the ring is full
+    trace->depth--;
+    if (trace->depth < TPK_TRACE_DEPTH) {
+        zone = &trace->zones[trace->count++ % TPK_TRACE_SIZE];
+        zone->name = trace->names[trace->depth];
+        zone->start = trace->starts[trace->depth];
+        zone->length = tpkClock() - zone->start;
+    }
+    return;
+}
+
+// Turns trace zone recording on or off for all threads
+void tpkTraceEnable(int enable) {
+    TPK_TRACING = (enable) ? TPK_TRUE : TPK_FALSE;
+    return;
+}
+
+// Writes every recorded zone to a Chrome trace event file, best done while
+// the traced threads are idle
+int tpkTraceDump(char *filename) {
+    TPK_TRACE *trace;
+    TPK_ZONE *zone;
+    unsigned int x, first;
+    const char *c;
+    FILE *fPtr;
+    int sep = 0;
+
+    // Error checking
+    if (filename == NULL) return TPK_ERR_UNKNOWN;
+    fPtr = fopen(filename, "w");
+    if (fPtr == NULL) return TPK_ERR_UNKNOWN;
+
+    // Complete events, in microseconds as the format expects
+    fprintf(fPtr, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (trace = tList; trace != NULL; trace = trace->next) {
+        first = (trace->count > TPK_TRACE_SIZE) ?
+            trace->count - TPK_TRACE_SIZE : 0;
+        for (x = first; x < trace->count; x++) {
+            zone = &trace->zones[x % TPK_TRACE_SIZE];
+            fprintf(fPtr, "%s\n{\"name\":\"", sep++ ? "," : "");
+            for (c = zone->name; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', fPtr);
+                if ((unsigned char) *c >= 32) fputc(*c, fPtr);
+            }
+            fprintf(fPtr, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}", trace->tid,
+                (double) zone->start / 1000.0, (double) zone->length / 1000.0);
+        }
+    }
+    fprintf(fPtr, "\n]}\n");
+
+    // Report whether everything was written
+    x = ferror(fPtr);
+    if (fclose(fPtr) || x) return TPK_ERR_UNKNOWN;
+    return TPK_ERR_NONE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                            Event Queue Functions                           //
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns how many more events the producer can add to a queue
+static int queueRoom(TPK_QUEUE *q) {
+    return TPK_QUEUE_SIZE -
+        (int) (q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE));
+}
+
+// Checks whether a queue holds events the consumer hasn't taken yet
+static int queuePending(TPK_QUEUE *q) {
+    return __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) != q->head;
+}
+
+// Adds an event to the end of a queue, returning TPK_FALSE if it's full.
+// Only one thread at a time may add events to a given queue
+static int queueEvent(TPK_QUEUE *q, int event, int arg1, int arg2) {
+    TPK_QEVENT *rec;
+    unsigned int tail = q->tail;
+
+    // Error checking
+    if (queueRoom(q) < 1) return TPK_FALSE;
+
+    // Fill the slot before publishing it
+    rec = &q->events[tail & (TPK_QUEUE_SIZE - 1)];
+    rec->event = event;
+    rec->arg1  = arg1;
+    rec->arg2  = arg2;
+    rec->time  = tpkClock();
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    // Wake the consumer if it went to sleep before seeing the event
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiting, __ATOMIC_RELAXED)) {
+        tpkLockMutex(iLock);
+        tpkBroadcastCond(iWake);
+        tpkUnlockMutex(iLock);
+    }
+    return TPK_TRUE;
+}
+
+// Takes the next event from the front of a queue. Of a run of mouse moves,
+// window moves or resizes only the latest is returned, since each of them
+// replaces the state the ones before it reported
+static int dequeueEvent(TPK_QUEUE *q, int *arg1, int *arg2,
+    unsigned long long *time) {
+    TPK_QEVENT *rec, *next;
+    unsigned int head = q->head, tail;
+    int event;
+
+    // Queue is empty
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        *arg1 = *arg2 = 0;
+        if (time != NULL) *time = 0;
+        return TPK_EVENT_NONE;
+    }
+
+    // Skip to the last of a run of coalescing events
+    rec = &q->events[head & (TPK_QUEUE_SIZE - 1)];
+    while (head + 1 != tail && (rec->event == TPK_EVENT_MOUSEMOVE ||
+        rec->event == TPK_EVENT_MOVE || rec->event == TPK_EVENT_RESIZE)) {
+        next = &q->events[(head + 1) & (TPK_QUEUE_SIZE - 1)];
+        if (next->event != rec->event) break;
+        rec = next;
+        head++;
+    }
+
+    // Copy the event out before handing the slot back
+    event = rec->event;
+    *arg1 = rec->arg1;
+    *arg2 = rec->arg2;
+    if (time != NULL) *time = rec->time;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return event;
+}
+
+// Takes the next event from a window's queue, bringing in waiting system
+// events once it runs dry, and applies moves and resizes to the window
+static int nextEventWindow(TPK_WINDOW_EXT *wnd, int *arg1, int *arg2,
+    unsigned long long *time) {
+    int event;
+
+    if (!queuePending(&wnd->queue)) pumpEvents();
+    event = dequeueEvent(&wnd->queue, arg1, arg2, time);
+    switch (event) {
+    case TPK_EVENT_MOVE:
+        wnd->user.x = wnd->self.x = *arg1;
+        wnd->user.y = wnd->self.y = *arg2;
+        break;
+    case TPK_EVENT_RESIZE:
+        wnd->user.width  = wnd->self.width  = *arg1;
+        wnd->user.height = wnd->self.height = *arg2;
+        break;
+    default: break;
+    }
+
+    return event;
+}
+
+// Moves all waiting system events into the queues of their windows
+void tpkDoEvents() {
+
+    // Error checking
+    if (!API_ACTIVE) return;
+
+    pumpEvents();
+    return;
+}
+
+// Starts or stops a thread that moves system events into window queues as
+// they arrive, so input keeps flowing while the rendering thread is busy.
+// Windows should be created after it starts and deleted before it stops.
+// Returns TPK_TRUE if the thread is running
+int tpkInputThread(int enable) {
+
+    // Error checking
+    if (!API_ACTIVE) return TPK_FALSE;
+
+    // Start the thread along with what tpkWaitEvents() sleeps on
+    if (enable && iThread == NULL) {
+        iLock = tpkCreateMutex();
+        iWake = tpkCreateCond();
+        iStop = 0;
+        if (!startInput()) {
+            tpkDelete(iWake);
+            tpkDelete(iLock);
+            iWake = NULL; iLock = NULL;
+        }
+    }
+
+    // Stop the thread, after which events are pumped on demand again
+    else if (!enable && iThread != NULL) {
+        stopInput();
+        tpkDelete(iWake);
+        tpkDelete(iLock);
+        iWake = NULL; iLock = NULL;
+    }
+
+    return (iThread != NULL) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Retrieves the next event for a given object, along with the tpkClock()
+// value when the system delivered it
+int tpkNextEventEx(void *objptr, int *arg1, int *arg2,
+    unsigned long long *time) {
+    int type;
+
+    // Error checking
+    *arg1 = *arg2 = 0;
+    if (time != NULL) *time = 0;
+    if (!API_ACTIVE) return TPK_EVENT_NONE;
+
+    // Get the pointer type field;
+    if (objptr == NULL) return TPK_EVENT_NONE;
+    objptr = TPK_OBJECT(objptr);
+    type = *((int *) objptr);
+
+    // Process by object type
+    switch (type) {
+    case TPK_TYPE_WINDOW:
+        return nextEventWindow(objptr, arg1, arg2, time); break;
+    default: break;
+    }
+
+    // Default return value
+    return TPK_EVENT_NONE;
+}
+
+// Waits until a window has events, or for a number of milliseconds when
+// positive, returning TPK_TRUE if there are events to process
+int tpkWaitEvents(TPK_WINDOW *wnd, int ms) {
+    TPK_QUEUE *queue;
+    int ready;
+
+    // Error checking
+    if (!API_ACTIVE) return TPK_FALSE;
+
+    // Without a window only the system's queue can be waited on
+    if (wnd == NULL) return waitEvents(ms);
+    queue = &((TPK_WINDOW_EXT *) TPK_OBJECT(wnd))->queue;
+
+    // Events already waiting, or waiting to be brought in
+    if (queuePending(queue)) return TPK_TRUE;
+    if (iThread == NULL) {
+        pumpEvents();
+        if (queuePending(queue)) return TPK_TRUE;
+        return waitEvents(ms);
+    }
+
+    // Sleep until the input thread queues something, saying so first
+    tpkLockMutex(iLock);
+    tpkAtomicSet(&queue->waiting, TPK_TRUE);
+    ready = queuePending(queue);
+    if (!ready) do {
+        waitCondTimed(iWake, iLock, ms);
+        ready = queuePending(queue);
+    } while (!ready && ms < 0);
+    tpkAtomicSet(&queue->waiting, TPK_FALSE);
+    tpkUnlockMutex(iLock);
+    return ready ? TPK_TRUE : TPK_FALSE;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                              Atomic Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Adds to an integer atomically, returning the new value
+int tpkAtomicAdd(volatile int *value, int amount) {
+    return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+}
+
+// Replaces an integer with a new value if it still holds the expected one,
+// returning TPK_TRUE if it did
+int tpkAtomicCas(volatile int *value, int expected, int desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Reads an integer written by other threads
+int tpkAtomicGet(volatile int *value) {
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+// Writes an integer read by other threads
+void tpkAtomicSet(volatile int *value, int desired) {
+    __atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Job System Functions                           //
+////////////////////////////////////////////////////////////////////////////////
+
+// Adds a job to the bottom of the calling thread's own deque
+static int dequePush(TPK_DEQUE *q, TPK_JOB_EX *job) {
+    long b, t;
+
+    b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    if (b - t >= TPK_JOB_DEQUE) return TPK_FALSE;
+    q->jobs[b & (TPK_JOB_DEQUE - 1)] = job;
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+    return TPK_TRUE;
+}
+
+// Takes the most recently pushed job from the calling thread's own deque
+static TPK_JOB_EX* dequePop(TPK_DEQUE *q) {
+    TPK_JOB_EX *job;
+    long b, t;
+
+    b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+    // Deque was empty
+    if (t > b) {
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    // The last job might be contested by a thief
+    job = q->jobs[b & (TPK_JOB_DEQUE - 1)];
+    if (t == b) {
+        if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) job = NULL;
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+// Takes the oldest job from another thread's deque
+static TPK_JOB_EX* dequeSteal(TPK_DEQUE *q) {
+    TPK_JOB_EX *job;
+    long b, t;
+
+    t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+
+    job = q->jobs[t & (TPK_JOB_DEQUE - 1)];
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return NULL;
+    return job;
+}
+
+// Finds a job for the calling thread: its own first, then queued by threads
+// outside the job system, then stolen from a random victim
+static TPK_JOB_EX* nextJob() {
+    TPK_JOB_EX *job;
+    int x, victim, count;
+
+    // Own deque
+    if (tWorker >= 0 && (job = dequePop(&jDeques[tWorker])) != NULL)
+        return job;
+
+    // Injection queue
+    if (tpkAtomicGet(&jInjected) > 0) {
+        tpkLockMutex(jLock);
+        job = jInject;
+        if (job != NULL) {
+            jInject = job->next;
+            if (jInject == NULL) jInjectTail = NULL;
+            tpkAtomicAdd(&jInjected, -1);
+        }
+        tpkUnlockMutex(jLock);
+        if (job != NULL) return job;
+    }
+
+    // Other threads' deques
+    count = jWorkers + 1;
+    tSeed = tSeed * 1103515245 + 12345;
+    victim = (int) ((tSeed >> 16) % count);
+    for (x = 0; x < count; x++, victim = (victim + 1) % count) {
+        if (victim == tWorker) continue;
+        job = dequeSteal(&jDeques[victim]);
+        if (job != NULL) return job;
+    }
+
+    return NULL;
+}
+
+// Wakes a sleeping worker, if there is one, after new work was queued
+static void wakeWorker() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (tpkAtomicGet(&jSleepers) > 0) tpkSignalSemaphore(jWake, 1);
+    return;
+}
+
+// Marks one unit of a job finished, passing completion up to its parent.
+// Child jobs are released here, root jobs by tpkJobWait()
+static void finishJob(TPK_JOB_EX *job) {
+    TPK_JOB_EX *parent;
+
+    while (job != NULL) {
+        parent = job->parent;
+        if (tpkAtomicAdd(&job->unfinished, -1) > 0) break;
+        if (parent == NULL) break;
+        free(job);
+        job = parent;
+    }
+    return;
+}
+
+// Allocates a job, registering it as a child of its parent
+static TPK_JOB_EX* createJob(void *func, void *range, void *data,
+    TPK_JOB_EX *parent) {
+    TPK_JOB_EX *job = malloc(sizeof(TPK_JOB_EX));
+
+    if (job == NULL) return NULL;
+    job->func = (void (*)(void *)) func;
+    job->range = (void (*)(void *, int, int)) range;
+    job->data = data;
+    job->first = job->last = job->grain = 0;
+    job->parent = parent;
+    job->next = NULL;
+    job->unfinished = 1;
+    if (parent != NULL) tpkAtomicAdd(&parent->unfinished, 1);
+    return job;
+}
+
+// Runs a job's function, splitting range jobs in halves down to their grain
+static void runJob(TPK_JOB_EX *job) {
+    TPK_JOB_EX *child;
+    int first, last, mid;
+
+    // Hand the upper halves of the range to other threads
+    if (job->range != NULL) {
+        first = job->first;
+        last  = job->last;
+        while (last - first > job->grain) {
+            mid = first + (last - first) / 2;
+            child = createJob(NULL, job->range, job->data, job);
+            if (child == NULL) break;
+            child->first = mid;
+            child->last  = last;
+            child->grain = job->grain;
+            tpkJobRun(child);
+            last = mid;
+        }
+        job->range(job->data, first, last);
+    } else if (job->func != NULL) job->func(job->data);
+
+    finishJob(job);
+    return;
+}
+
+// Thread entry of the job system's workers
+static void jobWorker(void *param) {
+    TPK_JOB_EX *job;
+    int spins = 0;
+
+    tWorker = (int) (size_t) param;
+    tSeed = (unsigned int) tWorker * 2654435761u;
+    while (!tpkAtomicGet(&jStop)) {
+
+        // Run whatever can be found
+        job = nextJob();
+        if (job != NULL) { runJob(job); spins = 0; continue; }
+        if (++spins < TPK_JOB_SPINS) { yieldThread(); continue; }
+
+        // Sleep until more work is queued, looking once more after saying so
+        tpkAtomicAdd(&jSleepers, 1);
+        job = nextJob();
+        if (job == NULL && !tpkAtomicGet(&jStop)) tpkWaitSemaphore(jWake);
+        tpkAtomicAdd(&jSleepers, -1);
+        if (job != NULL) runJob(job);
+        spins = 0;
+    }
+
+    tpkExitThread(0);
+    return;
+}
+
+// Starts the job system with a number of worker threads, or one fewer than
+// the processor count (but at least one) when 0, returning the number of
+// workers. The calling thread takes part whenever it waits on a job
+int tpkJobStartup(int workers) {
+    int x;
+
+    // Error checking
+    if (!API_ACTIVE) return 0;
+    if (jDeques != NULL) return jWorkers;
+
+    // Size the pool, keeping one worker so background jobs never run inline
+    if (workers <= 0) workers = tpkCpuCount() - 1;
+    if (workers > TPK_JOB_WORKERS) workers = TPK_JOB_WORKERS;
+    if (workers < 1) workers = 1;
+
+    // Shared state
+    jDeques = calloc(workers + 1, sizeof(TPK_DEQUE));
+    jWake = tpkCreateSemaphore(0);
+    jLock = tpkCreateMutex();
+    jInject = jInjectTail = NULL;
+    jInjected = jSleepers = jStop = 0;
+    tWorker = 0;
+    tSeed = 1;
+
+    // Start the workers. A worker that fails to start only leaves an empty
+    // deque behind, so the count is fixed before any of them runs
+    jWorkers = workers;
+    for (x = 0; x < workers; x++)
+        jThreads[x] = tpkCreateThread(jobWorker, (void *) (size_t) (x + 1));
+    return jWorkers;
+}
+
+// Stops the job system once the workers are done with their current jobs
+void tpkJobShutdown() {
+    int x;
+
+    // Error checking
+    if (jDeques == NULL) return;
+
+    // Wake everyone up and wait for them to leave
+    tpkAtomicSet(&jStop, 1);
+    tpkSignalSemaphore(jWake, jWorkers);
+    for (x = 0; x < jWorkers; x++) {
+        tpkWaitForThread(jThreads[x]);
+        tpkDelete(jThreads[x]);
+    }
+
+    // Release the shared state
+    tpkDelete(jWake);
+    tpkDelete(jLock);
+    free(jDeques);
+    jDeques = NULL;
+    jWorkers = 0;
+    tWorker = -1;
+    return;
+}
+
+// Creates a job calling func(data). Creating it with a parent makes the
+// parent wait for it, which must happen before the parent finishes. One
+// created without a parent must be waited on, which is what releases it
+TPK_JOB* tpkJobCreate(void *func, void *data, TPK_JOB *parent) {
+    return createJob(func, NULL, data, (TPK_JOB_EX *) parent);
+}
+
+// Creates a job calling func(data, first, last) over [0, count), split into
+// ranges of at least grain indexes as it runs, 0 picking one from the number
+// of threads. It finishes once every range has run
+TPK_JOB* tpkJobCreateRange(void *func, void *data, int count, int grain,
+    TPK_JOB *parent) {
+    TPK_JOB_EX *job;
+
+    // Error checking
+    if (func == NULL || count < 0) return NULL;
+
+    // Enough ranges for stealing to even out uneven work
+    if (grain < 1) grain = count / ((jWorkers + 1) * TPK_JOB_SPLIT);
+    if (grain < 1) grain = 1;
+
+    // The job splits itself as it runs
+    job = createJob(NULL, func, data, (TPK_JOB_EX *) parent);
+    if (job == NULL) return NULL;
+    job->last = count;
+    job->grain = grain;
+    return job;
+}
+
+// Queues a job to run. Without workers the job runs immediately
+void tpkJobRun(TPK_JOB *job) {
+    TPK_JOB_EX *xJob = (TPK_JOB_EX *) job;
+
+    // Error checking
+    if (xJob == NULL) return;
+
+    // No job system, or a full deque: run it here and now
+    if (jDeques == NULL || (tWorker >= 0 &&
+        !dequePush(&jDeques[tWorker], xJob))) {
+        runJob(xJob);
+        return;
+    }
+
+    // Threads outside the job system queue through the shared list
+    if (tWorker < 0) {
+        tpkLockMutex(jLock);
+        xJob->next = NULL;
+        if (jInjectTail != NULL) jInjectTail->next = xJob;
+        else jInject = xJob;
+        jInjectTail = xJob;
+        tpkAtomicAdd(&jInjected, 1);
+        tpkUnlockMutex(jLock);
+    }
+
+    wakeWorker();
+    return;
+}
+
+// Checks whether a job and all of its children have finished
+int tpkJobDone(TPK_JOB *job) {
+    if (job == NULL) return TPK_TRUE;
+    return tpkAtomicGet(&((TPK_JOB_EX *) job)->unfinished) <= 0;
+}
+
+// Runs other jobs until a job and all of its children have finished, then
+// releases it. Only jobs created without a parent are waited on, and each
+// of them exactly once, even if tpkJobDone() already says it's finished
+void tpkJobWait(TPK_JOB *job) {
+    TPK_JOB_EX *xJob = (TPK_JOB_EX *) job, *next;
+
+    // Error checking
+    if (xJob == NULL) return;
+
+    // Help out instead of blocking
+    while (tpkAtomicGet(&xJob->unfinished) > 0) {
+        next = (jDeques == NULL) ? NULL : nextJob();
+        if (next != NULL) runJob(next);
+        else yieldThread();
+    }
+
+    free(xJob);
+    return;
+}
+
+// Calls func(data, first, last) over [0, count) split into ranges of at
+// least grain indexes across the job system, returning when all are done.
+// A grain of 0 picks one from the number of threads
+void tpkParallelFor(void *func, void *data, int count, int grain) {
+    TPK_JOB *job;
+
+    // Error checking
+    if (func == NULL || count < 1) return;
+
+    // Run it all here if the job can't be made
+    job = tpkJobCreateRange(func, data, count, grain, NULL);
+    if (job == NULL) {
+        ((void (*)(void *, int, int)) func)(data, 0, count);
+        return;
+    }
+    tpkJobRun(job);
+    tpkJobWait(job);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               File Functions                               //
+////////////////////////////////////////////////////////////////////////////////
+
+// Prepares for asynchronous reads, called by tpkStartup()
+static void startReads() {
+    rLock = tpkCreateMutex();
+    rPending = rPendingTail = NULL;
+    startRing();
+    return;
+}
+
+// Waits for reads the system has in flight, called by tpkShutdown()
+static void stopReads() {
+    stopRing();
+    tpkDelete(rLock);
+    rLock = NULL;
+    return;
+}
+
+// Runs the callback of a read once its contents are in
+static void completeRead(TPK_READ_EX *read) {
+    if (read->func != NULL) read->func(read->data, read->buffer, read->length);
+    return;
+}
+
+// Reads a whole file on a job system thread, then runs its callback
+static void readJob(TPK_READ_EX *read) {
+    FILE *fPtr;
+    long len;
+
+    // Read the file, leaving a NULL buffer if any of it fails
+    fPtr = fopen(read->filename, "rb");
+    if (fPtr != NULL) {
+        fseek(fPtr, 0, SEEK_END);
+        len = ftell(fPtr);
+        if (len > 0 && len <= INT_MAX) {
+            read->buffer = malloc(len);
+            if (read->buffer != NULL) {
+                fseek(fPtr, 0, SEEK_SET);
+                if (fread(read->buffer, 1, len, fPtr) == (size_t) len)
+                    read->length = (int) len;
+                else {
+                    free(read->buffer);
+                    read->buffer = NULL;
+                }
+            }
+        }
+        fclose(fPtr);
+    }
+
+    completeRead(read);
+    return;
+}
+
+// Hints that a file will be read soon so the system can start bringing it
+// into its cache, returning TPK_TRUE if the system took the hint
+int tpkReadAhead(char *filename) {
+
+    // Error checking
+    if (!API_ACTIVE || filename == NULL) return TPK_FALSE;
+
+    return readAhead(filename);
+}
+
+// Queues a read of a whole file, started by the next tpkReadSubmit(). Once
+// the file is in, func(data, buffer, length) runs on a job system thread,
+// with a NULL buffer and a length of 0 if it couldn't be read. The callback
+// may change the buffer's contents, but the buffer stays with the read
+TPK_READ* tpkReadFile(char *filename, void *func, void *data) {
+    TPK_READ_EX *read;
+
+    // Error checking
+    if (!API_ACTIVE || filename == NULL) return NULL;
+
+    // Initialize the read
+    read = calloc(1, sizeof(TPK_READ_EX));
+    if (read == NULL) return NULL;
+    read->filename = malloc(strlen(filename) + 1);
+    if (read->filename == NULL) { free(read); return NULL; }
+    strcpy(read->filename, filename);
+    read->func = (void (*)(void *, unsigned char *, int)) func;
+    read->data = data;
+    read->fd = -1;
+
+    // Queue it in order
+    tpkLockMutex(rLock);
+    if (rPendingTail != NULL) rPendingTail->next = read;
+    else rPending = read;
+    rPendingTail = read;
+    tpkUnlockMutex(rLock);
+    return read;
+}
+
+// Starts every queued read as one batch. The system takes as many as it can
+// have in flight with a single call where it supports that, and job system
+// threads read the rest
+void tpkReadSubmit() {
+    TPK_READ_EX *read, *next, *jobs = NULL;
+
+    // Error checking
+    if (!API_ACTIVE) return;
+
+    // Each read's job exists before the system can finish the read, and
+    // reads the system took aren't touched again once submitted
+    tpkLockMutex(rLock);
+    for (read = rPending; read != NULL; read = next) {
+        next = read->next;
+        read->ring = ringRead(read);
+        read->job = createJob(read->ring ? completeRead : readJob, NULL,
+            read, NULL);
+        if (!read->ring) {
+            read->next = jobs;
+            jobs = read;
+        }
+    }
+    rPending = rPendingTail = NULL;
+
+    // Reads the system wouldn't take go to the job system after all
+    for (read = ringFlush(); read != NULL; read = next) {
+        next = read->next;
+        free(read->job);
+        read->job = createJob(readJob, NULL, read, NULL);
+        read->next = jobs;
+        jobs = read;
+    }
+    tpkUnlockMutex(rLock);
+
+    // The rest are read by the job system
+    for (read = jobs; read != NULL; read = next) {
+        next = read->next;
+        tpkJobRun(read->job);
+    }
+
+    return;
+}
+
+// Waits for a read and its callback to finish, submitting it first if it's
+// still queued. The buffer becomes the caller's to free() when buffer isn't
+// NULL. Returns the length of the file, 0 if it couldn't be read
+int tpkReadWait(TPK_READ *read, unsigned char **buffer) {
+    TPK_READ_EX *xRead = (TPK_READ_EX *) read;
+    TPK_JOB *job;
+    int length;
+
+    // Error checking
+    if (buffer != NULL) *buffer = NULL;
+    if (xRead == NULL) return 0;
+
+    // Start it if nobody has yet
+    tpkLockMutex(rLock);
+    job = xRead->job;
+    tpkUnlockMutex(rLock);
+    if (job == NULL) {
+        tpkReadSubmit();
+        tpkLockMutex(rLock);
+        job = xRead->job;
+        tpkUnlockMutex(rLock);
+    }
+
+    // Sleep while the system reads it, then help the job system along until
+    // the callback has run
+    if (xRead->ring) ringWait(xRead);
+    tpkJobWait(job);
+
+    // Hand over the results and release the read
+    length = xRead->length;
+    if (buffer != NULL) *buffer = xRead->buffer;
+    else free(xRead->buffer);
+    free(xRead->filename);
+    free(xRead);
+    return length;
+}
+
+// Adds a directory entry to a walk, walking into subdirectories
+static void findEntry(void *data, char *name, int isdir) {
+    TPK_FIND *find = data;
+    int len, namelen, extlen;
+
+    len = strlen(find->rel);
+    namelen = strlen(name);
+    extlen = strlen(find->ext);
+    if (len + namelen + 2 > TPK_FIND_PATH) return;
+    if (isdir) {
+        sprintf(&find->rel[len], "%s/", name);
+        findDir(find);
+        find->rel[len] = 0;
+        return;
+    }
+
+    // Only files with the extension are wanted
+    if (namelen < extlen || tpkCaseComp(&name[namelen - extlen], find->ext))
+        return;
+    if (find->filenum == find->filemax) {
+        find->filemax = find->filemax ? find->filemax * 2 : 256;
+        find->files = realloc(find->files, find->filemax * sizeof(char *));
+    }
+    find->files[find->filenum] = malloc(len + namelen + 1);
+    sprintf(find->files[find->filenum++], "%s%s", find->rel, name);
+    return;
+}
+
+// Walks the directory a walk is in
+static void findDir(TPK_FIND *find) {
+    char path[TPK_FIND_PATH * 2 + 2];
+    int len;
+
+    // Leave the trailing separator off
+    sprintf(path, "%s/%s", find->dir, find->rel);
+    len = strlen(path);
+    if (len > 1 && path[len - 1] == '/') path[len - 1] = 0;
+    tpkListDir(path, findEntry, find);
+    return;
+}
+
+// Finds every file under a directory whose name ends in ext, case aside.
+// Returns their paths relative to dir, in the order the system lists them,
+// with their number in num. The paths and the array are freed with free()
+char** tpkFindFiles(char *dir, char *ext, int *num) {
+    TPK_FIND find;
+
+    // Error checking
+    if (num != NULL) *num = 0;
+    if (!API_ACTIVE || dir == NULL || ext == NULL || num == NULL ||
+        strlen(dir) >= TPK_FIND_PATH) return NULL;
+
+    memset(&find, 0, sizeof(TPK_FIND));
+    find.dir = dir;
+    find.ext = ext;
+    findDir(&find);
+    *num = find.filenum;
+    return find.files;
+}
+
+// Reads a file's modification time, in the system's own units, and its
+// length. Returns TPK_FALSE if the file can't be looked at
+int tpkFileStamp(char *filename, long long *mtime, long long *size) {
+
+    // Error checking
+    if (!API_ACTIVE || filename == NULL || mtime == NULL || size == NULL)
+        return TPK_FALSE;
+
+    return fileStamp(filename, mtime, size);
+}
+
+// Starts watching a file for changes, through the system's notifications
+// where it has them and by polling the file otherwise
+TPK_WATCH* tpkWatchFile(char *filename) {
+    TPK_WATCH_EX *watch;
+    char *c;
+
+    // Error checking
+    if (!API_ACTIVE || filename == NULL) return NULL;
+
+    // The name is kept with the object
+    watch = calloc(1, sizeof(TPK_WATCH_EX) + strlen(filename) + 1);
+    watch->type = TPK_TYPE_WATCH;
+    watch->filename = (char *) &watch[1];
+    strcpy(watch->filename, filename);
+    for (c = watch->base = watch->filename; *c; c++)
+        if (*c == '/') watch->base = c + 1;
+
+    // Changes are measured against the file as it is now
+    fileStamp(watch->filename, &watch->mtime, &watch->size);
+    watch->fd = -1;
+    startWatch(watch);
+    return (TPK_WATCH *) &watch->filename;
+}
+
+// Checks whether a watched file changed since the last call. Only a new
+// modification time or length counts, so a file being replaced is reported
+// once it's back, not while it's missing
+int tpkWatchChanged(TPK_WATCH *watch) {
+    TPK_WATCH_EX *xWatch;
+    long long mtime, size;
+
+    // Error checking
+    if (!API_ACTIVE || watch == NULL) return TPK_FALSE;
+    xWatch = (TPK_WATCH_EX *) TPK_OBJECT(watch);
+
+    // With notifications the file is only looked at when they say so
+    if (xWatch->fd >= 0 && !watchEvents(xWatch)) return TPK_FALSE;
+    if (!fileStamp(xWatch->filename, &mtime, &size)) return TPK_FALSE;
+    if (mtime == xWatch->mtime && size == xWatch->size) return TPK_FALSE;
+
+    xWatch->mtime = mtime;
+    xWatch->size = size;
+    return TPK_TRUE;
+}
@@ -1,5 +1,5 @@
-// Linux links: X11 GL
-// Windows links: user32.lib Ws2_32.lib gdi32.lib OpenGL32.lib
+// Linux links: X11 GL EGL pthread
+// Windows links: user32.lib Ws2_32.lib gdi32.lib OpenGL32.lib winmm.lib
 
 #ifndef __TPKAPI__
 #define __TPKAPI__
@@ -21,8 +21,11 @@
 #include <sys/socket.h>
 #endif
 
-// Windows includes
+// Windows includes, condition variables need Vista or later
 #ifdef __windows__
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
 #include <windows.h>
 #include <winsock2.h>
 #include <GL/gl.h>
@@ -48,6 +51,7 @@
 #define TPK_EVENT_MOUSEDOWN 6
 #define TPK_EVENT_MOUSEUP   7
 #define TPK_EVENT_MOUSEMOVE 8
+#define TPK_EVENT_PAINT     9
 
 // Mouse button constants
 #define TPK_MOUSE_LEFT       1
@@ -74,30 +78,83 @@ typedef struct {
     void *window; // The window this rendering context is bound to
 } TPK_GLRC;
 
-// "Containers" for other objects
-#define TPK_THREAD void
-#define TPK_MUTEX  void
+// Container for a file mapped into memory
+typedef struct {
+    unsigned char *data;   // The file's contents, read-only
+    long long      length; // The file's length, in bytes
+} TPK_MAP;
+
+// "Containers" for other objects. A job created without a parent is only
+// released by tpkJobWait(), so every one of them must be waited on
+#define TPK_COND      void
+#define TPK_JOB       void
+#define TPK_MUTEX     void
+#define TPK_READ      void
+#define TPK_SEMAPHORE void
+#define TPK_THREAD    void
+#define TPK_WATCH     void
 
 // Function prototypes
+int          tpkAtomicAdd(volatile int *, int);
+int          tpkAtomicCas(volatile int *, int, int);
+int          tpkAtomicGet(volatile int *);
+void         tpkAtomicSet(volatile int *, int);
+void         tpkBroadcastCond(TPK_COND *);
 int          tpkCaseComp(char *, char *);
+unsigned long long tpkClock();
+int          tpkCpuCount();
+TPK_COND*    tpkCreateCond();
 TPK_GLRC*    tpkCreateGLRC(TPK_WINDOW *);
 TPK_MUTEX*   tpkCreateMutex();
+TPK_GLRC*    tpkCreateOffscreenGLRC(int, int);
+TPK_SEMAPHORE* tpkCreateSemaphore(int);
 TPK_THREAD*  tpkCreateThread(void *, void *);
 TPK_WINDOW*  tpkCreateWindow(int, int, char *);
 void         tpkDelete(void *);
 void         tpkDoEvents();
 void         tpkExitThread(int);
+int          tpkFileStamp(char *, long long *, long long *);
+char**       tpkFindFiles(char *, char *, int *);
+int          tpkInputThread(int);
+void*        tpkGetProcAddress(char *);
+TPK_JOB*     tpkJobCreate(void *, void *, TPK_JOB *);
+TPK_JOB*     tpkJobCreateRange(void *, void *, int, int, TPK_JOB *);
+int          tpkJobDone(TPK_JOB *);
+void         tpkJobRun(TPK_JOB *);
+void         tpkJobShutdown();
+int          tpkJobStartup(int);
+void         tpkJobWait(TPK_JOB *);
+int          tpkListDir(char *, void *, void *);
 void         tpkLockMutex(TPK_MUTEX *);
 void         tpkMakeCurrent(TPK_GLRC *);
+TPK_MAP*     tpkMapFile(char *);
 int          tpkNextEvent(void *, int *, int *);
+int          tpkNextEventEx(void *, int *, int *, unsigned long long *);
+void         tpkParallelFor(void *, void *, int, int);
+int          tpkReadAhead(char *);
+TPK_READ*    tpkReadFile(char *, void *, void *);
+void         tpkReadSubmit();
+int          tpkReadWait(TPK_READ *, unsigned char **);
+void         tpkSignalCond(TPK_COND *);
+void         tpkSignalSemaphore(TPK_SEMAPHORE *, int);
 void         tpkSleep(int);
 int          tpkShutdown();
 int          tpkStartup();
 void         tpkSwapBuffers(TPK_GLRC *);
+int          tpkSwapInterval(TPK_GLRC *, int);
 unsigned int tpkTimer(unsigned int *);
+void         tpkTraceBegin(char *);
+int          tpkTraceDump(char *);
+void         tpkTraceEnable(int);
+void         tpkTraceEnd();
 void         tpkUnlockMutex(TPK_MUTEX *);
 void         tpkUpdate(void *);
+void         tpkWaitCond(TPK_COND *, TPK_MUTEX *);
+int          tpkWaitEvents(TPK_WINDOW *, int);
 int          tpkWaitForThread(TPK_THREAD *);
+void         tpkWaitSemaphore(TPK_SEMAPHORE *);
+int          tpkWatchChanged(TPK_WATCH *);
+TPK_WATCH*   tpkWatchFile(char *);
 
 #endif // __TPKAPI__
 
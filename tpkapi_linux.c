@@ -0,0 +1,1537 @@
+// Includes are processed in tpkapi.c
+
+// Not every eglext.h carries the Mesa platform tokens
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Additional constants not seen to the public API
+#define TPK_EVENT_UNKNOWN -1
+
+// Event mask requested for every window
+#define TPK_EVENT_MASK (KeyPressMask | KeyReleaseMask | ButtonPressMask | \
+    ButtonReleaseMask | PointerMotionMask | StructureNotifyMask | \
+    ExposureMask)
+
+// Swap interval entry points, which one exists depends on the driver
+typedef void (*GLX_SWAPEXT)(Display *, GLXDrawable, int);
+typedef int  (*GLX_SWAPMESA)(unsigned int);
+typedef int  (*GLX_SWAPSGI)(int);
+
+// Internal extended data structure for window information
+typedef struct {
+    TPK_HEADER;         // Object type field
+    TPK_WINDOW user;    // User-visible data structure
+    TPK_WINDOW self;    // Internal data structure
+    Window hwnd;        // OS-specific window handle
+    Colormap cmap;      // Colormap matching the window's visual
+    XVisualInfo *vi;    // GLX visual the window was created with
+    int  qwidth;        // Width last queued, only touched by the producer
+    int  qheight;       // Height last queued, only touched by the producer
+    TPK_QUEUE queue;    // Events waiting for tpkNextEvent()
+} TPK_WINDOW_EXT;
+
+// Internal extended data structure for OpenGL rendering context information
+typedef struct {
+    TPK_HEADER;      // Object type field
+    TPK_GLRC user;   // User-visible data structure
+    TPK_GLRC self;   // Internal data structure
+    GLXContext rc;   // OS-specific rendering context handle
+    EGLContext ectx; // EGL context of an offscreen context, else NULL
+    EGLSurface esurf;// Pbuffer surface of an offscreen context
+} TPK_GLRC_EXT;
+
+// Internal extended data structure for thread information
+typedef struct {
+    TPK_HEADER;
+    pthread_t hThread;
+    int joined;
+} TPK_THREAD_EX;
+
+// Internal extended data structure for mutex information
+typedef struct {
+    TPK_HEADER;
+    pthread_mutex_t hMutex;
+} TPK_MUTEX_EX;
+
+// Internal extended data structure for semaphore information
+typedef struct {
+    TPK_HEADER;
+    sem_t hSem;
+} TPK_SEMAPHORE_EX;
+
+// Internal extended data structure for condition variable information
+typedef struct {
+    TPK_HEADER;
+    pthread_cond_t hCond;
+} TPK_COND_EX;
+
+// Internal extended data structure for file mapping information
+typedef struct {
+    TPK_HEADER;   // Object type field
+    TPK_MAP user; // User-visible data structure
+} TPK_MAP_EX;
+
+// io_uring instance asynchronous reads go through, shared with the kernel
+typedef struct {
+    int fd;                     // Ring file descriptor, -1 when not in use
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    void *sqRing, *cqRing;      // Mapped ring memory
+    size_t sqSize, cqSize, sqeSize;
+    void *sqes, *cqes;          // Submission and completion entries
+    unsigned queued;            // Entries filled but not yet submitted
+    volatile int inflight;      // Reads submitted but not yet completed
+    int failed;                 // The kernel stopped taking entries
+    int gaveup;                 // The reaper stopped collecting completions
+    TPK_READ_EX *reading;       // Reads submitted but not yet completed
+    TPK_THREAD *reaper;         // Thread collecting completions
+    TPK_MUTEX *lock;            // Guards reads arriving and reading
+    TPK_COND *arrived;          // Signaled whenever a read arrives
+} TPK_RING;
+
+// Private variables for the display connection and window lookups. Windows
+// are only freed while holding wLock, so the input thread can't route events
+// to a window that's going away
+Display *hDpy = NULL;
+Atom wmDelete;
+XContext wContext;
+Window iWindow = 0;
+pthread_mutex_t wLock = PTHREAD_MUTEX_INITIALIZER;
+EGLDisplay eDpy = EGL_NO_DISPLAY;
+int API_ACTIVE = TPK_FALSE;
+TPK_RING rRing = { .fd = -1 };
+TPK_GLRC_EXT   *gCur;
+TPK_WINDOW_EXT *wCur;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                              Window Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Translates an X key symbol into the Windows virtual-key code the API uses
+static int translateKey(KeySym key) {
+
+    // Letters are reported in upper case, as Windows does
+    if (key >= XK_a && key <= XK_z) return (int) (key - XK_a) + 'A';
+    if (key >= XK_0 && key <= XK_9) return (int) key;
+    if (key >= XK_F1 && key <= XK_F12) return (int) (key - XK_F1) + 112;
+
+    // Everything else needs a lookup
+    switch (key) {
+        case XK_BackSpace: return 8;
+        case XK_Tab:       return 9;
+        case XK_Return:    return 13;
+        case XK_Shift_L:   case XK_Shift_R:   return 16;
+        case XK_Control_L: case XK_Control_R: return 17;
+        case XK_Alt_L:     case XK_Alt_R:     return 18;
+        case XK_Escape:    return 27;
+        case XK_space:     return 32;
+        case XK_Prior:     return 33;
+        case XK_Next:      return 34;
+        case XK_End:       return 35;
+        case XK_Home:      return 36;
+        case XK_Left:      return 37;
+        case XK_Up:        return 38;
+        case XK_Right:     return 39;
+        case XK_Down:      return 40;
+        case XK_Insert:    return 45;
+        case XK_Delete:    return 46;
+        default: break;
+    }
+
+    // Pass anything unrecognized through unchanged
+    return (int) key;
+}
+
+// Retrieves the location and dimensions of a window's client area
+static void measureWindow(TPK_WINDOW_EXT *wnd) {
+    XWindowAttributes attr;
+    Window child;
+    int x, y;
+
+    // Retrieve the information from the system and apply to the window object
+    XGetWindowAttributes(hDpy, wnd->hwnd, &attr);
+    XTranslateCoordinates(hDpy, wnd->hwnd, attr.root, 0, 0, &x, &y, &child);
+    wnd->user.x = wnd->self.x = x;
+    wnd->user.y = wnd->self.y = y;
+    wnd->user.width  = wnd->self.width  = attr.width;
+    wnd->user.height = wnd->self.height = attr.height;
+
+    return;
+}
+
+// Converts an X event into an API event, or TPK_EVENT_UNKNOWN to skip it
+static int translateEvent(TPK_WINDOW_EXT *wnd, XEvent *e, int *arg1,
+    int *arg2) {
+    Window child;
+
+    *arg1 = *arg2 = 0;
+
+    // Determine what events to handle
+    switch (e->type) {
+
+    // Window close request
+    case ClientMessage:
+        if ((Atom) e->xclient.data.l[0] != wmDelete) break;
+        return TPK_EVENT_CLOSE;
+
+    // Key Down and Key Up
+    case KeyPress:
+        *arg1 = translateKey(XLookupKeysym(&e->xkey, 0));
+        return TPK_EVENT_KEYDOWN;
+    case KeyRelease:
+        *arg1 = translateKey(XLookupKeysym(&e->xkey, 0));
+        return TPK_EVENT_KEYUP;
+
+    // Mouse Down, where buttons 4 and 5 are the scroll-wheel
+    case ButtonPress:
+        switch (e->xbutton.button) {
+            case Button1: *arg1 = TPK_MOUSE_LEFT;       break;
+            case Button2: *arg1 = TPK_MOUSE_MIDDLE;     break;
+            case Button3: *arg1 = TPK_MOUSE_RIGHT;      break;
+            case Button4: *arg1 = TPK_MOUSE_SCROLLUP;   break;
+            case Button5: *arg1 = TPK_MOUSE_SCROLLDOWN; break;
+            default: return TPK_EVENT_UNKNOWN;
+        }
+        return TPK_EVENT_MOUSEDOWN;
+
+    // Mouse Up, scroll-wheel "buttons" have no matching up event on Windows
+    case ButtonRelease:
+        switch (e->xbutton.button) {
+            case Button1: *arg1 = TPK_MOUSE_LEFT;   break;
+            case Button2: *arg1 = TPK_MOUSE_MIDDLE; break;
+            case Button3: *arg1 = TPK_MOUSE_RIGHT;  break;
+            default: return TPK_EVENT_UNKNOWN;
+        }
+        return TPK_EVENT_MOUSEUP;
+
+    // Mouse Move
+    case MotionNotify:
+        *arg1 = e->xmotion.x;
+        *arg2 = e->xmotion.y;
+        return TPK_EVENT_MOUSEMOVE;
+
+    // Part of the window needs to be drawn again, once per batch of exposes
+    case Expose:
+        if (e->xexpose.count) break;
+        return TPK_EVENT_PAINT;
+
+    // Resize, or else a move reported in root window coordinates since a
+    // window manager's frame makes the event's own position relative to it
+    case ConfigureNotify:
+        if (e->xconfigure.width  != wnd->qwidth ||
+            e->xconfigure.height != wnd->qheight) {
+            wnd->qwidth  = *arg1 = e->xconfigure.width;
+            wnd->qheight = *arg2 = e->xconfigure.height;
+            return TPK_EVENT_RESIZE;
+        }
+        XTranslateCoordinates(hDpy, wnd->hwnd, DefaultRootWindow(hDpy), 0, 0,
+            arg1, arg2, &child);
+        return TPK_EVENT_MOVE;
+
+    default: break;
+    } // switch
+
+    return TPK_EVENT_UNKNOWN;
+}
+
+// Moves an X event into the queue of its window as long as more than
+// reserve events of room are left, returning TPK_FALSE if there wasn't.
+// Events of windows the API doesn't know are dropped
+static int routeEvent(XEvent *e, int reserve) {
+    TPK_WINDOW_EXT *wnd;
+    XPointer ptr;
+    int event, arg1, arg2, ret = TPK_TRUE;
+
+    pthread_mutex_lock(&wLock);
+    if (!XFindContext(hDpy, e->xany.window, wContext, &ptr)) {
+        wnd = (TPK_WINDOW_EXT *) ptr;
+        if (queueRoom(&wnd->queue) <= reserve) ret = TPK_FALSE;
+        else {
+            event = translateEvent(wnd, e, &arg1, &arg2);
+            if (event != TPK_EVENT_UNKNOWN)
+                queueEvent(&wnd->queue, event, arg1, arg2);
+        }
+    }
+    pthread_mutex_unlock(&wLock);
+
+    return ret;
+}
+
+// Creates a window
+TPK_WINDOW* tpkCreateWindow(int width, int height, char *text) {
+    XSetWindowAttributes swa;
+    TPK_WINDOW_EXT *wnd;
+    Window root;
+    int attrs[] = {
+        GLX_RGBA, GLX_DOUBLEBUFFER, GLX_RED_SIZE, 8, GLX_GREEN_SIZE, 8,
+        GLX_BLUE_SIZE, 8, GLX_DEPTH_SIZE, 16, None
+    };
+
+    // Error checking, windows need a display connection
+    if (!API_ACTIVE || hDpy == NULL) return NULL;
+
+    // Initialize variables
+    wnd = malloc(sizeof (TPK_WINDOW_EXT));
+    wnd->type = TPK_TYPE_WINDOW;
+    wnd->user.rc = wnd->self.rc = NULL;
+    wnd->user.text[0] = 0;
+    if (text != NULL) strncat(wnd->user.text, text, 255);
+    strcpy(wnd->self.text, wnd->user.text);
+    wnd->self.x = wnd->self.y = wnd->self.width = wnd->self.height = -1;
+    wnd->self.visible = TPK_FALSE;
+    wnd->queue.head = wnd->queue.tail = 0;
+    wnd->queue.waiting = TPK_FALSE;
+
+    // Initialize user component
+    width  = (width  < 1) ? 1 : width;
+    height = (height < 1) ? 1 : height;
+    wnd->user.x = 32;
+    wnd->user.y = 32;
+    wnd->user.width = width;
+    wnd->user.height = height;
+    wnd->user.visible = TPK_TRUE;
+
+    // GLX fixes the pixel format when the window is created
+    root = DefaultRootWindow(hDpy);
+    wnd->vi = glXChooseVisual(hDpy, DefaultScreen(hDpy), attrs);
+    if (wnd->vi == NULL) {
+        free(wnd);
+        return NULL;
+    }
+
+    // Attempt to create the window
+    wnd->cmap = XCreateColormap(hDpy, root, wnd->vi->visual, AllocNone);
+    swa.colormap   = wnd->cmap;
+    swa.event_mask = TPK_EVENT_MASK;
+    wnd->hwnd = XCreateWindow(hDpy, root, 32, 32, width, height, 0,
+        wnd->vi->depth, InputOutput, wnd->vi->visual,
+        CWColormap | CWEventMask, &swa);
+    if (!wnd->hwnd) {
+        XFreeColormap(hDpy, wnd->cmap);
+        XFree(wnd->vi);
+        free(wnd);
+        return NULL;
+    }
+
+    // Configure the remainder of the window
+    XSaveContext(hDpy, wnd->hwnd, wContext, (XPointer) wnd);
+    XSetWMProtocols(hDpy, wnd->hwnd, &wmDelete, 1);
+    XStoreName(hDpy, wnd->hwnd, wnd->self.text);
+    tpkUpdate(&wnd->user);
+    measureWindow(wnd);
+    wnd->qwidth  = wnd->self.width;
+    wnd->qheight = wnd->self.height;
+
+    // Return a pointer to only the user-visible portion of the data structure
+    return &wnd->user;
+}
+
+// Updates a window's properties
+static void updateWindow(TPK_WINDOW_EXT *wnd) {
+
+    // Visibility
+    if (wnd->user.visible != wnd->self.visible) {
+        wnd->self.visible = (wnd->user.visible) ? TPK_TRUE : TPK_FALSE;
+        wnd->user.visible = wnd->self.visible;
+        if (wnd->self.visible) XMapWindow(hDpy, wnd->hwnd);
+        else XUnmapWindow(hDpy, wnd->hwnd);
+    }
+
+    // Window Title
+    if (strcmp(wnd->user.text, wnd->self.text)) {
+        wnd->user.text[255] = 0;
+        strcpy(wnd->self.text, wnd->user.text);
+        strcpy(wnd->user.text, wnd->self.text);
+        XStoreName(hDpy, wnd->hwnd, wnd->self.text);
+    }
+
+    // Resize/position the window
+    if (wnd->user.x      != wnd->self.x     ||
+        wnd->user.y      != wnd->self.y     ||
+        wnd->user.width  != wnd->self.width ||
+        wnd->user.height != wnd->self.height) {
+
+        // Keep the requested values, the server applies them asynchronously
+        if (wnd->user.width  < 1) wnd->user.width  = 1;
+        if (wnd->user.height < 1) wnd->user.height = 1;
+        XMoveResizeWindow(hDpy, wnd->hwnd, wnd->user.x, wnd->user.y,
+            wnd->user.width, wnd->user.height);
+        wnd->self.x     = wnd->user.x;     wnd->self.y      = wnd->user.y;
+        wnd->self.width = wnd->user.width; wnd->self.height = wnd->user.height;
+    }
+
+    // Make sure the requests reach the server
+    XSync(hDpy, False);
+    return;
+}
+
+// Deletes a window
+static void deleteWindow(TPK_WINDOW_EXT *wnd) {
+
+    // Delete the OpenGL rendering context, if applicable
+    if (wnd->self.rc != NULL)
+        tpkDelete(wnd->self.rc);
+
+    // Deselect the window from OpenGL, if applicable
+    if (wnd == wCur) {
+        glXMakeCurrent(hDpy, None, NULL);
+        wCur = NULL; gCur = NULL;
+    }
+
+    // Delete the window, after which the input thread can't find it
+    pthread_mutex_lock(&wLock);
+    XDeleteContext(hDpy, wnd->hwnd, wContext);
+    pthread_mutex_unlock(&wLock);
+    XDestroyWindow(hDpy, wnd->hwnd);
+    XFreeColormap(hDpy, wnd->cmap);
+    XFree(wnd->vi);
+    XSync(hDpy, False);
+
+    // Deallocate memory and return
+    free(wnd);
+    return;
+}
+
+// Moves waiting X events into the queues of their windows, leaving them with
+// Xlib once a queue is full. Returns TPK_FALSE if it stopped for that reason
+static int pumpEvents() {
+    XEvent e;
+
+    // The input thread does this itself when it runs
+    if (hDpy == NULL || iThread != NULL) return TPK_TRUE;
+
+    while (XPending(hDpy)) {
+        XPeekEvent(hDpy, &e);
+        if (!routeEvent(&e, 0)) return TPK_FALSE;
+        XNextEvent(hDpy, &e);
+    }
+
+    return TPK_TRUE;
+}
+
+// Waits until the X server has sent something, or for a number of
+// milliseconds when positive
+static int waitEvents(int ms) {
+    struct pollfd pfd;
+
+    // Without a display there are no events to wait for
+    if (hDpy == NULL) {
+        if (ms > 0) tpkSleep(ms);
+        return TPK_FALSE;
+    }
+
+    // Events already waiting
+    if (XEventsQueued(hDpy, QueuedAfterFlush)) return TPK_TRUE;
+
+    // Sleep on the X connection until the server sends something
+    pfd.fd = ConnectionNumber(hDpy);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, (ms < 0) ? -1 : ms) <= 0) return TPK_FALSE;
+    return XPending(hDpy) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Thread entry of the input thread. Xlib lets it block in XNextEvent() while
+// other threads keep making requests on the same connection
+static void inputThread(void *param) {
+    XEvent e;
+
+    (void) param;
+
+    while (!tpkAtomicGet(&iStop)) {
+        XNextEvent(hDpy, &e);
+
+        // The server keeps anything else while a full queue drains
+        while (!routeEvent(&e, 0) && !tpkAtomicGet(&iStop)) tpkSleep(1);
+    }
+
+    tpkExitThread(0);
+    return;
+}
+
+// Starts the input thread, along with a window to wake it up with
+static int startInput() {
+
+    // Error checking
+    if (hDpy == NULL) return TPK_FALSE;
+
+    // Only the API sends events to this window
+    iWindow = XCreateWindow(hDpy, DefaultRootWindow(hDpy), 0, 0, 1, 1, 0,
+        CopyFromParent, InputOnly, CopyFromParent, 0, NULL);
+    if (!iWindow) return TPK_FALSE;
+
+    // Start the thread
+    iThread = tpkCreateThread(inputThread, NULL);
+    if (iThread == NULL) {
+        XDestroyWindow(hDpy, iWindow);
+        iWindow = 0;
+        return TPK_FALSE;
+    }
+
+    return TPK_TRUE;
+}
+
+// Stops the input thread by sending it an event of its own
+static void stopInput() {
+    XEvent e;
+
+    // Wake the thread out of XNextEvent()
+    tpkAtomicSet(&iStop, TPK_TRUE);
+    memset(&e, 0, sizeof(XEvent));
+    e.xclient.type = ClientMessage;
+    e.xclient.window = iWindow;
+    e.xclient.format = 32;
+    XSendEvent(hDpy, iWindow, False, NoEventMask, &e);
+    XFlush(hDpy);
+
+    // Wait for it to leave
+    tpkWaitForThread(iThread);
+    tpkDelete(iThread);
+    iThread = NULL;
+    XDestroyWindow(hDpy, iWindow);
+    iWindow = 0;
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                              OpenGL Functions                              //
+////////////////////////////////////////////////////////////////////////////////
+
+// Create an OpenGL rendering context
+TPK_GLRC* tpkCreateGLRC(TPK_WINDOW *wnd) {
+    TPK_WINDOW_EXT *xwnd;
+    TPK_GLRC_EXT *rc;
+
+    // Error checking
+    if (!API_ACTIVE || wnd == NULL) return NULL;
+    xwnd = (TPK_WINDOW_EXT *) TPK_OBJECT(wnd);
+    if (xwnd->self.rc != NULL) return NULL; // Can't bind two contexts
+
+    // Attempt to allocate the needed memory
+    rc = malloc(sizeof(TPK_GLRC_EXT));
+    if (rc == NULL) return NULL;
+    rc->type = TPK_TYPE_GLRC;
+    rc->user.window  = rc->self.window  = (void *) wnd;
+    rc->ectx = NULL; rc->esurf = EGL_NO_SURFACE;
+
+    // Attempt to create the rendering context with the window's visual
+    rc->rc = glXCreateContext(hDpy, xwnd->vi, NULL, True);
+    if (rc->rc == NULL) {
+        free(rc);
+        return NULL;
+    }
+
+    // Return the handle to the object
+    xwnd->user.rc = xwnd->self.rc = &rc->user;
+    return &rc->user;
+}
+
+// Opens the EGL display offscreen contexts are created on
+static int openEGL() {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+    const char *exts;
+
+    // Already open
+    if (eDpy != EGL_NO_DISPLAY) return TPK_TRUE;
+
+    // Prefer Mesa's surfaceless platform, it needs neither X nor a GPU device
+    exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (exts != NULL && getPlatformDisplay != NULL &&
+        strstr(exts, "EGL_MESA_platform_surfaceless") != NULL) {
+        eDpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+            EGL_DEFAULT_DISPLAY, NULL);
+        if (eDpy != EGL_NO_DISPLAY && !eglInitialize(eDpy, NULL, NULL))
+            eDpy = EGL_NO_DISPLAY;
+    }
+
+    // Fall back to whatever the default display is
+    if (eDpy == EGL_NO_DISPLAY) {
+        eDpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (eDpy != EGL_NO_DISPLAY && !eglInitialize(eDpy, NULL, NULL))
+            eDpy = EGL_NO_DISPLAY;
+    }
+
+    return eDpy != EGL_NO_DISPLAY;
+}
+
+// Create an OpenGL rendering context that doesn't present to the screen
+TPK_GLRC* tpkCreateOffscreenGLRC(int width, int height) {
+    TPK_GLRC_EXT *rc;
+    EGLConfig config;
+    EGLint count, sattrs[5];
+    EGLint cattrs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 16, EGL_NONE
+    };
+
+    // Error checking
+    if (!API_ACTIVE || width < 1 || height < 1) return NULL;
+    if (!openEGL() || !eglBindAPI(EGL_OPENGL_API)) return NULL;
+
+    // Locate a pbuffer-capable desktop GL configuration
+    if (!eglChooseConfig(eDpy, cattrs, &config, 1, &count) || count < 1)
+        return NULL;
+
+    // Attempt to allocate the needed memory
+    rc = malloc(sizeof(TPK_GLRC_EXT));
+    if (rc == NULL) return NULL;
+    rc->type = TPK_TYPE_GLRC;
+    rc->user.window  = rc->self.window  = NULL;
+    rc->rc = NULL;
+
+    // The pbuffer stands in for a window's back buffer
+    sattrs[0] = EGL_WIDTH;  sattrs[1] = width;
+    sattrs[2] = EGL_HEIGHT; sattrs[3] = height;
+    sattrs[4] = EGL_NONE;
+    rc->esurf = eglCreatePbufferSurface(eDpy, config, sattrs);
+    if (rc->esurf == EGL_NO_SURFACE) {
+        free(rc);
+        return NULL;
+    }
+
+    // Attempt to create the rendering context
+    rc->ectx = eglCreateContext(eDpy, config, EGL_NO_CONTEXT, NULL);
+    if (rc->ectx == EGL_NO_CONTEXT) {
+        eglDestroySurface(eDpy, rc->esurf);
+        free(rc);
+        return NULL;
+    }
+
+    // Return the handle to the object
+    return &rc->user;
+}
+
+// Retrieves the address of an OpenGL function or extension
+void* tpkGetProcAddress(char *name) {
+
+    // Error checking
+    if (!API_ACTIVE || name == NULL) return NULL;
+
+    // Ask the window system the current context belongs to
+    if (gCur != NULL && gCur->ectx != NULL)
+        return (void *) eglGetProcAddress(name);
+    return (void *) glXGetProcAddressARB((const GLubyte *) name);
+}
+
+// Sets the number of display refreshes per buffer swap, 0 disables vsync
+int tpkSwapInterval(TPK_GLRC *rc, int interval) {
+    TPK_WINDOW_EXT *wnd;
+    TPK_GLRC_EXT *xrc;
+    GLX_SWAPEXT swapext;
+    GLX_SWAPMESA swapmesa;
+    GLX_SWAPSGI swapsgi;
+    const char *exts;
+
+    // Error checking
+    if (!API_ACTIVE || rc == NULL || interval < 0) return TPK_FALSE;
+    xrc = (TPK_GLRC_EXT *) TPK_OBJECT(rc);
+
+    // Pbuffers are never presented, but EGL still accepts an interval
+    if (xrc->ectx != NULL)
+        return eglSwapInterval(eDpy, interval) ? TPK_TRUE : TPK_FALSE;
+
+    // The MESA and SGI variants act on the current context
+    if (xrc != gCur) tpkMakeCurrent(rc);
+    wnd = (TPK_WINDOW_EXT *) TPK_OBJECT(xrc->self.window);
+    exts = glXQueryExtensionsString(hDpy, DefaultScreen(hDpy));
+    if (exts == NULL) return TPK_FALSE;
+
+    // Use the first extension the driver has
+    if (strstr(exts, "GLX_EXT_swap_control") != NULL) {
+        swapext = (GLX_SWAPEXT) tpkGetProcAddress("glXSwapIntervalEXT");
+        swapext(hDpy, wnd->hwnd, interval);
+        return TPK_TRUE;
+    }
+    if (strstr(exts, "GLX_MESA_swap_control") != NULL) {
+        swapmesa = (GLX_SWAPMESA) tpkGetProcAddress("glXSwapIntervalMESA");
+        return swapmesa(interval) ? TPK_FALSE : TPK_TRUE;
+    }
+    if (strstr(exts, "GLX_SGI_swap_control") != NULL && interval > 0) {
+        swapsgi = (GLX_SWAPSGI) tpkGetProcAddress("glXSwapIntervalSGI");
+        return swapsgi(interval) ? TPK_FALSE : TPK_TRUE;
+    }
+
+    return TPK_FALSE;
+}
+
+// Deselects a rendering context from the calling thread
+static void releaseGLRC(TPK_GLRC_EXT *rc) {
+    if (rc->ectx != NULL)
+        eglMakeCurrent(eDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    else glXMakeCurrent(hDpy, None, NULL);
+    return;
+}
+
+// Selects a rendering context and the window it draws to
+static void selectGLRC(TPK_WINDOW_EXT *wnd, TPK_GLRC_EXT *rc) {
+
+    // GLX and EGL contexts can't replace each other directly
+    if (gCur != NULL && gCur != rc && (gCur->ectx == NULL) != (rc->ectx == NULL))
+        releaseGLRC(gCur);
+
+    // Select by context kind
+    if (rc->ectx != NULL) {
+        eglBindAPI(EGL_OPENGL_API);
+        eglMakeCurrent(eDpy, rc->esurf, rc->esurf, rc->ectx);
+    } else glXMakeCurrent(hDpy, wnd->hwnd, rc->rc);
+
+    return;
+}
+
+// Deletes an OpenGL rednering context
+static void deleteGLRC(TPK_GLRC_EXT *rc) {
+    TPK_WINDOW_EXT *wnd;
+
+    // Deselect the rendering context from OpenGL, if applicable
+    if (rc == gCur) {
+        releaseGLRC(rc);
+        wCur = NULL; gCur = NULL;
+    }
+
+    // Unbind the context from its window
+    if (rc->self.window != NULL) {
+        wnd = (TPK_WINDOW_EXT *) TPK_OBJECT(rc->self.window);
+        wnd->user.rc = wnd->self.rc = NULL;
+    }
+
+    // Delete the rendering context
+    if (rc->ectx != NULL) {
+        eglDestroyContext(eDpy, rc->ectx);
+        eglDestroySurface(eDpy, rc->esurf);
+    } else glXDestroyContext(hDpy, rc->rc);
+
+    // Deallocate memory and return
+    free(rc);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                          Multithreading Functions                          //
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the number of processors available to the program
+int tpkCpuCount() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count < 1) ? 1 : (int) count;
+}
+
+// Creates a new condition variable
+TPK_COND* tpkCreateCond() {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (!API_ACTIVE) return NULL;
+
+    // Initialize the condition variable object
+    xCond = malloc(sizeof(TPK_COND_EX));
+    xCond->type = TPK_TYPE_COND;
+    pthread_cond_init(&xCond->hCond, NULL);
+
+    // Return the public handle
+    return (TPK_COND *) &xCond->hCond;
+}
+
+// Creates a new mutex
+TPK_MUTEX* tpkCreateMutex() {
+    pthread_mutexattr_t attr;
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (!API_ACTIVE) return NULL;
+
+    // Initialize the mutex object, recursive like a critical section
+    xMutex = malloc(sizeof(TPK_MUTEX_EX));
+    xMutex->type = TPK_TYPE_MUTEX;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&xMutex->hMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // Return the public handle
+    return (TPK_MUTEX *) &xMutex->hMutex;
+}
+
+// Creates a new semaphore with an initial count
+TPK_SEMAPHORE* tpkCreateSemaphore(int count) {
+    TPK_SEMAPHORE_EX *xSem;
+
+    // Error checking
+    if (!API_ACTIVE || count < 0) return NULL;
+
+    // Initialize the semaphore object
+    xSem = malloc(sizeof(TPK_SEMAPHORE_EX));
+    xSem->type = TPK_TYPE_SEMAPHORE;
+    sem_init(&xSem->hSem, 0, count);
+
+    // Return the public handle
+    return (TPK_SEMAPHORE *) &xSem->hSem;
+}
+
+// Creates a new execution thread -- Executes immediately
+TPK_THREAD* tpkCreateThread(void *entry, void *param) {
+    pthread_t hThread;
+    TPK_THREAD_EX *xThread;
+
+    // Error checking
+    if (!API_ACTIVE) return NULL;
+    if (entry == NULL) return NULL;
+
+    // Attempt to create a POSIX thread
+    if (pthread_create(&hThread, NULL, (void *(*)(void *)) entry, param))
+        return NULL;
+
+    // Construct a TPK thread object
+    xThread = malloc(sizeof(TPK_THREAD_EX));
+    xThread->type = TPK_TYPE_THREAD;
+    xThread->hThread = hThread;
+    xThread->joined = TPK_FALSE;
+
+    // Return the public handle
+    return (TPK_THREAD *) &xThread->hThread;
+}
+
+// Exits the current thread
+void tpkExitThread(int exitcode) {
+    pthread_exit((void *) (long) exitcode);
+    return; // Unreachable, but some compilers throw warnings without it
+}
+
+// Requests ownership of a mutex
+void tpkLockMutex(TPK_MUTEX *mutex) {
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (mutex == NULL) return;
+
+    // Request ownership of the mutex
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    pthread_mutex_lock(&xMutex->hMutex);
+    return;
+}
+
+// Releases ownership of a mutex
+void tpkUnlockMutex(TPK_MUTEX *mutex) {
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (mutex == NULL) return;
+
+    // Release ownership of the mutex
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    pthread_mutex_unlock(&xMutex->hMutex);
+    return;
+}
+
+// Wakes one thread waiting on a condition variable
+void tpkSignalCond(TPK_COND *cond) {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (cond == NULL) return;
+
+    xCond = (TPK_COND_EX *) TPK_OBJECT(cond);
+    pthread_cond_signal(&xCond->hCond);
+    return;
+}
+
+// Wakes every thread waiting on a condition variable
+void tpkBroadcastCond(TPK_COND *cond) {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (cond == NULL) return;
+
+    xCond = (TPK_COND_EX *) TPK_OBJECT(cond);
+    pthread_cond_broadcast(&xCond->hCond);
+    return;
+}
+
+// Releases a mutex held once and waits on a condition variable, then
+// requests ownership of the mutex again
+void tpkWaitCond(TPK_COND *cond, TPK_MUTEX *mutex) {
+    TPK_COND_EX *xCond;
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (cond == NULL || mutex == NULL) return;
+
+    xCond  = (TPK_COND_EX *)  TPK_OBJECT(cond);
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    pthread_cond_wait(&xCond->hCond, &xMutex->hMutex);
+    return;
+}
+
+// Like tpkWaitCond(), but gives up after a number of milliseconds when
+// positive
+static void waitCondTimed(TPK_COND *cond, TPK_MUTEX *mutex, int ms) {
+    TPK_COND_EX *xCond;
+    TPK_MUTEX_EX *xMutex;
+    struct timespec ts;
+
+    // Error checking
+    if (cond == NULL || mutex == NULL) return;
+    xCond  = (TPK_COND_EX *)  TPK_OBJECT(cond);
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    if (ms < 0) {
+        pthread_cond_wait(&xCond->hCond, &xMutex->hMutex);
+        return;
+    }
+
+    // Condition variables time out against the system clock
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += ms / 1000;
+    ts.tv_nsec += (long) (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&xCond->hCond, &xMutex->hMutex, &ts);
+    return;
+}
+
+// Adds to the count of a semaphore, waking as many waiting threads
+void tpkSignalSemaphore(TPK_SEMAPHORE *sem, int count) {
+    TPK_SEMAPHORE_EX *xSem;
+
+    // Error checking
+    if (sem == NULL) return;
+
+    xSem = (TPK_SEMAPHORE_EX *) TPK_OBJECT(sem);
+    while (count-- > 0) sem_post(&xSem->hSem);
+    return;
+}
+
+// Waits until the count of a semaphore is positive, then decrements it
+void tpkWaitSemaphore(TPK_SEMAPHORE *sem) {
+    TPK_SEMAPHORE_EX *xSem;
+
+    // Error checking
+    if (sem == NULL) return;
+
+    xSem = (TPK_SEMAPHORE_EX *) TPK_OBJECT(sem);
+    while (sem_wait(&xSem->hSem)); // Restart when interrupted by a signal
+    return;
+}
+
+// Gives up the rest of the calling thread's time slice
+static void yieldThread() {
+    sched_yield();
+    return;
+}
+
+// Waits for a thread to terminate
+int tpkWaitForThread(TPK_THREAD *thread) {
+    TPK_THREAD_EX *xThread;
+    void *ret = NULL;
+
+    // Error checking
+    if (thread == NULL) return 0;
+
+    // Wait for the thread to exit, a thread can only be joined once
+    xThread = (TPK_THREAD_EX *) TPK_OBJECT(thread);
+    if (xThread->joined) return 0;
+    pthread_join(xThread->hThread, &ret);
+    xThread->joined = TPK_TRUE;
+
+    // Return the thread's exit code
+    return (int) (long) ret;
+}
+
+// Deletes a mutex
+static void deleteMutex(TPK_MUTEX_EX *xMutex) {
+    pthread_mutex_destroy(&xMutex->hMutex);
+    free(xMutex);
+    return;
+}
+
+// Deletes a condition variable
+static void deleteCond(TPK_COND_EX *xCond) {
+    pthread_cond_destroy(&xCond->hCond);
+    free(xCond);
+    return;
+}
+
+// Deletes a semaphore
+static void deleteSemaphore(TPK_SEMAPHORE_EX *xSem) {
+    sem_destroy(&xSem->hSem);
+    free(xSem);
+    return;
+}
+
+// Deletes a thread
+static void deleteThread(TPK_THREAD_EX *xThread) {
+    if (!xThread->joined) pthread_detach(xThread->hThread);
+    free(xThread);
+    return;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                               File Functions                               //
+////////////////////////////////////////////////////////////////////////////////
+
+// Asks the kernel to start reading a file into its cache
+static int readAhead(char *filename) {
+    int fd, ret;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return TPK_FALSE;
+    ret = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+    return ret ? TPK_FALSE : TPK_TRUE;
+}
+
+// Maps a whole file into memory for reading
+TPK_MAP* tpkMapFile(char *filename) {
+    TPK_MAP_EX *map;
+    struct stat st;
+    void *data;
+    int fd;
+
+    // Error checking
+    if (!API_ACTIVE || filename == NULL) return NULL;
+
+    // Empty files can't be mapped
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || st.st_size <= 0 || 
+        (unsigned long long) st.st_size > (size_t) -1) {
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping outlives the descriptor
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    map = malloc(sizeof(TPK_MAP_EX));
+    map->type = TPK_TYPE_MAP;
+    map->user.data = data;
+    map->user.length = (long long) st.st_size;
+    return &map->user;
+}
+
+// Deletes a file mapping
+static void deleteMap(TPK_MAP_EX *map) {
+    munmap(map->user.data, map->user.length);
+    free(map);
+    return;
+}
+
+// Calls func(data, name, isdir) for each entry in a directory but . and ..
+int tpkListDir(char *path, void *func, void *data) {
+    void (*call)(void *, char *, int) = func;
+    char full[PATH_MAX];
+    struct dirent *ent;
+    struct stat st;
+    int isdir;
+    DIR *dir;
+
+    // Error checking
+    if (!API_ACTIVE || path == NULL || func == NULL) return TPK_ERR_UNKNOWN;
+    dir = opendir(path);
+    if (dir == NULL) return TPK_ERR_UNKNOWN;
+
+    // Not every file system reports the type, links to directories are
+    // left alone so a loop can't recurse forever
+    while ((ent = readdir(dir)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+        if (ent->d_type == DT_UNKNOWN) {
+            snprintf(full, sizeof(full), "%s/%s", path, ent->d_name);
+            isdir = !lstat(full, &st) && S_ISDIR(st.st_mode);
+        } else isdir = (ent->d_type == DT_DIR);
+        call(data, ent->d_name, isdir);
+    }
+
+    closedir(dir);
+    return TPK_ERR_NONE;
+}
+
+// Reads a file's modification time and length
+static int fileStamp(char *filename, long long *mtime, long long *size) {
+    struct stat st;
+
+    if (stat(filename, &st)) return TPK_FALSE;
+    *mtime = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    *size = (long long) st.st_size;
+    return TPK_TRUE;
+}
+
+// Has inotify report writes to the file's directory, which also catches the
+// file being replaced by a rename. Without it, the watch polls
+static int startWatch(TPK_WATCH_EX *watch) {
+    char dir[PATH_MAX];
+    int len;
+
+    // Directory part of the name, the current directory if there's none
+    len = watch->base - watch->filename;
+    if (len >= PATH_MAX) return TPK_FALSE;
+    if (len) { memcpy(dir, watch->filename, len); dir[len] = 0; }
+    else strcpy(dir, ".");
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) return TPK_FALSE;
+    if (inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(watch->fd);
+        watch->fd = -1;
+        return TPK_FALSE;
+    }
+    return TPK_TRUE;
+}
+
+// Drains the notifications, returning whether any could concern the file
+static int watchEvents(TPK_WATCH_EX *watch) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *e;
+    int len, off, hit = TPK_FALSE;
+
+    while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < len; off += sizeof(struct inotify_event) + e->len) {
+            e = (struct inotify_event *) &buf[off];
+
+            // Lost events might have been about the file, and a directory
+            // that went away gets no more, so fall back to polling
+            if (e->mask & IN_IGNORED) {
+                close(watch->fd);
+                watch->fd = -1;
+                return TPK_TRUE;
+            }
+            if ((e->mask & IN_Q_OVERFLOW) || 
+                (e->len && !strcmp(e->name, watch->base))) hit = TPK_TRUE;
+        }
+    }
+    return hit;
+}
+
+// Deletes a file watch
+static void deleteWatch(TPK_WATCH_EX *watch) {
+    if (watch->fd >= 0) close(watch->fd);
+    free(watch);
+    return;
+}
+
+#ifdef TPK_URING
+
+// Finishes a read the kernel completed, then queues its callback
+static void ringComplete(TPK_READ_EX *read, int res) {
+    ssize_t got = res, ret;
+
+    // Short reads are finished here, they're rare with regular files
+    while (got >= 0 && got < read->length) {
+        ret = pread(read->fd, read->buffer + got, read->length - got, got);
+        if (ret > 0) got += ret;
+        else if (ret < 0 && errno == EINTR) continue;
+        else got = -1;
+    }
+
+    // Failed reads have no contents
+    if (got != read->length) {
+        free(read->buffer);
+        read->buffer = NULL;
+        read->length = 0;
+    }
+    close(read->fd);
+    read->fd = -1;
+
+    // Wake anyone waiting on it before its callback can release it
+    tpkLockMutex(rRing.lock);
+    if (read->prev != NULL) read->prev->next = read->next;
+    else if (rRing.reading == read) rRing.reading = read->next;
+    if (read->next != NULL) read->next->prev = read->prev;
+    read->arrived = TPK_TRUE;
+    tpkBroadcastCond(rRing.arrived);
+    tpkUnlockMutex(rRing.lock);
+    tpkJobRun(read->job);
+    return;
+}
+
+// Reads a file again once the reaper has given up with the read still in
+// the kernel. The kernel may yet write into the buffer it was given, so
+// that one is left to it
+static void ringRescue(TPK_READ_EX *read) {
+    read->prev = read->next = NULL;
+    read->buffer = malloc(read->length);
+    ringComplete(read, (read->buffer != NULL) ? 0 : -1);
+    tpkAtomicAdd(&rRing.inflight, -1);
+    return;
+}
+
+// Sleeps until the kernel has finished a read, so its waiter doesn't spin
+// while the disk is busy
+static void ringWait(TPK_READ_EX *read) {
+    tpkLockMutex(rRing.lock);
+    while (!read->arrived) tpkWaitCond(rRing.arrived, rRing.lock);
+    tpkUnlockMutex(rRing.lock);
+    return;
+}
+
+// Thread entry collecting completed reads. A completion without a read is
+// the signal to stop
+static void ringReaper(void *param) {
+    struct io_uring_cqe *cqe;
+    TPK_READ_EX *read, *next;
+    unsigned head;
+    int res, failed = TPK_FALSE, stop = TPK_FALSE;
+
+    (void) param;
+    while (!stop) {
+
+        // Sleep until the kernel completes something. If it can't be waited
+        // on any more, what it already finished is still collected
+        if (syscall(__NR_io_uring_enter, rRing.fd, 0, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            failed = stop = TPK_TRUE;
+
+        // Hand every completion back to its read
+        head = *rRing.cqHead;
+        while (head != __atomic_load_n(rRing.cqTail, __ATOMIC_ACQUIRE)) {
+            cqe = (struct io_uring_cqe *) rRing.cqes + (head & *rRing.cqMask);
+            read = (TPK_READ_EX *) (size_t) cqe->user_data;
+            res = cqe->res;
+            __atomic_store_n(rRing.cqHead, ++head, __ATOMIC_RELEASE);
+            if (read == NULL) { stop = TPK_TRUE; continue; }
+            ringComplete(read, res);
+            tpkAtomicAdd(&rRing.inflight, -1);
+        }
+    }
+
+    // Nothing would collect the reads the kernel still has, so they're read
+    // again here, and later ones go to the job system
+    if (failed) {
+        tpkLockMutex(rRing.lock);
+        rRing.failed = rRing.gaveup = TPK_TRUE;
+        read = rRing.reading;
+        rRing.reading = NULL;
+        tpkUnlockMutex(rRing.lock);
+        for ( ; read != NULL; read = next) {
+            next = read->next;
+            ringRescue(read);
+        }
+    }
+
+    tpkExitThread(0);
+    return;
+}
+
+// Fills the next submission entry, which the kernel sees on ringFlush()
+static void ringQueue(int opcode, int fd, void *addr, unsigned len,
+    void *data) {
+    struct io_uring_sqe *sqe;
+    unsigned tail, index;
+
+    tail  = *rRing.sqTail;
+    index = tail & *rRing.sqMask;
+    sqe = (struct io_uring_sqe *) rRing.sqes + index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) addr;
+    sqe->len = len;
+    sqe->user_data = (unsigned long) data;
+    rRing.sqArray[index] = index;
+    __atomic_store_n(rRing.sqTail, tail + 1, __ATOMIC_RELEASE);
+    rRing.queued++;
+    return;
+}
+
+// Opens a file and queues a read of all of it, returning TPK_FALSE if the
+// ring is unavailable or full so the job system reads it instead
+static int ringRead(TPK_READ_EX *read) {
+    struct stat st;
+    int fd;
+
+    // Error checking
+    if (rRing.fd < 0 || rRing.reaper == NULL || rRing.failed ||
+        tpkAtomicGet(&rRing.inflight) >= TPK_READ_DEPTH) return TPK_FALSE;
+
+    // Opening is synchronous, and failures are reported by the job system
+    fd = open(read->filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return TPK_FALSE;
+    if (fstat(fd, &st) || st.st_size <= 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return TPK_FALSE;
+    }
+    read->buffer = malloc(st.st_size);
+    if (read->buffer == NULL) {
+        close(fd);
+        return TPK_FALSE;
+    }
+    read->length = (int) st.st_size;
+    read->fd = fd;
+
+    // Queue the read itself
+    tpkAtomicAdd(&rRing.inflight, 1);
+    ringQueue(IORING_OP_READ, fd, read->buffer, read->length, read);
+    return TPK_TRUE;
+}
+
+// Takes the entries the kernel hasn't seen back off the ring, returning
+// their reads, undone, as a list. The kernel only looks at the ring when
+// asked to, so the tail can be moved back
+static TPK_READ_EX* ringRetract() {
+    struct io_uring_sqe *sqe;
+    TPK_READ_EX *read, *list = NULL;
+    unsigned tail;
+
+    tail = *rRing.sqTail;
+    for ( ; rRing.queued; rRing.queued--) {
+        tail--;
+        sqe = (struct io_uring_sqe *) rRing.sqes + (tail & *rRing.sqMask);
+        read = (TPK_READ_EX *) (size_t) sqe->user_data;
+        if (read == NULL) continue;
+        close(read->fd);
+        free(read->buffer);
+        read->fd = -1;
+        read->buffer = NULL;
+        read->length = 0;
+        read->ring = TPK_FALSE;
+        read->next = list;
+        list = read;
+        tpkAtomicAdd(&rRing.inflight, -1);
+    }
+    __atomic_store_n(rRing.sqTail, tail, __ATOMIC_RELEASE);
+    return list;
+}
+
+// Submits every queued read with one system call. If the kernel stops
+// taking entries or the reaper has given up, the ring isn't used again and
+// the reads it didn't take are returned as a list for the job system to
+// read instead. Submitted reads are kept track of in the same step, so the
+// reaper can't give up in between
+static TPK_READ_EX* ringFlush() {
+    struct io_uring_sqe *sqe;
+    TPK_READ_EX *read, *list = NULL;
+    unsigned tail;
+    int ret;
+
+    while (rRing.fd >= 0 && rRing.queued && list == NULL) {
+        tpkLockMutex(rRing.lock);
+        tail = *rRing.sqTail - rRing.queued;
+        ret = rRing.failed ? -1 : syscall(__NR_io_uring_enter, rRing.fd,
+            rRing.queued, 0, 0, NULL, 0);
+        if (ret > 0) {
+            for (rRing.queued -= ret; ret; ret--, tail++) {
+                sqe = (struct io_uring_sqe *) rRing.sqes +
+                    (tail & *rRing.sqMask);
+                read = (TPK_READ_EX *) (size_t) sqe->user_data;
+                if (read == NULL) continue;
+                read->prev = NULL;
+                read->next = rRing.reading;
+                if (rRing.reading != NULL) rRing.reading->prev = read;
+                rRing.reading = read;
+            }
+        } else if (rRing.failed || (errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY)) {
+            rRing.failed = TPK_TRUE;
+            list = ringRetract();
+        }
+        tpkUnlockMutex(rRing.lock);
+    }
+    return list;
+}
+
+// Waits for reads in flight, then stops the reaper and releases the ring
+static void stopRing() {
+
+    // Error checking
+    if (rRing.fd < 0) return;
+
+    // Reads in flight hold buffers and callbacks that have to run. If the
+    // signal to stop can't be submitted, the reaper is left asleep, holding
+    // nothing. A reaper that gave up has stopped by itself
+    if (rRing.reaper != NULL) {
+        while (tpkAtomicGet(&rRing.inflight) > 0) tpkSleep(1);
+        if (!rRing.gaveup) {
+            rRing.failed = TPK_FALSE;
+            ringQueue(IORING_OP_NOP, -1, NULL, 0, NULL);
+            ringFlush();
+        }
+        if (rRing.gaveup || !rRing.failed) {
+            tpkWaitForThread(rRing.reaper);
+            tpkDelete(rRing.reaper);
+        }
+        rRing.reaper = NULL;
+    }
+    tpkDelete(rRing.arrived);
+    tpkDelete(rRing.lock);
+    rRing.arrived = NULL;
+    rRing.lock = NULL;
+
+    // Release the ring
+    munmap(rRing.sqes, rRing.sqeSize);
+    if (rRing.cqRing != rRing.sqRing) munmap(rRing.cqRing, rRing.cqSize);
+    munmap(rRing.sqRing, rRing.sqSize);
+    close(rRing.fd);
+    rRing.fd = -1;
+    return;
+}
+
+// Sets up the io_uring instance and its reaper, leaving reads to the job
+// system if the kernel doesn't allow it or predates plain reads (5.6)
+static void startRing() {
+    struct io_uring_params p;
+    unsigned char *sq, *cq;
+    int fd;
+
+    // Ask for the ring
+    memset(&p, 0, sizeof(struct io_uring_params));
+    fd = syscall(__NR_io_uring_setup, TPK_READ_DEPTH, &p);
+    if (fd < 0) return;
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) { close(fd); return; }
+
+    // Map the rings, which newer kernels keep in one mapping
+    rRing.sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    rRing.cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (rRing.cqSize > rRing.sqSize) rRing.sqSize = rRing.cqSize;
+        rRing.cqSize = rRing.sqSize;
+    }
+    rRing.sqeSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    rRing.sqRing = mmap(NULL, rRing.sqSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    rRing.cqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? rRing.sqRing :
+        mmap(NULL, rRing.cqSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    rRing.sqes = mmap(NULL, rRing.sqeSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (rRing.sqRing == MAP_FAILED || rRing.cqRing == MAP_FAILED ||
+        rRing.sqes == MAP_FAILED) {
+        if (rRing.sqes != MAP_FAILED) munmap(rRing.sqes, rRing.sqeSize);
+        if (rRing.cqRing != MAP_FAILED && rRing.cqRing != rRing.sqRing)
+            munmap(rRing.cqRing, rRing.cqSize);
+        if (rRing.sqRing != MAP_FAILED) munmap(rRing.sqRing, rRing.sqSize);
+        close(fd);
+        return;
+    }
+
+    // Locate the ring fields
+    sq = rRing.sqRing;
+    cq = rRing.cqRing;
+    rRing.sqHead  = (unsigned *) (sq + p.sq_off.head);
+    rRing.sqTail  = (unsigned *) (sq + p.sq_off.tail);
+    rRing.sqMask  = (unsigned *) (sq + p.sq_off.ring_mask);
+    rRing.sqArray = (unsigned *) (sq + p.sq_off.array);
+    rRing.cqHead  = (unsigned *) (cq + p.cq_off.head);
+    rRing.cqTail  = (unsigned *) (cq + p.cq_off.tail);
+    rRing.cqMask  = (unsigned *) (cq + p.cq_off.ring_mask);
+    rRing.cqes    = cq + p.cq_off.cqes;
+    rRing.queued = 0;
+    rRing.inflight = 0;
+    rRing.failed = rRing.gaveup = TPK_FALSE;
+    rRing.reading = NULL;
+    rRing.fd = fd;
+
+    // Start collecting completions
+    rRing.lock = tpkCreateMutex();
+    rRing.arrived = tpkCreateCond();
+    rRing.reaper = tpkCreateThread(ringReaper, NULL);
+    if (rRing.reaper == NULL) stopRing();
+    return;
+}
+
+#else
+
+// Without io_uring every read goes to the job system
+static void startRing() { return; }
+static int  ringRead(TPK_READ_EX *read) { return TPK_FALSE; }
+static TPK_READ_EX* ringFlush() { return NULL; }
+static void ringWait(TPK_READ_EX *read) { return; }
+static void stopRing() { return; }
+
+#endif // TPK_URING
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Abstract Functions                             //
+////////////////////////////////////////////////////////////////////////////////
+
+// Sleep for a given number of milliseconds
+void tpkSleep(int ms) {
+    struct timespec ts;
+
+    ts.tv_sec  = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts));
+    return;
+}
+
+// Uninitialize the API
+int tpkShutdown() {
+
+    // Stop reads, the job system and the input thread before anything they
+    // might use goes away
+    stopReads();
+    tpkJobShutdown();
+    tpkInputThread(TPK_FALSE);
+
+    // Close the display connections
+    if (eDpy != EGL_NO_DISPLAY) eglTerminate(eDpy);
+    if (hDpy != NULL) XCloseDisplay(hDpy);
+    eDpy = EGL_NO_DISPLAY;
+    hDpy = NULL;
+
+    API_ACTIVE = TPK_FALSE;
+    return TPK_ERR_NONE;
+}
+
+// Initialize the API
+int tpkStartup() {
+
+    // Error checking
+    if (API_ACTIVE) return TPK_ERR_NONE;
+
+    // Connect to the X server. Running without one is allowed, in which case
+    // only offscreen rendering contexts are available
+    XInitThreads();
+    hDpy = XOpenDisplay(NULL);
+    if (hDpy != NULL) {
+        wmDelete = XInternAtom(hDpy, "WM_DELETE_WINDOW", False);
+        wContext = XUniqueContext();
+
+        // Held keys repeat key down events without key ups, as on Windows
+        XkbSetDetectableAutoRepeat(hDpy, True, NULL);
+    }
+
+    // Perform initialization routine
+    API_ACTIVE = TPK_TRUE;
+    wCur = NULL; gCur = NULL;
+    startReads();
+    return TPK_ERR_NONE;
+}
+
+// Return a monotonic time in nanoseconds
+unsigned long long tpkClock() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Return elapsed milliseconds between function calls
+unsigned int tpkTimer(unsigned int *previous) {
+    unsigned int change, thisms, lastms = *previous;
+    struct timespec ts;
+
+    // Get current time, unaffected by changes to the system clock
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    thisms = (unsigned int) ((unsigned long long) ts.tv_sec * 1000 +
+        ts.tv_nsec / 1000000);
+    change = thisms - lastms;
+
+    // Return ticks
+    *previous = thisms;
+    return change;
+}
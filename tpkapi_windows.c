@@ -5,45 +5,83 @@
 #define WM_MOUSEWHEEL 0x020A
 #endif
 
+// Newer flag for MsgWaitForMultipleObjectsEx(), missing from older headers
+#ifndef MWMO_INPUTAVAILABLE
+#define MWMO_INPUTAVAILABLE 0x0004
+#endif
+
+// Swap interval entry point from WGL_EXT_swap_control
+typedef BOOL (WINAPI *WGL_SWAPEXT)(int);
+
 // Additional constants not seen to the public API
 #define TPK_EVENT_UNKNOWN -1
+#define TPK_WM_CALL       (WM_APP + 1) // Thread message carrying a TPK_CALL
 
 // Internal extended data structure for window information
 typedef struct {
-    int  type;          // Object type field
+    TPK_HEADER;         // Object type field
     TPK_WINDOW user;    // User-visible data structure
     TPK_WINDOW self;    // Internal data structure
     char classname[32]; // String data used for class name
     HINSTANCE hinst;    // OS-specific instance handle
     HWND hwnd;          // OS-specific window handle
     HDC  hdc;           // OS-specific device context handle
-    int  hasMove;       // Move events aren't added to queue
-    int  hasResize;     // Resize events aren't added to queue
+    DWORD owner;        // Thread the window belongs to
+    TPK_QUEUE queue;    // Events waiting for tpkNextEvent()
 } TPK_WINDOW_EXT;
 
+// Window function handed to the thread that owns, or will own, a window
+typedef struct {
+    int (*func)(TPK_WINDOW_EXT *);
+    TPK_WINDOW_EXT *wnd;
+    int ret;
+    TPK_SEMAPHORE *done;
+} TPK_CALL;
+
 // Internal extended data structure for OpenGL rendering context information
 typedef struct {
-    int type;        // Object type field
+    TPK_HEADER;      // Object type field
     TPK_GLRC user;   // User-visible data structure
     TPK_GLRC self;   // Internal data structure
     HGLRC rc;        // OS-specific rendering context handle
+    void *hidden;    // Hidden window backing an offscreen context, if any
 } TPK_GLRC_EXT;
 
 // Internal extended data structure for thread information
 typedef struct {
-    int type;
+    TPK_HEADER;
     HANDLE hThread;
 } TPK_THREAD_EX;
 
 // Internal extended data structure for mutex information
 typedef struct {
-    int type;
+    TPK_HEADER;
     CRITICAL_SECTION hMutex;
 } TPK_MUTEX_EX;
 
-// Private variables for most recent window event
-#define WndEvent(x, y, z) wEvent = x; wArg1 = y; wArg2 = z; return 0
-int wEvent, wArg1, wArg2, API_ACTIVE = TPK_FALSE;
+// Internal extended data structure for semaphore information
+typedef struct {
+    TPK_HEADER;
+    HANDLE hSem;
+} TPK_SEMAPHORE_EX;
+
+// Internal extended data structure for condition variable information
+typedef struct {
+    TPK_HEADER;
+    CONDITION_VARIABLE hCond;
+} TPK_COND_EX;
+
+// Internal extended data structure for file mapping information
+typedef struct {
+    TPK_HEADER;   // Object type field
+    TPK_MAP user; // User-visible data structure
+} TPK_MAP_EX;
+
+// Queues an event from the window procedure. Only the thread owning the
+// window runs it, which makes that thread the queue's one producer
+#define WndEvent(x, y, z) queueEvent(&wnd->queue, x, y, z); return 0
+int API_ACTIVE = TPK_FALSE;
+DWORD iThreadId = 0;
 TPK_GLRC_EXT   *gCur;
 TPK_WINDOW_EXT *wCur;
 
@@ -58,6 +96,7 @@ static LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam,
     LPARAM lParam){
     TPK_WINDOW_EXT *wnd = 
         (TPK_WINDOW_EXT *) GetWindowLongPtr(hWnd, GWL_USERDATA);
+    RECT r;
 
     // If window is still being constructed, there's no user data yet
     if (!wnd)
@@ -95,19 +134,24 @@ static LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam,
     case WM_RBUTTONUP: WndEvent(TPK_EVENT_MOUSEUP, TPK_MOUSE_RIGHT,  0);
     case WM_MBUTTONUP: WndEvent(TPK_EVENT_MOUSEUP, TPK_MOUSE_MIDDLE, 0);
 
-    // Move
+    // Part of the window needs to be drawn again
+    case WM_PAINT:
+        ValidateRect(hWnd, NULL);
+        WndEvent(TPK_EVENT_PAINT, 0, 0);
+
+    // Move, reported as the position of the whole window like measureWindow()
     case WM_MOVE:
-        wnd->hasMove = TPK_TRUE; return 0;
+        GetWindowRect(hWnd, &r);
+        WndEvent(TPK_EVENT_MOVE, r.left, r.top);
 
     // Resize
     case WM_SIZE:
-        wnd->hasResize = TPK_TRUE; return 0;
+        WndEvent(TPK_EVENT_RESIZE, LOWORD(lParam), HIWORD(lParam));
 
     default: break;
     } // switch
 
     // All other events processed by Windows
-    wEvent = TPK_EVENT_UNKNOWN;
     return DefWindowProc(hWnd, uMsg, wParam, lParam);
 }
 
@@ -126,9 +170,77 @@ static void measureWindow(TPK_WINDOW_EXT *wnd) {
     return;
 }
 
+// Registers the class of a window and creates it on the calling thread
+static int openWindow(TPK_WINDOW_EXT *wnd) {
+    WNDCLASS C;
+
+    // Window class structure to register with the system
+    C.style         = CS_OWNDC;
+    C.lpfnWndProc   = (WNDPROC) WindowProc;
+    C.cbClsExtra    = 0;
+    C.cbWndExtra    = 0;
+    C.hInstance     = wnd->hinst;
+    C.hIcon         = LoadIcon(NULL, IDI_WINLOGO);
+    C.hCursor       = LoadCursor(NULL, IDC_ARROW);
+    C.hbrBackground = (HBRUSH) (COLOR_BTNFACE + 1);
+    C.lpszMenuName  = NULL;
+    C.lpszClassName = wnd->classname;
+
+    // Attempt to register the class
+    wnd->hwnd = NULL;
+    if (!RegisterClass(&C)) return TPK_FALSE;
+
+    // Attempt to create the window
+    wnd->hwnd = CreateWindow(wnd->classname, wnd->self.text,
+        WS_POPUPWINDOW, 32, 32, wnd->user.width, wnd->user.height, NULL, NULL,
+        wnd->hinst, NULL);
+    if (wnd->hwnd == NULL) {
+        UnregisterClass(wnd->classname, wnd->hinst);
+        return TPK_FALSE;
+    }
+
+    // Configure the remainder of the window
+    wnd->owner = GetCurrentThreadId();
+    SetWindowLongPtr(wnd->hwnd, GWL_USERDATA, (LONG_PTR) wnd);
+    wnd->hdc = GetDC(wnd->hwnd);
+    SetWindowLong(wnd->hwnd, GWL_STYLE,   0x06CF0000);
+    SetWindowLong(wnd->hwnd, GWL_EXSTYLE, 0x00040100);
+    return TPK_TRUE;
+}
+
+// Destroys a window and its class on the thread that created them
+static int closeWindow(TPK_WINDOW_EXT *wnd) {
+    ReleaseDC(wnd->hwnd, wnd->hdc);
+    DestroyWindow(wnd->hwnd);
+    UnregisterClass(wnd->classname, wnd->hinst);
+    return TPK_TRUE;
+}
+
+// Runs a window function on a given thread, which has to be the input
+// thread or the calling one since only they process window messages
+static int callWindow(int (*func)(TPK_WINDOW_EXT *), TPK_WINDOW_EXT *wnd,
+    DWORD thread) {
+    TPK_CALL call;
+
+    // Run it here unless the input thread is the one to run it
+    if (iThread == NULL || thread != iThreadId ||
+        thread == GetCurrentThreadId())
+        return func(wnd);
+
+    // Hand it over and wait for the result
+    call.func = func;
+    call.wnd  = wnd;
+    call.ret  = TPK_FALSE;
+    call.done = tpkCreateSemaphore(0);
+    if (call.done == NULL) return TPK_FALSE;
+    if (PostThreadMessage(thread, TPK_WM_CALL, 0, (LPARAM) &call))
+        tpkWaitSemaphore(call.done);
+    tpkDelete(call.done);
+    return call.ret;
+}
+
 // Creates a window
 TPK_WINDOW* tpkCreateWindow(int width, int height, char *text) {
-    WNDCLASS C;
     TPK_WINDOW_EXT *wnd;
 
     // Error checking
@@ -139,10 +251,12 @@ TPK_WINDOW* tpkCreateWindow(int width, int height, char *text) {
     wnd->type = TPK_TYPE_WINDOW;
     wnd->user.rc = wnd->self.rc = NULL;
     wnd->user.text[0] = 0;
-    strncat(wnd->user.text, text, 255);
+    if (text != NULL) strncat(wnd->user.text, text, 255);
     strcpy(wnd->self.text, wnd->user.text);
     wnd->self.x = wnd->self.y = wnd->self.width = wnd->self.height = -1;
-    wnd->self.visible = wnd->hasMove = wnd->hasResize = TPK_FALSE;
+    wnd->self.visible = TPK_FALSE;
+    wnd->queue.head = wnd->queue.tail = 0;
+    wnd->queue.waiting = TPK_FALSE;
 
     // Initialize user component
     width  = (width  < 0) ? 0 : width;
@@ -157,39 +271,14 @@ TPK_WINDOW* tpkCreateWindow(int width, int height, char *text) {
     sprintf(wnd->classname, "%x", (unsigned int) wnd);
     wnd->hinst = GetModuleHandle(NULL);
 
-    // Window class structure to register with the system
-    C.style         = CS_OWNDC;
-    C.lpfnWndProc   = (WNDPROC) WindowProc;
-    C.cbClsExtra    = 0;
-    C.cbWndExtra    = 0;
-    C.hInstance     = wnd->hinst;
-    C.hIcon         = LoadIcon(NULL, IDI_WINLOGO);
-    C.hCursor       = LoadCursor(NULL, IDC_ARROW);
-    C.hbrBackground = (HBRUSH) (COLOR_BTNFACE + 1);
-    C.lpszMenuName  = NULL;
-    C.lpszClassName = wnd->classname;
-
-    // Attempt to register the class
-    wnd->hwnd = NULL;
-    if (!RegisterClass(&C)) {
-        free(wnd);
-        return NULL;
-    }
-
-    // Attempt to create the window
-    wnd->hwnd = CreateWindow(wnd->classname, (text == NULL) ? "" : text, 
-        WS_POPUPWINDOW, 32, 32, width, height, NULL, NULL, wnd->hinst, NULL);
-    if (wnd->hwnd == NULL) {
-        UnregisterClass(wnd->classname, wnd->hinst);
+    // Windows belong to the thread that creates them, which is the input
+    // thread whenever it runs
+    if (!callWindow(openWindow, wnd, iThreadId)) {
         free(wnd);
         return NULL;
     }
 
-    // Configure the remainder of the window
-    SetWindowLongPtr(wnd->hwnd, GWL_USERDATA, (LONG_PTR) wnd);
-    wnd->hdc = GetDC(wnd->hwnd);
-    SetWindowLong(wnd->hwnd, GWL_STYLE,   0x06CF0000);
-    SetWindowLong(wnd->hwnd, GWL_EXSTYLE, 0x00040100);
+    // Apply the remaining properties
     tpkUpdate(&wnd->user);
     measureWindow(wnd);
 
@@ -197,47 +286,6 @@ TPK_WINDOW* tpkCreateWindow(int width, int height, char *text) {
     return &wnd->user;
 }
 
-// Processes the next window event
-static int nextEventWindow(TPK_WINDOW_EXT *wnd, int *arg1, int *arg2) {
-    MSG m;
-    int ret;
-
-    // Catch Microsoft's move event mistakes
-    if (wnd->hasMove) {
-        wnd->hasMove = TPK_FALSE;
-        measureWindow(wnd);
-        *arg1 = wnd->self.x;
-        *arg2 = wnd->self.y;
-        return TPK_EVENT_MOVE;
-    }
-
-    // Catch Microsoft's resize event mistakes
-    if (wnd->hasResize) {
-        wnd->hasResize = TPK_FALSE;
-        measureWindow(wnd);
-        *arg1 = wnd->self.width;
-        *arg2 = wnd->self.height;
-        return TPK_EVENT_RESIZE;
-    }
-
-    // Skip events until a known event is encountered
-    else {
-        for (wEvent = TPK_EVENT_UNKNOWN; wEvent == TPK_EVENT_UNKNOWN; ) {
-            if (PeekMessage(&m, wnd->hwnd, 0, 0, PM_REMOVE)) {
-                TranslateMessage(&m);
-                DispatchMessage(&m);
-            } else wEvent = TPK_EVENT_NONE;
-        }
-    }
-
-    // Set parameters and exit
-    *arg1 = wArg1;
-    *arg2 = wArg2;
-    ret = wEvent;
-    wEvent = TPK_EVENT_NONE;
-    return ret;
-}
-
 // Updates a window's properties
 static void updateWindow(TPK_WINDOW_EXT *wnd) {
     RECT r;
@@ -251,8 +299,8 @@ static void updateWindow(TPK_WINDOW_EXT *wnd) {
 
     // Window Title
     if (strcmp(wnd->user.text, wnd->self.text)) {
-        wnd->self.text[0] = 0;
-        strncat(wnd->self.text, wnd->user.text, 255);
+        wnd->user.text[255] = 0;
+        strcpy(wnd->self.text, wnd->user.text);
         strcpy(wnd->user.text, wnd->self.text);
         SetWindowText(wnd->hwnd, wnd->self.text);
     }
@@ -288,16 +336,114 @@ static void deleteWindow(TPK_WINDOW_EXT *wnd) {
     if (wnd->self.rc != NULL)
         tpkDelete(wnd->self.rc);
 
-    // Delete the window
-    ReleaseDC(wnd->hwnd, wnd->hdc);
-    DestroyWindow(wnd->hwnd);
-    UnregisterClass(wnd->classname, wnd->hinst);
+    // Delete the window on the thread it belongs to
+    callWindow(closeWindow, wnd, wnd->owner);
 
     // Deallocate memory and return
     free(wnd);
     return;
 }
 
+// Looks up the API window behind a window handle, if there is one
+static TPK_WINDOW_EXT* findWindow(HWND hWnd) {
+    if (hWnd == NULL ||
+        (WNDPROC) GetClassLongPtr(hWnd, GCLP_WNDPROC) != (WNDPROC) WindowProc)
+        return NULL;
+    return (TPK_WINDOW_EXT *) GetWindowLongPtr(hWnd, GWL_USERDATA);
+}
+
+// Dispatches waiting messages of the calling thread, which queues the events
+// of its windows. Messages stay with the system once a window's queue is down
+// to the room kept for messages Windows sends directly, in which case this
+// returns TPK_FALSE
+static int pumpEvents() {
+    TPK_WINDOW_EXT *wnd;
+    TPK_CALL *call;
+    MSG m;
+
+    while (PeekMessage(&m, NULL, 0, 0, PM_NOREMOVE)) {
+
+        // Leave the message be if its window has no room for it
+        wnd = findWindow(m.hwnd);
+        if (wnd != NULL && queueRoom(&wnd->queue) <= TPK_QUEUE_RESERVE)
+            return TPK_FALSE;
+        if (!PeekMessage(&m, NULL, 0, 0, PM_REMOVE)) break;
+
+        // Window functions handed over by other threads
+        if (m.hwnd == NULL && m.message == TPK_WM_CALL) {
+            call = (TPK_CALL *) m.lParam;
+            call->ret = call->func(call->wnd);
+            tpkSignalSemaphore(call->done, 1);
+            continue;
+        }
+
+        TranslateMessage(&m);
+        DispatchMessage(&m);
+    }
+
+    return TPK_TRUE;
+}
+
+// Waits until the calling thread has messages, or for a number of
+// milliseconds when positive
+static int waitEvents(int ms) {
+    DWORD ret;
+
+    // Sleep on the thread's message queue, including unread messages
+    ret = MsgWaitForMultipleObjectsEx(0, NULL, (ms < 0) ? INFINITE : ms,
+        QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+    return (ret == WAIT_OBJECT_0) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Thread entry of the input thread, which owns the windows created while it
+// runs and so receives all of their messages
+static void inputThread(void *param) {
+    MSG m;
+
+    // Make sure the thread has a message queue before anyone posts to it
+    PeekMessage(&m, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+    iThreadId = GetCurrentThreadId();
+    tpkSignalSemaphore((TPK_SEMAPHORE *) param, 1);
+
+    // Pump until stopped, giving full queues a moment to drain
+    while (!tpkAtomicGet(&iStop)) {
+        if (pumpEvents()) waitEvents(-1);
+        else tpkSleep(1);
+    }
+
+    tpkExitThread(0);
+    return;
+}
+
+// Starts the input thread once it's ready to receive window functions
+static int startInput() {
+    TPK_SEMAPHORE *ready = tpkCreateSemaphore(0);
+
+    // Error checking
+    if (ready == NULL) return TPK_FALSE;
+
+    // Start the thread
+    iThread = tpkCreateThread(inputThread, ready);
+    if (iThread != NULL) tpkWaitSemaphore(ready);
+    tpkDelete(ready);
+    return (iThread != NULL) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Stops the input thread, which takes any windows it still owns with it
+static void stopInput() {
+
+    // Wake the thread out of its wait
+    tpkAtomicSet(&iStop, TPK_TRUE);
+    PostThreadMessage(iThreadId, WM_NULL, 0, 0);
+
+    // Wait for it to leave
+    tpkWaitForThread(iThread);
+    tpkDelete(iThread);
+    iThread = NULL;
+    iThreadId = 0;
+    return;
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -313,7 +459,7 @@ TPK_GLRC* tpkCreateGLRC(TPK_WINDOW *wnd) {
 
     // Error checking
     if (!API_ACTIVE || wnd == NULL) return NULL;
-    xwnd = (TPK_WINDOW_EXT *) (((char *) wnd) - sizeof (int));
+    xwnd = (TPK_WINDOW_EXT *) TPK_OBJECT(wnd);
     if (xwnd->self.rc != NULL) return NULL; // Can't bind two contexts
 
     // Attempt to allocate the needed memory
@@ -321,6 +467,7 @@ TPK_GLRC* tpkCreateGLRC(TPK_WINDOW *wnd) {
     if (rc == NULL) return NULL;
     rc->type = TPK_TYPE_GLRC;
     rc->user.window  = rc->self.window  = (void *) wnd;
+    rc->hidden = NULL;
 
     // Configure needed PixelFormatDescriptor elements
     memset(&pfd, 0, sizeof(PIXELFORMATDESCRIPTOR));
@@ -346,18 +493,93 @@ TPK_GLRC* tpkCreateGLRC(TPK_WINDOW *wnd) {
     return &rc->user;
 }
 
+// Create an OpenGL rendering context that doesn't present to the screen
+TPK_GLRC* tpkCreateOffscreenGLRC(int width, int height) {
+    TPK_WINDOW *wnd;
+    TPK_GLRC *rc;
+    TPK_WINDOW_EXT *xwnd;
+    TPK_GLRC_EXT *xrc;
+
+    // Error checking
+    if (!API_ACTIVE) return NULL;
+
+    // Windows has no windowless GL, so back the context with a hidden window.
+    // Pixels of a hidden window aren't guaranteed to be kept, so callers that
+    // read results back should render into a framebuffer object
+    wnd = tpkCreateWindow(width, height, "");
+    if (wnd == NULL) return NULL;
+    wnd->visible = TPK_FALSE;
+    tpkUpdate(wnd);
+    rc = tpkCreateGLRC(wnd);
+    if (rc == NULL) {
+        tpkDelete(wnd);
+        return NULL;
+    }
+
+    // The context owns the window from here on, not the other way around
+    xwnd = (TPK_WINDOW_EXT *) TPK_OBJECT(wnd);
+    xrc  = (TPK_GLRC_EXT *)   TPK_OBJECT(rc);
+    xwnd->user.rc = xwnd->self.rc = NULL;
+    xrc->user.window = xrc->self.window = NULL;
+    xrc->hidden = xwnd;
+    return rc;
+}
+
+// Retrieves the address of an OpenGL function or extension
+void* tpkGetProcAddress(char *name) {
+    void *proc;
+
+    // Error checking
+    if (!API_ACTIVE || name == NULL) return NULL;
+
+    // Core 1.1 functions only come from opengl32.dll itself, and some drivers
+    // answer with small integers instead of NULL when they don't know a name
+    proc = (void *) wglGetProcAddress(name);
+    if ((size_t) proc <= 3 || proc == (void *) -1)
+        proc = (void *) GetProcAddress(GetModuleHandle("opengl32.dll"), name);
+    return proc;
+}
+
+// Sets the number of display refreshes per buffer swap, 0 disables vsync
+int tpkSwapInterval(TPK_GLRC *rc, int interval) {
+    WGL_SWAPEXT swapext;
+
+    // Error checking
+    if (!API_ACTIVE || rc == NULL || interval < 0) return TPK_FALSE;
+
+    // The extension acts on the current context
+    if ((TPK_GLRC_EXT *) TPK_OBJECT(rc) != gCur) tpkMakeCurrent(rc);
+    swapext = (WGL_SWAPEXT) tpkGetProcAddress("wglSwapIntervalEXT");
+    if (swapext == NULL) return TPK_FALSE;
+    return swapext(interval) ? TPK_TRUE : TPK_FALSE;
+}
+
+// Deselects a rendering context from the calling thread
+static void releaseGLRC(TPK_GLRC_EXT *rc) {
+    wglMakeCurrent(NULL, NULL);
+    return;
+}
+
+// Selects a rendering context and the window it draws to
+static void selectGLRC(TPK_WINDOW_EXT *wnd, TPK_GLRC_EXT *rc) {
+    if (wnd == NULL) wnd = rc->hidden;
+    wglMakeCurrent(wnd->hdc, rc->rc);
+    return;
+}
+
 // Deletes an OpenGL rednering context
 static void deleteGLRC(TPK_GLRC_EXT *rc) {
 
     // Deselect the rendering context from OpenGL, if applicable
     if (rc == gCur) {
         wglMakeCurrent(NULL, NULL);
-        wCur->user.rc = wCur->self.rc = NULL;
+        if (wCur != NULL) wCur->user.rc = wCur->self.rc = NULL;
         wCur = NULL; gCur = NULL;
     }
 
-    // Delete the rendering context
+    // Delete the rendering context and any window backing it
     wglDeleteContext(rc->rc);
+    if (rc->hidden != NULL) deleteWindow(rc->hidden);
 
     // Deallocate memory and return
     free(rc);
@@ -370,6 +592,31 @@ static void deleteGLRC(TPK_GLRC_EXT *rc) {
 //                          Multithreading Functions                          //
 ////////////////////////////////////////////////////////////////////////////////
 
+// Returns the number of processors available to the program
+int tpkCpuCount() {
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors < 1) ? 1 :
+        (int) info.dwNumberOfProcessors;
+}
+
+// Creates a new condition variable
+TPK_COND* tpkCreateCond() {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (!API_ACTIVE) return NULL;
+
+    // Initialize the condition variable object
+    xCond = malloc(sizeof(TPK_COND_EX));
+    xCond->type = TPK_TYPE_COND;
+    InitializeConditionVariable(&xCond->hCond);
+
+    // Return the public handle
+    return (TPK_COND *) &xCond->hCond;
+}
+
 // Creates a new mutex
 TPK_MUTEX* tpkCreateMutex() {
     TPK_MUTEX_EX *xMutex = malloc(sizeof(TPK_MUTEX_EX));
@@ -385,6 +632,27 @@ TPK_MUTEX* tpkCreateMutex() {
     return (TPK_MUTEX *) &xMutex->hMutex;
 }
 
+// Creates a new semaphore with an initial count
+TPK_SEMAPHORE* tpkCreateSemaphore(int count) {
+    TPK_SEMAPHORE_EX *xSem;
+    HANDLE hSem;
+
+    // Error checking
+    if (!API_ACTIVE || count < 0) return NULL;
+
+    // Attempt to create a Windows semaphore
+    hSem = CreateSemaphore(NULL, count, 0x7FFFFFFF, NULL);
+    if (hSem == NULL) return NULL;
+
+    // Construct a TPK semaphore object
+    xSem = malloc(sizeof(TPK_SEMAPHORE_EX));
+    xSem->type = TPK_TYPE_SEMAPHORE;
+    xSem->hSem = hSem;
+
+    // Return the public handle
+    return (TPK_SEMAPHORE *) &xSem->hSem;
+}
+
 // Creates a new execution thread -- Executes immediately
 TPK_THREAD* tpkCreateThread(void *entry, void *param) {
     HANDLE hThread;
@@ -422,7 +690,7 @@ void tpkLockMutex(TPK_MUTEX *mutex) {
     if (mutex == NULL) return;
 
     // Request ownership of the mutex
-    xMutex = (TPK_MUTEX_EX *) ((char *) mutex - sizeof(int));
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
     EnterCriticalSection(&xMutex->hMutex);
     return;
 }
@@ -435,11 +703,96 @@ void tpkUnlockMutex(TPK_MUTEX *mutex) {
     if (mutex == NULL) return;
 
     // Request ownership of the mutex
-    xMutex = (TPK_MUTEX_EX *) ((char *) mutex - sizeof(int));
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
     LeaveCriticalSection(&xMutex->hMutex);
     return;
 }
 
+// Wakes one thread waiting on a condition variable
+void tpkSignalCond(TPK_COND *cond) {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (cond == NULL) return;
+
+    xCond = (TPK_COND_EX *) TPK_OBJECT(cond);
+    WakeConditionVariable(&xCond->hCond);
+    return;
+}
+
+// Wakes every thread waiting on a condition variable
+void tpkBroadcastCond(TPK_COND *cond) {
+    TPK_COND_EX *xCond;
+
+    // Error checking
+    if (cond == NULL) return;
+
+    xCond = (TPK_COND_EX *) TPK_OBJECT(cond);
+    WakeAllConditionVariable(&xCond->hCond);
+    return;
+}
+
+// Releases a mutex held once and waits on a condition variable, then
+// requests ownership of the mutex again
+void tpkWaitCond(TPK_COND *cond, TPK_MUTEX *mutex) {
+    TPK_COND_EX *xCond;
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (cond == NULL || mutex == NULL) return;
+
+    xCond  = (TPK_COND_EX *)  TPK_OBJECT(cond);
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    SleepConditionVariableCS(&xCond->hCond, &xMutex->hMutex, INFINITE);
+    return;
+}
+
+// Like tpkWaitCond(), but gives up after a number of milliseconds when
+// positive
+static void waitCondTimed(TPK_COND *cond, TPK_MUTEX *mutex, int ms) {
+    TPK_COND_EX *xCond;
+    TPK_MUTEX_EX *xMutex;
+
+    // Error checking
+    if (cond == NULL || mutex == NULL) return;
+
+    xCond  = (TPK_COND_EX *)  TPK_OBJECT(cond);
+    xMutex = (TPK_MUTEX_EX *) TPK_OBJECT(mutex);
+    SleepConditionVariableCS(&xCond->hCond, &xMutex->hMutex,
+        (ms < 0) ? INFINITE : ms);
+    return;
+}
+
+// Adds to the count of a semaphore, waking as many waiting threads
+void tpkSignalSemaphore(TPK_SEMAPHORE *sem, int count) {
+    TPK_SEMAPHORE_EX *xSem;
+
+    // Error checking
+    if (sem == NULL || count < 1) return;
+
+    xSem = (TPK_SEMAPHORE_EX *) TPK_OBJECT(sem);
+    ReleaseSemaphore(xSem->hSem, count, NULL);
+    return;
+}
+
+// Waits until the count of a semaphore is positive, then decrements it
+void tpkWaitSemaphore(TPK_SEMAPHORE *sem) {
+    TPK_SEMAPHORE_EX *xSem;
+
+    // Error checking
+    if (sem == NULL) return;
+
+    xSem = (TPK_SEMAPHORE_EX *) TPK_OBJECT(sem);
+    WaitForSingleObject(xSem->hSem, INFINITE);
+    return;
+}
+
+// Gives up the rest of the calling thread's time slice
+static void yieldThread() {
+    SwitchToThread();
+    return;
+}
+
 // Waits for a thread to terminate
 int tpkWaitForThread(TPK_THREAD *thread) {
     TPK_THREAD_EX *xThread;
@@ -449,7 +802,7 @@ int tpkWaitForThread(TPK_THREAD *thread) {
     if (thread == NULL) return 0;
 
     // Wait for the thread to exit
-    xThread = (TPK_THREAD_EX *) ((char *) thread - sizeof(int));
+    xThread = (TPK_THREAD_EX *) TPK_OBJECT(thread);
     WaitForSingleObject(xThread->hThread, INFINITE);
 
     // Return the thread's exit code
@@ -463,6 +816,19 @@ static void deleteMutex(TPK_MUTEX_EX *xMutex) {
     return;
 }
 
+// Deletes a condition variable, Windows has nothing to release
+static void deleteCond(TPK_COND_EX *xCond) {
+    free(xCond);
+    return;
+}
+
+// Deletes a semaphore
+static void deleteSemaphore(TPK_SEMAPHORE_EX *xSem) {
+    CloseHandle(xSem->hSem);
+    free(xSem);
+    return;
+}
+
 // Deletes a thread
 static void deleteThread(TPK_THREAD_EX *xThread) {
     free(xThread);
@@ -472,24 +838,118 @@ static void deleteThread(TPK_THREAD_EX *xThread) {
 
 
 ////////////////////////////////////////////////////////////////////////////////
-//                             Abstract Functions                             //
+//                               File Functions                               //
 ////////////////////////////////////////////////////////////////////////////////
 
-// Flushes out all remaining events
-void tpkDoEvents() {
-    MSG m;
+// Windows has no hint to bring a file into its cache without reading it
+static int readAhead(char *filename) {
+    return TPK_FALSE;
+}
+
+// Maps a whole file into memory for reading
+TPK_MAP* tpkMapFile(char *filename) {
+    LARGE_INTEGER size;
+    TPK_MAP_EX *map;
+    HANDLE hFile, hMap;
+    void *data;
 
-    // Flush all events
-    while (1) {
-        if (PeekMessage(&m, NULL, 0, 0, PM_REMOVE)) {
-            TranslateMessage(&m);
-            DispatchMessage(&m);
-        } else break;
+    // Error checking
+    if (!API_ACTIVE || filename == NULL) return NULL;
+
+    // Empty files can't be mapped
+    hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, 
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return NULL;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 ||
+        (unsigned long long) size.QuadPart > (SIZE_T) -1) {
+        CloseHandle(hFile);
+        return NULL;
     }
 
+    // The view outlives both handles
+    hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMap == NULL) return NULL;
+    data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMap);
+    if (data == NULL) return NULL;
+
+    map = malloc(sizeof(TPK_MAP_EX));
+    map->type = TPK_TYPE_MAP;
+    map->user.data = data;
+    map->user.length = size.QuadPart;
+    return &map->user;
+}
+
+// Deletes a file mapping
+static void deleteMap(TPK_MAP_EX *map) {
+    UnmapViewOfFile(map->user.data);
+    free(map);
     return;
 }
 
+// Calls func(data, name, isdir) for each entry in a directory but . and ..
+int tpkListDir(char *path, void *func, void *data) {
+    void (*call)(void *, char *, int) = func;
+    char pattern[MAX_PATH];
+    WIN32_FIND_DATAA find;
+    HANDLE hFind;
+
+    // Error checking
+    if (!API_ACTIVE || path == NULL || func == NULL) return TPK_ERR_UNKNOWN;
+    if (strlen(path) > MAX_PATH - 3) return TPK_ERR_UNKNOWN;
+    sprintf(pattern, "%s\\*", path);
+    hFind = FindFirstFileA(pattern, &find);
+    if (hFind == INVALID_HANDLE_VALUE) return TPK_ERR_UNKNOWN;
+
+    // Junctions are left alone so a loop can't recurse forever
+    do {
+        if (!strcmp(find.cFileName, ".") || !strcmp(find.cFileName, ".."))
+            continue;
+        call(data, find.cFileName, 
+            (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+            !(find.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+    } while (FindNextFileA(hFind, &find));
+
+    FindClose(hFind);
+    return TPK_ERR_NONE;
+}
+
+// Reads a file's modification time and length
+static int fileStamp(char *filename, long long *mtime, long long *size) {
+    WIN32_FILE_ATTRIBUTE_DATA info;
+
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info))
+        return TPK_FALSE;
+    *mtime = ((long long) info.ftLastWriteTime.dwHighDateTime << 32) |
+        info.ftLastWriteTime.dwLowDateTime;
+    *size = ((long long) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    return TPK_TRUE;
+}
+
+// File watches poll, a change notification only names the directory
+static int startWatch(TPK_WATCH_EX *watch) { return TPK_FALSE; }
+static int watchEvents(TPK_WATCH_EX *watch) { return TPK_TRUE; }
+
+// Deletes a file watch
+static void deleteWatch(TPK_WATCH_EX *watch) {
+    free(watch);
+    return;
+}
+
+// Reads all go to the job system, whose threads keep the disk busy
+static void startRing() { return; }
+static int  ringRead(TPK_READ_EX *read) { return TPK_FALSE; }
+static TPK_READ_EX* ringFlush() { return NULL; }
+static void ringWait(TPK_READ_EX *read) { return; }
+static void stopRing() { return; }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//                             Abstract Functions                             //
+////////////////////////////////////////////////////////////////////////////////
+
 // Sleep for a given number of milliseconds
 void tpkSleep(int ms) {
     SleepEx(ms, 0);
@@ -499,8 +959,15 @@ void tpkSleep(int ms) {
 // Uninitialize the API
 int tpkShutdown() {
 
-    // Shut down WinSock
+    // Stop reads, the job system and the input thread before anything they
+    // might use goes away
+    stopReads();
+    tpkJobShutdown();
+    tpkInputThread(TPK_FALSE);
+
+    // Shut down WinSock and restore the system timer resolution
     WSACleanup();
+    timeEndPeriod(1);
 
     API_ACTIVE = TPK_FALSE;
     return TPK_ERR_NONE;
@@ -517,13 +984,31 @@ int tpkStartup() {
     if (WSAStartup(MAKEWORD(2,2), &wsaData))
         return TPK_ERR_UNKNOWN;
 
+    // Millisecond sleeps and waits instead of the default 15.6 ms ticks
+    timeBeginPeriod(1);
+
     // Perform initialization routine
-    wEvent = TPK_EVENT_NONE;
     API_ACTIVE = TPK_TRUE;
     wCur = NULL; gCur = NULL;
+    startReads();
     return TPK_ERR_NONE;
 }
 
+// Return a monotonic time in nanoseconds
+unsigned long long tpkClock() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    // The counter frequency is fixed at boot
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    // Split the conversion so the multiplication can't overflow
+    return (unsigned long long) (now.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (unsigned long long) (now.QuadPart % freq.QuadPart) * 1000000000ULL /
+        freq.QuadPart;
+}
+
 // Return elapsed milliseconds between function calls
 unsigned int tpkTimer(unsigned int *previous) {
     unsigned int change, thisms, lastms = *previous;